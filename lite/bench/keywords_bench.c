@@ -0,0 +1,187 @@
+/**
+ * keywords_bench.c - Keyword lookup microbenchmark for LITE editor
+ *
+ * Compares the generated perfect hash tables with the linear strcmp scan
+ * the highlighter used before. Words are taken from a source file given
+ * on the command line, or from a built-in sample of typical code.
+ *
+ * Usage: keywords_bench [file]
+ */
+
+#include "syntax/highlight.h"
+#include "syntax/keyword_hash.h"
+#include "syntax/keyword_tables.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_WORDS 200000
+#define MIN_LOOKUPS 20000000
+
+/* Word of the sample text */
+typedef struct Word {
+    const char *text;
+    int length;
+} Word;
+
+static const char *sample_text =
+    "static int buffer_insert_text(Buffer *buffer, const char *text, size_t length) {\n"
+    "    if (!buffer || !text) return LITE_ERROR;\n"
+    "    for (size_t i = 0; i < length; i++) {\n"
+    "        if (text[i] == '\\n') newlines++;\n"
+    "        else if (text[i] == '\\t') continue;\n"
+    "    }\n"
+    "    while (offset < end) { offset = next_line(buffer, offset); }\n"
+    "    switch (state) { case LEX_NORMAL: break; default: return state; }\n"
+    "    unsigned long count = sizeof(struct Piece) * priority;\n"
+    "    public final class Reader implements Closeable extends Object {}\n"
+    "    async function load(path) { const data = await read(path); return data; }\n";
+
+/**
+ * Linear lookup over the entries of a table, as the old is_keyword did
+ */
+static int linear_lookup(const char **words, const int *types, int count,
+                         const char *word, int length) {
+    for (int i = 0; i < count; i++) {
+        if (strncmp(words[i], word, length) == 0 && words[i][length] == '\0') {
+            return types[i];
+        }
+    }
+    
+    return TOK_IDENTIFIER;
+}
+
+/**
+ * Split text into identifier words
+ */
+static int split_words(const char *text, Word *words, int max_words) {
+    int count = 0;
+    const char *p = text;
+    
+    while (*p && count < max_words) {
+        if (isalpha((unsigned char)*p) || *p == '_') {
+            const char *start = p;
+            while (isalnum((unsigned char)*p) || *p == '_') p++;
+            words[count].text = start;
+            words[count].length = (int)(p - start);
+            count++;
+        } else {
+            p++;
+        }
+    }
+    
+    return count;
+}
+
+/**
+ * Read a whole file
+ */
+static char* read_file(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return NULL;
+    }
+    
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    
+    char *data = (char*)malloc((size_t)size + 1);
+    if (data) {
+        size_t read = fread(data, 1, (size_t)size, fp);
+        data[read] = '\0';
+    }
+    
+    fclose(fp);
+    return data;
+}
+
+/**
+ * Current time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * Time both lookups against one table
+ */
+static void bench_table(const char *name, const KeywordTable *table, const Word *words, int word_count) {
+    /* Rebuild the flat keyword list the linear scan walks */
+    const char *list[256];
+    int types[256];
+    int count = 0;
+    
+    for (uint32_t i = 0; i <= table->mask && count < 256; i++) {
+        if (table->entries[i].word) {
+            list[count] = table->entries[i].word;
+            types[count] = table->entries[i].type;
+            count++;
+        }
+    }
+    
+    int rounds = MIN_LOOKUPS / word_count + 1;
+    long lookups = (long)rounds * word_count;
+    long linear_hits = 0;
+    long hash_hits = 0;
+    
+    double start = now();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < word_count; i++) {
+            linear_hits += linear_lookup(list, types, count, words[i].text, words[i].length) != TOK_IDENTIFIER;
+        }
+    }
+    double linear_time = now() - start;
+    
+    start = now();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < word_count; i++) {
+            hash_hits += keyword_lookup(table, words[i].text, words[i].length) != NULL;
+        }
+    }
+    double hash_time = now() - start;
+    
+    if (linear_hits != hash_hits) {
+        fprintf(stderr, "%s: lookups disagree (%ld vs %ld)\n", name, linear_hits, hash_hits);
+        exit(1);
+    }
+    
+    printf("%-5s %3d keywords  linear %6.2f ns  hash %6.2f ns  speedup %5.1fx  (%.0f%% hits)\n",
+           name, count, linear_time * 1e9 / lookups, hash_time * 1e9 / lookups,
+           linear_time / hash_time, 100.0 * hash_hits / lookups);
+}
+
+/* Main function */
+int main(int argc, char *argv[]) {
+    char *data = NULL;
+    const char *text = sample_text;
+    
+    if (argc > 1) {
+        data = read_file(argv[1]);
+        if (!data) return 1;
+        text = data;
+    }
+    
+    Word *words = (Word*)malloc(MAX_WORDS * sizeof(Word));
+    if (!words) return 1;
+    
+    int word_count = split_words(text, words, MAX_WORDS);
+    if (word_count == 0) {
+        fprintf(stderr, "no words to look up\n");
+        return 1;
+    }
+    
+    printf("%d words per round\n", word_count);
+    bench_table("c", &keywords_c, words, word_count);
+    bench_table("js", &keywords_js, words, word_count);
+    bench_table("java", &keywords_java, words, word_count);
+    
+    free(words);
+    free(data);
+    return 0;
+}
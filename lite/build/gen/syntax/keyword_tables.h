@@ -0,0 +1,141 @@
+/* Generated by tools/keywords_gen from src/syntax/keywords.def, do not edit */
+
+static const KeywordEntry keywords_c_entries[64] = {
+    [0] = { "return", 6, TOK_KEYWORD },
+    [1] = { "else", 4, TOK_KEYWORD },
+    [2] = { "void", 4, TOK_TYPE },
+    [3] = { "do", 2, TOK_KEYWORD },
+    [4] = { "while", 5, TOK_KEYWORD },
+    [6] = { "short", 5, TOK_TYPE },
+    [7] = { "default", 7, TOK_KEYWORD },
+    [9] = { "struct", 6, TOK_TYPE },
+    [12] = { "double", 6, TOK_TYPE },
+    [13] = { "case", 4, TOK_KEYWORD },
+    [15] = { "float", 5, TOK_TYPE },
+    [17] = { "register", 8, TOK_KEYWORD },
+    [18] = { "char", 4, TOK_TYPE },
+    [20] = { "static", 6, TOK_TYPE },
+    [21] = { "auto", 4, TOK_KEYWORD },
+    [28] = { "unsigned", 8, TOK_TYPE },
+    [32] = { "union", 5, TOK_TYPE },
+    [33] = { "long", 4, TOK_TYPE },
+    [35] = { "const", 5, TOK_KEYWORD },
+    [39] = { "extern", 6, TOK_KEYWORD },
+    [41] = { "switch", 6, TOK_KEYWORD },
+    [42] = { "break", 5, TOK_KEYWORD },
+    [43] = { "if", 2, TOK_KEYWORD },
+    [44] = { "continue", 8, TOK_KEYWORD },
+    [46] = { "sizeof", 6, TOK_KEYWORD },
+    [48] = { "enum", 4, TOK_TYPE },
+    [49] = { "typedef", 7, TOK_TYPE },
+    [50] = { "int", 3, TOK_TYPE },
+    [57] = { "signed", 6, TOK_TYPE },
+    [61] = { "goto", 4, TOK_KEYWORD },
+    [62] = { "for", 3, TOK_KEYWORD },
+    [63] = { "volatile", 8, TOK_KEYWORD },
+};
+
+static const KeywordTable keywords_c = {
+    26160u, 63u, 8, keywords_c_entries
+};
+
+static const KeywordEntry keywords_js_entries[128] = {
+    [3] = { "with", 4, TOK_KEYWORD },
+    [10] = { "void", 4, TOK_KEYWORD },
+    [12] = { "for", 3, TOK_KEYWORD },
+    [15] = { "import", 6, TOK_KEYWORD },
+    [16] = { "continue", 8, TOK_KEYWORD },
+    [21] = { "switch", 6, TOK_KEYWORD },
+    [23] = { "async", 5, TOK_KEYWORD },
+    [25] = { "var", 3, TOK_KEYWORD },
+    [31] = { "do", 2, TOK_KEYWORD },
+    [39] = { "delete", 6, TOK_KEYWORD },
+    [45] = { "while", 5, TOK_KEYWORD },
+    [49] = { "class", 5, TOK_KEYWORD },
+    [54] = { "await", 5, TOK_KEYWORD },
+    [55] = { "case", 4, TOK_KEYWORD },
+    [61] = { "break", 5, TOK_KEYWORD },
+    [62] = { "export", 6, TOK_KEYWORD },
+    [63] = { "default", 7, TOK_KEYWORD },
+    [67] = { "typeof", 6, TOK_KEYWORD },
+    [68] = { "debugger", 8, TOK_KEYWORD },
+    [72] = { "return", 6, TOK_KEYWORD },
+    [75] = { "yield", 5, TOK_KEYWORD },
+    [81] = { "super", 5, TOK_KEYWORD },
+    [84] = { "catch", 5, TOK_KEYWORD },
+    [88] = { "finally", 7, TOK_KEYWORD },
+    [90] = { "this", 4, TOK_KEYWORD },
+    [95] = { "try", 3, TOK_KEYWORD },
+    [101] = { "new", 3, TOK_KEYWORD },
+    [102] = { "if", 2, TOK_KEYWORD },
+    [105] = { "let", 3, TOK_KEYWORD },
+    [110] = { "instanceof", 10, TOK_KEYWORD },
+    [111] = { "throw", 5, TOK_KEYWORD },
+    [117] = { "const", 5, TOK_KEYWORD },
+    [118] = { "function", 8, TOK_KEYWORD },
+    [123] = { "extends", 7, TOK_KEYWORD },
+    [124] = { "else", 4, TOK_KEYWORD },
+    [126] = { "in", 2, TOK_KEYWORD },
+};
+
+static const KeywordTable keywords_js = {
+    81u, 127u, 10, keywords_js_entries
+};
+
+static const KeywordEntry keywords_java_entries[128] = {
+    [0] = { "transient", 9, TOK_KEYWORD },
+    [4] = { "super", 5, TOK_KEYWORD },
+    [7] = { "while", 5, TOK_KEYWORD },
+    [8] = { "if", 2, TOK_KEYWORD },
+    [11] = { "final", 5, TOK_KEYWORD },
+    [14] = { "default", 7, TOK_KEYWORD },
+    [15] = { "new", 3, TOK_KEYWORD },
+    [16] = { "protected", 9, TOK_KEYWORD },
+    [17] = { "short", 5, TOK_KEYWORD },
+    [18] = { "finally", 7, TOK_KEYWORD },
+    [19] = { "const", 5, TOK_KEYWORD },
+    [20] = { "throws", 6, TOK_KEYWORD },
+    [25] = { "else", 4, TOK_KEYWORD },
+    [27] = { "return", 6, TOK_KEYWORD },
+    [31] = { "int", 3, TOK_KEYWORD },
+    [33] = { "strictfp", 8, TOK_KEYWORD },
+    [34] = { "char", 4, TOK_KEYWORD },
+    [35] = { "enum", 4, TOK_KEYWORD },
+    [36] = { "catch", 5, TOK_KEYWORD },
+    [37] = { "private", 7, TOK_KEYWORD },
+    [43] = { "goto", 4, TOK_KEYWORD },
+    [45] = { "try", 3, TOK_KEYWORD },
+    [53] = { "extends", 7, TOK_KEYWORD },
+    [58] = { "this", 4, TOK_KEYWORD },
+    [61] = { "long", 4, TOK_KEYWORD },
+    [62] = { "import", 6, TOK_KEYWORD },
+    [63] = { "instanceof", 10, TOK_KEYWORD },
+    [65] = { "boolean", 7, TOK_KEYWORD },
+    [66] = { "double", 6, TOK_KEYWORD },
+    [71] = { "void", 4, TOK_KEYWORD },
+    [75] = { "break", 5, TOK_KEYWORD },
+    [80] = { "public", 6, TOK_KEYWORD },
+    [84] = { "static", 6, TOK_KEYWORD },
+    [85] = { "continue", 8, TOK_KEYWORD },
+    [86] = { "assert", 6, TOK_KEYWORD },
+    [90] = { "synchronized", 12, TOK_KEYWORD },
+    [91] = { "byte", 4, TOK_KEYWORD },
+    [96] = { "case", 4, TOK_KEYWORD },
+    [100] = { "abstract", 8, TOK_KEYWORD },
+    [102] = { "class", 5, TOK_KEYWORD },
+    [105] = { "interface", 9, TOK_KEYWORD },
+    [106] = { "implements", 10, TOK_KEYWORD },
+    [108] = { "switch", 6, TOK_KEYWORD },
+    [114] = { "float", 5, TOK_KEYWORD },
+    [115] = { "do", 2, TOK_KEYWORD },
+    [116] = { "for", 3, TOK_KEYWORD },
+    [117] = { "volatile", 8, TOK_KEYWORD },
+    [120] = { "package", 7, TOK_KEYWORD },
+    [122] = { "throw", 5, TOK_KEYWORD },
+    [123] = { "native", 6, TOK_KEYWORD },
+};
+
+static const KeywordTable keywords_java = {
+    11067u, 127u, 12, keywords_java_entries
+};
+
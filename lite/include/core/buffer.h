@@ -6,23 +6,40 @@
 #define LITE_BUFFER_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+#include "piece.h"
+#include "undo.h"
 
 /* Forward declarations */
 struct EditorState;
+struct HighlightState;
+struct UndoFile;
+struct SwapFile;
 
-/* Line structure */
-typedef struct Line {
-    char *data;
-    int length;
-    struct Line *prev;
-    struct Line *next;
-} Line;
+/* Marks a dirty range as extending to the end of the buffer */
+#define BUFFER_LAST_LINE INT_MAX
+
+/* Most lines a buffer holds, line numbers are ints below BUFFER_LAST_LINE */
+#define BUFFER_MAX_LINES (INT_MAX - 1)
+
+/* Longest line a buffer holds, columns are ints as well */
+#define BUFFER_MAX_LINE_LENGTH (INT_MAX - 1)
 
 /* Buffer structure */
 typedef struct Buffer {
     char *filename;
-    Line *first_line;
-    Line *current_line;
+    PieceTable text;
+    dev_t file_device;          /* File the text is mapped from */
+    ino_t file_inode;
+    bool final_crlf;            /* The file ends in "\r\n", which saves write back */
+    size_t lost_from;           /* Text from here on was lost with its file, or PIECE_NPOS */
+    size_t line_offset;
+    int line_length;
+    char *line_cache;
+    size_t line_cache_size;
     int line_count;
     int cursor_x;
     int cursor_y;
@@ -30,6 +47,13 @@ typedef struct Buffer {
     int scroll_y;
     bool modified;
     int id;
+    int dirty_from;
+    int dirty_to;
+    unsigned long version;
+    struct HighlightState *highlight;
+    UndoJournal undo;
+    struct UndoFile *undo_file;
+    struct SwapFile *swap;
 } Buffer;
 
 /* Buffer functions */
@@ -37,13 +61,30 @@ Buffer* buffer_create(void);
 void buffer_free(Buffer *buffer);
 int buffer_load_file(Buffer *buffer, const char *filename);
 int buffer_save_file(Buffer *buffer);
+void buffer_mark_saved(Buffer *buffer, bool current, uint64_t hash);
 int buffer_insert_char(Buffer *buffer, int ch);
+int buffer_insert_text(Buffer *buffer, const char *text, size_t length);
+int buffer_append_text(Buffer *buffer, const char *text, size_t length);
+int buffer_append_loaded(Buffer *buffer, size_t length, size_t newlines);
+int buffer_detach_file(Buffer *buffer, size_t kept);
+bool buffer_lines_fit(const Buffer *buffer, size_t newlines);
 int buffer_delete_char(Buffer *buffer);
 int buffer_new_line(Buffer *buffer);
+int buffer_edit(Buffer *buffer, bool insert, size_t offset, const char *text, size_t length);
+int buffer_undo(Buffer *buffer);
+int buffer_redo(Buffer *buffer);
 void buffer_move_cursor(Buffer *buffer, int dx, int dy);
 void buffer_set_cursor(Buffer *buffer, int x, int y);
 char* buffer_get_current_line(Buffer *buffer);
 int buffer_get_line_count(Buffer *buffer);
 bool buffer_is_modified(Buffer *buffer);
+size_t buffer_line_offset(Buffer *buffer, int line);
+size_t buffer_next_line(Buffer *buffer, size_t offset);
+int buffer_line_length(Buffer *buffer, size_t offset);
+int buffer_copy_line(Buffer *buffer, size_t offset, int col, char *dest, int size);
+void buffer_mark_dirty(Buffer *buffer, int from, int to);
+void buffer_clear_dirty(Buffer *buffer);
+bool buffer_is_dirty(Buffer *buffer);
+bool buffer_is_line_dirty(Buffer *buffer, int line);
 
 #endif /* LITE_BUFFER_H */
\ No newline at end of file
@@ -30,5 +30,12 @@ int command_quit(struct EditorState *state, int argc, char **argv);
 int command_tab(struct EditorState *state, int argc, char **argv);
 int command_theme(struct EditorState *state, int argc, char **argv);
 int command_help(struct EditorState *state, int argc, char **argv);
+int command_goto(struct EditorState *state, int argc, char **argv);
+int command_stats(struct EditorState *state, int argc, char **argv);
+int command_search(struct EditorState *state, int argc, char **argv);
+int command_grep(struct EditorState *state, int argc, char **argv);
+int command_find(struct EditorState *state, int argc, char **argv);
+int command_recover(struct EditorState *state, int argc, char **argv);
+int command_follow(struct EditorState *state, int argc, char **argv);
 
 #endif /* LITE_COMMAND_H */
\ No newline at end of file
@@ -6,6 +6,9 @@
 #define LITE_EDITOR_H
 
 #include "buffer.h"
+#include "event.h"
+#include "search.h"
+#include "../fs/file.h"
 #include "../tui/ui.h"
 
 /* Editor configuration */
@@ -14,6 +17,12 @@ typedef struct EditorConfig {
     bool syntax_highlight;
     bool line_numbers;
     bool dark_mode;
+    int autosave_delay;
+    int undo_memory;
+    bool undo_file;
+    bool swap_file;
+    FileSync save_sync;
+    int large_file_memory;
     char *theme_name;
     char *config_path;
 } EditorConfig;
@@ -28,9 +37,17 @@ typedef struct EditorState {
     UIState ui;
     char command_buffer[LITE_MAX_LINE_LENGTH];
     int command_pos;
+    char command_prompt;
     bool running;
     char status_message[LITE_MAX_LINE_LENGTH];
-    int status_message_time;
+    EventLoop events;
+    int status_timer;
+    int autosave_timer;
+    int undo_timer;
+    int swap_timer;
+    int pager_timer;
+    int follow_timer;
+    SearchPattern search;
 } EditorState;
 
 /* Editor functions */
@@ -38,14 +55,16 @@ EditorState* editor_init(void);
 void editor_free(EditorState *state);
 int editor_open_file(EditorState *state, const char *filename);
 int editor_save_current_buffer(EditorState *state);
+int editor_follow_current_buffer(EditorState *state);
 int editor_switch_buffer(EditorState *state, int buffer_id);
 int editor_close_current_buffer(EditorState *state);
 void editor_set_mode(EditorState *state, EditorMode mode);
 void editor_process_key(EditorState *state, int key);
-void editor_update(EditorState *state);
 void editor_render(EditorState *state);
 void editor_set_status_message(EditorState *state, const char *fmt, ...);
 int editor_execute_command(EditorState *state, const char *command);
+int editor_search(EditorState *state, const char *pattern, bool ignore_case, bool regex);
+int editor_search_next(EditorState *state, bool backward);
 void editor_quit(EditorState *state);
 int editor_load_config(EditorState *state, const char *config_path);
 int editor_save_config(EditorState *state);
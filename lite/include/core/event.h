@@ -0,0 +1,69 @@
+/**
+ * event.h - Event loop for LITE editor
+ *
+ * The editor sleeps in poll() until a registered file descriptor becomes
+ * readable, a timer deadline passes or a signal arrives. Timers share a
+ * single timerfd armed for the earliest deadline, and signals are read
+ * from a signalfd instead of being handled asynchronously.
+ */
+
+#ifndef LITE_EVENT_H
+#define LITE_EVENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <poll.h>
+
+/* Registered file descriptors, including the timer and signal fds */
+#define EVENT_MAX_SOURCES 16
+
+/* Timers that can be created */
+#define EVENT_MAX_TIMERS 8
+
+/* Callback for a readable file descriptor or an expired timer */
+typedef void (*EventCallback)(void *data);
+
+/* Callback for a received signal */
+typedef void (*EventSignalCallback)(int sig, void *data);
+
+/* Watched file descriptor */
+typedef struct EventSource {
+    EventCallback callback;
+    void *data;
+} EventSource;
+
+/* One-shot timer */
+typedef struct EventTimer {
+    uint64_t deadline;
+    bool armed;
+    EventCallback callback;
+    void *data;
+} EventTimer;
+
+/* Event loop */
+typedef struct EventLoop {
+    struct pollfd fds[EVENT_MAX_SOURCES];
+    EventSource sources[EVENT_MAX_SOURCES];
+    int source_count;
+    EventTimer timers[EVENT_MAX_TIMERS];
+    int timer_count;
+    uint64_t timer_deadline;
+    int timer_fd;
+    int signal_fd;
+    EventSignalCallback signal_callback;
+    void *signal_data;
+} EventLoop;
+
+/* Event loop functions */
+int event_loop_init(EventLoop *loop);
+void event_loop_free(EventLoop *loop);
+int event_loop_add_fd(EventLoop *loop, int fd, EventCallback callback, void *data);
+int event_loop_remove_fd(EventLoop *loop, int fd);
+int event_loop_add_timer(EventLoop *loop, EventCallback callback, void *data);
+void event_loop_set_timer(EventLoop *loop, int timer, unsigned int delay_ms);
+void event_loop_cancel_timer(EventLoop *loop, int timer);
+bool event_loop_timer_armed(const EventLoop *loop, int timer);
+void event_loop_on_signal(EventLoop *loop, EventSignalCallback callback, void *data);
+int event_loop_run_once(EventLoop *loop);
+
+#endif /* LITE_EVENT_H */
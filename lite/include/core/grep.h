@@ -0,0 +1,48 @@
+/**
+ * grep.h - Search across all open buffers and files for LITE editor
+ *
+ * Every buffer is cut into ranges of whole lines, which a work-stealing
+ * pool of threads searches in parallel. Matching lines are appended to a
+ * results buffer, ordered by buffer and line, as soon as every range in
+ * front of them is done. Files under a directory are read by a second
+ * pool and searched as they arrive.
+ */
+
+#ifndef LITE_GREP_H
+#define LITE_GREP_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "buffer.h"
+
+/* Text searched by one task */
+#define GREP_RANGE_BYTES (4 << 20)
+
+/* Longest part of a matching line copied into the results */
+#define GREP_LINE_MAX 256
+
+/* Matches found between checks for cancellation */
+#define GREP_CANCEL_CHECK 256
+
+/* Threads reading files, which mostly wait for the disk */
+#define GREP_IO_THREADS 4
+
+/* Files read ahead of the search */
+#define GREP_QUEUE_FILES 64
+
+/* Leading bytes of a file checked for a NUL, which marks binary files */
+#define GREP_BINARY_CHECK 8192
+
+/* Forward declarations */
+struct EditorState;
+
+/* Grep functions */
+int grep_init(void);
+void grep_free(void);
+int grep_start(struct EditorState *state, const char *pattern, bool ignore_case, bool regex);
+int grep_files(struct EditorState *state, const char *directory, const char *pattern,
+               bool ignore_case, bool regex);
+void grep_collect(struct EditorState *state);
+void grep_forget(Buffer *buffer);
+
+#endif /* LITE_GREP_H */
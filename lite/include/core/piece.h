@@ -0,0 +1,119 @@
+/**
+ * piece.h - Piece table text storage for LITE editor
+ *
+ * The text of a buffer is described by a tree of pieces. Each piece
+ * points into either the original file contents, which are never
+ * modified, or into the append buffer that receives all inserted text.
+ */
+
+#ifndef LITE_PIECE_H
+#define LITE_PIECE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "../utils/slab.h"
+
+/* Returned by searches that find nothing */
+#define PIECE_NPOS ((size_t)-1)
+
+/* Append buffer blocks start small and double up to the maximum */
+#define PIECE_ADD_BLOCK_MIN 4096
+#define PIECE_ADD_BLOCK_MAX (1 << 20)
+
+/* Pieces carved from each slab */
+#define PIECE_SLAB_OBJECTS 1024
+
+/* Longest piece, bounds the work needed to split one */
+#define PIECE_MAX_LENGTH PIECE_ADD_BLOCK_MAX
+
+/* Address space set aside after a file mapping that can grow in place */
+#define PIECE_MAP_RESERVE ((size_t)64 << 30)
+
+/* Piece descriptor, a node of the piece tree */
+typedef struct Piece {
+    const char *data;
+    size_t length;
+    size_t newlines;
+    size_t subtree_length;
+    size_t subtree_newlines;
+    unsigned int priority;
+    struct Piece *left;
+    struct Piece *right;
+} Piece;
+
+/* Append buffer block, never moved once allocated */
+typedef struct AddBlock {
+    struct AddBlock *next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} AddBlock;
+
+/* Piece table */
+typedef struct PieceTable {
+    char *original;
+    size_t original_length;
+    size_t original_mapped;
+    size_t original_reserved;   /* Address space of the mapping, 0 if not mapped */
+    AddBlock *add;
+    Piece *root;
+    SlabAllocator pieces;
+} PieceTable;
+
+/* Contiguous run of text in a snapshot */
+typedef struct PieceSpan {
+    const char *data;
+    size_t length;
+} PieceSpan;
+
+/* Sequence of text runs copied out of the piece tree
+ *
+ * The text itself is not copied. It stays valid across later edits,
+ * because neither the original text nor the append buffer is ever
+ * overwritten, but not after the table is freed or reloaded.
+ */
+typedef struct PieceSnapshot {
+    PieceSpan *spans;
+    size_t count;
+    size_t capacity;
+    size_t length;
+} PieceSnapshot;
+
+/* Piece table memory statistics */
+typedef struct PieceTableStats {
+    SlabStats pieces;
+    size_t add_blocks;
+    size_t add_used;
+    size_t add_capacity;
+    size_t original_length;
+    bool original_mapped;
+} PieceTableStats;
+
+/* Piece table functions */
+void piece_table_init(PieceTable *table);
+void piece_table_free(PieceTable *table);
+int piece_table_load(PieceTable *table, char *data, size_t length);
+int piece_table_map(PieceTable *table, int fd, size_t map_length, size_t reserve);
+int piece_table_remap(PieceTable *table, int fd, size_t map_length);
+int piece_table_load_mapped(PieceTable *table, size_t length);
+int piece_table_detach(PieceTable *table, size_t kept);
+int piece_table_extend(PieceTable *table, size_t length, size_t newlines);
+size_t piece_table_length(const PieceTable *table);
+size_t piece_table_newlines(const PieceTable *table);
+size_t piece_table_line_offset(const PieceTable *table, size_t line);
+size_t piece_table_line_at(const PieceTable *table, size_t offset);
+int piece_table_insert(PieceTable *table, size_t offset, const char *text, size_t length);
+int piece_table_delete(PieceTable *table, size_t offset, size_t length);
+char* piece_table_append_space(PieceTable *table, size_t min_length, size_t *available);
+int piece_table_append_commit(PieceTable *table, size_t length);
+const char* piece_table_chunk(const PieceTable *table, size_t offset, size_t *length);
+const char* piece_table_chunk_before(const PieceTable *table, size_t offset, size_t *length);
+size_t piece_table_copy(const PieceTable *table, size_t offset, char *dest, size_t length);
+size_t piece_table_find(const PieceTable *table, size_t offset, int ch);
+size_t piece_table_find_reverse(const PieceTable *table, size_t offset, int ch);
+void piece_table_get_stats(const PieceTable *table, PieceTableStats *stats);
+int piece_table_snapshot(const PieceTable *table, size_t offset, PieceSnapshot *snapshot);
+void piece_snapshot_free(PieceSnapshot *snapshot);
+int piece_table_view(const PieceTable *table, PieceTable *view);
+
+#endif /* LITE_PIECE_H */
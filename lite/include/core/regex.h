@@ -0,0 +1,37 @@
+/**
+ * regex.h - Regular expression search for LITE editor
+ *
+ * Patterns are compiled to Thompson NFAs and matched by DFAs whose states
+ * are built lazily while scanning, so every search runs in time linear in
+ * the text scanned, whatever the pattern. The text is read straight from
+ * the piece table chunks.
+ *
+ * A compiled regex caches DFA states as it runs and must only be used by
+ * one thread at a time.
+ */
+
+#ifndef LITE_REGEX_H
+#define LITE_REGEX_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "piece.h"
+
+/* Memory the DFA state cache of each direction may use before it is flushed */
+#define REGEX_CACHE_BYTES (1 << 20)
+
+/* Largest NFA a pattern may compile to */
+#define REGEX_MAX_NODES 16384
+
+/* Compiled regular expression */
+typedef struct Regex Regex;
+
+/* Regex functions */
+Regex* regex_compile(const char *pattern, size_t length, bool ignore_case,
+                     char *error, size_t error_size);
+void regex_free(Regex *regex);
+size_t regex_search_forward(Regex *regex, const PieceTable *table, size_t offset);
+size_t regex_search_range(Regex *regex, const PieceTable *table, size_t from, size_t to);
+size_t regex_search_backward(Regex *regex, const PieceTable *table, size_t offset);
+
+#endif /* LITE_REGEX_H */
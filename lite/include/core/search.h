@@ -0,0 +1,44 @@
+/**
+ * search.h - Buffer text search for LITE editor
+ *
+ * Literal patterns are matched against the piece table chunk by chunk,
+ * without copying the text, using the widest substring kernel the CPU
+ * supports. Regular expression patterns are handed to the regex engine.
+ */
+
+#ifndef LITE_SEARCH_H
+#define LITE_SEARCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "piece.h"
+#include "regex.h"
+
+/* Longest pattern, the length of a command line */
+#define SEARCH_MAX_PATTERN 1024
+
+/* Compiled search pattern */
+typedef struct SearchPattern {
+    char text[SEARCH_MAX_PATTERN];  /* Folded to lower case when ignoring case */
+    size_t length;
+    bool ignore_case;
+    uint8_t first;                  /* First and last byte, folded */
+    uint8_t last;
+    uint8_t first_fold;             /* 0x20 if the byte is a letter to fold */
+    uint8_t last_fold;
+    Regex *regex;                   /* Compiled regex, NULL for literal text */
+} SearchPattern;
+
+/* Search functions */
+int search_compile(SearchPattern *pattern, const char *text, size_t length, bool ignore_case);
+int search_compile_regex(SearchPattern *pattern, const char *text, size_t length, bool ignore_case,
+                         char *error, size_t error_size);
+void search_free(SearchPattern *pattern);
+const char* search_block(const SearchPattern *pattern, const char *text, size_t length);
+size_t search_forward(const PieceTable *table, size_t offset, const SearchPattern *pattern);
+size_t search_range(const PieceTable *table, size_t from, size_t to, const SearchPattern *pattern);
+size_t search_backward(const PieceTable *table, size_t offset, const SearchPattern *pattern);
+const char* search_kernel_name(void);
+
+#endif /* LITE_SEARCH_H */
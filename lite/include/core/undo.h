@@ -0,0 +1,77 @@
+/**
+ * undo.h - Undo and redo journal for LITE editor
+ *
+ * Every edit of a buffer is appended to its journal as a record of the
+ * text inserted or deleted at an offset. Keystrokes that continue the
+ * previous edit grow its record instead of adding a new one, and all
+ * edits between two seals are undone as one step.
+ */
+
+#ifndef LITE_UNDO_H
+#define LITE_UNDO_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Saved position of a journal whose saved text cannot be reached */
+#define UNDO_UNSAVED ((size_t)-1)
+
+/* Kind of edit */
+typedef enum {
+    UNDO_INSERT,
+    UNDO_DELETE
+} UndoKind;
+
+/* Edit in the journal
+ *
+ * The text lives in the journal's log. Deleted text is stored last byte
+ * first, so that backspacing grows a record at the end of the log.
+ */
+typedef struct UndoRecord {
+    size_t offset;
+    size_t length;
+    size_t text;                /* Position of the text in the log */
+    unsigned char kind;
+    bool joined;                /* Undone together with the record before */
+} UndoRecord;
+
+/* Journal of a buffer
+ *
+ * Records before current are applied to the text, the ones after it have
+ * been undone and can be redone until the next edit. dropped, saved and
+ * changed count records from the first one ever made, including those
+ * dropped since.
+ */
+typedef struct UndoJournal {
+    UndoRecord *records;
+    size_t count;
+    size_t capacity;
+    size_t current;
+    char *log;
+    size_t log_length;
+    size_t log_capacity;
+    size_t dropped;             /* Records dropped to stay under the limit */
+    size_t saved;               /* Records applied when the text was saved */
+    size_t changed;             /* First record changed since last written out */
+    bool sealed;
+} UndoJournal;
+
+/* Undo functions */
+void undo_init(UndoJournal *journal);
+void undo_free(UndoJournal *journal);
+void undo_clear(UndoJournal *journal);
+void undo_set_limit(size_t bytes);
+int undo_record(UndoJournal *journal, UndoKind kind, size_t offset, const char *text, size_t length);
+void undo_seal(UndoJournal *journal);
+const UndoRecord* undo_back(UndoJournal *journal);
+const UndoRecord* undo_forward(UndoJournal *journal);
+const char* undo_text(const UndoJournal *journal, const UndoRecord *record);
+void undo_mark_saved(UndoJournal *journal);
+void undo_forget_saved(UndoJournal *journal);
+bool undo_is_saved(const UndoJournal *journal);
+size_t undo_memory(const UndoJournal *journal);
+void undo_mark_written(UndoJournal *journal);
+int undo_restore(UndoJournal *journal, const UndoRecord *records, size_t count,
+                 const char *log, size_t log_length, size_t dropped, size_t current, size_t saved);
+
+#endif /* LITE_UNDO_H */
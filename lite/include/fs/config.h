@@ -0,0 +1,13 @@
+/**
+ * config.h - Configuration file parsing for LITE editor
+ */
+
+#ifndef LITE_CONFIG_H
+#define LITE_CONFIG_H
+
+#include "../core/editor.h"
+
+/* Configuration functions */
+int config_load(EditorConfig *config, const char *path);
+
+#endif /* LITE_CONFIG_H */
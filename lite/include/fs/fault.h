@@ -0,0 +1,24 @@
+/**
+ * fault.h - Mapped files cut short for LITE editor
+ *
+ * Reading the part of a mapped file that another program truncated
+ * raises SIGBUS. The read is let through with zeros in place of what was
+ * lost, and the buffers it came from are loaded again or, if they hold
+ * edits, keep what is left of their file.
+ */
+
+#ifndef LITE_FAULT_H
+#define LITE_FAULT_H
+
+/* Faulting reads that wait for their page at the same time */
+#define FAULT_SLOTS 64
+
+/* Forward declarations */
+struct EditorState;
+
+/* Fault functions */
+int fault_init(void);
+void fault_free(void);
+void fault_collect(struct EditorState *state);
+
+#endif /* LITE_FAULT_H */
@@ -7,11 +7,22 @@
 
 #include "../core/buffer.h"
 
+/* How hard saves make sure the file reached the disk */
+typedef enum {
+    FILE_SYNC_NONE,             /* Leave it to the system */
+    FILE_SYNC_DATA,             /* Sync the contents before renaming */
+    FILE_SYNC_FULL              /* Also sync the directory after renaming */
+} FileSync;
+
 /* File operations */
 int file_load(Buffer *buffer, const char *filename);
 int file_save(Buffer *buffer);
+int file_write(const char *filename, const PieceTable *text, bool crlf);
+void file_set_sync(FileSync sync);
 int file_exists(const char *filename);
 char* file_get_absolute_path(const char *filename);
 char* file_get_extension(const char *filename);
+void file_make_directories(const char *path);
+char* file_cache_path(const char *kind, const char *filename, const char *extension);
 
 #endif /* LITE_FILE_H */
\ No newline at end of file
@@ -0,0 +1,33 @@
+/**
+ * follow.h - Following growing files for LITE editor
+ *
+ * A followed buffer is watched with inotify. When its file is written
+ * to, the bytes past the end of what the buffer already holds are mapped
+ * and appended, the way tail -f does, without loading the file again.
+ */
+
+#ifndef LITE_FOLLOW_H
+#define LITE_FOLLOW_H
+
+#include <stdbool.h>
+#include "../core/buffer.h"
+
+/* Milliseconds between reads of a file that keeps being written to */
+#define FOLLOW_DELAY 50
+
+/* Most bytes read from a file at once, the rest waits for the next read */
+#define FOLLOW_READ_LIMIT (64 << 20)
+
+/* Forward declarations */
+struct EditorState;
+
+/* Follow functions */
+int follow_init(void);
+void follow_free(void);
+int follow_start(Buffer *buffer);
+void follow_stop(Buffer *buffer);
+bool follow_running(const Buffer *buffer);
+bool follow_collect(void);
+bool follow_update(struct EditorState *state);
+
+#endif /* LITE_FOLLOW_H */
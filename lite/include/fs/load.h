@@ -0,0 +1,33 @@
+/**
+ * load.h - Background loading for LITE editor
+ *
+ * A large file is mapped at once but its lines are counted on a thread of
+ * its own, in batches that end at a line break. Each batch is added to the
+ * end of the buffer's text as it arrives, so the first screen is shown
+ * and can be moved around and edited long before the rest of the file is
+ * in. Saving waits until the whole file is.
+ */
+
+#ifndef LITE_LOAD_H
+#define LITE_LOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "../core/buffer.h"
+
+/* Files with at least this much text are loaded in the background */
+#define LOAD_ASYNC_MIN (16 << 20)
+
+/* Forward declarations */
+struct EditorState;
+
+/* Load functions */
+int load_init(void);
+void load_free(void);
+int load_start(Buffer *buffer, size_t length);
+bool load_running(const Buffer *buffer);
+int load_progress(const Buffer *buffer);
+void load_collect(struct EditorState *state);
+void load_forget(Buffer *buffer);
+
+#endif /* LITE_LOAD_H */
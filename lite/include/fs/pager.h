@@ -0,0 +1,32 @@
+/**
+ * pager.h - Memory budget for mapped files in LITE editor
+ *
+ * A file is mapped rather than read, and every page the editor looks at
+ * stays in memory until the mapping goes. For files larger than the
+ * budget, the pager keeps track of the fixed-size windows of the mapping
+ * that were shown most recently and drops the pages of the others, so a
+ * file of any size takes no more than the budget.
+ */
+
+#ifndef LITE_PAGER_H
+#define LITE_PAGER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "../core/buffer.h"
+
+/* Mapped files are kept in memory in windows of this size */
+#define PAGER_WINDOW (4 << 20)
+
+/* Milliseconds after activity before unused pages are dropped */
+#define PAGER_TRIM_DELAY 2000
+
+/* Pager functions */
+void pager_set_budget(size_t bytes);
+void pager_free(void);
+bool pager_enabled(const Buffer *buffer);
+void pager_touch(Buffer *buffer, size_t offset, size_t length);
+void pager_trim(Buffer *buffer);
+void pager_forget(Buffer *buffer);
+
+#endif /* LITE_PAGER_H */
@@ -0,0 +1,28 @@
+/**
+ * save.h - Background saving for LITE editor
+ *
+ * Saving takes a read-only view of the buffer's text, which costs a copy
+ * of the piece tree but none of the text, and writes it out on a thread
+ * of its own. The buffer can be edited meanwhile. When the save is done,
+ * the UI thread is woken and marks the buffer saved, unless it was
+ * edited after the view was taken.
+ */
+
+#ifndef LITE_SAVE_H
+#define LITE_SAVE_H
+
+#include <stdbool.h>
+#include "../core/buffer.h"
+
+/* Forward declarations */
+struct EditorState;
+
+/* Save functions */
+int save_init(void);
+void save_free(void);
+int save_start(Buffer *buffer);
+bool save_running(const Buffer *buffer);
+void save_collect(struct EditorState *state);
+void save_forget(Buffer *buffer);
+
+#endif /* LITE_SAVE_H */
@@ -0,0 +1,43 @@
+/**
+ * swap.h - Crash recovery files for LITE editor
+ *
+ * Every edit of a buffer that has a file is logged to a swap file under
+ * the user's cache directory until the buffer is saved. If the editor
+ * dies before then, the swap file is left behind and the edits can be
+ * applied again to the file they were made to.
+ */
+
+#ifndef LITE_SWAP_H
+#define LITE_SWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "../core/buffer.h"
+
+/* Milliseconds edits wait before they are written out and synced */
+#define SWAP_FLUSH_DELAY 1000
+
+/* Edits are written out without waiting once this much is pending */
+#define SWAP_BATCH_LIMIT (1 << 20)
+
+/* What opening a swap file found */
+typedef enum {
+    SWAP_NONE,                  /* No edits were left behind */
+    SWAP_FOUND,                 /* Edits of an earlier session can be recovered */
+    SWAP_IN_USE                 /* Another editor is editing the file */
+} SwapStatus;
+
+/* Swap file functions */
+void swap_set_enabled(bool enabled);
+void swap_free(void);
+SwapStatus swap_open(Buffer *buffer, int *owner);
+void swap_record(Buffer *buffer, bool insert, size_t offset, const char *text, size_t length);
+void swap_flush(Buffer *buffer);
+void swap_save_started(Buffer *buffer);
+void swap_save_failed(Buffer *buffer);
+void swap_saved(Buffer *buffer);
+int swap_recover(Buffer *buffer, size_t *edits);
+void swap_detach(Buffer *buffer);
+void swap_close(Buffer *buffer);
+
+#endif /* LITE_SWAP_H */
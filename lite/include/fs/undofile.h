@@ -0,0 +1,47 @@
+/**
+ * undofile.h - Persistent undo history for LITE editor
+ *
+ * The undo journal of every buffer that edits a file is mirrored to a file
+ * under the user's cache directory, named after the absolute path of the
+ * edited file. It is read back when the file is opened again, as long as
+ * the file still holds the text it was last saved with.
+ */
+
+#ifndef LITE_UNDOFILE_H
+#define LITE_UNDOFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../core/buffer.h"
+
+/* Seconds edits wait before they are written out */
+#define UNDOFILE_FLUSH_DELAY 2
+
+/* History files grow by appending until they are this much larger than
+ * the history they hold, then they are rewritten */
+#define UNDOFILE_SLACK (1 << 20)
+
+/* Hash of a text taken in the chunks it comes in, which tells whether a
+ * file still holds the text its history was saved with */
+typedef struct UndoHash {
+    uint64_t hash;
+    uint64_t word;
+    unsigned int fill;
+    uint64_t length;
+} UndoHash;
+
+/* Undo file functions */
+void undofile_set_enabled(bool enabled);
+bool undofile_enabled(void);
+void undofile_free(void);
+void undofile_hash_init(UndoHash *hash);
+void undofile_hash_add(UndoHash *hash, const char *data, size_t length);
+uint64_t undofile_hash_end(const UndoHash *hash);
+uint64_t undofile_hash_text(const PieceTable *text);
+void undofile_open(Buffer *buffer, const uint64_t *hash);
+void undofile_saved(Buffer *buffer, uint64_t hash);
+void undofile_flush(Buffer *buffer);
+void undofile_close(Buffer *buffer);
+
+#endif /* LITE_UNDOFILE_H */
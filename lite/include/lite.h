@@ -23,12 +23,22 @@
 #define LITE_MAX_BUFFERS 10
 #define LITE_MAX_LINE_LENGTH 1024
 #define LITE_TAB_WIDTH 4
+#define LITE_STATUS_TIMEOUT 5   /* Seconds a status message stays visible */
+#define LITE_AUTOSAVE_DELAY 0   /* Seconds before changes are saved, 0 disables */
+#define LITE_UNDO_MEMORY 16     /* MiB of undo history kept per buffer */
+#define LITE_UNDO_FILE true     /* Keep undo history on disk between sessions */
+#define LITE_SWAP_FILE true     /* Log unsaved edits for crash recovery */
+#define LITE_SAVE_SYNC FILE_SYNC_FULL /* How hard saves make sure they reached the disk */
+#define LITE_LARGE_FILE_MEMORY 256 /* MiB of a mapped file kept in memory */
 
 /* Error codes */
 #define LITE_OK 0
 #define LITE_ERROR -1
 #define LITE_ERROR_FILE_NOT_FOUND -2
 #define LITE_ERROR_BUFFER_FULL -3
+#define LITE_ERROR_FILE_CHANGED -4
+#define LITE_ERROR_TOO_MANY_LINES -5
+#define LITE_ERROR_LINE_TOO_LONG -6
 
 /* Mode definitions */
 typedef enum {
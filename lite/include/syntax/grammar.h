@@ -0,0 +1,126 @@
+/**
+ * grammar.h - Data-defined language grammars for LITE editor
+ *
+ * A grammar is a text file describing a language as a set of contexts,
+ * each with an ordered list of rules. A rule is a small regular
+ * expression together with the token type of its matches and the context
+ * to switch to. Grammars are compiled into flat DFA tables, one image per
+ * grammar, and the image is cached on disk so that later starts only map
+ * it. The layout below is the cache file format.
+ */
+
+#ifndef LITE_GRAMMAR_H
+#define LITE_GRAMMAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Cache file identification, bump the version whenever the layout changes */
+#define GRAMMAR_MAGIC 0x4d52474cu /* "LGRM" */
+#define GRAMMAR_VERSION 1
+
+/* Limits, a context must fit in the one byte of state kept per line */
+#define GRAMMAR_MAX_CONTEXTS 254
+#define GRAMMAR_MAX_RULES 1024
+#define GRAMMAR_MAX_STATES 65535
+#define GRAMMAR_MAX_LOADED 64
+
+/* The DFA state every table entry without a transition points to */
+#define GRAMMAR_DEAD_STATE 0
+
+/* Rule target meaning "stay in the current context" */
+#define GRAMMAR_STAY 0xFF
+
+/* Rule flags */
+#define GRAMMAR_RULE_WORD 0x01  /* Matches are looked up as keywords */
+#define GRAMMAR_RULE_KEEP 0x02  /* A match at the end of the line keeps the context */
+
+/* Directory next to the configuration file that grammars are loaded from */
+#define GRAMMAR_DIR "themes/grammars"
+
+/* Subdirectory of GRAMMAR_DIR holding compiled grammars */
+#define GRAMMAR_CACHE_DIR ".cache"
+
+/* Image header, all offsets are in bytes from the start of the image */
+typedef struct GrammarHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_size;
+    int64_t source_mtime;
+    int64_t source_mtime_nsec;
+    uint32_t size;
+    uint32_t name;              /* String offset of the language name */
+    uint32_t file_count;
+    uint32_t files;             /* uint32_t string offsets of file patterns */
+    uint32_t context_count;
+    uint32_t contexts;          /* GrammarContext[context_count] */
+    uint32_t rule_count;
+    uint32_t rules;             /* GrammarRule[rule_count] */
+    uint32_t state_count;
+    uint32_t class_count;
+    uint32_t classes;           /* uint8_t[256], byte to character class */
+    uint32_t transitions;       /* uint16_t[state_count][class_count] */
+    uint32_t accepts;           /* uint16_t[state_count], rule + 1 or 0 */
+    uint32_t keyword_seed;
+    uint32_t keyword_mask;
+    uint32_t keyword_max_length;
+    uint32_t keywords;          /* GrammarKeyword[keyword_mask + 1] */
+    uint32_t strings;
+    uint32_t strings_size;
+} GrammarHeader;
+
+/* Lexer context, also the state a line can end in */
+typedef struct GrammarContext {
+    uint16_t start;             /* DFA state for matches inside a line */
+    uint16_t line_start;        /* DFA state at the start of a line */
+    uint8_t token;              /* Token type of unmatched bytes */
+    uint8_t eol;                /* Context the next line starts in */
+    uint8_t reserved[2];
+} GrammarContext;
+
+/* Rule of a context */
+typedef struct GrammarRule {
+    uint8_t token;
+    uint8_t next;               /* Context after a match, or GRAMMAR_STAY */
+    uint8_t flags;
+    uint8_t reserved;
+} GrammarRule;
+
+/* Keyword hash table slot, empty when length is 0 */
+typedef struct GrammarKeyword {
+    uint32_t word;              /* String offset */
+    uint8_t length;
+    uint8_t token;
+    uint8_t reserved[2];
+} GrammarKeyword;
+
+/* Loaded grammar */
+typedef struct Grammar {
+    char *path;
+    const unsigned char *image;
+    size_t size;
+    bool mapped;
+    const GrammarHeader *header;
+    const GrammarContext *contexts;
+    const GrammarRule *rules;
+    const uint8_t *classes;
+    const uint16_t *transitions;
+    const uint16_t *accepts;
+    const GrammarKeyword *keywords;
+    const uint32_t *files;
+    const char *strings;
+} Grammar;
+
+/* Grammar functions */
+int grammar_compile(const char *path, unsigned char **image, size_t *size,
+                    char *error, size_t error_size);
+int grammar_load_dir(const char *dir);
+void grammar_unload_all(void);
+int grammar_find(const char *filename);
+const Grammar* grammar_get(int index);
+const char* grammar_name(const Grammar *grammar);
+int grammar_lex_line(const Grammar *grammar, const char *text, int length, int state,
+                     unsigned char *tokens);
+
+#endif /* LITE_GRAMMAR_H */
@@ -1,5 +1,9 @@
 /**
  * highlight.h - Syntax highlighting for LITE editor
+ *
+ * Short runs of lines are lexed on the UI thread. Anything longer is
+ * handed to a worker thread that lexes a snapshot of the text and
+ * publishes the results tagged with the buffer version they belong to.
  */
 
 #ifndef LITE_HIGHLIGHT_H
@@ -22,7 +26,7 @@ typedef enum {
     TOK_COUNT
 } TokenType;
 
-/* Language IDs */
+/* Language IDs, grammar files loaded at startup follow LANG_COUNT */
 typedef enum {
     LANG_UNKNOWN,
     LANG_C,
@@ -31,10 +35,66 @@ typedef enum {
     LANG_COUNT
 } LanguageId;
 
+/* Lexer state carried from the end of one line into the next, for
+ * grammar languages the index of a grammar context instead */
+typedef enum {
+    LEX_NORMAL,
+    LEX_COMMENT,
+    LEX_STRING,
+    LEX_TEMPLATE,
+    LEX_PREPROCESSOR,
+    LEX_UNKNOWN = 0xFF
+} LexState;
+
+/* Lexed on the UI thread per update before the rest goes to the worker */
+#define HIGHLIGHT_SYNC_BYTES (64 * 1024)
+
+/* Lines the worker lexes between publishing results */
+#define HIGHLIGHT_PUBLISH_LINES 65536
+
+/* Scratch space for one line and its token types */
+typedef struct HighlightScratch {
+    char *text;
+    unsigned char *tokens;
+    size_t size;
+} HighlightScratch;
+
+/* Per-buffer highlighting state
+ *
+ * states[i] is the lexer state at the end of line i for the first
+ * `computed` lines. Entries before `dirty` are known to be correct, the
+ * ones from there on are left over from before an edit. Lines between
+ * `dirty` and `dirty_end` have changed text since they were lexed, and
+ * relexing cannot stop before dirty_end. dirty_offset caches the offset
+ * of line `dirty` between edits. Lines from plain_from on were drawn
+ * without highlighting while their states were not ready yet. While
+ * `job` is set, the worker is lexing from line `dirty` on.
+ */
+typedef struct HighlightState {
+    LanguageId language;
+    unsigned char *states;
+    int capacity;
+    int computed;
+    int dirty;
+    int dirty_end;
+    size_t dirty_offset;
+    int plain_from;
+    struct HighlightJob *job;
+    HighlightScratch scratch;
+    size_t lexed_lines;
+} HighlightState;
+
 /* Highlight functions */
 void highlight_init(void);
 void highlight_set_color(TokenType type, short fg, short bg);
+int highlight_get_color(TokenType type);
 LanguageId highlight_detect_language(const char *filename);
-void highlight_line(WINDOW *win, const char *line, int line_num, LanguageId lang);
+int highlight_worker_init(void);
+void highlight_worker_free(void);
+void highlight_worker_drain(void);
+void highlight_free(HighlightState *state);
+void highlight_lines_changed(Buffer *buffer, int first, int old_count, int new_count);
+void highlight_update(Buffer *buffer, int end_line);
+const unsigned char* highlight_line(Buffer *buffer, int line, size_t offset, int *length);
 
 #endif /* LITE_HIGHLIGHT_H */
\ No newline at end of file
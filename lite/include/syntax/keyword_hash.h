@@ -0,0 +1,59 @@
+/**
+ * keyword_hash.h - Perfect hash keyword lookup for LITE editor
+ *
+ * The keyword tables are generated at build time by tools/keywords_gen,
+ * which searches for a seed that gives every keyword of a table its own
+ * slot. Looking a word up then takes one hash and one compare.
+ */
+
+#ifndef LITE_KEYWORD_HASH_H
+#define LITE_KEYWORD_HASH_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* Slot of a keyword table, empty when word is NULL */
+typedef struct KeywordEntry {
+    const char *word;
+    unsigned char length;
+    unsigned char type;
+} KeywordEntry;
+
+/* Perfect hash table of keywords */
+typedef struct KeywordTable {
+    uint32_t seed;
+    uint32_t mask;
+    int max_length;
+    const KeywordEntry *entries;
+} KeywordTable;
+
+/**
+ * Hash a word, shared by the generator and the lookup
+ */
+static inline uint32_t keyword_hash(uint32_t seed, const char *word, int length) {
+    uint32_t hash = seed ^ (uint32_t)length;
+    
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)word[i]) * 16777619u;
+    }
+    
+    return hash ^ (hash >> 15);
+}
+
+/**
+ * Look a word up
+ *
+ * Returns the matching entry, or NULL if the word is not a keyword.
+ */
+static inline const KeywordEntry* keyword_lookup(const KeywordTable *table, const char *word, int length) {
+    if (length <= 0 || length > table->max_length) return NULL;
+    
+    const KeywordEntry *entry = &table->entries[keyword_hash(table->seed, word, length) & table->mask];
+    if (entry->length != length || memcmp(entry->word, word, length) != 0) {
+        return NULL;
+    }
+    
+    return entry;
+}
+
+#endif /* LITE_KEYWORD_HASH_H */
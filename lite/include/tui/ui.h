@@ -7,6 +7,14 @@
 
 #include <ncurses.h>
 
+/* Markers the terminal sends around pasted text */
+#define UI_PASTE_BEGIN "\033[200~"
+#define UI_PASTE_END "\033[201~"
+
+/* Key codes returned for the paste markers */
+#define UI_KEY_PASTE_BEGIN (KEY_MAX + 1)
+#define UI_KEY_PASTE_END (KEY_MAX + 2)
+
 /* Forward declarations */
 struct EditorState;
 
@@ -18,18 +26,30 @@ typedef struct UIState {
     int term_width;
     int term_height;
     int editor_height;
+    bool full_redraw;
+    int drawn_buffer_id;
+    int drawn_scroll_x;
+    int drawn_scroll_y;
+    char status_text[LITE_MAX_LINE_LENGTH];
+    char command_text[LITE_MAX_LINE_LENGTH + 1];
+    char *input;                /* Read past a paste, handed out as keys before the terminal's */
+    size_t input_length;
+    size_t input_offset;
 } UIState;
 
 /* UI functions */
 int ui_init(struct EditorState *state);
 void ui_free(struct EditorState *state);
 void ui_resize(struct EditorState *state);
+void ui_terminal_resized(struct EditorState *state);
 void ui_render_buffer(struct EditorState *state);
 void ui_render_status_line(struct EditorState *state);
 void ui_render_command_line(struct EditorState *state);
 void ui_render_message(struct EditorState *state);
 void ui_refresh(struct EditorState *state);
 void ui_clear(struct EditorState *state);
+void ui_invalidate(struct EditorState *state);
 int ui_get_key(struct EditorState *state);
+char* ui_read_paste(struct EditorState *state, size_t *length);
 
 #endif /* LITE_UI_H */
\ No newline at end of file
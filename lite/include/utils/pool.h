@@ -0,0 +1,32 @@
+/**
+ * pool.h - Work-stealing thread pool for LITE editor
+ *
+ * Every worker has a deque of tasks of its own. A worker runs the newest
+ * task of its own deque first and, once that is empty, steals the oldest
+ * task of another worker, so work spreads out to idle threads while each
+ * thread mostly touches the data of tasks it queued itself.
+ */
+
+#ifndef LITE_POOL_H
+#define LITE_POOL_H
+
+#include <stdbool.h>
+
+/* Most workers a pool starts */
+#define POOL_MAX_THREADS 64
+
+/* Task run by a worker */
+typedef void (*PoolTask)(void *data);
+
+/* Thread pool */
+typedef struct ThreadPool ThreadPool;
+
+/* Thread pool functions */
+ThreadPool* pool_create(int threads);
+void pool_free(ThreadPool *pool);
+int pool_submit(ThreadPool *pool, PoolTask task, void *data);
+void pool_wait(ThreadPool *pool);
+int pool_threads(const ThreadPool *pool);
+int pool_worker_index(void);
+
+#endif /* LITE_POOL_H */
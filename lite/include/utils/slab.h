@@ -0,0 +1,35 @@
+/**
+ * slab.h - Fixed-size object slab allocator for LITE editor
+ */
+
+#ifndef LITE_SLAB_H
+#define LITE_SLAB_H
+
+#include <stddef.h>
+
+/* Slab allocator statistics */
+typedef struct SlabStats {
+    size_t slabs;
+    size_t objects;
+    size_t in_use;
+    size_t bytes;
+} SlabStats;
+
+/* Slab allocator */
+typedef struct SlabAllocator {
+    size_t object_size;
+    size_t objects_per_slab;
+    void *slabs;
+    void *free_list;
+    size_t slab_count;
+    size_t in_use;
+} SlabAllocator;
+
+/* Slab functions */
+void slab_init(SlabAllocator *slab, size_t object_size, size_t objects_per_slab);
+void* slab_alloc(SlabAllocator *slab);
+void slab_free(SlabAllocator *slab, void *object);
+void slab_release(SlabAllocator *slab);
+void slab_get_stats(const SlabAllocator *slab, SlabStats *stats);
+
+#endif /* LITE_SLAB_H */
@@ -4,7 +4,15 @@
 
 #include "lite.h"
 #include "core/buffer.h"
+#include "core/grep.h"
 #include "fs/file.h"
+#include "fs/undofile.h"
+#include "fs/swap.h"
+#include "fs/save.h"
+#include "fs/load.h"
+#include "fs/pager.h"
+#include "fs/follow.h"
+#include "syntax/highlight.h"
 #include "utils/log.h"
 #include <stdlib.h>
 #include <string.h>
@@ -13,37 +21,110 @@
 static int next_buffer_id = 1;
 
 /**
- * Create a new empty line
+ * Get the byte at an offset
  */
-static Line* create_line(void) {
-    Line *line = (Line*)malloc(sizeof(Line));
-    if (!line) return NULL;
-    
-    line->data = (char*)malloc(1);
-    if (!line->data) {
-        free(line);
-        return NULL;
+static char char_at(Buffer *buffer, size_t offset) {
+    char ch = '\0';
+    piece_table_copy(&buffer->text, offset, &ch, 1);
+    return ch;
+}
+
+/**
+ * Get the visible length of the line starting at an offset
+ *
+ * A carriage return in front of the newline is not part of the line.
+ * Lines are kept within BUFFER_MAX_LINE_LENGTH, but zeros in place of
+ * text lost with its file may run longer, so the length is capped.
+ */
+static int line_length_at(Buffer *buffer, size_t offset) {
+    size_t end = piece_table_find(&buffer->text, offset, '\n');
+    if (end == PIECE_NPOS) {
+        end = piece_table_length(&buffer->text);
+    } else if (end > offset && char_at(buffer, end - 1) == '\r') {
+        end--;
     }
-    
-    line->data[0] = '\0';
-    line->length = 0;
-    line->prev = NULL;
-    line->next = NULL;
-    
-    return line;
+
+    return end - offset > BUFFER_MAX_LINE_LENGTH ? BUFFER_MAX_LINE_LENGTH : (int)(end - offset);
 }
 
 /**
- * Free a line and its data
+ * Record that lines were replaced by an edit
+ *
+ * old_count lines starting at first were replaced with new_count lines.
+ * When the number of lines changes, everything below moves on screen.
  */
-static void free_line(Line *line) {
-    if (!line) return;
+static void lines_changed(Buffer *buffer, int first, int old_count, int new_count) {
+    buffer_mark_dirty(buffer, first,
+                      old_count == new_count ? first + new_count - 1 : BUFFER_LAST_LINE);
+    highlight_lines_changed(buffer, first, old_count, new_count);
+    buffer->version++;
+}
+
+/**
+ * Count the line breaks in a block of text
+ */
+static size_t count_newlines(const char *text, size_t length) {
+    size_t newlines = 0;
+    const char *p = text;
+    const char *end = text + length;
+    
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        newlines++;
+        p++;
+    }
     
-    if (line->data) {
-        free(line->data);
+    return newlines;
+}
+
+/**
+ * Check that replacing the text between two offsets keeps lines short
+ *
+ * The line that from is on is cut there and joined to the inserted text,
+ * whose last line is joined to what follows to on its line. Columns are
+ * ints, so no line may grow past BUFFER_MAX_LINE_LENGTH.
+ */
+static bool edit_fits(Buffer *buffer, size_t from, size_t to, const char *text, size_t length) {
+    size_t start = from > 0 ? piece_table_find_reverse(&buffer->text, from - 1, '\n') : PIECE_NPOS;
+    size_t end = piece_table_find(&buffer->text, to, '\n');
+    if (end == PIECE_NPOS) end = piece_table_length(&buffer->text);
+    
+    /* Bytes of the line being built so far, starting with the head */
+    size_t line = from - (start == PIECE_NPOS ? 0 : start + 1);
+    const char *p = text;
+    const char *text_end = text + length;
+    const char *newline;
+    
+    while ((newline = memchr(p, '\n', text_end - p)) != NULL) {
+        if (line + (size_t)(newline - p) > BUFFER_MAX_LINE_LENGTH) return false;
+        line = 0;
+        p = newline + 1;
     }
     
-    free(line);
+    line += (size_t)(text_end - p) + (end - to);
+    return line <= BUFFER_MAX_LINE_LENGTH;
+}
+
+/**
+ * Get the offset of the line before the line starting at an offset
+ */
+static size_t previous_line(Buffer *buffer, size_t offset) {
+    if (offset == 0) return PIECE_NPOS;
+
+    size_t newline = piece_table_find_reverse(&buffer->text, offset - 1, '\n');
+    return newline == PIECE_NPOS ? 0 : newline + 1;
+}
+
+/**
+ * Clamp the cursor column to the current line
+ */
+static void clamp_cursor(Buffer *buffer) {
+    if (buffer->cursor_x < 0) {
+        buffer->cursor_x = 0;
+    }
+
+    if (buffer->cursor_x > buffer->line_length) {
+        buffer->cursor_x = buffer->line_length;
+    }
 }
 
 /**
@@ -61,31 +142,55 @@ Buffer* buffer_create(void) {
     buffer->modified = false;
     buffer->id = next_buffer_id++;
     
-    /* Create initial empty line */
-    buffer->first_line = create_line();
-    if (!buffer->first_line) {
-        free(buffer);
-        return NULL;
-    }
-    
-    buffer->current_line = buffer->first_line;
+    /* Start with a single empty line */
+    piece_table_init(&buffer->text);
+    buffer->file_device = 0;
+    buffer->file_inode = 0;
+    buffer->final_crlf = false;
+    buffer->lost_from = PIECE_NPOS;
+    buffer->line_offset = 0;
+    buffer->line_length = 0;
+    buffer->line_cache = NULL;
+    buffer->line_cache_size = 0;
     buffer->line_count = 1;
     
+    /* Nothing has been drawn yet */
+    buffer->dirty_from = 0;
+    buffer->dirty_to = BUFFER_LAST_LINE;
+    buffer->version = 0;
+    
+    /* Highlighting state is created on first use */
+    buffer->highlight = NULL;
+    
+    undo_init(&buffer->undo);
+    buffer->undo_file = NULL;
+    buffer->swap = NULL;
+    
     return buffer;
 }
 
 /**
- * Free a buffer and all its lines
+ * Free a buffer and its text
  */
 void buffer_free(Buffer *buffer) {
     if (!buffer) return;
     
-    /* Free all lines */
-    Line *line = buffer->first_line;
-    while (line) {
-        Line *next = line->next;
-        free_line(line);
-        line = next;
+    /* The highlighter, searches, saves and loads may still be reading the text */
+    highlight_free(buffer->highlight);
+    grep_forget(buffer);
+    save_forget(buffer);
+    load_forget(buffer);
+    pager_forget(buffer);
+    follow_stop(buffer);
+    undofile_close(buffer);
+    swap_close(buffer);
+    
+    /* Free text storage */
+    piece_table_free(&buffer->text);
+    undo_free(&buffer->undo);
+    
+    if (buffer->line_cache) {
+        free(buffer->line_cache);
     }
     
     /* Free filename */
@@ -112,6 +217,14 @@ int buffer_load_file(Buffer *buffer, const char *filename) {
         
         buffer->filename = strdup(filename);
         buffer->modified = false;
+        
+        /* The history of the previous file is written out before it goes,
+         * the new one is read once the whole file is loaded */
+        undofile_close(buffer);
+        undo_clear(&buffer->undo);
+        if (!load_running(buffer)) {
+            undofile_open(buffer, NULL);
+        }
     }
     
     return result;
@@ -124,35 +237,63 @@ int buffer_save_file(Buffer *buffer) {
     if (!buffer) return LITE_ERROR;
     if (!buffer->filename) return LITE_ERROR;
     
+    /* Saving part of a file would cut off the rest */
+    if (load_running(buffer)) return LITE_ERROR;
+    
     int result = file_save(buffer);
     if (result == LITE_OK) {
-        buffer->modified = false;
+        buffer_mark_saved(buffer, true, undofile_enabled() ? undofile_hash_text(&buffer->text) : 0);
     }
     
     return result;
 }
 
+/**
+ * Note that the text of a buffer was written to its file
+ *
+ * current tells whether the text written is the text as it is now. When
+ * edits came in while a background save ran, the buffer stays modified
+ * and undoing can no longer get back to the saved text. hash is the hash
+ * of the text written, for its undo history.
+ */
+void buffer_mark_saved(Buffer *buffer, bool current, uint64_t hash) {
+    if (!buffer) return;
+    
+    if (current) {
+        buffer->modified = false;
+        undo_mark_saved(&buffer->undo);
+        undofile_saved(buffer, hash);
+    } else {
+        undo_forget_saved(&buffer->undo);
+    }
+    swap_saved(buffer);
+}
+
+/**
+ * Log an edit that was just made for undo and crash recovery
+ */
+static void record_edit(Buffer *buffer, UndoKind kind, size_t offset, const char *text, size_t length) {
+    undo_record(&buffer->undo, kind, offset, text, length);
+    swap_record(buffer, kind == UNDO_INSERT, offset, text, length);
+}
+
 /**
  * Insert a character at the current cursor position
  */
 int buffer_insert_char(Buffer *buffer, int ch) {
-    if (!buffer || !buffer->current_line) return LITE_ERROR;
-    
-    Line *line = buffer->current_line;
-    int pos = buffer->cursor_x;
-    
-    /* Allocate new memory for the line */
-    char *new_data = (char*)realloc(line->data, line->length + 2);
-    if (!new_data) return LITE_ERROR;
+    if (!buffer) return LITE_ERROR;
     
-    line->data = new_data;
+    char c = (char)ch;
+    size_t offset = buffer->line_offset + buffer->cursor_x;
+    if (buffer->line_length >= BUFFER_MAX_LINE_LENGTH) return LITE_ERROR;
     
-    /* Shift characters after the cursor */
-    memmove(line->data + pos + 1, line->data + pos, line->length - pos + 1);
+    if (piece_table_insert(&buffer->text, offset, &c, 1) != LITE_OK) {
+        return LITE_ERROR;
+    }
+    record_edit(buffer, UNDO_INSERT, offset, &c, 1);
     
-    /* Insert the character */
-    line->data[pos] = (char)ch;
-    line->length++;
+    buffer->line_length++;
+    lines_changed(buffer, buffer->cursor_y, 1, 1);
     
     /* Move cursor right */
     buffer->cursor_x++;
@@ -163,53 +304,211 @@ int buffer_insert_char(Buffer *buffer, int ch) {
     return LITE_OK;
 }
 
+/**
+ * Insert text at the cursor position
+ *
+ * The text may span several lines. It goes into the piece table as one
+ * insert and the cursor ends up just after it.
+ */
+int buffer_insert_text(Buffer *buffer, const char *text, size_t length) {
+    if (!buffer || (!text && length > 0)) return LITE_ERROR;
+    if (length == 0) return LITE_OK;
+    
+    size_t offset = buffer->line_offset + buffer->cursor_x;
+    
+    /* Count the inserted line breaks and find where the last line starts */
+    size_t count = 0;
+    size_t last_line = 0;
+    const char *p = text;
+    const char *end = text + length;
+    
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        count++;
+        p++;
+        last_line = p - text;
+    }
+    
+    if (!buffer_lines_fit(buffer, count)) return LITE_ERROR;
+    if (!edit_fits(buffer, offset, offset, text, length)) return LITE_ERROR;
+    int newlines = (int)count;
+    
+    if (piece_table_insert(&buffer->text, offset, text, length) != LITE_OK) {
+        return LITE_ERROR;
+    }
+    record_edit(buffer, UNDO_INSERT, offset, text, length);
+    
+    if (newlines == 0) {
+        buffer->line_length += (int)length;
+        buffer->cursor_x += (int)length;
+        lines_changed(buffer, buffer->cursor_y, 1, 1);
+    } else {
+        /* The split line and every line after it change */
+        lines_changed(buffer, buffer->cursor_y, 1, newlines + 1);
+        
+        buffer->line_offset = offset + last_line;
+        buffer->line_length = line_length_at(buffer, buffer->line_offset);
+        buffer->cursor_x = (int)(length - last_line);
+        buffer->cursor_y += newlines;
+        buffer->line_count += newlines;
+    }
+    
+    /* Mark buffer as modified */
+    buffer->modified = true;
+    
+    return LITE_OK;
+}
+
+/**
+ * Append text at the end of the buffer
+ *
+ * Meant for output the editor writes into a buffer of its own, so the
+ * cursor stays where it is and the buffer does not count as modified.
+ */
+int buffer_append_text(Buffer *buffer, const char *text, size_t length) {
+    if (!buffer || (!text && length > 0)) return LITE_ERROR;
+    if (length == 0) return LITE_OK;
+    
+    size_t count = count_newlines(text, length);
+    size_t total = piece_table_length(&buffer->text);
+    if (!buffer_lines_fit(buffer, count)) return LITE_ERROR;
+    if (!edit_fits(buffer, total, total, text, length)) return LITE_ERROR;
+    
+    int last = buffer->line_count - 1;
+    int newlines = (int)count;
+    
+    if (piece_table_insert(&buffer->text, total, text, length) != LITE_OK) {
+        return LITE_ERROR;
+    }
+    
+    lines_changed(buffer, last, 1, newlines + 1);
+    buffer->line_count += newlines;
+    
+    /* The last line grew if the cursor is on it */
+    if (buffer->cursor_y == last) {
+        buffer->line_length = line_length_at(buffer, buffer->line_offset);
+    }
+    
+    return LITE_OK;
+}
+
+/**
+ * Add the next part of a file that is being loaded in the background
+ *
+ * The part is the next length bytes of the file mapped by the buffer's
+ * text, with newlines line breaks in it. As with appended output, the
+ * cursor stays where it is and the buffer does not count as modified.
+ * Fails if the buffer would hold more than BUFFER_MAX_LINES.
+ */
+int buffer_append_loaded(Buffer *buffer, size_t length, size_t newlines) {
+    if (!buffer) return LITE_ERROR;
+    if (length == 0) return LITE_OK;
+    if (!buffer_lines_fit(buffer, newlines)) return LITE_ERROR;
+    
+    int last = buffer->line_count - 1;
+    
+    if (piece_table_extend(&buffer->text, length, newlines) != LITE_OK) {
+        return LITE_ERROR;
+    }
+    
+    lines_changed(buffer, last, 1, (int)newlines + 1);
+    buffer->line_count += (int)newlines;
+    
+    if (buffer->cursor_y == last) {
+        buffer->line_length = line_length_at(buffer, buffer->line_offset);
+    }
+    
+    return LITE_OK;
+}
+
+/**
+ * Check whether a buffer can take more lines
+ *
+ * Line numbers are ints, so a buffer holds at most BUFFER_MAX_LINES.
+ */
+bool buffer_lines_fit(const Buffer *buffer, size_t newlines) {
+    return buffer && newlines <= (size_t)(BUFFER_MAX_LINES - buffer->line_count);
+}
+
+/**
+ * Keep what is left of a mapped file that was cut short under the text
+ *
+ * The text past the first kept bytes of the file was lost with it and
+ * reads as zeros. The buffer keeps its edits but no longer maps the file,
+ * and remembers where the lost text starts so it is not saved unawares.
+ */
+int buffer_detach_file(Buffer *buffer, size_t kept) {
+    if (!buffer) return LITE_ERROR;
+    
+    int old_count = buffer->line_count;
+    
+    if (piece_table_detach(&buffer->text, kept) != LITE_OK) {
+        return LITE_ERROR;
+    }
+    buffer->file_device = 0;
+    buffer->file_inode = 0;
+    if (kept < buffer->lost_from) buffer->lost_from = kept;
+    
+    /* Lines may have merged, the one under the cursor starts elsewhere */
+    buffer->line_count = (int)piece_table_newlines(&buffer->text) + 1;
+    lines_changed(buffer, 0, old_count, buffer->line_count);
+    
+    if (buffer->cursor_y >= buffer->line_count) {
+        buffer->cursor_y = buffer->line_count - 1;
+    }
+    buffer->line_offset = piece_table_line_offset(&buffer->text, (size_t)buffer->cursor_y);
+    buffer->line_length = line_length_at(buffer, buffer->line_offset);
+    clamp_cursor(buffer);
+    
+    return LITE_OK;
+}
+
 /**
  * Delete the character before the cursor
  */
 int buffer_delete_char(Buffer *buffer) {
-    if (!buffer || !buffer->current_line) return LITE_ERROR;
+    if (!buffer) return LITE_ERROR;
     
-    Line *line = buffer->current_line;
     int pos = buffer->cursor_x;
     
     /* Can't delete at beginning of line */
     if (pos == 0) {
         /* If not first line, merge with previous line */
-        if (line->prev) {
-            Line *prev_line = line->prev;
-            int prev_length = prev_line->length;
+        if (buffer->cursor_y > 0) {
+            size_t prev_offset = previous_line(buffer, buffer->line_offset);
+            int prev_length = line_length_at(buffer, prev_offset);
+            if (prev_length >= BUFFER_MAX_LINE_LENGTH - buffer->line_length) return LITE_ERROR;
             
-            /* Resize previous line to fit both */
-            char *new_data = (char*)realloc(prev_line->data, prev_length + line->length + 1);
-            if (!new_data) return LITE_ERROR;
-            
-            prev_line->data = new_data;
-            
-            /* Copy current line to end of previous line */
-            memcpy(prev_line->data + prev_length, line->data, line->length + 1);
-            prev_line->length += line->length;
-            
-            /* Update line links */
-            prev_line->next = line->next;
-            if (line->next) {
-                line->next->prev = prev_line;
+            /* Remove the line break, including a carriage return */
+            size_t from = prev_offset + prev_length;
+            char line_break[2];
+            size_t length = piece_table_copy(&buffer->text, from, line_break, buffer->line_offset - from);
+            if (piece_table_delete(&buffer->text, from, buffer->line_offset - from) != LITE_OK) {
+                return LITE_ERROR;
             }
+            record_edit(buffer, UNDO_DELETE, from, line_break, length);
             
             /* Update buffer state */
-            buffer->current_line = prev_line;
+            buffer->line_offset = prev_offset;
+            buffer->line_length = line_length_at(buffer, prev_offset);
             buffer->cursor_x = prev_length;
             buffer->cursor_y--;
             buffer->line_count--;
             
-            /* Free the current line */
-            free_line(line);
+            /* Every following line moves up */
+            lines_changed(buffer, buffer->cursor_y, 2, 1);
         } else {
             return LITE_OK; /* Can't delete at beginning of first line */
         }
     } else {
         /* Delete character within line */
-        memmove(line->data + pos - 1, line->data + pos, line->length - pos + 1);
-        line->length--;
+        size_t offset = buffer->line_offset + pos - 1;
+        char ch = char_at(buffer, offset);
+        if (piece_table_delete(&buffer->text, offset, 1) != LITE_OK) {
+            return LITE_ERROR;
+        }
+        record_edit(buffer, UNDO_DELETE, offset, &ch, 1);
+        buffer->line_length--;
+        lines_changed(buffer, buffer->cursor_y, 1, 1);
         
         /* Move cursor left */
         buffer->cursor_x--;
@@ -225,43 +524,23 @@ int buffer_delete_char(Buffer *buffer) {
  * Insert a new line at the current cursor position
  */
 int buffer_new_line(Buffer *buffer) {
-    if (!buffer || !buffer->current_line) return LITE_ERROR;
-    
-    Line *current = buffer->current_line;
-    int pos = buffer->cursor_x;
-    
-    /* Create new line */
-    Line *new_line = create_line();
-    if (!new_line) return LITE_ERROR;
-    
-    /* If splitting line, copy text after cursor to new line */
-    if (pos < current->length) {
-        new_line->data = (char*)realloc(new_line->data, current->length - pos + 1);
-        if (!new_line->data) {
-            free(new_line);
-            return LITE_ERROR;
-        }
-        
-        strcpy(new_line->data, current->data + pos);
-        new_line->length = current->length - pos;
-        
-        /* Truncate current line */
-        current->data[pos] = '\0';
-        current->length = pos;
-    }
+    if (!buffer) return LITE_ERROR;
     
-    /* Link the new line into the list */
-    new_line->next = current->next;
-    new_line->prev = current;
+    size_t offset = buffer->line_offset + buffer->cursor_x;
+    if (!buffer_lines_fit(buffer, 1)) return LITE_ERROR;
     
-    if (current->next) {
-        current->next->prev = new_line;
+    /* Split the line at the cursor */
+    if (piece_table_insert(&buffer->text, offset, "\n", 1) != LITE_OK) {
+        return LITE_ERROR;
     }
+    record_edit(buffer, UNDO_INSERT, offset, "\n", 1);
     
-    current->next = new_line;
+    /* The split line and every line after it change */
+    lines_changed(buffer, buffer->cursor_y, 1, 2);
     
     /* Update buffer state */
-    buffer->current_line = new_line;
+    buffer->line_offset = offset + 1;
+    buffer->line_length -= buffer->cursor_x;
     buffer->cursor_x = 0;
     buffer->cursor_y++;
     buffer->line_count++;
@@ -272,36 +551,192 @@ int buffer_new_line(Buffer *buffer) {
     return LITE_OK;
 }
 
+/**
+ * Put the cursor at a byte offset
+ */
+static void cursor_to_offset(Buffer *buffer, size_t offset) {
+    int line = (int)piece_table_line_at(&buffer->text, offset);
+    size_t line_offset = piece_table_line_offset(&buffer->text, line);
+    
+    buffer->line_offset = line_offset;
+    buffer->line_length = line_length_at(buffer, line_offset);
+    buffer->cursor_y = line;
+    buffer->cursor_x = (int)(offset - line_offset);
+    clamp_cursor(buffer);
+}
+
+/**
+ * Insert or delete text at an offset
+ *
+ * text is the inserted or deleted text, it is only looked at for line
+ * breaks when deleting. The cursor ends up where the text was changed.
+ */
+static int change_text(Buffer *buffer, bool insert, size_t offset, const char *text, size_t length) {
+    size_t count = count_newlines(text, length);
+    if (insert && !buffer_lines_fit(buffer, count)) return LITE_ERROR;
+    if (insert ? !edit_fits(buffer, offset, offset, text, length)
+               : count > 0 && !edit_fits(buffer, offset, offset + length, "", 0)) {
+        return LITE_ERROR;
+    }
+    
+    int first = (int)piece_table_line_at(&buffer->text, offset);
+    int newlines = (int)count;
+    int result = insert ? piece_table_insert(&buffer->text, offset, text, length)
+                        : piece_table_delete(&buffer->text, offset, length);
+    if (result != LITE_OK) return LITE_ERROR;
+    
+    swap_record(buffer, insert, offset, text, length);
+    
+    if (insert) {
+        lines_changed(buffer, first, 1, newlines + 1);
+        buffer->line_count += newlines;
+        cursor_to_offset(buffer, offset + length);
+    } else {
+        lines_changed(buffer, first, newlines + 1, 1);
+        buffer->line_count -= newlines;
+        cursor_to_offset(buffer, offset);
+    }
+    
+    return LITE_OK;
+}
+
+/**
+ * Insert or delete the text of a record for undo and redo
+ */
+static int apply_record(Buffer *buffer, const UndoRecord *record, bool insert) {
+    const char *stored = undo_text(&buffer->undo, record);
+    char *text = NULL;
+    
+    /* Deleted text is stored reversed */
+    if (insert && record->kind == UNDO_DELETE) {
+        text = (char*)malloc(record->length);
+        if (!text) return LITE_ERROR;
+        
+        for (size_t i = 0; i < record->length; i++) {
+            text[i] = stored[record->length - 1 - i];
+        }
+        stored = text;
+    }
+    
+    int result = change_text(buffer, insert, record->offset, stored, record->length);
+    free(text);
+    
+    return result;
+}
+
+/**
+ * Insert text at an offset, or delete length bytes from it
+ *
+ * For edits that do not come from typing, such as recovered ones. text
+ * is only needed for inserting. The edit is recorded for undo like any
+ * other and the cursor ends up where the text was changed.
+ */
+int buffer_edit(Buffer *buffer, bool insert, size_t offset, const char *text, size_t length) {
+    if (!buffer || (insert && !text && length > 0)) return LITE_ERROR;
+    if (length == 0) return LITE_OK;
+    
+    size_t total = piece_table_length(&buffer->text);
+    if (offset > total || (!insert && length > total - offset)) return LITE_ERROR;
+    
+    /* The deleted text is kept for undoing */
+    char *deleted = NULL;
+    if (!insert) {
+        deleted = (char*)malloc(length);
+        if (!deleted) return LITE_ERROR;
+        
+        piece_table_copy(&buffer->text, offset, deleted, length);
+        text = deleted;
+    }
+    
+    int result = change_text(buffer, insert, offset, text, length);
+    if (result == LITE_OK) {
+        undo_record(&buffer->undo, insert ? UNDO_INSERT : UNDO_DELETE, offset, text, length);
+        buffer->modified = true;
+    }
+    
+    free(deleted);
+    return result;
+}
+
+/**
+ * Undo the last step of edits
+ *
+ * Returns LITE_ERROR if there is nothing to undo.
+ */
+int buffer_undo(Buffer *buffer) {
+    if (!buffer) return LITE_ERROR;
+    
+    const UndoRecord *record = undo_back(&buffer->undo);
+    if (!record) return LITE_ERROR;
+    
+    for (;;) {
+        if (apply_record(buffer, record, record->kind == UNDO_DELETE) != LITE_OK) {
+            /* Leave the record to be undone again */
+            undo_forward(&buffer->undo);
+            return LITE_ERROR;
+        }
+        
+        if (!record->joined) break;
+        record = undo_back(&buffer->undo);
+        if (!record) break;
+    }
+    
+    buffer->modified = !undo_is_saved(&buffer->undo);
+    return LITE_OK;
+}
+
+/**
+ * Redo the last undone step of edits
+ *
+ * Returns LITE_ERROR if there is nothing to redo.
+ */
+int buffer_redo(Buffer *buffer) {
+    if (!buffer) return LITE_ERROR;
+    
+    const UndoRecord *record = undo_forward(&buffer->undo);
+    if (!record) return LITE_ERROR;
+    
+    for (;;) {
+        if (apply_record(buffer, record, record->kind == UNDO_INSERT) != LITE_OK) {
+            undo_back(&buffer->undo);
+            return LITE_ERROR;
+        }
+        
+        /* The step goes on while the next record is joined to this one */
+        const UndoJournal *journal = &buffer->undo;
+        if (journal->current == journal->count || !journal->records[journal->current].joined) break;
+        record = undo_forward(&buffer->undo);
+    }
+    
+    buffer->modified = !undo_is_saved(&buffer->undo);
+    return LITE_OK;
+}
+
 /**
  * Move the cursor by a relative amount
  */
 void buffer_move_cursor(Buffer *buffer, int dx, int dy) {
     if (!buffer) return;
     
-    /* Move vertically */
-    while (dy < 0 && buffer->current_line->prev) {
-        buffer->current_line = buffer->current_line->prev;
-        buffer->cursor_y--;
-        dy++;
-    }
+    /* Typing somewhere else starts a new undo step */
+    undo_seal(&buffer->undo);
     
-    while (dy > 0 && buffer->current_line->next) {
-        buffer->current_line = buffer->current_line->next;
-        buffer->cursor_y++;
-        dy--;
+    /* Move vertically */
+    int y = buffer->cursor_y + dy;
+    if (y < 0) y = 0;
+    if (y >= buffer->line_count) y = buffer->line_count - 1;
+    
+    if (y != buffer->cursor_y) {
+        buffer->line_offset = buffer_line_offset(buffer, y);
+        buffer->line_length = line_length_at(buffer, buffer->line_offset);
+        buffer->cursor_y = y;
     }
     
     /* Move horizontally */
     buffer->cursor_x += dx;
     
     /* Clamp cursor position */
-    if (buffer->cursor_x < 0) {
-        buffer->cursor_x = 0;
-    }
-    
-    if (buffer->cursor_x > buffer->current_line->length) {
-        buffer->cursor_x = buffer->current_line->length;
-    }
+    clamp_cursor(buffer);
 }
 
 /**
@@ -310,35 +745,46 @@ void buffer_move_cursor(Buffer *buffer, int dx, int dy) {
 void buffer_set_cursor(Buffer *buffer, int x, int y) {
     if (!buffer) return;
     
-    /* Start from first line */
-    buffer->current_line = buffer->first_line;
-    buffer->cursor_y = 0;
+    undo_seal(&buffer->undo);
+    
+    /* Clamp target line */
+    if (y < 0) y = 0;
+    if (y >= buffer->line_count) y = buffer->line_count - 1;
     
     /* Move to target line */
-    while (buffer->cursor_y < y && buffer->current_line->next) {
-        buffer->current_line = buffer->current_line->next;
-        buffer->cursor_y++;
-    }
+    buffer->line_offset = buffer_line_offset(buffer, y);
+    buffer->line_length = line_length_at(buffer, buffer->line_offset);
+    buffer->cursor_y = y;
     
     /* Set x position */
     buffer->cursor_x = x;
     
     /* Clamp cursor position */
-    if (buffer->cursor_x < 0) {
-        buffer->cursor_x = 0;
-    }
-    
-    if (buffer->cursor_x > buffer->current_line->length) {
-        buffer->cursor_x = buffer->current_line->length;
-    }
+    clamp_cursor(buffer);
 }
 
 /**
  * Get the text of the current line
+ *
+ * The returned string is owned by the buffer and is only valid until
+ * the next call.
  */
 char* buffer_get_current_line(Buffer *buffer) {
-    if (!buffer || !buffer->current_line) return NULL;
-    return buffer->current_line->data;
+    if (!buffer) return NULL;
+    
+    size_t needed = (size_t)buffer->line_length + 1;
+    if (buffer->line_cache_size < needed) {
+        char *cache = (char*)realloc(buffer->line_cache, needed);
+        if (!cache) return NULL;
+        
+        buffer->line_cache = cache;
+        buffer->line_cache_size = needed;
+    }
+    
+    piece_table_copy(&buffer->text, buffer->line_offset, buffer->line_cache, buffer->line_length);
+    buffer->line_cache[buffer->line_length] = '\0';
+    
+    return buffer->line_cache;
 }
 
 /**
@@ -355,4 +801,107 @@ int buffer_get_line_count(Buffer *buffer) {
 bool buffer_is_modified(Buffer *buffer) {
     if (!buffer) return false;
     return buffer->modified;
+}
+
+/**
+ * Get the byte offset of the start of a line
+ */
+size_t buffer_line_offset(Buffer *buffer, int line) {
+    if (!buffer || line <= 0) return 0;
+    
+    if (line >= buffer->line_count) {
+        line = buffer->line_count - 1;
+    }
+    
+    /* Neighbouring lines are cheaper to reach with a local scan */
+    if (line == buffer->cursor_y) {
+        return buffer->line_offset;
+    } else if (line == buffer->cursor_y + 1) {
+        return buffer_next_line(buffer, buffer->line_offset);
+    } else if (line == buffer->cursor_y - 1) {
+        return previous_line(buffer, buffer->line_offset);
+    }
+    
+    return piece_table_line_offset(&buffer->text, (size_t)line);
+}
+
+/**
+ * Get the byte offset of the line after the line starting at an offset
+ *
+ * Returns PIECE_NPOS if the line is the last one.
+ */
+size_t buffer_next_line(Buffer *buffer, size_t offset) {
+    if (!buffer) return PIECE_NPOS;
+    
+    size_t newline = piece_table_find(&buffer->text, offset, '\n');
+    return newline == PIECE_NPOS ? PIECE_NPOS : newline + 1;
+}
+
+/**
+ * Get the length of the line starting at an offset
+ */
+int buffer_line_length(Buffer *buffer, size_t offset) {
+    if (!buffer) return 0;
+    
+    return line_length_at(buffer, offset);
+}
+
+/**
+ * Copy part of the line starting at an offset into dest
+ *
+ * Copies at most size - 1 bytes beginning at column col and terminates
+ * the result. Returns the number of bytes copied.
+ */
+int buffer_copy_line(Buffer *buffer, size_t offset, int col, char *dest, int size) {
+    if (!buffer || !dest || size <= 0) return 0;
+    
+    int length = line_length_at(buffer, offset) - col;
+    if (length < 0) length = 0;
+    if (length > size - 1) length = size - 1;
+    
+    piece_table_copy(&buffer->text, offset + col, dest, length);
+    dest[length] = '\0';
+    
+    return length;
+}
+
+/**
+ * Record that a range of lines must be redrawn
+ */
+void buffer_mark_dirty(Buffer *buffer, int from, int to) {
+    if (!buffer) return;
+    
+    if (buffer_is_dirty(buffer)) {
+        if (from < buffer->dirty_from) buffer->dirty_from = from;
+        if (to > buffer->dirty_to) buffer->dirty_to = to;
+    } else {
+        buffer->dirty_from = from;
+        buffer->dirty_to = to;
+    }
+}
+
+/**
+ * Forget the dirty range once it has been redrawn
+ */
+void buffer_clear_dirty(Buffer *buffer) {
+    if (!buffer) return;
+    
+    buffer->dirty_from = 0;
+    buffer->dirty_to = -1;
+}
+
+/**
+ * Check if any line must be redrawn
+ */
+bool buffer_is_dirty(Buffer *buffer) {
+    if (!buffer) return false;
+    return buffer->dirty_from <= buffer->dirty_to;
+}
+
+/**
+ * Check if a line must be redrawn
+ */
+bool buffer_is_line_dirty(Buffer *buffer, int line) {
+    if (!buffer) return false;
+    return line >= buffer->dirty_from && line <= buffer->dirty_to;
 }
\ No newline at end of file
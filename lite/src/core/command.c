@@ -5,6 +5,9 @@
 #include "lite.h"
 #include "core/command.h"
 #include "core/editor.h"
+#include "core/grep.h"
+#include "fs/swap.h"
+#include "fs/load.h"
 #include "utils/log.h"
 #include <stdlib.h>
 #include <string.h>
@@ -60,6 +63,14 @@ int command_init(void) {
     command_register("tab", "Tab management", command_tab);
     command_register("theme", "Theme management", command_theme);
     command_register("help", "Show help", command_help);
+    command_register("goto", "Go to a line", command_goto);
+    command_register("stats", "Show memory statistics for the buffer", command_stats);
+    command_register("search", "Search the buffer for text", command_search);
+    command_register("grep", "Search all open buffers", command_grep);
+    command_register("find", "Search the files under the current directory", command_find);
+    command_register("rg", "Search the files under the current directory", command_find);
+    command_register("recover", "Restore unsaved changes left by a crash", command_recover);
+    command_register("follow", "Show what is written to the file as it grows", command_follow);
     
     return LITE_OK;
 }
@@ -298,4 +309,192 @@ int command_help(EditorState *state, int argc, char **argv) {
     }
     
     return LITE_OK;
+}
+
+/**
+ * Built-in command: goto
+ */
+int command_goto(EditorState *state, int argc, char **argv) {
+    if (!state) return LITE_ERROR;
+    
+    if (argc < 2) {
+        editor_set_status_message(state, "Usage: goto <line>");
+        return LITE_ERROR;
+    }
+    
+    if (state->buffer_count == 0) return LITE_ERROR;
+    
+    Buffer *buffer = state->buffers[state->current_buffer];
+    if (!buffer) return LITE_ERROR;
+    
+    buffer_set_cursor(buffer, 0, atoi(argv[1]) - 1);
+    return LITE_OK;
+}
+
+/**
+ * Built-in command: stats
+ */
+int command_stats(EditorState *state, int argc, char **argv) {
+    if (!state) return LITE_ERROR;
+    
+    (void)argc;
+    (void)argv;
+    
+    if (state->buffer_count == 0) return LITE_ERROR;
+    
+    Buffer *buffer = state->buffers[state->current_buffer];
+    if (!buffer) return LITE_ERROR;
+    
+    PieceTableStats stats;
+    piece_table_get_stats(&buffer->text, &stats);
+    
+    editor_set_status_message(state,
+        "Pieces %zu/%zu in %zu slabs (%zuK) | Append %zuK/%zuK in %zu blocks | File %zuK%s | Undo %zuK",
+        stats.pieces.in_use, stats.pieces.objects, stats.pieces.slabs, stats.pieces.bytes / 1024,
+        stats.add_used / 1024, stats.add_capacity / 1024, stats.add_blocks,
+        stats.original_length / 1024, stats.original_mapped ? " mapped" : "",
+        undo_memory(&buffer->undo) / 1024);
+    LOG_INFO("Buffer %d: %s", buffer->id, state->status_message);
+    
+    return LITE_OK;
+}
+
+/**
+ * Join the arguments of a search command into a pattern
+ *
+ * A leading -i ignores case, and text between slashes is a regular
+ * expression. Returns the pattern, or NULL if there is none.
+ */
+static char* parse_pattern(int argc, char **argv, char *pattern, size_t size,
+                           bool *ignore_case, bool *regex) {
+    int first = 1;
+    *ignore_case = false;
+    *regex = false;
+    
+    if (argc > first && strcmp(argv[first], "-i") == 0) {
+        *ignore_case = true;
+        first++;
+    }
+    
+    if (argc <= first) return NULL;
+    
+    /* The arguments were split at whitespace, join them with single spaces */
+    size_t length = 0;
+    pattern[0] = '\0';
+    for (int i = first; i < argc; i++) {
+        int written = snprintf(pattern + length, size - length, "%s%s",
+                               i > first ? " " : "", argv[i]);
+        if (written < 0 || (size_t)written >= size - length) break;
+        length += (size_t)written;
+    }
+    
+    if (length >= 2 && pattern[0] == '/' && pattern[length - 1] == '/') {
+        pattern[length - 1] = '\0';
+        *regex = true;
+        return pattern + 1;
+    }
+    
+    return pattern;
+}
+
+/**
+ * Built-in command: search
+ */
+int command_search(EditorState *state, int argc, char **argv) {
+    if (!state) return LITE_ERROR;
+    
+    char buffer[LITE_MAX_LINE_LENGTH];
+    bool ignore_case, regex;
+    char *pattern = parse_pattern(argc, argv, buffer, sizeof(buffer), &ignore_case, &regex);
+    
+    if (!pattern) {
+        editor_set_status_message(state, "Usage: search [-i] <text> | /<regex>/");
+        return LITE_ERROR;
+    }
+    
+    return editor_search(state, pattern, ignore_case, regex);
+}
+
+/**
+ * Built-in command: grep
+ */
+int command_grep(EditorState *state, int argc, char **argv) {
+    if (!state) return LITE_ERROR;
+    
+    char buffer[LITE_MAX_LINE_LENGTH];
+    bool ignore_case, regex;
+    char *pattern = parse_pattern(argc, argv, buffer, sizeof(buffer), &ignore_case, &regex);
+    
+    if (!pattern) {
+        editor_set_status_message(state, "Usage: grep [-i] <text> | /<regex>/");
+        return LITE_ERROR;
+    }
+    
+    return grep_start(state, pattern, ignore_case, regex);
+}
+
+/**
+ * Built-in command: find
+ */
+int command_find(EditorState *state, int argc, char **argv) {
+    if (!state) return LITE_ERROR;
+    
+    char buffer[LITE_MAX_LINE_LENGTH];
+    bool ignore_case, regex;
+    char *pattern = parse_pattern(argc, argv, buffer, sizeof(buffer), &ignore_case, &regex);
+    
+    if (!pattern) {
+        editor_set_status_message(state, "Usage: %s [-i] <text> | /<regex>/", argv[0]);
+        return LITE_ERROR;
+    }
+    
+    return grep_files(state, ".", pattern, ignore_case, regex);
+}
+
+/**
+ * Built-in command: recover
+ */
+int command_recover(EditorState *state, int argc, char **argv) {
+    if (!state) return LITE_ERROR;
+    
+    (void)argc;
+    (void)argv;
+    
+    if (state->buffer_count == 0) return LITE_ERROR;
+    
+    Buffer *buffer = state->buffers[state->current_buffer];
+    if (!buffer) return LITE_ERROR;
+    
+    /* The changes are made to the whole file */
+    if (load_running(buffer)) {
+        editor_set_status_message(state, "Still loading %s", buffer->filename);
+        return LITE_ERROR;
+    }
+    
+    size_t edits = 0;
+    int result = swap_recover(buffer, &edits);
+    
+    if (result == LITE_ERROR_FILE_NOT_FOUND) {
+        editor_set_status_message(state, "No unsaved changes to recover");
+    } else if (result == LITE_ERROR_FILE_CHANGED) {
+        editor_set_status_message(state, "%s changed since, not recovering", buffer->filename);
+    } else if (result != LITE_OK) {
+        editor_set_status_message(state, "Failed to recover changes");
+    } else {
+        editor_set_status_message(state, "Recovered %zu change%s", edits, edits == 1 ? "" : "s");
+    }
+    
+    return result == LITE_OK ? LITE_OK : LITE_ERROR;
+}
+
+/**
+ * Built-in command: follow
+ */
+int command_follow(EditorState *state, int argc, char **argv) {
+    if (!state) return LITE_ERROR;
+    
+    (void)argc;
+    (void)argv;
+    
+    return editor_follow_current_buffer(state);
 }
\ No newline at end of file
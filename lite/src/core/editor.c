@@ -6,13 +6,374 @@
 #include "core/editor.h"
 #include "core/buffer.h"
 #include "core/command.h"
+#include "core/event.h"
+#include "core/grep.h"
 #include "tui/ui.h"
+#include "fs/config.h"
+#include "fs/undofile.h"
+#include "fs/swap.h"
+#include "fs/save.h"
+#include "fs/load.h"
+#include "fs/pager.h"
+#include "fs/follow.h"
+#include "fs/fault.h"
+#include "syntax/highlight.h"
+#include "syntax/grammar.h"
 #include "utils/log.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
-#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <limits.h>
+
+/* Typed characters collected before they are inserted */
+#define INPUT_BATCH_SIZE 4096
+
+/**
+ * Clear an expired status message
+ */
+static void expire_status_message(void *data) {
+    EditorState *state = (EditorState*)data;
+    
+    state->status_message[0] = '\0';
+}
+
+/**
+ * Save every modified buffer that has a filename
+ *
+ * Buffers are saved in the background where possible, and a buffer that
+ * is still being saved is left to that save.
+ */
+static void autosave_buffers(void *data) {
+    EditorState *state = (EditorState*)data;
+    int saved = 0;
+    
+    for (int i = 0; i < state->buffer_count; i++) {
+        Buffer *buffer = state->buffers[i];
+        if (!buffer || !buffer->filename || !buffer_is_modified(buffer)) continue;
+        if (save_running(buffer) || load_running(buffer)) continue;
+        
+        /* Lost text is only saved when asked for */
+        if (buffer->lost_from != PIECE_NPOS) continue;
+        
+        if (save_start(buffer) == LITE_OK || buffer_save_file(buffer) == LITE_OK) {
+            saved++;
+        } else {
+            LOG_WARNING("Autosave failed: %s", buffer->filename);
+        }
+    }
+    
+    if (saved > 0) {
+        editor_set_status_message(state, "Autosaving %d buffer%s", saved, saved == 1 ? "" : "s");
+    }
+}
+
+/**
+ * Start the autosave countdown when unsaved changes appear
+ *
+ * The deadline counts from the first unsaved change, so continuous typing
+ * cannot postpone the save indefinitely.
+ */
+static void schedule_autosave(EditorState *state) {
+    if (state->config.autosave_delay <= 0) return;
+    if (event_loop_timer_armed(&state->events, state->autosave_timer)) return;
+    
+    for (int i = 0; i < state->buffer_count; i++) {
+        Buffer *buffer = state->buffers[i];
+        if (buffer && buffer->filename && buffer_is_modified(buffer)) {
+            event_loop_set_timer(&state->events, state->autosave_timer,
+                                 (unsigned int)state->config.autosave_delay * 1000);
+            return;
+        }
+    }
+}
+
+/**
+ * Write the undo history of every buffer that changed since the last time
+ */
+static void flush_undo_files(void *data) {
+    EditorState *state = (EditorState*)data;
+    
+    for (int i = 0; i < state->buffer_count; i++) {
+        undofile_flush(state->buffers[i]);
+    }
+}
+
+/**
+ * Start the countdown to writing out undo history after input
+ *
+ * Like autosave, the countdown is not restarted by further typing, so a
+ * crash loses at most a few seconds of history.
+ */
+static void schedule_undo_flush(EditorState *state) {
+    if (!state->config.undo_file) return;
+    if (event_loop_timer_armed(&state->events, state->undo_timer)) return;
+    
+    event_loop_set_timer(&state->events, state->undo_timer, UNDOFILE_FLUSH_DELAY * 1000);
+}
+
+/**
+ * Hand the edits of every buffer to the swap file writer
+ */
+static void flush_swap_files(void *data) {
+    EditorState *state = (EditorState*)data;
+    
+    for (int i = 0; i < state->buffer_count; i++) {
+        swap_flush(state->buffers[i]);
+    }
+}
+
+/**
+ * Start the countdown to writing out swap files after input
+ */
+static void schedule_swap_flush(EditorState *state) {
+    if (!state->config.swap_file) return;
+    if (event_loop_timer_armed(&state->events, state->swap_timer)) return;
+    
+    event_loop_set_timer(&state->events, state->swap_timer, SWAP_FLUSH_DELAY);
+}
+
+/**
+ * Drop the pages of large files that are not on screen
+ */
+static void trim_mapped_files(void *data) {
+    EditorState *state = (EditorState*)data;
+    
+    for (int i = 0; i < state->buffer_count; i++) {
+        pager_trim(state->buffers[i]);
+    }
+}
+
+/**
+ * Start the countdown to trimming large files after activity
+ *
+ * Searches and saves read the whole file, its pages are dropped once
+ * they are done with it.
+ */
+static void schedule_pager_trim(EditorState *state) {
+    if (event_loop_timer_armed(&state->events, state->pager_timer)) return;
+    
+    for (int i = 0; i < state->buffer_count; i++) {
+        if (pager_enabled(state->buffers[i])) {
+            event_loop_set_timer(&state->events, state->pager_timer, PAGER_TRIM_DELAY);
+            return;
+        }
+    }
+}
+
+/**
+ * Get the character a key types in insert mode, or -1
+ */
+static int typed_char(int key) {
+    if (key == KEY_ENTER || key == '\r' || key == '\n') return '\n';
+    if (key >= 32 && key < 127) return key;
+    
+    return -1;
+}
+
+/**
+ * Insert the typed text collected so far
+ */
+static void flush_typed_text(EditorState *state, char *text, size_t *length) {
+    if (*length == 0) return;
+    
+    if (state->buffer_count > 0) {
+        buffer_insert_text(state->buffers[state->current_buffer], text, *length);
+    }
+    
+    *length = 0;
+}
+
+/**
+ * Apply pasted text
+ *
+ * Line breaks are normalized to '\n' and control characters other than
+ * tabs are dropped. In command mode only the first line is used.
+ */
+static void paste_text(EditorState *state, char *text, size_t length) {
+    size_t out = 0;
+    
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+        
+        if (c == '\r') {
+            if (i + 1 < length && text[i + 1] == '\n') continue;
+            c = '\n';
+        }
+        
+        if (c < 32 && c != '\n' && c != '\t') continue;
+        if (c == 127) continue;
+        
+        text[out++] = (char)c;
+    }
+    
+    if (state->mode == MODE_COMMAND) {
+        for (size_t i = 0; i < out && text[i] != '\n'; i++) {
+            if (state->command_pos >= LITE_MAX_LINE_LENGTH - 1) break;
+            state->command_buffer[state->command_pos++] = text[i];
+        }
+        state->command_buffer[state->command_pos] = '\0';
+        return;
+    }
+    
+    if (state->buffer_count > 0) {
+        /* A paste is undone on its own, in one step however long it is */
+        Buffer *buffer = state->buffers[state->current_buffer];
+        undo_seal(&buffer->undo);
+        buffer_insert_text(buffer, text, out);
+        undo_seal(&buffer->undo);
+    }
+}
+
+/**
+ * Process all keys waiting on the terminal
+ *
+ * Runs of text typed in insert mode are collected and inserted at once,
+ * and a bracketed paste is read in bulk. Rendering happens only after
+ * all pending input has been applied.
+ */
+static void handle_input(void *data) {
+    EditorState *state = (EditorState*)data;
+    char typed[INPUT_BATCH_SIZE];
+    size_t typed_length = 0;
+    int key;
+    
+    while (state->running && (key = ui_get_key(state)) != ERR) {
+        if (key == UI_KEY_PASTE_BEGIN) {
+            flush_typed_text(state, typed, &typed_length);
+            
+            size_t length;
+            char *text = ui_read_paste(state, &length);
+            if (text) {
+                paste_text(state, text, length);
+                free(text);
+            }
+            continue;
+        }
+        
+        int ch = state->mode == MODE_INSERT ? typed_char(key) : -1;
+        if (ch != -1) {
+            typed[typed_length++] = (char)ch;
+            if (typed_length == sizeof(typed)) {
+                flush_typed_text(state, typed, &typed_length);
+            }
+            continue;
+        }
+        
+        flush_typed_text(state, typed, &typed_length);
+        editor_process_key(state, key);
+    }
+    
+    flush_typed_text(state, typed, &typed_length);
+    schedule_autosave(state);
+    schedule_undo_flush(state);
+    schedule_swap_flush(state);
+    schedule_pager_trim(state);
+}
+
+/**
+ * Handle new highlighting results
+ *
+ * Only the wakeup is consumed here, the next render takes the results.
+ */
+static void handle_highlight(void *data) {
+    (void)data;
+    
+    highlight_worker_drain();
+}
+
+/**
+ * Handle new results of a search across buffers
+ */
+static void handle_grep(void *data) {
+    EditorState *state = (EditorState*)data;
+    
+    grep_collect(state);
+    schedule_pager_trim(state);
+}
+
+/**
+ * Handle saves that finished in the background
+ */
+static void handle_save(void *data) {
+    EditorState *state = (EditorState*)data;
+    
+    save_collect(state);
+    schedule_pager_trim(state);
+}
+
+/**
+ * Handle writes to followed files
+ *
+ * However often a file is written to, it is read at most every
+ * FOLLOW_DELAY milliseconds.
+ */
+static void handle_follow(void *data) {
+    EditorState *state = (EditorState*)data;
+    
+    if (follow_collect() && !event_loop_timer_armed(&state->events, state->follow_timer)) {
+        event_loop_set_timer(&state->events, state->follow_timer, FOLLOW_DELAY);
+    }
+}
+
+/**
+ * Append what was written to followed files
+ */
+static void update_followed_files(void *data) {
+    EditorState *state = (EditorState*)data;
+    
+    if (follow_update(state)) {
+        event_loop_set_timer(&state->events, state->follow_timer, FOLLOW_DELAY);
+    }
+    
+    /* Counting the new lines brought their pages in */
+    schedule_pager_trim(state);
+}
+
+/**
+ * Handle lines of large files counted in the background
+ */
+static void handle_load(void *data) {
+    EditorState *state = (EditorState*)data;
+    
+    load_collect(state);
+}
+
+/**
+ * Handle the buffers whose files were cut short
+ */
+static void handle_fault(void *data) {
+    EditorState *state = (EditorState*)data;
+    
+    fault_collect(state);
+}
+
+/**
+ * Handle a signal delivered through the event loop
+ */
+static void handle_signal(int sig, void *data) {
+    EditorState *state = (EditorState*)data;
+    
+    if (sig == SIGWINCH) {
+        ui_terminal_resized(state);
+        
+        /* Resizing may queue a key inside curses that poll() cannot see */
+        handle_input(state);
+        return;
+    }
+    
+    LOG_INFO("Received signal %d, exiting", sig);
+    
+    /* Unsaved edits stay in their swap files to be recovered */
+    for (int i = 0; i < state->buffer_count; i++) {
+        if (state->buffers[i] && buffer_is_modified(state->buffers[i])) {
+            swap_detach(state->buffers[i]);
+        }
+    }
+    editor_quit(state);
+}
 
 /**
  * Initialize the editor state
@@ -32,25 +393,97 @@ EditorState* editor_init(void) {
     /* Initialize command buffer */
     memset(state->command_buffer, 0, sizeof(state->command_buffer));
     state->command_pos = 0;
+    state->command_prompt = ':';
+    
+    /* No search yet */
+    memset(&state->search, 0, sizeof(state->search));
     
     /* Initialize status message */
     memset(state->status_message, 0, sizeof(state->status_message));
-    state->status_message_time = 0;
     
     /* Initialize running state */
     state->running = false;
     
     /* Initialize configuration */
     state->config.tab_width = LITE_TAB_WIDTH;
+    state->config.autosave_delay = LITE_AUTOSAVE_DELAY;
+    state->config.undo_memory = LITE_UNDO_MEMORY;
+    state->config.undo_file = LITE_UNDO_FILE;
+    state->config.swap_file = LITE_SWAP_FILE;
+    state->config.save_sync = LITE_SAVE_SYNC;
+    state->config.large_file_memory = LITE_LARGE_FILE_MEMORY;
     state->config.syntax_highlight = true;
     state->config.line_numbers = true;
     state->config.dark_mode = true;
     state->config.theme_name = strdup("default");
     state->config.config_path = strdup(LITE_CONFIG_FILE);
     
+    /* Initialize the event loop before curses so signals are already blocked */
+    if (event_loop_init(&state->events) != LITE_OK) {
+        LOG_ERROR("Failed to initialize event loop");
+        free(state->config.theme_name);
+        free(state->config.config_path);
+        free(state);
+        return NULL;
+    }
+    
+    state->status_timer = event_loop_add_timer(&state->events, expire_status_message, state);
+    state->autosave_timer = event_loop_add_timer(&state->events, autosave_buffers, state);
+    state->undo_timer = event_loop_add_timer(&state->events, flush_undo_files, state);
+    state->swap_timer = event_loop_add_timer(&state->events, flush_swap_files, state);
+    state->pager_timer = event_loop_add_timer(&state->events, trim_mapped_files, state);
+    state->follow_timer = event_loop_add_timer(&state->events, update_followed_files, state);
+    event_loop_add_fd(&state->events, STDIN_FILENO, handle_input, state);
+    
+    /* Highlighting results wake the loop so they are drawn */
+    int highlight_fd = highlight_worker_init();
+    if (highlight_fd != -1) {
+        event_loop_add_fd(&state->events, highlight_fd, handle_highlight, state);
+    }
+    
+    /* So do results of searches across buffers */
+    int grep_fd = grep_init();
+    if (grep_fd != -1) {
+        event_loop_add_fd(&state->events, grep_fd, handle_grep, state);
+    }
+    
+    /* And saves, which report how they went */
+    int save_fd = save_init();
+    if (save_fd != -1) {
+        event_loop_add_fd(&state->events, save_fd, handle_save, state);
+    }
+    
+    /* And loads, whose lines are shown as they come in */
+    int load_fd = load_init();
+    if (load_fd != -1) {
+        event_loop_add_fd(&state->events, load_fd, handle_load, state);
+    }
+    
+    /* And writes to followed files */
+    int follow_fd = follow_init();
+    if (follow_fd != -1) {
+        event_loop_add_fd(&state->events, follow_fd, handle_follow, state);
+    }
+    
+    /* And reads of mapped files that were cut short */
+    int fault_fd = fault_init();
+    if (fault_fd != -1) {
+        event_loop_add_fd(&state->events, fault_fd, handle_fault, state);
+    }
+    event_loop_on_signal(&state->events, handle_signal, state);
+    
     /* Initialize UI */
     if (ui_init(state) != LITE_OK) {
         LOG_ERROR("Failed to initialize UI");
+        highlight_worker_free();
+        grep_free();
+        save_free();
+        load_free();
+        follow_free();
+        fault_free();
+        event_loop_free(&state->events);
+        free(state->config.theme_name);
+        free(state->config.config_path);
         free(state);
         return NULL;
     }
@@ -59,6 +492,15 @@ EditorState* editor_init(void) {
     if (command_init() != LITE_OK) {
         LOG_ERROR("Failed to initialize commands");
         ui_free(state);
+        highlight_worker_free();
+        grep_free();
+        save_free();
+        load_free();
+        follow_free();
+        fault_free();
+        event_loop_free(&state->events);
+        free(state->config.theme_name);
+        free(state->config.config_path);
         free(state);
         return NULL;
     }
@@ -78,6 +520,12 @@ void editor_free(EditorState *state) {
     /* Free UI state */
     ui_free(state);
     
+    /* Free event loop */
+    event_loop_free(&state->events);
+    
+    /* Stop searches before the text they read goes away */
+    grep_free();
+    
     /* Free buffers */
     for (int i = 0; i < state->buffer_count; i++) {
         if (state->buffers[i]) {
@@ -85,6 +533,19 @@ void editor_free(EditorState *state) {
         }
     }
     
+    /* Stop the highlighter, saving and loading once no buffer needs them */
+    highlight_worker_free();
+    save_free();
+    load_free();
+    pager_free();
+    follow_free();
+    fault_free();
+    undofile_free();
+    swap_free();
+    grammar_unload_all();
+    
+    search_free(&state->search);
+    
     /* Free configuration */
     if (state->config.theme_name) {
         free(state->config.theme_name);
@@ -124,15 +585,36 @@ int editor_open_file(EditorState *state, const char *filename) {
         if (result == LITE_ERROR_FILE_NOT_FOUND) {
             buffer->filename = strdup(filename);
             editor_set_status_message(state, "New file: %s", filename);
+        } else if (result == LITE_ERROR_TOO_MANY_LINES) {
+            editor_set_status_message(state, "%s has more than %d lines, too many to open",
+                                      filename, BUFFER_MAX_LINES);
+            buffer_free(buffer);
+            return result;
+        } else if (result == LITE_ERROR_LINE_TOO_LONG) {
+            editor_set_status_message(state, "%s has a line longer than %d bytes, too long to open",
+                                      filename, BUFFER_MAX_LINE_LENGTH);
+            buffer_free(buffer);
+            return result;
         } else {
             editor_set_status_message(state, "Failed to load file: %s", filename);
             buffer_free(buffer);
             return result;
         }
+    } else if (load_running(buffer)) {
+        editor_set_status_message(state, "Loading %s", filename);
     } else {
         editor_set_status_message(state, "Opened %s", filename);
     }
     
+    /* Edits left behind by an editor that did not exit cleanly */
+    int owner = 0;
+    SwapStatus swap = swap_open(buffer, &owner);
+    if (swap == SWAP_FOUND) {
+        editor_set_status_message(state, "Found unsaved changes to %s, :recover restores them", filename);
+    } else if (swap == SWAP_IN_USE) {
+        editor_set_status_message(state, "%s is being edited by process %d", filename, owner);
+    }
+    
     /* Add buffer to state */
     state->buffers[state->buffer_count] = buffer;
     state->current_buffer = state->buffer_count;
@@ -156,6 +638,31 @@ int editor_save_current_buffer(EditorState *state) {
         return LITE_ERROR;
     }
     
+    if (save_running(buffer)) {
+        editor_set_status_message(state, "Still saving %s", buffer->filename);
+        return LITE_ERROR;
+    }
+    
+    if (load_running(buffer)) {
+        editor_set_status_message(state, "Still loading %s", buffer->filename);
+        return LITE_ERROR;
+    }
+    
+    /* Text lost with its file reads as zeros, which are only saved once
+     * the user was told */
+    if (buffer->lost_from != PIECE_NPOS) {
+        editor_set_status_message(state, "Text past byte %zu was lost, write again to save it as zeros",
+                                  buffer->lost_from);
+        buffer->lost_from = PIECE_NPOS;
+        return LITE_ERROR;
+    }
+    
+    /* Save in the background, the result is reported when it is done */
+    if (save_start(buffer) == LITE_OK) {
+        editor_set_status_message(state, "Saving %s...", buffer->filename);
+        return LITE_OK;
+    }
+    
     /* Save buffer to file */
     int result = buffer_save_file(buffer);
     if (result != LITE_OK) {
@@ -167,6 +674,54 @@ int editor_save_current_buffer(EditorState *state) {
     return LITE_OK;
 }
 
+/**
+ * Start or stop following the file of the current buffer
+ */
+int editor_follow_current_buffer(EditorState *state) {
+    if (!state || state->buffer_count == 0) return LITE_ERROR;
+    
+    Buffer *buffer = state->buffers[state->current_buffer];
+    if (!buffer) return LITE_ERROR;
+    
+    if (!buffer->filename) {
+        editor_set_status_message(state, "No file to follow");
+        return LITE_ERROR;
+    }
+    
+    if (follow_running(buffer)) {
+        follow_stop(buffer);
+        editor_set_status_message(state, "Stopped following %s", buffer->filename);
+        return LITE_OK;
+    }
+    
+    if (load_running(buffer)) {
+        editor_set_status_message(state, "Still loading %s", buffer->filename);
+        return LITE_ERROR;
+    }
+    
+    if (save_running(buffer)) {
+        editor_set_status_message(state, "Still saving %s", buffer->filename);
+        return LITE_ERROR;
+    }
+    
+    if (buffer_is_modified(buffer)) {
+        editor_set_status_message(state, "Save %s before following it", buffer->filename);
+        return LITE_ERROR;
+    }
+    
+    if (follow_start(buffer) != LITE_OK) {
+        editor_set_status_message(state, "Cannot follow %s", buffer->filename);
+        return LITE_ERROR;
+    }
+    
+    /* Start at the end, and read what was written since it was loaded */
+    buffer_set_cursor(buffer, 0, buffer->line_count - 1);
+    event_loop_set_timer(&state->events, state->follow_timer, 0);
+    
+    editor_set_status_message(state, "Following %s", buffer->filename);
+    return LITE_OK;
+}
+
 /**
  * Switch to a different buffer
  */
@@ -273,15 +828,53 @@ void editor_process_key(EditorState *state, int key) {
                     if (buffer) buffer_move_cursor(buffer, 1, 0);
                     break;
                     
+                case 'g':
+                    if (buffer) buffer_set_cursor(buffer, 0, 0);
+                    break;
+                    
+                case 'G':
+                    if (buffer) buffer_set_cursor(buffer, 0, buffer->line_count - 1);
+                    break;
+                    
+                case KEY_NPAGE:
+                    if (buffer) buffer_move_cursor(buffer, 0, state->ui.editor_height);
+                    break;
+                    
+                case KEY_PPAGE:
+                    if (buffer) buffer_move_cursor(buffer, 0, -state->ui.editor_height);
+                    break;
+                    
                 case 'i':
                     editor_set_mode(state, MODE_INSERT);
                     editor_set_status_message(state, "-- INSERT --");
                     break;
                     
                 case ':':
+                case '/':
                     editor_set_mode(state, MODE_COMMAND);
                     state->command_buffer[0] = '\0';
                     state->command_pos = 0;
+                    state->command_prompt = (char)key;
+                    break;
+                    
+                case 'n':
+                    editor_search_next(state, false);
+                    break;
+                    
+                case 'N':
+                    editor_search_next(state, true);
+                    break;
+                    
+                case 'u':
+                    if (buffer && buffer_undo(buffer) != LITE_OK) {
+                        editor_set_status_message(state, "Already at oldest change");
+                    }
+                    break;
+                    
+                case 18: /* Ctrl-R */
+                    if (buffer && buffer_redo(buffer) != LITE_OK) {
+                        editor_set_status_message(state, "Already at newest change");
+                    }
                     break;
                     
                 case 'q':
@@ -298,6 +891,8 @@ void editor_process_key(EditorState *state, int key) {
             /* Insert mode keybindings */
             switch (key) {
                 case 27: /* ESC */
+                    /* Everything typed in insert mode is undone at once */
+                    if (buffer) undo_seal(&buffer->undo);
                     editor_set_mode(state, MODE_NORMAL);
                     editor_set_status_message(state, "-- NORMAL --");
                     break;
@@ -313,6 +908,14 @@ void editor_process_key(EditorState *state, int key) {
                     if (buffer) buffer_new_line(buffer);
                     break;
                     
+                case KEY_NPAGE:
+                    if (buffer) buffer_move_cursor(buffer, 0, state->ui.editor_height);
+                    break;
+                    
+                case KEY_PPAGE:
+                    if (buffer) buffer_move_cursor(buffer, 0, -state->ui.editor_height);
+                    break;
+                    
                 default:
                     if (key >= 32 && key < 127) {
                         if (buffer) buffer_insert_char(buffer, key);
@@ -339,8 +942,14 @@ void editor_process_key(EditorState *state, int key) {
                 case KEY_ENTER:
                 case '\r':
                 case '\n':
-                    /* Execute command */
-                    if (strlen(state->command_buffer) > 0) {
+                    /* Execute command, an empty search repeats the last one */
+                    if (state->command_prompt == '/') {
+                        if (strlen(state->command_buffer) > 0) {
+                            editor_search(state, state->command_buffer, false, false);
+                        } else {
+                            editor_search_next(state, false);
+                        }
+                    } else if (strlen(state->command_buffer) > 0) {
                         command_execute(state, state->command_buffer);
                     }
                     editor_set_mode(state, MODE_NORMAL);
@@ -363,42 +972,24 @@ void editor_process_key(EditorState *state, int key) {
     }
 }
 
-/**
- * Update editor state
- */
-void editor_update(EditorState *state) {
-    if (!state) return;
-    
-    /* Check status message timeout */
-    if (state->status_message_time > 0) {
-        time_t current_time = time(NULL);
-        if (current_time - state->status_message_time > 5) {
-            state->status_message[0] = '\0';
-            state->status_message_time = 0;
-        }
-    }
-}
-
 /**
  * Render the editor
+ *
+ * Each part redraws only what changed since the last render, so an idle
+ * editor sends nothing to the terminal.
  */
 void editor_render(EditorState *state) {
     if (!state) return;
     
-    ui_clear(state);
-    
     /* Render buffer */
     ui_render_buffer(state);
     
     /* Render status line */
     ui_render_status_line(state);
     
-    /* Render command line */
+    /* Render command line, including any status message */
     ui_render_command_line(state);
     
-    /* Render message */
-    ui_render_message(state);
-    
     /* Refresh display */
     ui_refresh(state);
 }
@@ -414,7 +1005,8 @@ void editor_set_status_message(EditorState *state, const char *fmt, ...) {
     vsnprintf(state->status_message, sizeof(state->status_message), fmt, ap);
     va_end(ap);
     
-    state->status_message_time = time(NULL);
+    /* Clear the message once it has been shown long enough */
+    event_loop_set_timer(&state->events, state->status_timer, LITE_STATUS_TIMEOUT * 1000);
 }
 
 /**
@@ -426,6 +1018,102 @@ int editor_execute_command(EditorState *state, const char *command) {
     return command_execute(state, command);
 }
 
+/**
+ * Search the current buffer for text and move to the next match
+ *
+ * A "\c" anywhere in the text makes the search ignore case, as in vim.
+ * With regex set the text is a regular expression.
+ */
+int editor_search(EditorState *state, const char *pattern, bool ignore_case, bool regex) {
+    if (!state || !pattern) return LITE_ERROR;
+    
+    char text[SEARCH_MAX_PATTERN];
+    size_t length = 0;
+    
+    for (const char *p = pattern; *p && length < sizeof(text); p++) {
+        if (p[0] == '\\' && p[1] == 'c') {
+            ignore_case = true;
+            p++;
+            continue;
+        }
+        text[length++] = *p;
+    }
+    
+    /* Keep the last search until the new one compiles */
+    SearchPattern search;
+    char error[128] = "";
+    int result = regex ? search_compile_regex(&search, text, length, ignore_case, error, sizeof(error))
+                       : search_compile(&search, text, length, ignore_case);
+    if (result != LITE_OK) {
+        if (error[0]) {
+            editor_set_status_message(state, "Invalid search pattern: %s", error);
+        } else {
+            editor_set_status_message(state, "Invalid search pattern");
+        }
+        return LITE_ERROR;
+    }
+    
+    search_free(&state->search);
+    state->search = search;
+    
+    return editor_search_next(state, false);
+}
+
+/**
+ * Move to the next or previous match of the last search
+ *
+ * The search wraps around the end of the buffer.
+ */
+int editor_search_next(EditorState *state, bool backward) {
+    if (!state || state->buffer_count == 0) return LITE_ERROR;
+    
+    Buffer *buffer = state->buffers[state->current_buffer];
+    if (!buffer) return LITE_ERROR;
+    
+    if (state->search.length == 0) {
+        editor_set_status_message(state, "No previous search");
+        return LITE_ERROR;
+    }
+    
+    size_t cursor = buffer->line_offset + (size_t)buffer->cursor_x;
+    bool wrapped = false;
+    size_t match;
+    
+    if (backward) {
+        match = search_backward(&buffer->text, cursor, &state->search);
+        if (match == PIECE_NPOS) {
+            match = search_backward(&buffer->text, piece_table_length(&buffer->text), &state->search);
+            wrapped = true;
+        }
+    } else {
+        match = search_forward(&buffer->text, cursor + 1, &state->search);
+        if (match == PIECE_NPOS) {
+            match = search_forward(&buffer->text, 0, &state->search);
+            wrapped = true;
+        }
+    }
+    
+    if (match == PIECE_NPOS) {
+        editor_set_status_message(state, "Pattern not found: %.*s",
+                                  (int)state->search.length, state->search.text);
+        return LITE_ERROR;
+    }
+    
+    int line = (int)piece_table_line_at(&buffer->text, match);
+    size_t line_offset = buffer_line_offset(buffer, line);
+    buffer_set_cursor(buffer, (int)(match - line_offset), line);
+    
+    if (wrapped) {
+        editor_set_status_message(state, backward ? "Search hit TOP, continuing at BOTTOM"
+                                                  : "Search hit BOTTOM, continuing at TOP");
+    } else {
+        editor_set_status_message(state, "%c%.*s", backward ? '?' : '/',
+                                  (int)state->search.length, state->search.text);
+    }
+    
+    return LITE_OK;
+}
+
 /**
  * Quit the editor
  */
@@ -435,16 +1123,49 @@ void editor_quit(EditorState *state) {
     state->running = false;
 }
 
+/**
+ * Load the grammars in the grammar directory next to a configuration file
+ */
+static void load_grammars(const char *config_path) {
+    const char *slash = strrchr(config_path, '/');
+    int dir_length = slash ? (int)(slash - config_path) : 1;
+    const char *dir = slash ? config_path : ".";
+    
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%.*s/%s", dir_length, dir, GRAMMAR_DIR) >= (int)sizeof(path)) {
+        return;
+    }
+    
+    int count = grammar_load_dir(path);
+    if (count > 0) {
+        LOG_INFO("Loaded %d grammar(s) from %s", count, path);
+    }
+}
+
 /**
  * Load editor configuration
  */
 int editor_load_config(EditorState *state, const char *config_path) {
     if (!state || !config_path) return LITE_ERROR;
     
-    /* TODO: Implement configuration loading */
-    editor_set_status_message(state, "Config loading not implemented yet");
+    load_grammars(config_path);
     
-    return LITE_OK;
+    int result = config_load(&state->config, config_path);
+    undo_set_limit((size_t)state->config.undo_memory << 20);
+    undofile_set_enabled(state->config.undo_file);
+    swap_set_enabled(state->config.swap_file);
+    file_set_sync(state->config.save_sync);
+    pager_set_budget((size_t)state->config.large_file_memory << 20);
+    if (result == LITE_ERROR_FILE_NOT_FOUND) {
+        /* Running without a configuration file is normal */
+        return result;
+    }
+    
+    if (result != LITE_OK) {
+        editor_set_status_message(state, "Failed to load config: %s", config_path);
+    }
+    
+    return result;
 }
 
 /**
@@ -0,0 +1,329 @@
+/**
+ * event.c - Event loop for LITE editor
+ *
+ * Nothing in the loop polls on an interval. When no timer is armed and no
+ * input arrives the process stays blocked in poll() indefinitely.
+ */
+
+#include "lite.h"
+#include "core/event.h"
+#include "utils/log.h"
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+/* Fixed slots for the internal descriptors */
+#define TIMER_SLOT 0
+#define SIGNAL_SLOT 1
+
+/**
+ * Current monotonic time in nanoseconds
+ */
+static uint64_t monotonic_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Arm the timerfd for the earliest pending deadline, or disarm it
+ */
+static void program_timer(EventLoop *loop) {
+    uint64_t deadline = 0;
+    
+    for (int i = 0; i < loop->timer_count; i++) {
+        EventTimer *timer = &loop->timers[i];
+        if (timer->armed && (deadline == 0 || timer->deadline < deadline)) {
+            deadline = timer->deadline;
+        }
+    }
+    
+    /* Already set up for this deadline */
+    if (deadline == loop->timer_deadline) return;
+    
+    /* A zero it_value disarms the timer */
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = deadline / 1000000000ull;
+    spec.it_value.tv_nsec = deadline % 1000000000ull;
+    
+    if (timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+        LOG_ERROR("Failed to arm timer: %s", strerror(errno));
+        return;
+    }
+    
+    loop->timer_deadline = deadline;
+}
+
+/**
+ * Run the callbacks of every timer whose deadline has passed
+ */
+static void dispatch_timers(EventLoop *loop) {
+    uint64_t expirations;
+    
+    /* Drain the timerfd, the count itself is not needed */
+    while (read(loop->timer_fd, &expirations, sizeof(expirations)) > 0) {
+    }
+    
+    /* The kernel timer is no longer armed */
+    loop->timer_deadline = 0;
+    
+    uint64_t now = monotonic_now();
+    
+    for (int i = 0; i < loop->timer_count; i++) {
+        EventTimer *timer = &loop->timers[i];
+        
+        /* Disarm first so the callback may set the timer again */
+        if (timer->armed && timer->deadline <= now) {
+            timer->armed = false;
+            timer->callback(timer->data);
+        }
+    }
+    
+    program_timer(loop);
+}
+
+/**
+ * Pass every pending signal to the signal callback
+ */
+static void dispatch_signals(EventLoop *loop) {
+    struct signalfd_siginfo info;
+    
+    while (read(loop->signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+        if (loop->signal_callback) {
+            loop->signal_callback((int)info.ssi_signo, loop->signal_data);
+        }
+    }
+}
+
+/**
+ * Initialize an event loop
+ *
+ * SIGWINCH, SIGINT, SIGTERM and SIGHUP are blocked and delivered through
+ * the loop instead. This must happen before any thread is started so that
+ * every thread inherits the blocked mask.
+ */
+int event_loop_init(EventLoop *loop) {
+    if (!loop) return LITE_ERROR;
+    
+    memset(loop, 0, sizeof(EventLoop));
+    loop->timer_fd = -1;
+    loop->signal_fd = -1;
+    
+    for (int i = 0; i < EVENT_MAX_SOURCES; i++) {
+        loop->fds[i].fd = -1;
+    }
+    
+    /* Block the signals handled by the loop */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGWINCH);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        LOG_ERROR("Failed to block signals: %s", strerror(errno));
+        return LITE_ERROR;
+    }
+    
+    loop->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    
+    if (loop->signal_fd == -1 || loop->timer_fd == -1) {
+        LOG_ERROR("Failed to create event descriptors: %s", strerror(errno));
+        event_loop_free(loop);
+        return LITE_ERROR;
+    }
+    
+    loop->fds[TIMER_SLOT].fd = loop->timer_fd;
+    loop->fds[TIMER_SLOT].events = POLLIN;
+    loop->fds[SIGNAL_SLOT].fd = loop->signal_fd;
+    loop->fds[SIGNAL_SLOT].events = POLLIN;
+    loop->source_count = 2;
+    
+    return LITE_OK;
+}
+
+/**
+ * Free an event loop
+ *
+ * Registered descriptors other than the loop's own are left open.
+ */
+void event_loop_free(EventLoop *loop) {
+    if (!loop) return;
+    
+    if (loop->timer_fd != -1) {
+        close(loop->timer_fd);
+        loop->timer_fd = -1;
+    }
+    
+    if (loop->signal_fd != -1) {
+        close(loop->signal_fd);
+        loop->signal_fd = -1;
+    }
+    
+    loop->source_count = 0;
+    loop->timer_count = 0;
+}
+
+/**
+ * Watch a file descriptor for input
+ */
+int event_loop_add_fd(EventLoop *loop, int fd, EventCallback callback, void *data) {
+    if (!loop || fd < 0 || !callback) return LITE_ERROR;
+    
+    /* Reuse a removed slot before growing */
+    int slot = -1;
+    for (int i = 0; i < loop->source_count; i++) {
+        if (loop->fds[i].fd == -1) {
+            slot = i;
+            break;
+        }
+    }
+    
+    if (slot == -1) {
+        if (loop->source_count >= EVENT_MAX_SOURCES) {
+            LOG_ERROR("Too many event sources");
+            return LITE_ERROR;
+        }
+        slot = loop->source_count++;
+    }
+    
+    loop->fds[slot].fd = fd;
+    loop->fds[slot].events = POLLIN;
+    loop->fds[slot].revents = 0;
+    loop->sources[slot].callback = callback;
+    loop->sources[slot].data = data;
+    
+    return LITE_OK;
+}
+
+/**
+ * Stop watching a file descriptor
+ *
+ * Safe to call from a callback. The slot is only cleared, poll() skips
+ * negative descriptors.
+ */
+int event_loop_remove_fd(EventLoop *loop, int fd) {
+    if (!loop || fd < 0) return LITE_ERROR;
+    
+    for (int i = SIGNAL_SLOT + 1; i < loop->source_count; i++) {
+        if (loop->fds[i].fd == fd) {
+            loop->fds[i].fd = -1;
+            loop->fds[i].revents = 0;
+            loop->sources[i].callback = NULL;
+            loop->sources[i].data = NULL;
+            return LITE_OK;
+        }
+    }
+    
+    return LITE_ERROR;
+}
+
+/**
+ * Create a timer, initially disarmed
+ *
+ * Returns the timer id, or LITE_ERROR if no timer is left.
+ */
+int event_loop_add_timer(EventLoop *loop, EventCallback callback, void *data) {
+    if (!loop || !callback) return LITE_ERROR;
+    
+    if (loop->timer_count >= EVENT_MAX_TIMERS) {
+        LOG_ERROR("Too many timers");
+        return LITE_ERROR;
+    }
+    
+    EventTimer *timer = &loop->timers[loop->timer_count];
+    timer->deadline = 0;
+    timer->armed = false;
+    timer->callback = callback;
+    timer->data = data;
+    
+    return loop->timer_count++;
+}
+
+/**
+ * Arm a timer to fire once after a delay, replacing any earlier deadline
+ */
+void event_loop_set_timer(EventLoop *loop, int timer, unsigned int delay_ms) {
+    if (!loop || timer < 0 || timer >= loop->timer_count) return;
+    
+    loop->timers[timer].deadline = monotonic_now() + (uint64_t)delay_ms * 1000000ull;
+    loop->timers[timer].armed = true;
+    
+    program_timer(loop);
+}
+
+/**
+ * Disarm a timer
+ */
+void event_loop_cancel_timer(EventLoop *loop, int timer) {
+    if (!loop || timer < 0 || timer >= loop->timer_count) return;
+    
+    loop->timers[timer].armed = false;
+    
+    program_timer(loop);
+}
+
+/**
+ * Check whether a timer is waiting to fire
+ */
+bool event_loop_timer_armed(const EventLoop *loop, int timer) {
+    if (!loop || timer < 0 || timer >= loop->timer_count) return false;
+    
+    return loop->timers[timer].armed;
+}
+
+/**
+ * Set the callback for SIGWINCH, SIGINT, SIGTERM and SIGHUP
+ */
+void event_loop_on_signal(EventLoop *loop, EventSignalCallback callback, void *data) {
+    if (!loop) return;
+    
+    loop->signal_callback = callback;
+    loop->signal_data = data;
+}
+
+/**
+ * Wait for the next events and dispatch them
+ *
+ * Blocks without a timeout, timers wake the loop through their fd.
+ */
+int event_loop_run_once(EventLoop *loop) {
+    if (!loop) return LITE_ERROR;
+    
+    int ready = poll(loop->fds, (nfds_t)loop->source_count, -1);
+    if (ready == -1) {
+        if (errno == EINTR) return LITE_OK;
+        
+        LOG_ERROR("poll failed: %s", strerror(errno));
+        return LITE_ERROR;
+    }
+    
+    for (int i = 0; i < loop->source_count && ready > 0; i++) {
+        short revents = loop->fds[i].revents;
+        if (revents == 0) continue;
+        
+        loop->fds[i].revents = 0;
+        ready--;
+        
+        if (i == TIMER_SLOT) {
+            dispatch_timers(loop);
+        } else if (i == SIGNAL_SLOT) {
+            dispatch_signals(loop);
+        } else if (loop->sources[i].callback) {
+            loop->sources[i].callback(loop->sources[i].data);
+            
+            /* A descriptor that hung up would wake the loop forever */
+            if (!(revents & POLLIN) && (revents & (POLLHUP | POLLERR | POLLNVAL))) {
+                LOG_WARNING("Event source %d closed", loop->fds[i].fd);
+                event_loop_remove_fd(loop, loop->fds[i].fd);
+            }
+        }
+    }
+    
+    return LITE_OK;
+}
@@ -0,0 +1,881 @@
+/**
+ * grep.c - Search across all open buffers and files for LITE editor
+ *
+ * A search of the buffers works on read-only views of the piece tables,
+ * so the buffers can be edited while it runs. Each range of lines is a
+ * task of its own and collects its matching lines in a private output
+ * block. The UI thread is woken whenever a range is done and appends the
+ * blocks of all finished ranges at the front to the results buffer, which
+ * keeps the results in order without making the workers wait for each
+ * other.
+ *
+ * A search of the files under a directory is a pipeline of two pools.
+ * The I/O pool walks the directories and maps each file, touching every
+ * page while it counts lines, and hands the file to the search pool. At
+ * most GREP_QUEUE_FILES files wait between the two, so reading runs
+ * ahead of searching without mapping the whole tree. Files are listed in
+ * the order their searches finish.
+ *
+ * A compiled regex caches DFA states and belongs to one thread, so each
+ * search worker compiles its own copy of the pattern the first time it
+ * needs it. Literal patterns are shared.
+ */
+
+#include "lite.h"
+#include "core/grep.h"
+#include "core/editor.h"
+#include "core/search.h"
+#include "utils/pool.h"
+#include "utils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+/* Buffer being searched, through a view of its text */
+typedef struct GrepTarget {
+    Buffer *buffer;
+    PieceTable view;
+    char name[256];
+} GrepTarget;
+
+/* Matching lines found by one task */
+typedef struct GrepOutput {
+    char *text;
+    size_t length;
+    size_t capacity;
+    size_t matches;
+    bool failed;
+} GrepOutput;
+
+/* Range of whole lines searched by one task
+ *
+ * The output belongs to the task until done is set under the grep lock.
+ */
+typedef struct GrepRange {
+    struct GrepJob *job;
+    int target;
+    size_t start;
+    size_t end;
+    GrepOutput output;
+    bool done;
+} GrepRange;
+
+/* File read by the I/O pool and searched as a whole */
+typedef struct GrepFile {
+    struct GrepJob *job;
+    struct GrepFile *next;
+    PieceTable text;
+    GrepOutput output;
+    char path[];
+} GrepFile;
+
+/* Directory waiting to be walked */
+typedef struct GrepDirectory {
+    struct GrepJob *job;
+    char path[];
+} GrepDirectory;
+
+/* Running search
+ *
+ * patterns holds one compiled pattern per worker for regex searches, and
+ * the shared literal pattern in its first entry otherwise. cancelled, the
+ * done flags of the ranges and the walk counts from busy to finished are
+ * guarded by the grep lock, the rest belongs to the UI thread.
+ */
+typedef struct GrepJob {
+    GrepTarget *targets;
+    int target_count;
+    GrepRange *ranges;
+    size_t range_count;
+    size_t collected;
+    size_t matches;
+    SearchPattern *patterns;
+    int pattern_count;
+    bool regex;
+    bool failed;
+    bool cancelled;
+    Buffer *results;
+    /* Searches of the files under a directory */
+    bool walk;
+    size_t files;
+    size_t busy;                /* Directories and files not done with */
+    size_t waiting;             /* Files read but not searched yet */
+    bool skipped;               /* Some directory or file could not be read */
+    GrepFile *finished;         /* Searched files not collected, newest first */
+} GrepJob;
+
+/* Search state, the pools are started on first use */
+static struct {
+    ThreadPool *pool;
+    ThreadPool *io_pool;
+    pthread_mutex_t lock;
+    pthread_cond_t room;
+    int notify_fd;
+    GrepJob *job;
+} grep = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .room = PTHREAD_COND_INITIALIZER,
+    .notify_fd = -1,
+};
+
+/**
+ * Check whether the job was cancelled
+ */
+static bool job_cancelled(GrepJob *job) {
+    pthread_mutex_lock(&grep.lock);
+    bool cancelled = job->cancelled;
+    pthread_mutex_unlock(&grep.lock);
+
+    return cancelled;
+}
+
+/**
+ * Get the pattern the calling worker searches with
+ *
+ * Returns NULL if the worker's copy of a regex fails to compile.
+ */
+static SearchPattern* worker_pattern(GrepJob *job) {
+    if (!job->regex) return &job->patterns[0];
+
+    int index = pool_worker_index();
+    if (index < 0 || index >= job->pattern_count) return NULL;
+
+    SearchPattern *pattern = &job->patterns[index];
+    if (!pattern->regex) {
+        const SearchPattern *first = &job->patterns[0];
+        if (search_compile_regex(pattern, first->text, first->length, first->ignore_case,
+                                 NULL, 0) != LITE_OK) {
+            return NULL;
+        }
+    }
+
+    return pattern;
+}
+
+/**
+ * Make room for more output
+ */
+static bool reserve_output(GrepOutput *output, size_t length) {
+    if (output->length + length <= output->capacity) return true;
+
+    size_t capacity = output->capacity > 0 ? output->capacity * 2 : 4096;
+    while (capacity < output->length + length) {
+        capacity *= 2;
+    }
+
+    char *text = (char*)realloc(output->text, capacity);
+    if (!text) return false;
+
+    output->text = text;
+    output->capacity = capacity;
+    return true;
+}
+
+/**
+ * Add a matching line to an output
+ */
+static bool add_line(GrepOutput *output, const PieceTable *text, const char *name,
+                     size_t line_start, size_t line_end) {
+    char prefix[PATH_MAX + 32];
+    size_t line = piece_table_line_at(text, line_start) + 1;
+    int prefix_length = snprintf(prefix, sizeof(prefix), "%s:%zu: ", name, line);
+    if (prefix_length < 0) return false;
+    if ((size_t)prefix_length >= sizeof(prefix)) prefix_length = sizeof(prefix) - 1;
+
+    size_t length = line_end - line_start;
+    if (length > GREP_LINE_MAX) length = GREP_LINE_MAX;
+
+    if (!reserve_output(output, (size_t)prefix_length + length + 1)) return false;
+
+    char *out = output->text + output->length;
+    memcpy(out, prefix, (size_t)prefix_length);
+    out += prefix_length;
+
+    length = piece_table_copy(text, line_start, out, length);
+    if (length > 0 && out[length - 1] == '\r') {
+        length--;
+    }
+    out[length] = '\n';
+
+    output->length += (size_t)prefix_length + length + 1;
+    output->matches++;
+    return true;
+}
+
+/**
+ * Free the text of an output
+ */
+static void free_output(GrepOutput *output) {
+    free(output->text);
+    output->text = NULL;
+    output->length = output->capacity = 0;
+}
+
+/**
+ * Signal the UI thread that there are results to collect
+ */
+static void notify(void) {
+    uint64_t one = 1;
+    ssize_t written = write(grep.notify_fd, &one, sizeof(one));
+    (void)written;
+}
+
+/**
+ * List the lines of text between start and end that match the pattern
+ */
+static void search_text(GrepJob *job, const PieceTable *text, const char *name,
+                        size_t start, size_t end, GrepOutput *output) {
+    size_t length = piece_table_length(text);
+
+    SearchPattern *pattern = job_cancelled(job) ? NULL : worker_pattern(job);
+    output->failed = !pattern && !job_cancelled(job);
+
+    /* An empty match may start at the end of a last line without a line break */
+    size_t to = end;
+    char last = '\0';
+    if (to == length && piece_table_copy(text, length - 1, &last, 1) == 1 && last != '\n') {
+        to++;
+    }
+
+    size_t offset = start;
+    while (pattern && offset < end) {
+        size_t match = search_range(text, offset, to, pattern);
+        if (match == PIECE_NPOS) break;
+
+        /* A line is listed once however often it matches */
+        size_t line_start = piece_table_find_reverse(text, match, '\n');
+        line_start = line_start == PIECE_NPOS ? 0 : line_start + 1;
+        size_t line_end = piece_table_find(text, match, '\n');
+        if (line_end == PIECE_NPOS) line_end = length;
+
+        if (!add_line(output, text, name, line_start, line_end)) {
+            output->failed = true;
+            break;
+        }
+
+        if (output->matches % GREP_CANCEL_CHECK == 0 && job_cancelled(job)) break;
+        offset = line_end + 1;
+    }
+}
+
+/**
+ * Search one range of lines on a worker thread
+ */
+static void search_lines(void *data) {
+    GrepRange *range = (GrepRange*)data;
+    GrepJob *job = range->job;
+    const GrepTarget *target = &job->targets[range->target];
+
+    search_text(job, &target->view, target->name, range->start, range->end, &range->output);
+
+    pthread_mutex_lock(&grep.lock);
+    range->done = true;
+    pthread_mutex_unlock(&grep.lock);
+
+    notify();
+}
+
+/**
+ * Finish a directory or file of a walk
+ */
+static void walk_done(GrepJob *job, bool skipped) {
+    pthread_mutex_lock(&grep.lock);
+    job->busy--;
+    job->skipped |= skipped;
+    pthread_mutex_unlock(&grep.lock);
+
+    notify();
+}
+
+/**
+ * Hand a searched file to the UI thread
+ */
+static void finish_file(GrepFile *file) {
+    GrepJob *job = file->job;
+
+    pthread_mutex_lock(&grep.lock);
+    file->next = job->finished;
+    job->finished = file;
+    job->busy--;
+    pthread_mutex_unlock(&grep.lock);
+
+    notify();
+}
+
+/**
+ * Search a file on a search worker
+ */
+static void search_file(void *data) {
+    GrepFile *file = (GrepFile*)data;
+    GrepJob *job = file->job;
+
+    search_text(job, &file->text, file->path, 0, piece_table_length(&file->text), &file->output);
+    piece_table_free(&file->text);
+
+    pthread_mutex_lock(&grep.lock);
+    job->waiting--;
+    pthread_cond_signal(&grep.room);
+    pthread_mutex_unlock(&grep.lock);
+
+    finish_file(file);
+}
+
+/**
+ * Map a file for searching
+ *
+ * Returns false for files that are empty, cannot be read or look binary,
+ * with a NUL byte near the start.
+ */
+static bool map_file(GrepFile *file, bool *unreadable) {
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        *unreadable = true;
+        return false;
+    }
+
+    struct stat st;
+    bool mapped = false;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        mapped = piece_table_map(&file->text, fd, (size_t)st.st_size, 0) == LITE_OK;
+        *unreadable = !mapped;
+    }
+    close(fd);
+
+    if (!mapped) return false;
+
+    size_t length = (size_t)st.st_size;
+    size_t check = length < GREP_BINARY_CHECK ? length : GREP_BINARY_CHECK;
+    if (memchr(file->text.original, '\0', check) ||
+        piece_table_load_mapped(&file->text, length) != LITE_OK) {
+        piece_table_free(&file->text);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Read a file on an I/O worker and queue it for searching
+ */
+static void read_file(void *data) {
+    GrepFile *file = (GrepFile*)data;
+    GrepJob *job = file->job;
+
+    bool unreadable = false;
+    if (job_cancelled(job) || !map_file(file, &unreadable)) {
+        free(file);
+        walk_done(job, unreadable);
+        return;
+    }
+
+    /* Wait for the search to catch up, so that reading does not map the whole tree */
+    pthread_mutex_lock(&grep.lock);
+    while (job->waiting >= GREP_QUEUE_FILES && !job->cancelled) {
+        pthread_cond_wait(&grep.room, &grep.lock);
+    }
+    job->waiting++;
+    pthread_mutex_unlock(&grep.lock);
+
+    if (pool_submit(grep.pool, search_file, file) != LITE_OK) {
+        piece_table_free(&file->text);
+        file->output.failed = true;
+
+        pthread_mutex_lock(&grep.lock);
+        job->waiting--;
+        pthread_mutex_unlock(&grep.lock);
+
+        finish_file(file);
+    }
+}
+
+static void walk_directory(void *data);
+
+/**
+ * Queue a directory or file of a walk on the I/O pool
+ */
+static void queue_path(GrepJob *job, const char *parent, const char *name, bool directory) {
+    /* Paths under the current directory are listed without a leading ./ */
+    size_t parent_length = strcmp(parent, ".") == 0 ? 0 : strlen(parent);
+    size_t name_length = strlen(name);
+    size_t length = parent_length + (parent_length > 0) + name_length;
+
+    size_t size = directory ? sizeof(GrepDirectory) : sizeof(GrepFile);
+    void *item = length < PATH_MAX ? calloc(1, size + length + 1) : NULL;
+    if (!item) {
+        pthread_mutex_lock(&grep.lock);
+        job->skipped = true;
+        pthread_mutex_unlock(&grep.lock);
+        return;
+    }
+
+    char *path = directory ? ((GrepDirectory*)item)->path : ((GrepFile*)item)->path;
+    if (parent_length > 0) {
+        memcpy(path, parent, parent_length);
+        path[parent_length] = '/';
+        memcpy(path + parent_length + 1, name, name_length + 1);
+    } else {
+        memcpy(path, name, name_length + 1);
+    }
+
+    pthread_mutex_lock(&grep.lock);
+    job->busy++;
+    pthread_mutex_unlock(&grep.lock);
+
+    int result;
+    if (directory) {
+        ((GrepDirectory*)item)->job = job;
+        result = pool_submit(grep.io_pool, walk_directory, item);
+    } else {
+        GrepFile *file = (GrepFile*)item;
+        file->job = job;
+        piece_table_init(&file->text);
+        result = pool_submit(grep.io_pool, read_file, file);
+    }
+
+    if (result != LITE_OK) {
+        free(item);
+        walk_done(job, true);
+    }
+}
+
+/**
+ * Walk a directory on an I/O worker
+ *
+ * Hidden entries are skipped, along with symbolic links, which could
+ * lead out of the tree or around in circles.
+ */
+static void walk_directory(void *data) {
+    GrepDirectory *directory = (GrepDirectory*)data;
+    GrepJob *job = directory->job;
+
+    DIR *dir = job_cancelled(job) ? NULL : opendir(directory->path);
+    bool skipped = !dir && !job_cancelled(job);
+
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL && !job_cancelled(job)) {
+        if (entry->d_name[0] == '.') continue;
+
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if (type == DT_DIR || type == DT_REG) {
+            queue_path(job, directory->path, entry->d_name, type == DT_DIR);
+        }
+    }
+
+    if (dir) {
+        closedir(dir);
+    }
+
+    free(directory);
+    walk_done(job, skipped);
+}
+
+/**
+ * Free a job whose tasks have all finished
+ */
+static void free_job(GrepJob *job) {
+    if (!job) return;
+
+    for (int i = 0; i < job->target_count; i++) {
+        piece_table_free(&job->targets[i].view);
+    }
+
+    for (size_t i = 0; i < job->range_count; i++) {
+        free_output(&job->ranges[i].output);
+    }
+
+    while (job->finished) {
+        GrepFile *file = job->finished;
+        job->finished = file->next;
+        free_output(&file->output);
+        free(file);
+    }
+
+    for (int i = 0; i < job->pattern_count; i++) {
+        search_free(&job->patterns[i]);
+    }
+
+    free(job->targets);
+    free(job->ranges);
+    free(job->patterns);
+    free(job);
+}
+
+/**
+ * Stop the running search and wait for its tasks to let go of it
+ */
+static void cancel_job(void) {
+    GrepJob *job = grep.job;
+    if (!job) return;
+
+    pthread_mutex_lock(&grep.lock);
+    job->cancelled = true;
+    pthread_cond_broadcast(&grep.room);
+    pthread_mutex_unlock(&grep.lock);
+
+    /* Reading stops first, as it queues more searches */
+    pool_wait(grep.io_pool);
+    pool_wait(grep.pool);
+
+    grep.job = NULL;
+    free_job(job);
+}
+
+/**
+ * Cut the text of a target into ranges of whole lines
+ */
+static int add_ranges(GrepJob *job, int target, size_t *capacity) {
+    const PieceTable *text = &job->targets[target].view;
+    size_t length = piece_table_length(text);
+    size_t offset = 0;
+
+    while (offset < length) {
+        size_t end = length;
+        if (length - offset > GREP_RANGE_BYTES) {
+            end = piece_table_find(text, offset + GREP_RANGE_BYTES, '\n');
+            end = end == PIECE_NPOS ? length : end + 1;
+        }
+
+        if (job->range_count == *capacity) {
+            size_t new_capacity = *capacity > 0 ? *capacity * 2 : 64;
+            GrepRange *ranges = (GrepRange*)realloc(job->ranges, new_capacity * sizeof(GrepRange));
+            if (!ranges) return LITE_ERROR;
+
+            job->ranges = ranges;
+            *capacity = new_capacity;
+        }
+
+        GrepRange *range = &job->ranges[job->range_count++];
+        memset(range, 0, sizeof(GrepRange));
+        range->job = job;
+        range->target = target;
+        range->start = offset;
+        range->end = end;
+
+        offset = end;
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Set up a job searching every open buffer, or the files of a walk
+ */
+static GrepJob* create_job(EditorState *state, const char *pattern, bool ignore_case, bool regex,
+                           bool walk, char *error, size_t error_size) {
+    GrepJob *job = (GrepJob*)calloc(1, sizeof(GrepJob));
+    if (!job) return NULL;
+
+    job->regex = regex;
+    job->walk = walk;
+    job->pattern_count = regex ? pool_threads(grep.pool) : 1;
+    job->patterns = (SearchPattern*)calloc(job->pattern_count, sizeof(SearchPattern));
+    if (!walk) {
+        job->targets = (GrepTarget*)calloc(state->buffer_count > 0 ? state->buffer_count : 1, sizeof(GrepTarget));
+    }
+    if (!job->patterns || (!walk && !job->targets)) {
+        free_job(job);
+        return NULL;
+    }
+
+    /* The first copy is compiled here so that errors show up right away */
+    size_t length = strlen(pattern);
+    int result = regex ? search_compile_regex(&job->patterns[0], pattern, length, ignore_case, error, error_size)
+                       : search_compile(&job->patterns[0], pattern, length, ignore_case);
+    if (result != LITE_OK) {
+        free_job(job);
+        return NULL;
+    }
+
+    size_t capacity = 0;
+    for (int i = 0; i < state->buffer_count && !walk; i++) {
+        Buffer *buffer = state->buffers[i];
+        if (!buffer) continue;
+
+        GrepTarget *target = &job->targets[job->target_count];
+        target->buffer = buffer;
+        if (buffer->filename) {
+            snprintf(target->name, sizeof(target->name), "%s", buffer->filename);
+        } else {
+            snprintf(target->name, sizeof(target->name), "[buffer %d]", buffer->id);
+        }
+
+        if (piece_table_view(&buffer->text, &target->view) != LITE_OK) {
+            free_job(job);
+            return NULL;
+        }
+        job->target_count++;
+
+        if (add_ranges(job, job->target_count - 1, &capacity) != LITE_OK) {
+            free_job(job);
+            return NULL;
+        }
+    }
+
+    return job;
+}
+
+/**
+ * Set up searching
+ *
+ * The worker threads start with the first search. Returns a descriptor
+ * that becomes readable when results are ready, or -1 if searching
+ * across buffers is not available.
+ */
+int grep_init(void) {
+    if (grep.notify_fd == -1) {
+        grep.notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (grep.notify_fd == -1) {
+            LOG_WARNING("No search across buffers: %s", strerror(errno));
+        }
+    }
+
+    return grep.notify_fd;
+}
+
+/**
+ * Stop searching and the worker threads
+ */
+void grep_free(void) {
+    cancel_job();
+
+    pool_free(grep.io_pool);
+    grep.io_pool = NULL;
+    pool_free(grep.pool);
+    grep.pool = NULL;
+
+    if (grep.notify_fd != -1) {
+        close(grep.notify_fd);
+        grep.notify_fd = -1;
+    }
+}
+
+/**
+ * Start a search, listing matching lines in a new buffer
+ *
+ * A search that is still running is cancelled first. The files under
+ * directory are searched, or every open buffer if it is NULL.
+ */
+static int start_job(EditorState *state, const char *pattern, bool ignore_case, bool regex,
+                     const char *directory) {
+    if (!state || !pattern || !*pattern) return LITE_ERROR;
+
+    if (grep.notify_fd == -1) {
+        editor_set_status_message(state, "Search across %s is not available", directory ? "files" : "buffers");
+        return LITE_ERROR;
+    }
+
+    cancel_job();
+
+    if (!grep.pool) {
+        grep.pool = pool_create(0);
+    }
+    if (directory && !grep.io_pool) {
+        grep.io_pool = pool_create(GREP_IO_THREADS);
+    }
+    if (!grep.pool || (directory && !grep.io_pool)) {
+        editor_set_status_message(state, "Failed to start search threads");
+        return LITE_ERROR;
+    }
+
+    if (state->buffer_count >= LITE_MAX_BUFFERS) {
+        editor_set_status_message(state, "Buffer limit reached");
+        return LITE_ERROR;
+    }
+
+    char error[128] = "";
+    GrepJob *job = create_job(state, pattern, ignore_case, regex, directory != NULL, error, sizeof(error));
+    if (!job) {
+        if (error[0]) {
+            editor_set_status_message(state, "Invalid search pattern: %s", error);
+        } else {
+            editor_set_status_message(state, "Failed to start search");
+        }
+        return LITE_ERROR;
+    }
+
+    /* Results go into a new buffer, created like :tab new does */
+    Buffer *results = buffer_create();
+    if (!results) {
+        free_job(job);
+        editor_set_status_message(state, "Failed to create buffer");
+        return LITE_ERROR;
+    }
+
+    state->buffers[state->buffer_count] = results;
+    state->current_buffer = state->buffer_count;
+    state->buffer_count++;
+
+    job->results = results;
+    grep.job = job;
+
+    if (directory) {
+        queue_path(job, "", directory, true);
+    }
+
+    for (size_t i = 0; i < job->range_count; i++) {
+        if (pool_submit(grep.pool, search_lines, &job->ranges[i]) != LITE_OK) {
+            /* Leave the range to the UI thread as done with nothing found */
+            pthread_mutex_lock(&grep.lock);
+            job->ranges[i].output.failed = true;
+            job->ranges[i].done = true;
+            pthread_mutex_unlock(&grep.lock);
+        }
+    }
+
+    grep_collect(state);
+    return LITE_OK;
+}
+
+/**
+ * Search every open buffer, listing matching lines in a new buffer
+ */
+int grep_start(EditorState *state, const char *pattern, bool ignore_case, bool regex) {
+    return start_job(state, pattern, ignore_case, regex, NULL);
+}
+
+/**
+ * Search the files under a directory, listing matching lines in a new
+ * buffer
+ *
+ * The files are read from disk, unsaved changes in open buffers are not
+ * seen.
+ */
+int grep_files(EditorState *state, const char *directory, const char *pattern, bool ignore_case, bool regex) {
+    if (!directory) return LITE_ERROR;
+
+    return start_job(state, pattern, ignore_case, regex, directory);
+}
+
+/**
+ * Append an output to the results buffer
+ */
+static void collect_output(GrepJob *job, GrepOutput *output) {
+    if (output->length > 0 && buffer_append_text(job->results, output->text, output->length) != LITE_OK) {
+        output->failed = true;
+    }
+    job->matches += output->matches;
+    job->failed |= output->failed;
+
+    free_output(output);
+}
+
+/**
+ * Append the results of searched files to the results buffer
+ *
+ * Returns true once the walk is over.
+ */
+static bool collect_files(GrepJob *job) {
+    pthread_mutex_lock(&grep.lock);
+    GrepFile *finished = job->finished;
+    job->finished = NULL;
+    bool over = job->busy == 0;
+    job->failed |= job->skipped;
+    pthread_mutex_unlock(&grep.lock);
+
+    /* The list is newest first, turn it around */
+    GrepFile *file = NULL;
+    while (finished) {
+        GrepFile *next = finished->next;
+        finished->next = file;
+        file = finished;
+        finished = next;
+    }
+
+    while (file) {
+        GrepFile *next = file->next;
+        collect_output(job, &file->output);
+        job->files++;
+        free(file);
+        file = next;
+    }
+
+    return over;
+}
+
+/**
+ * Append the results of finished tasks to the results buffer
+ *
+ * Called on the UI thread when the workers signal progress.
+ */
+void grep_collect(EditorState *state) {
+    uint64_t count;
+    while (grep.notify_fd != -1 && read(grep.notify_fd, &count, sizeof(count)) > 0) {
+        /* Only the wakeup matters */
+    }
+
+    GrepJob *job = grep.job;
+    if (!job || !state) return;
+
+    if (job->walk) {
+        if (!collect_files(job)) {
+            editor_set_status_message(state, "find: %zu matching lines, %zu files searched",
+                                      job->matches, job->files);
+            return;
+        }
+
+        editor_set_status_message(state, "find: %zu matching lines in %zu files%s", job->matches,
+                                  job->files, job->failed ? ", some files were skipped" : "");
+
+        grep.job = NULL;
+        free_job(job);
+        return;
+    }
+
+    /* Results are only taken in order, up to the first unfinished range */
+    size_t ready = job->collected;
+    pthread_mutex_lock(&grep.lock);
+    while (ready < job->range_count && job->ranges[ready].done) {
+        ready++;
+    }
+    pthread_mutex_unlock(&grep.lock);
+
+    for (; job->collected < ready; job->collected++) {
+        collect_output(job, &job->ranges[job->collected].output);
+    }
+
+    if (job->collected < job->range_count) {
+        editor_set_status_message(state, "grep: %zu matching lines, %zu%% searched",
+                                  job->matches, job->collected * 100 / job->range_count);
+        return;
+    }
+
+    editor_set_status_message(state, "grep: %zu matching lines in %d buffers%s", job->matches,
+                              job->target_count, job->failed ? ", some lines were skipped" : "");
+
+    grep.job = NULL;
+    free_job(job);
+}
+
+/**
+ * Stop reading a buffer that is about to be freed
+ *
+ * A running search that reads the buffer or writes into it is cancelled.
+ */
+void grep_forget(Buffer *buffer) {
+    GrepJob *job = grep.job;
+    if (!job || !buffer) return;
+
+    bool involved = job->results == buffer;
+    for (int i = 0; i < job->target_count && !involved; i++) {
+        involved = job->targets[i].buffer == buffer;
+    }
+
+    if (involved) {
+        cancel_job();
+    }
+}
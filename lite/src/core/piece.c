@@ -0,0 +1,1000 @@
+/**
+ * piece.c - Piece table text storage for LITE editor
+ *
+ * Pieces are kept in a treap ordered by their position in the text, with
+ * every node caching the length and line break count of its subtree so
+ * that a byte offset or a line can be located in O(log n). Pieces are at
+ * most PIECE_MAX_LENGTH bytes long, which bounds the cost of counting line
+ * breaks when one is cut in two.
+ */
+
+#include "lite.h"
+#include "core/piece.h"
+#include "utils/slab.h"
+#include "utils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+/* Treap priority generator state, per thread as files are also loaded by
+ * search workers */
+static __thread unsigned int priority_state = 2463534242u;
+
+/**
+ * Generate a priority for a new piece (xorshift32)
+ */
+static unsigned int next_priority(void) {
+    unsigned int x = priority_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    priority_state = x;
+    return x;
+}
+
+/**
+ * Count the line breaks in a block of text
+ */
+static size_t count_newlines(const char *data, size_t length) {
+    size_t count = 0;
+    const char *end = data + length;
+
+    while (data < end) {
+        const char *newline = (const char*)memchr(data, '\n', end - data);
+        if (!newline) break;
+
+        count++;
+        data = newline + 1;
+    }
+
+    return count;
+}
+
+/**
+ * Get the length of a subtree
+ */
+static size_t subtree_length(const Piece *piece) {
+    return piece ? piece->subtree_length : 0;
+}
+
+/**
+ * Get the number of line breaks in a subtree
+ */
+static size_t subtree_newlines(const Piece *piece) {
+    return piece ? piece->subtree_newlines : 0;
+}
+
+/**
+ * Recompute the cached subtree totals of a piece
+ */
+static void update_piece(Piece *piece) {
+    piece->subtree_length = subtree_length(piece->left) + piece->length + subtree_length(piece->right);
+    piece->subtree_newlines = subtree_newlines(piece->left) + piece->newlines + subtree_newlines(piece->right);
+}
+
+/**
+ * Create a new piece
+ */
+static Piece* create_piece(SlabAllocator *pool, const char *data, size_t length, size_t newlines, unsigned int priority) {
+    Piece *piece = (Piece*)slab_alloc(pool);
+    if (!piece) return NULL;
+
+    piece->data = data;
+    piece->length = length;
+    piece->newlines = newlines;
+    piece->subtree_length = length;
+    piece->subtree_newlines = newlines;
+    piece->priority = priority;
+    piece->left = NULL;
+    piece->right = NULL;
+
+    return piece;
+}
+
+/**
+ * Free a subtree of pieces
+ */
+static void free_pieces(SlabAllocator *pool, Piece *piece) {
+    while (piece) {
+        Piece *right = piece->right;
+        free_pieces(pool, piece->left);
+        slab_free(pool, piece);
+        piece = right;
+    }
+}
+
+/**
+ * Merge two trees where every piece of left precedes every piece of right
+ */
+static Piece* merge_pieces(Piece *left, Piece *right) {
+    if (!left) return right;
+    if (!right) return left;
+
+    if (left->priority >= right->priority) {
+        left->right = merge_pieces(left->right, right);
+        update_piece(left);
+        return left;
+    }
+
+    right->left = merge_pieces(left, right->left);
+    update_piece(right);
+    return right;
+}
+
+/**
+ * Split a tree at a byte offset, cutting a piece in two if needed
+ */
+static int split_pieces(SlabAllocator *pool, Piece *piece, size_t offset, Piece **left, Piece **right) {
+    if (!piece) {
+        *left = NULL;
+        *right = NULL;
+        return LITE_OK;
+    }
+
+    size_t left_length = subtree_length(piece->left);
+    int result;
+
+    if (offset <= left_length) {
+        /* Split point is in the left subtree */
+        result = split_pieces(pool, piece->left, offset, left, &piece->left);
+        update_piece(piece);
+        *right = piece;
+    } else if (offset >= left_length + piece->length) {
+        /* Split point is in the right subtree */
+        result = split_pieces(pool, piece->right, offset - left_length - piece->length, &piece->right, right);
+        update_piece(piece);
+        *left = piece;
+    } else {
+        /* Split point is inside this piece, the tail becomes a new piece */
+        size_t cut = offset - left_length;
+        size_t head_newlines = count_newlines(piece->data, cut);
+        Piece *tail = create_piece(pool, piece->data + cut, piece->length - cut,
+                                   piece->newlines - head_newlines, piece->priority);
+        if (!tail) {
+            *left = piece;
+            *right = NULL;
+            return LITE_ERROR;
+        }
+
+        tail->right = piece->right;
+        update_piece(tail);
+
+        piece->length = cut;
+        piece->newlines = head_newlines;
+        piece->right = NULL;
+        update_piece(piece);
+
+        *left = piece;
+        *right = tail;
+        result = LITE_OK;
+    }
+
+    return result;
+}
+
+/**
+ * Find the piece containing a byte offset
+ */
+static const Piece* find_piece(const Piece *piece, size_t offset, size_t *piece_offset) {
+    while (piece) {
+        size_t left_length = subtree_length(piece->left);
+
+        if (offset < left_length) {
+            piece = piece->left;
+        } else if (offset < left_length + piece->length) {
+            *piece_offset = offset - left_length;
+            return piece;
+        } else {
+            offset -= left_length + piece->length;
+            piece = piece->right;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Find the piece containing an offset, adjusting subtree totals on the way
+ *
+ * The piece must exist. Its own length is left for the caller to change.
+ */
+static Piece* resize_piece(Piece *piece, size_t offset, ptrdiff_t delta, ptrdiff_t newline_delta) {
+    while (piece) {
+        size_t left_length = subtree_length(piece->left);
+        piece->subtree_length += delta;
+        piece->subtree_newlines += newline_delta;
+
+        if (offset < left_length) {
+            piece = piece->left;
+        } else if (offset < left_length + piece->length) {
+            return piece;
+        } else {
+            offset -= left_length + piece->length;
+            piece = piece->right;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Make sure the newest append block has room for at least length bytes
+ */
+static AddBlock* reserve_space(PieceTable *table, size_t length) {
+    AddBlock *block = table->add;
+
+    /* Start a new block when the current one is full, doubling its size */
+    if (!block || block->capacity - block->used < length) {
+        size_t capacity = block ? block->capacity * 2 : PIECE_ADD_BLOCK_MIN;
+        if (capacity > PIECE_ADD_BLOCK_MAX) capacity = PIECE_ADD_BLOCK_MAX;
+        if (capacity < length) capacity = length;
+
+        block = (AddBlock*)malloc(sizeof(AddBlock) + capacity);
+        if (!block) return NULL;
+
+        block->used = 0;
+        block->capacity = capacity;
+        block->next = table->add;
+        table->add = block;
+    }
+
+    return block;
+}
+
+/**
+ * Build a tree of pieces over a block of text
+ *
+ * The text is cut into pieces of at most PIECE_MAX_LENGTH bytes. When
+ * release is set, the pages of each piece are dropped from memory after
+ * its line breaks have been counted, which keeps a freshly mapped file
+ * from becoming resident.
+ */
+static int build_pieces(SlabAllocator *pool, const char *data, size_t length, bool release, Piece **root) {
+    Piece *tree = NULL;
+
+    for (size_t offset = 0; offset < length; offset += PIECE_MAX_LENGTH) {
+        size_t chunk = length - offset < PIECE_MAX_LENGTH ? length - offset : PIECE_MAX_LENGTH;
+
+        Piece *piece = create_piece(pool, data + offset, chunk, count_newlines(data + offset, chunk), next_priority());
+        if (!piece) {
+            free_pieces(pool, tree);
+            return LITE_ERROR;
+        }
+
+        tree = merge_pieces(tree, piece);
+
+#ifndef _WIN32
+        if (release) {
+            madvise((void*)(data + offset), chunk, MADV_DONTNEED);
+        }
+#else
+        (void)release;
+#endif
+    }
+
+    *root = tree;
+    return LITE_OK;
+}
+
+/**
+ * Link text written at the tail of the newest append block into the text
+ */
+static int link_text(PieceTable *table, size_t offset, const char *data, size_t length) {
+    /* Text right after the last appended text just extends its piece */
+    if (offset > 0) {
+        size_t piece_offset = 0;
+        const Piece *last = find_piece(table->root, offset - 1, &piece_offset);
+
+        if (last && piece_offset + 1 == last->length && last->data + last->length == data &&
+            last->length + length <= PIECE_MAX_LENGTH) {
+            size_t newlines = count_newlines(data, length);
+            Piece *piece = resize_piece(table->root, offset - 1, (ptrdiff_t)length, (ptrdiff_t)newlines);
+            piece->length += length;
+            piece->newlines += newlines;
+            table->add->used += length;
+            return LITE_OK;
+        }
+    }
+
+    Piece *middle;
+    if (build_pieces(&table->pieces, data, length, false, &middle) != LITE_OK) {
+        return LITE_ERROR;
+    }
+
+    Piece *left, *right;
+    if (split_pieces(&table->pieces, table->root, offset, &left, &right) != LITE_OK) {
+        table->root = merge_pieces(left, right);
+        free_pieces(&table->pieces, middle);
+        return LITE_ERROR;
+    }
+
+    table->root = merge_pieces(merge_pieces(left, middle), right);
+    table->add->used += length;
+
+    return LITE_OK;
+}
+
+/**
+ * Initialize an empty piece table
+ */
+void piece_table_init(PieceTable *table) {
+    if (!table) return;
+
+    table->original = NULL;
+    table->original_length = 0;
+    table->original_mapped = 0;
+    table->original_reserved = 0;
+    table->add = NULL;
+    table->root = NULL;
+    slab_init(&table->pieces, sizeof(Piece), PIECE_SLAB_OBJECTS);
+}
+
+/**
+ * Free all storage owned by a piece table
+ */
+void piece_table_free(PieceTable *table) {
+    if (!table) return;
+
+    /* All pieces go at once, there is no need to walk the tree */
+    slab_release(&table->pieces);
+
+    AddBlock *block = table->add;
+    while (block) {
+        AddBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    if (table->original_reserved) {
+#ifndef _WIN32
+        munmap(table->original, table->original_reserved);
+#endif
+    } else if (table->original) {
+        free(table->original);
+    }
+
+    piece_table_init(table);
+}
+
+/**
+ * Replace the contents of a piece table with loaded file data
+ *
+ * The table takes ownership of data, which must come from malloc.
+ */
+int piece_table_load(PieceTable *table, char *data, size_t length) {
+    if (!table) return LITE_ERROR;
+
+    piece_table_free(table);
+
+    table->original = data;
+    table->original_length = length;
+
+    return build_pieces(&table->pieces, data, length, false, &table->root);
+}
+
+/**
+ * Replace the contents of a piece table with a read-only mapping of a file
+ *
+ * The table holds no text yet. The mapping is turned into text all at
+ * once by piece_table_load_mapped, or a part at a time by
+ * piece_table_extend, which lets its line breaks be counted somewhere
+ * else first. reserve is how far the mapping may grow with the file; the
+ * address space for it is set aside now, so that the text already in the
+ * table never moves. The table unmaps the file when it is freed.
+ */
+int piece_table_map(PieceTable *table, int fd, size_t map_length, size_t reserve) {
+#ifndef _WIN32
+    if (!table || fd < 0) return LITE_ERROR;
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t reserved = (map_length + page - 1) & ~(page - 1);
+    if (reserved == 0) reserved = page;
+
+    /* Without address space to spare, the mapping cannot grow */
+    char *map = (char*)mmap(NULL, reserved + reserve, PROT_NONE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map != MAP_FAILED) {
+        reserved += reserve;
+    } else {
+        map = (char*)mmap(NULL, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (map == MAP_FAILED) return LITE_ERROR;
+    }
+
+    if (map_length > 0 &&
+        mmap(map, map_length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(map, reserved);
+        return LITE_ERROR;
+    }
+
+    piece_table_free(table);
+
+    table->original = map;
+    table->original_mapped = map_length;
+    table->original_reserved = reserved;
+
+    return LITE_OK;
+#else
+    (void)table;
+    (void)fd;
+    (void)map_length;
+    (void)reserve;
+    return LITE_ERROR;
+#endif
+}
+
+/**
+ * Map more of a file that grew into the space set aside for its mapping
+ *
+ * fd must refer to the file the table maps.
+ */
+int piece_table_remap(PieceTable *table, int fd, size_t map_length) {
+#ifndef _WIN32
+    if (!table || !table->original_reserved || fd < 0) return LITE_ERROR;
+    if (map_length <= table->original_mapped) return LITE_OK;
+    if (map_length > table->original_reserved) return LITE_ERROR;
+
+    /* The page the mapping ended in is mapped again with the rest, the
+     * text in it stays where it is */
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t from = table->original_mapped & ~(page - 1);
+    if (mmap(table->original + from, map_length - from, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+             fd, (off_t)from) == MAP_FAILED) {
+        return LITE_ERROR;
+    }
+
+    table->original_mapped = map_length;
+    return LITE_OK;
+#else
+    (void)table;
+    (void)fd;
+    (void)map_length;
+    return LITE_ERROR;
+#endif
+}
+
+/**
+ * Count the line breaks again in the pieces that point into a range
+ */
+static void recount_pieces(Piece *piece, const char *from, const char *to) {
+    if (!piece) return;
+
+    recount_pieces(piece->left, from, to);
+    recount_pieces(piece->right, from, to);
+
+    if (piece->data < to && piece->data + piece->length > from) {
+        piece->newlines = count_newlines(piece->data, piece->length);
+    }
+    update_piece(piece);
+}
+
+/**
+ * Stop a table's text from following its file
+ *
+ * The first kept bytes of the mapping are copied to a temporary file,
+ * which is mapped in its place. What came after them reads as zeros, and
+ * the line breaks in it are gone from the counts. The text stays where it
+ * is, and its pages can still be dropped and read back in. Used when a
+ * file was cut short under text that cannot simply be loaded again.
+ */
+int piece_table_detach(PieceTable *table, size_t kept) {
+#ifndef _WIN32
+    if (!table || !table->original_reserved) return LITE_ERROR;
+    if (table->original_mapped == 0) return LITE_OK;
+    if (kept > table->original_mapped) kept = table->original_mapped;
+
+    FILE *fp = tmpfile();
+    if (!fp) return LITE_ERROR;
+
+    /* The file may shrink further while it is copied, what is lost then
+     * is left as zeros */
+    int fd = fileno(fp);
+    size_t done = 0;
+    while (done < kept) {
+        ssize_t written = write(fd, table->original + done, kept - done);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) break;
+        done += (size_t)written;
+    }
+
+    int result = LITE_ERROR;
+    if (ftruncate(fd, (off_t)table->original_mapped) == 0 &&
+        mmap(table->original, table->original_mapped, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED) {
+        /* The line breaks that were lost no longer count */
+        recount_pieces(table->root, table->original + done, table->original + table->original_mapped);
+        result = LITE_OK;
+    }
+
+    fclose(fp);
+    return result;
+#else
+    (void)table;
+    (void)kept;
+    return LITE_ERROR;
+#endif
+}
+
+/**
+ * Turn the start of a table's mapping into its text
+ *
+ * The text covers the first length bytes of the mapping.
+ */
+int piece_table_load_mapped(PieceTable *table, size_t length) {
+    if (!table || !table->original_reserved || table->root || length > table->original_mapped) {
+        return LITE_ERROR;
+    }
+    if (length == 0) return LITE_OK;
+
+    char *map = table->original;
+    size_t map_length = table->original_mapped;
+
+#ifndef _WIN32
+    madvise(map, map_length, MADV_SEQUENTIAL);
+#endif
+
+    int result = build_pieces(&table->pieces, map, length, true, &table->root);
+    if (result == LITE_OK) {
+        table->original_length = length;
+    }
+
+#ifndef _WIN32
+    madvise(map, map_length, MADV_NORMAL);
+#endif
+
+    return result;
+}
+
+/**
+ * Add the next part of the original text to the end of the text
+ *
+ * The part starts where the original text added so far ends, and holds
+ * the given number of line breaks. It must not be longer than a piece.
+ */
+int piece_table_extend(PieceTable *table, size_t length, size_t newlines) {
+    if (!table || !table->original || length > PIECE_MAX_LENGTH) return LITE_ERROR;
+    if (table->original_reserved && table->original_length + length > table->original_mapped) {
+        return LITE_ERROR;
+    }
+    if (length == 0) return LITE_OK;
+
+    /* Small parts, as a followed file grows by, go on the last piece */
+    const char *data = table->original + table->original_length;
+    size_t end = piece_table_length(table);
+    if (end > 0) {
+        size_t piece_offset = 0;
+        const Piece *last = find_piece(table->root, end - 1, &piece_offset);
+
+        if (last && last->data + last->length == data && last->length + length <= PIECE_MAX_LENGTH) {
+            Piece *piece = resize_piece(table->root, end - 1, (ptrdiff_t)length, (ptrdiff_t)newlines);
+            piece->length += length;
+            piece->newlines += newlines;
+            table->original_length += length;
+            return LITE_OK;
+        }
+    }
+
+    Piece *piece = create_piece(&table->pieces, table->original + table->original_length, length,
+                                newlines, next_priority());
+    if (!piece) return LITE_ERROR;
+
+    table->root = merge_pieces(table->root, piece);
+    table->original_length += length;
+
+    return LITE_OK;
+}
+
+/**
+ * Get the length of the text
+ */
+size_t piece_table_length(const PieceTable *table) {
+    if (!table) return 0;
+    return subtree_length(table->root);
+}
+
+/**
+ * Get the number of line breaks in the text
+ */
+size_t piece_table_newlines(const PieceTable *table) {
+    if (!table) return 0;
+    return subtree_newlines(table->root);
+}
+
+/**
+ * Get the byte offset where a line starts
+ *
+ * Line n starts right after the n-th line break. Returns PIECE_NPOS if
+ * the text has fewer lines.
+ */
+size_t piece_table_line_offset(const PieceTable *table, size_t line) {
+    if (!table) return PIECE_NPOS;
+    if (line == 0) return 0;
+
+    const Piece *piece = table->root;
+    size_t offset = 0;
+
+    while (piece) {
+        size_t left_newlines = subtree_newlines(piece->left);
+
+        if (line <= left_newlines) {
+            piece = piece->left;
+        } else if (line <= left_newlines + piece->newlines) {
+            /* The line break we are after is inside this piece */
+            size_t remaining = line - left_newlines;
+            const char *p = piece->data;
+
+            /* A mapped file cut short may have lost line breaks that
+             * were counted, its lines end with the piece then */
+            for (;;) {
+                const char *found = (const char*)memchr(p, '\n', piece->length - (p - piece->data));
+                if (!found) {
+                    p = piece->data + piece->length;
+                    break;
+                }
+
+                p = found + 1;
+                if (--remaining == 0) break;
+            }
+
+            return offset + subtree_length(piece->left) + (size_t)(p - piece->data);
+        } else {
+            line -= left_newlines + piece->newlines;
+            offset += subtree_length(piece->left) + piece->length;
+            piece = piece->right;
+        }
+    }
+
+    return PIECE_NPOS;
+}
+
+/**
+ * Get the line containing a byte offset
+ *
+ * The line number is the count of line breaks before the offset.
+ */
+size_t piece_table_line_at(const PieceTable *table, size_t offset) {
+    if (!table) return 0;
+
+    const Piece *piece = table->root;
+    size_t line = 0;
+
+    while (piece) {
+        size_t left_length = subtree_length(piece->left);
+
+        if (offset < left_length) {
+            piece = piece->left;
+        } else if (offset < left_length + piece->length) {
+            return line + subtree_newlines(piece->left) +
+                   count_newlines(piece->data, offset - left_length);
+        } else {
+            line += subtree_newlines(piece->left) + piece->newlines;
+            offset -= left_length + piece->length;
+            piece = piece->right;
+        }
+    }
+
+    return line;
+}
+
+/**
+ * Insert text at a byte offset
+ */
+int piece_table_insert(PieceTable *table, size_t offset, const char *text, size_t length) {
+    if (!table || !text) return LITE_ERROR;
+    if (offset > piece_table_length(table)) return LITE_ERROR;
+    if (length == 0) return LITE_OK;
+
+    AddBlock *block = reserve_space(table, length);
+    if (!block) return LITE_ERROR;
+
+    char *data = block->data + block->used;
+    memcpy(data, text, length);
+
+    return link_text(table, offset, data, length);
+}
+
+/**
+ * Delete a range of text
+ */
+int piece_table_delete(PieceTable *table, size_t offset, size_t length) {
+    if (!table) return LITE_ERROR;
+    if (offset > piece_table_length(table) || length > piece_table_length(table) - offset) {
+        return LITE_ERROR;
+    }
+    if (length == 0) return LITE_OK;
+
+    /* Trimming either end of a single piece needs no restructuring */
+    size_t piece_offset = 0;
+    const Piece *found = find_piece(table->root, offset, &piece_offset);
+
+    if (found && ((piece_offset == 0 && length < found->length) ||
+                  (piece_offset > 0 && piece_offset + length == found->length))) {
+        size_t newlines = count_newlines(found->data + piece_offset, length);
+        Piece *piece = resize_piece(table->root, offset, -(ptrdiff_t)length, -(ptrdiff_t)newlines);
+        if (piece_offset == 0) {
+            piece->data += length;
+        }
+        piece->length -= length;
+        piece->newlines -= newlines;
+        return LITE_OK;
+    }
+
+    Piece *left, *middle, *right;
+    if (split_pieces(&table->pieces, table->root, offset, &left, &right) != LITE_OK) {
+        table->root = merge_pieces(left, right);
+        return LITE_ERROR;
+    }
+
+    if (split_pieces(&table->pieces, right, length, &middle, &right) != LITE_OK) {
+        table->root = merge_pieces(left, merge_pieces(middle, right));
+        return LITE_ERROR;
+    }
+
+    free_pieces(&table->pieces, middle);
+    table->root = merge_pieces(left, right);
+
+    return LITE_OK;
+}
+
+/**
+ * Get writable space at the end of the append buffer
+ *
+ * Data written there becomes part of the text once it is committed with
+ * piece_table_append_commit, which adds it at the end of the text.
+ */
+char* piece_table_append_space(PieceTable *table, size_t min_length, size_t *available) {
+    if (!table) return NULL;
+
+    AddBlock *block = reserve_space(table, min_length > 0 ? min_length : 1);
+    if (!block) return NULL;
+
+    if (available) *available = block->capacity - block->used;
+    return block->data + block->used;
+}
+
+/**
+ * Append data written into the space from piece_table_append_space
+ */
+int piece_table_append_commit(PieceTable *table, size_t length) {
+    if (!table || !table->add) return LITE_ERROR;
+    if (length > table->add->capacity - table->add->used) return LITE_ERROR;
+    if (length == 0) return LITE_OK;
+
+    const char *data = table->add->data + table->add->used;
+    return link_text(table, piece_table_length(table), data, length);
+}
+
+/**
+ * Get memory statistics for a piece table
+ */
+void piece_table_get_stats(const PieceTable *table, PieceTableStats *stats) {
+    if (!table || !stats) return;
+
+    memset(stats, 0, sizeof(*stats));
+    slab_get_stats(&table->pieces, &stats->pieces);
+
+    for (const AddBlock *block = table->add; block; block = block->next) {
+        stats->add_blocks++;
+        stats->add_used += block->used;
+        stats->add_capacity += block->capacity;
+    }
+
+    stats->original_length = table->original_length;
+    stats->original_mapped = table->original_reserved != 0;
+}
+
+/**
+ * Get the contiguous run of text starting at a byte offset
+ */
+const char* piece_table_chunk(const PieceTable *table, size_t offset, size_t *length) {
+    if (!table) return NULL;
+
+    size_t piece_offset = 0;
+    const Piece *piece = find_piece(table->root, offset, &piece_offset);
+    if (!piece) return NULL;
+
+    if (length) *length = piece->length - piece_offset;
+    return piece->data + piece_offset;
+}
+
+/**
+ * Get the contiguous run of text ending just before a byte offset
+ */
+const char* piece_table_chunk_before(const PieceTable *table, size_t offset, size_t *length) {
+    if (!table || offset == 0) return NULL;
+
+    size_t piece_offset = 0;
+    const Piece *piece = find_piece(table->root, offset - 1, &piece_offset);
+    if (!piece) return NULL;
+
+    if (length) *length = piece_offset + 1;
+    return piece->data;
+}
+
+/**
+ * Copy a range of text into a caller-provided buffer
+ */
+size_t piece_table_copy(const PieceTable *table, size_t offset, char *dest, size_t length) {
+    if (!table || !dest) return 0;
+
+    size_t copied = 0;
+    while (copied < length) {
+        size_t chunk_length;
+        const char *chunk = piece_table_chunk(table, offset + copied, &chunk_length);
+        if (!chunk) break;
+
+        if (chunk_length > length - copied) {
+            chunk_length = length - copied;
+        }
+
+        memcpy(dest + copied, chunk, chunk_length);
+        copied += chunk_length;
+    }
+
+    return copied;
+}
+
+/**
+ * Find the first occurrence of a byte at or after an offset
+ */
+size_t piece_table_find(const PieceTable *table, size_t offset, int ch) {
+    if (!table) return PIECE_NPOS;
+
+    size_t chunk_length;
+    const char *chunk;
+
+    while ((chunk = piece_table_chunk(table, offset, &chunk_length)) != NULL) {
+        const char *found = (const char*)memchr(chunk, ch, chunk_length);
+        if (found) {
+            return offset + (size_t)(found - chunk);
+        }
+        offset += chunk_length;
+    }
+
+    return PIECE_NPOS;
+}
+
+/**
+ * Find the last occurrence of a byte before an offset
+ */
+size_t piece_table_find_reverse(const PieceTable *table, size_t offset, int ch) {
+    if (!table) return PIECE_NPOS;
+
+    size_t chunk_length;
+    const char *chunk;
+
+    while ((chunk = piece_table_chunk_before(table, offset, &chunk_length)) != NULL) {
+        offset -= chunk_length;
+
+        for (size_t i = chunk_length; i > 0; i--) {
+            if (chunk[i - 1] == (char)ch) {
+                return offset + i - 1;
+            }
+        }
+    }
+
+    return PIECE_NPOS;
+}
+
+/**
+ * Append the text of a subtree from an offset on to a snapshot
+ */
+static int collect_spans(const Piece *piece, size_t offset, PieceSnapshot *snapshot) {
+    while (piece) {
+        size_t left_length = subtree_length(piece->left);
+
+        if (offset < left_length) {
+            if (collect_spans(piece->left, offset, snapshot) != LITE_OK) {
+                return LITE_ERROR;
+            }
+            offset = 0;
+        } else {
+            offset -= left_length;
+        }
+
+        if (offset < piece->length) {
+            if (snapshot->count == snapshot->capacity) {
+                size_t capacity = snapshot->capacity > 0 ? snapshot->capacity * 2 : 64;
+                PieceSpan *spans = (PieceSpan*)realloc(snapshot->spans, capacity * sizeof(PieceSpan));
+                if (!spans) return LITE_ERROR;
+
+                snapshot->spans = spans;
+                snapshot->capacity = capacity;
+            }
+
+            PieceSpan *span = &snapshot->spans[snapshot->count++];
+            span->data = piece->data + offset;
+            span->length = piece->length - offset;
+            snapshot->length += span->length;
+            offset = 0;
+        } else {
+            offset -= piece->length;
+        }
+
+        piece = piece->right;
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Take a snapshot of the text from an offset to the end
+ *
+ * Only the piece descriptors are copied, so this costs time proportional
+ * to the number of pieces rather than the length of the text.
+ */
+int piece_table_snapshot(const PieceTable *table, size_t offset, PieceSnapshot *snapshot) {
+    if (!table || !snapshot) return LITE_ERROR;
+
+    snapshot->spans = NULL;
+    snapshot->count = 0;
+    snapshot->capacity = 0;
+    snapshot->length = 0;
+
+    if (collect_spans(table->root, offset, snapshot) != LITE_OK) {
+        piece_snapshot_free(snapshot);
+        return LITE_ERROR;
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Free a snapshot
+ */
+void piece_snapshot_free(PieceSnapshot *snapshot) {
+    if (!snapshot) return;
+
+    free(snapshot->spans);
+    snapshot->spans = NULL;
+    snapshot->count = 0;
+    snapshot->capacity = 0;
+    snapshot->length = 0;
+}
+
+/**
+ * Copy a subtree of pieces into a pool
+ *
+ * On failure the pieces copied so far are left in the pool.
+ */
+static int copy_pieces(SlabAllocator *pool, const Piece *piece, Piece **copy) {
+    *copy = NULL;
+    if (!piece) return LITE_OK;
+
+    Piece *node = (Piece*)slab_alloc(pool);
+    if (!node) return LITE_ERROR;
+
+    *node = *piece;
+    *copy = node;
+
+    if (copy_pieces(pool, piece->left, &node->left) != LITE_OK) {
+        node->right = NULL;
+        return LITE_ERROR;
+    }
+
+    return copy_pieces(pool, piece->right, &node->right);
+}
+
+/**
+ * Make a read-only copy of a table that shares its text
+ *
+ * Only the piece tree is copied, so lines and offsets can be looked up in
+ * the view as in the table. Like a snapshot, the view stays valid across
+ * later edits but not after the table is freed or reloaded. Freeing the
+ * view leaves the text alone.
+ */
+int piece_table_view(const PieceTable *table, PieceTable *view) {
+    if (!table || !view) return LITE_ERROR;
+
+    piece_table_init(view);
+
+    if (copy_pieces(&view->pieces, table->root, &view->root) != LITE_OK) {
+        piece_table_free(view);
+        return LITE_ERROR;
+    }
+
+    return LITE_OK;
+}
@@ -0,0 +1,1176 @@
+/**
+ * regex.c - Regular expression search for LITE editor
+ *
+ * The pattern is parsed into a small syntax tree, from which two NFAs are
+ * generated: one for the pattern and one for the pattern read backwards.
+ * A forward scan with the first finds where the earliest match ends, and
+ * a backward scan over that line with the second finds where the leftmost
+ * match starts. A backward search only needs the second.
+ *
+ * Matches never span lines. Line breaks are left out of every character
+ * set and put a DFA back into its line start state. A '^' at the start and
+ * a '$' at the end of the pattern anchor it to the start and end of a line.
+ *
+ * DFA states are sets of NFA states, built the first time a transition
+ * leads to them. When the cache is full it is emptied and filled again
+ * from the current state, so memory stays bounded and each byte costs at
+ * most one state construction.
+ *
+ * Patterns know literals, '.', [classes], \s \d \w and their negations,
+ * \t, \xHH, grouping, '|', '*', '+' and '?'.
+ */
+
+#include "lite.h"
+#include "core/regex.h"
+#include "core/piece.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+/* Syntax tree node types */
+enum {
+    NODE_EMPTY,
+    NODE_SET,
+    NODE_CONCAT,
+    NODE_ALTERNATE,
+    NODE_STAR,
+    NODE_PLUS,
+    NODE_QUESTION
+};
+
+/* Syntax tree node, children are indices */
+typedef struct RegexNode {
+    int type;
+    int left;
+    int right;
+    int set;
+} RegexNode;
+
+/* NFA node types */
+enum {
+    NFA_EPSILON,
+    NFA_SET,
+    NFA_ACCEPT
+};
+
+/* NFA node, epsilon nodes have up to two successors */
+typedef struct NfaNode {
+    int type;
+    int out;
+    int out2;
+    int set;
+} NfaNode;
+
+/* Partly built automaton, end is an epsilon node waiting for its successor */
+typedef struct Fragment {
+    int start;
+    int end;
+} Fragment;
+
+/* DFA state flags */
+#define STATE_ACCEPT 0x01
+#define STATE_DEAD 0x02
+
+/* Cached state that has not been built, or was flushed */
+#define NO_STATE -1
+
+/* DFA state, members index the set pool */
+typedef struct DfaState {
+    int members;
+    int count;
+    unsigned int hash;
+} DfaState;
+
+/* Lazily built DFA over one NFA */
+typedef struct Dfa {
+    const struct Regex *regex;
+    NfaNode *nodes;
+    int node_count;
+    int start;
+    bool anchored_start;        /* Matches only begin at the start of a line */
+    bool anchored_end;          /* Matches only end at the end of a line */
+
+    DfaState *states;
+    uint8_t *flags;             /* Per row, at the first class */
+    int *next;                  /* Row of the target per state and class, -1 if not built */
+    int stride;                 /* Classes per row */
+    int state_count;
+    int max_states;
+    int *pool;
+    int pool_size;
+    int pool_capacity;
+    int max_pool;
+    int *table;
+    int table_mask;
+    int line_start;
+    int mid_line;
+    int skip_row;               /* Row of a state only one byte leaves, -1 if none */
+    int skip_byte;
+
+    int *scratch;
+    int *stack;
+    unsigned int *marks;
+    unsigned int generation;
+    unsigned long flushes;
+} Dfa;
+
+/* Compiled regular expression */
+struct Regex {
+    uint8_t (*sets)[32];
+    int set_count;
+    int set_capacity;
+    uint8_t classes[256];
+    int class_count;
+    Dfa forward;
+    Dfa reverse;
+};
+
+/* Parser state */
+typedef struct Parser {
+    Regex *regex;
+    const char *p;
+    bool ignore_case;
+    RegexNode *nodes;
+    int node_count;
+    int node_capacity;
+    char *error;
+    size_t error_size;
+} Parser;
+
+/* NFA generator state */
+typedef struct Builder {
+    NfaNode *nodes;
+    int count;
+    int capacity;
+} Builder;
+
+/**
+ * Record a parse error
+ */
+static int fail(Parser *ps, const char *format, ...) {
+    if (ps->error && ps->error_size > 0) {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(ps->error, ps->error_size, format, args);
+        va_end(args);
+    }
+
+    return LITE_ERROR;
+}
+
+/**
+ * Add a byte to a set
+ */
+static void set_add(uint8_t set[32], int byte) {
+    set[byte >> 3] |= (uint8_t)(1u << (byte & 7));
+}
+
+/**
+ * Check whether a set holds a byte
+ */
+static bool set_has(const uint8_t set[32], int byte) {
+    return (set[byte >> 3] >> (byte & 7)) & 1;
+}
+
+/**
+ * Add a range of bytes to a set
+ */
+static void set_add_range(uint8_t set[32], int from, int to) {
+    for (int b = from; b <= to; b++) {
+        set_add(set, b);
+    }
+}
+
+/**
+ * Invert a set
+ */
+static void set_invert(uint8_t set[32]) {
+    for (int i = 0; i < 32; i++) {
+        set[i] = (uint8_t)~set[i];
+    }
+}
+
+/**
+ * Add the other case of every ASCII letter in a set
+ */
+static void set_fold(uint8_t set[32]) {
+    for (int b = 'a'; b <= 'z'; b++) {
+        if (set_has(set, b) || set_has(set, b - 32)) {
+            set_add(set, b);
+            set_add(set, b - 32);
+        }
+    }
+}
+
+/**
+ * Store a set, folding case and leaving out the line break
+ */
+static int add_set(Parser *ps, uint8_t set[32]) {
+    Regex *regex = ps->regex;
+
+    if (ps->ignore_case) {
+        set_fold(set);
+    }
+    set['\n' >> 3] &= (uint8_t)~(1u << ('\n' & 7));
+
+    if (regex->set_count == regex->set_capacity) {
+        int capacity = regex->set_capacity > 0 ? regex->set_capacity * 2 : 16;
+        uint8_t (*sets)[32] = (uint8_t(*)[32])realloc(regex->sets, capacity * sizeof(*sets));
+        if (!sets) return fail(ps, "out of memory");
+
+        regex->sets = sets;
+        regex->set_capacity = capacity;
+    }
+
+    memcpy(regex->sets[regex->set_count], set, 32);
+    return regex->set_count++;
+}
+
+/**
+ * Add a syntax tree node
+ */
+static int add_node(Parser *ps, int type, int left, int right, int set) {
+    if (ps->node_count >= REGEX_MAX_NODES) return fail(ps, "pattern too large");
+
+    if (ps->node_count == ps->node_capacity) {
+        int capacity = ps->node_capacity > 0 ? ps->node_capacity * 2 : 64;
+        RegexNode *nodes = (RegexNode*)realloc(ps->nodes, capacity * sizeof(RegexNode));
+        if (!nodes) return fail(ps, "out of memory");
+
+        ps->nodes = nodes;
+        ps->node_capacity = capacity;
+    }
+
+    RegexNode *node = &ps->nodes[ps->node_count];
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    node->set = set;
+
+    return ps->node_count++;
+}
+
+/**
+ * Parse a hex digit
+ */
+static int hex_value(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Parse an escape after a backslash into a set
+ */
+static int parse_escape(Parser *ps, uint8_t set[32]) {
+    char ch = *ps->p++;
+
+    switch (ch) {
+        case '\0':
+            ps->p--;
+            return fail(ps, "pattern ends in a backslash");
+        case 's':
+        case 'S':
+            set_add(set, ' ');
+            set_add(set, '\t');
+            break;
+        case 'd':
+        case 'D':
+            set_add_range(set, '0', '9');
+            break;
+        case 'w':
+        case 'W':
+            set_add_range(set, 'a', 'z');
+            set_add_range(set, 'A', 'Z');
+            set_add_range(set, '0', '9');
+            set_add(set, '_');
+            break;
+        case 't':
+            set_add(set, '\t');
+            break;
+        case 'x': {
+            int high = hex_value(ps->p[0]);
+            int low = high < 0 ? -1 : hex_value(ps->p[1]);
+            if (low < 0) return fail(ps, "\\x needs two hex digits");
+
+            set_add(set, high * 16 + low);
+            ps->p += 2;
+            break;
+        }
+        default:
+            set_add(set, (unsigned char)ch);
+            break;
+    }
+
+    if (ch == 'S' || ch == 'D' || ch == 'W') {
+        set_invert(set);
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Parse a bracketed class after the opening '['
+ */
+static int parse_class(Parser *ps, uint8_t set[32]) {
+    bool negate = false;
+    bool first = true;
+
+    if (*ps->p == '^') {
+        negate = true;
+        ps->p++;
+    }
+
+    while (*ps->p != ']' || first) {
+        if (*ps->p == '\0') return fail(ps, "unterminated [");
+        first = false;
+
+        if (*ps->p == '\\') {
+            ps->p++;
+
+            uint8_t escaped[32] = {0};
+            if (parse_escape(ps, escaped) != LITE_OK) return LITE_ERROR;
+            for (int i = 0; i < 32; i++) {
+                set[i] |= escaped[i];
+            }
+            continue;
+        }
+
+        int from = (unsigned char)*ps->p++;
+        if (*ps->p == '-' && ps->p[1] != ']' && ps->p[1] != '\0') {
+            int to = (unsigned char)ps->p[1];
+            if (to < from) return fail(ps, "invalid range in class");
+
+            set_add_range(set, from, to);
+            ps->p += 2;
+        } else {
+            set_add(set, from);
+        }
+    }
+
+    ps->p++;
+
+    /* Fold before negating, so [^a] leaves out 'A' too */
+    if (ps->ignore_case) {
+        set_fold(set);
+    }
+    if (negate) {
+        set_invert(set);
+    }
+
+    return LITE_OK;
+}
+
+static int parse_alternation(Parser *ps, int *node);
+
+/**
+ * Parse a single item of a pattern
+ */
+static int parse_atom(Parser *ps, int *node) {
+    uint8_t set[32] = {0};
+    char ch = *ps->p;
+
+    switch (ch) {
+        case '(':
+            ps->p++;
+            if (parse_alternation(ps, node) != LITE_OK) return LITE_ERROR;
+            if (*ps->p != ')') return fail(ps, "missing )");
+            ps->p++;
+            return LITE_OK;
+        case ')':
+        case '|':
+        case '*':
+        case '+':
+        case '?':
+            return fail(ps, "unexpected '%c' in pattern", ch);
+        case '[':
+            ps->p++;
+            if (parse_class(ps, set) != LITE_OK) return LITE_ERROR;
+            break;
+        case '.':
+            ps->p++;
+            set_invert(set);
+            break;
+        case '\\':
+            ps->p++;
+            if (parse_escape(ps, set) != LITE_OK) return LITE_ERROR;
+            break;
+        default:
+            ps->p++;
+            set_add(set, (unsigned char)ch);
+            break;
+    }
+
+    int index = add_set(ps, set);
+    if (index < 0) return LITE_ERROR;
+
+    *node = add_node(ps, NODE_SET, -1, -1, index);
+    return *node < 0 ? LITE_ERROR : LITE_OK;
+}
+
+/**
+ * Parse an item followed by any number of repetition operators
+ */
+static int parse_repeat(Parser *ps, int *node) {
+    if (parse_atom(ps, node) != LITE_OK) return LITE_ERROR;
+
+    for (;;) {
+        int type;
+        switch (*ps->p) {
+            case '*': type = NODE_STAR; break;
+            case '+': type = NODE_PLUS; break;
+            case '?': type = NODE_QUESTION; break;
+            default: return LITE_OK;
+        }
+
+        ps->p++;
+        *node = add_node(ps, type, *node, -1, -1);
+        if (*node < 0) return LITE_ERROR;
+    }
+}
+
+/**
+ * Parse a sequence of items
+ */
+static int parse_sequence(Parser *ps, int *node) {
+    *node = -1;
+
+    while (*ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+        int item;
+        if (parse_repeat(ps, &item) != LITE_OK) return LITE_ERROR;
+
+        *node = *node < 0 ? item : add_node(ps, NODE_CONCAT, *node, item, -1);
+        if (*node < 0) return LITE_ERROR;
+    }
+
+    if (*node < 0) {
+        *node = add_node(ps, NODE_EMPTY, -1, -1, -1);
+        if (*node < 0) return LITE_ERROR;
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Parse alternatives separated by '|'
+ */
+static int parse_alternation(Parser *ps, int *node) {
+    if (parse_sequence(ps, node) != LITE_OK) return LITE_ERROR;
+
+    while (*ps->p == '|') {
+        ps->p++;
+
+        int right;
+        if (parse_sequence(ps, &right) != LITE_OK) return LITE_ERROR;
+
+        *node = add_node(ps, NODE_ALTERNATE, *node, right, -1);
+        if (*node < 0) return LITE_ERROR;
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Add an NFA node
+ */
+static int emit_node(Builder *b, int type, int out, int out2, int set) {
+    if (b->count >= REGEX_MAX_NODES) return -1;
+
+    if (b->count == b->capacity) {
+        int capacity = b->capacity > 0 ? b->capacity * 2 : 64;
+        NfaNode *nodes = (NfaNode*)realloc(b->nodes, capacity * sizeof(NfaNode));
+        if (!nodes) return -1;
+
+        b->nodes = nodes;
+        b->capacity = capacity;
+    }
+
+    NfaNode *node = &b->nodes[b->count];
+    node->type = type;
+    node->out = out;
+    node->out2 = out2;
+    node->set = set;
+
+    return b->count++;
+}
+
+/**
+ * Generate the NFA of a syntax tree, reading concatenations backwards
+ * when reverse is set
+ */
+static int emit(Builder *b, const RegexNode *nodes, int index, bool reverse, Fragment *frag) {
+    const RegexNode *node = &nodes[index];
+    Fragment first;
+    Fragment second;
+
+    switch (node->type) {
+        case NODE_EMPTY:
+            frag->start = frag->end = emit_node(b, NFA_EPSILON, -1, -1, -1);
+            return frag->start < 0 ? LITE_ERROR : LITE_OK;
+
+        case NODE_SET:
+            frag->end = emit_node(b, NFA_EPSILON, -1, -1, -1);
+            if (frag->end < 0) return LITE_ERROR;
+            frag->start = emit_node(b, NFA_SET, frag->end, -1, node->set);
+            return frag->start < 0 ? LITE_ERROR : LITE_OK;
+
+        case NODE_CONCAT:
+            if (emit(b, nodes, reverse ? node->right : node->left, reverse, &first) != LITE_OK ||
+                emit(b, nodes, reverse ? node->left : node->right, reverse, &second) != LITE_OK) {
+                return LITE_ERROR;
+            }
+            b->nodes[first.end].out = second.start;
+            frag->start = first.start;
+            frag->end = second.end;
+            return LITE_OK;
+
+        case NODE_ALTERNATE:
+            if (emit(b, nodes, node->left, reverse, &first) != LITE_OK ||
+                emit(b, nodes, node->right, reverse, &second) != LITE_OK) {
+                return LITE_ERROR;
+            }
+            frag->end = emit_node(b, NFA_EPSILON, -1, -1, -1);
+            if (frag->end < 0) return LITE_ERROR;
+            frag->start = emit_node(b, NFA_EPSILON, first.start, second.start, -1);
+            if (frag->start < 0) return LITE_ERROR;
+            b->nodes[first.end].out = frag->end;
+            b->nodes[second.end].out = frag->end;
+            return LITE_OK;
+
+        default:
+            if (emit(b, nodes, node->left, reverse, &first) != LITE_OK) return LITE_ERROR;
+            frag->end = emit_node(b, NFA_EPSILON, -1, -1, -1);
+            if (frag->end < 0) return LITE_ERROR;
+
+            if (node->type == NODE_PLUS) {
+                b->nodes[first.end].out = first.start;
+                b->nodes[first.end].out2 = frag->end;
+                frag->start = first.start;
+                return LITE_OK;
+            }
+
+            frag->start = emit_node(b, NFA_EPSILON, first.start, frag->end, -1);
+            if (frag->start < 0) return LITE_ERROR;
+            b->nodes[first.end].out = node->type == NODE_STAR ? frag->start : frag->end;
+            return LITE_OK;
+    }
+}
+
+/**
+ * Split the bytes into classes no set tells apart
+ */
+static void build_classes(Regex *regex) {
+    memset(regex->classes, 0, sizeof(regex->classes));
+    regex->class_count = 1;
+
+    uint8_t newline[32] = {0};
+    set_add(newline, '\n');
+
+    for (int s = -1; s < regex->set_count; s++) {
+        const uint8_t *set = s < 0 ? newline : regex->sets[s];
+        int split[256][2];
+        int count = 0;
+
+        memset(split, -1, sizeof(split));
+        for (int b = 0; b < 256; b++) {
+            int *target = &split[regex->classes[b]][set_has(set, b)];
+            if (*target < 0) *target = count++;
+            regex->classes[b] = (uint8_t)*target;
+        }
+
+        regex->class_count = count;
+    }
+}
+
+/**
+ * Empty the state cache
+ */
+static void dfa_flush(Dfa *dfa) {
+    memset(dfa->next, -1, (size_t)dfa->state_count * dfa->stride * sizeof(int));
+    memset(dfa->table, -1, ((size_t)dfa->table_mask + 1) * sizeof(int));
+    dfa->state_count = 0;
+    dfa->pool_size = 0;
+    dfa->line_start = NO_STATE;
+    dfa->mid_line = NO_STATE;
+    dfa->skip_row = -1;
+    dfa->flushes++;
+}
+
+/**
+ * Add the epsilon closure of an NFA node to a set
+ */
+static void add_closure(Dfa *dfa, int node, int *set, int *count) {
+    int top = 0;
+    dfa->stack[top++] = node;
+
+    while (top > 0) {
+        int n = dfa->stack[--top];
+        if (n < 0 || dfa->marks[n] == dfa->generation) continue;
+        dfa->marks[n] = dfa->generation;
+
+        const NfaNode *nfa = &dfa->nodes[n];
+        if (nfa->type == NFA_EPSILON) {
+            dfa->stack[top++] = nfa->out;
+            dfa->stack[top++] = nfa->out2;
+        } else {
+            set[(*count)++] = n;
+        }
+    }
+}
+
+/**
+ * Start collecting a new set of NFA nodes
+ */
+static void begin_set(Dfa *dfa) {
+    if (++dfa->generation == 0) {
+        memset(dfa->marks, 0, dfa->node_count * sizeof(unsigned int));
+        dfa->generation = 1;
+    }
+}
+
+/**
+ * Compare two NFA node indices
+ */
+static int compare_ints(const void *a, const void *b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+/**
+ * Find or add the state for a set of NFA nodes
+ *
+ * Returns NO_STATE if the cache is full.
+ */
+static int intern_state(Dfa *dfa, int *set, int count) {
+    qsort(set, (size_t)count, sizeof(int), compare_ints);
+
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < count; i++) {
+        hash = (hash ^ (unsigned int)set[i]) * 16777619u;
+    }
+
+    int slot = (int)(hash & (unsigned int)dfa->table_mask);
+    while (dfa->table[slot] != NO_STATE) {
+        const DfaState *state = &dfa->states[dfa->table[slot]];
+        if (state->hash == hash && state->count == count &&
+            memcmp(dfa->pool + state->members, set, count * sizeof(int)) == 0) {
+            return dfa->table[slot];
+        }
+        slot = (slot + 1) & dfa->table_mask;
+    }
+
+    if (dfa->state_count == dfa->max_states || dfa->pool_size + count > dfa->max_pool) {
+        return NO_STATE;
+    }
+
+    if (dfa->pool_size + count > dfa->pool_capacity) {
+        int capacity = dfa->pool_capacity * 2;
+        while (capacity < dfa->pool_size + count) capacity *= 2;
+        if (capacity > dfa->max_pool) capacity = dfa->max_pool;
+
+        int *pool = (int*)realloc(dfa->pool, capacity * sizeof(int));
+        if (!pool) return NO_STATE;
+
+        dfa->pool = pool;
+        dfa->pool_capacity = capacity;
+    }
+
+    int index = dfa->state_count++;
+    DfaState *state = &dfa->states[index];
+    state->members = dfa->pool_size;
+    state->count = count;
+    state->hash = hash;
+    if (count > 0) {
+        memcpy(dfa->pool + dfa->pool_size, set, count * sizeof(int));
+    }
+    dfa->pool_size += count;
+
+    uint8_t *flags = &dfa->flags[index * dfa->stride];
+    *flags = count == 0 ? STATE_DEAD : 0;
+    for (int i = 0; i < count; i++) {
+        if (dfa->nodes[set[i]].type == NFA_ACCEPT) {
+            *flags |= STATE_ACCEPT;
+        }
+    }
+
+    dfa->table[slot] = index;
+    return index;
+}
+
+/**
+ * Intern a set, emptying the cache first if it is full
+ *
+ * The set must be in dfa->scratch, which a flush leaves alone.
+ */
+static int intern_or_flush(Dfa *dfa, int count) {
+    int state = intern_state(dfa, dfa->scratch, count);
+    if (state == NO_STATE) {
+        dfa_flush(dfa);
+        state = intern_state(dfa, dfa->scratch, count);
+    }
+
+    return state;
+}
+
+/**
+ * Get the state at the start of a line
+ */
+static int dfa_line_start(Dfa *dfa) {
+    if (dfa->line_start == NO_STATE) {
+        int count = 0;
+        begin_set(dfa);
+        add_closure(dfa, dfa->start, dfa->scratch, &count);
+        dfa->line_start = intern_or_flush(dfa, count);
+    }
+
+    return dfa->line_start;
+}
+
+/**
+ * Get the state for a search starting inside a line
+ */
+static int dfa_mid_line(Dfa *dfa) {
+    if (dfa->mid_line == NO_STATE) {
+        int count = 0;
+        begin_set(dfa);
+        if (!dfa->anchored_start) {
+            add_closure(dfa, dfa->start, dfa->scratch, &count);
+        }
+
+        dfa->mid_line = intern_or_flush(dfa, count);
+    }
+
+    return dfa->mid_line;
+}
+
+/**
+ * Build the transition of a state on a byte
+ */
+static int dfa_step(Dfa *dfa, int state, unsigned char byte) {
+    unsigned long flushes = dfa->flushes;
+    int target;
+
+    if (byte == '\n') {
+        target = dfa_line_start(dfa);
+    } else {
+        const DfaState *from = &dfa->states[state];
+        const int *members = dfa->pool + from->members;
+        int count = 0;
+
+        begin_set(dfa);
+        for (int i = 0; i < from->count; i++) {
+            const NfaNode *node = &dfa->nodes[members[i]];
+            if (node->type == NFA_SET && set_has(dfa->regex->sets[node->set], byte)) {
+                add_closure(dfa, node->out, dfa->scratch, &count);
+            }
+        }
+
+        /* Unanchored patterns may start a new match at every byte */
+        if (!dfa->anchored_start) {
+            add_closure(dfa, dfa->start, dfa->scratch, &count);
+        }
+
+        target = intern_or_flush(dfa, count);
+    }
+
+    /* After a flush the source state no longer exists */
+    if (dfa->flushes == flushes) {
+        dfa->next[state * dfa->stride + dfa->regex->classes[byte]] = target * dfa->stride;
+    }
+
+    return target;
+}
+
+/**
+ * Check whether a single byte is all that leaves the line start state
+ *
+ * Unanchored patterns spend most of a scan in that state, waiting for the
+ * first byte of a match, and can jump straight to it with memchr.
+ */
+static void dfa_find_skip(Dfa *dfa) {
+    int state = dfa_line_start(dfa);
+    unsigned long flushes = dfa->flushes;
+    int skip = -1;
+
+    dfa->skip_row = -1;
+
+    for (int b = 0; b < 256; b++) {
+        int target = dfa->next[state * dfa->stride + dfa->regex->classes[b]];
+        if (target < 0) {
+            target = dfa_step(dfa, state, (unsigned char)b) * dfa->stride;
+            if (dfa->flushes != flushes) return;
+        }
+
+        if (target != state * dfa->stride) {
+            if (skip >= 0) return;
+            skip = b;
+        }
+    }
+
+    if (skip >= 0) {
+        dfa->skip_row = state * dfa->stride;
+        dfa->skip_byte = skip;
+    }
+}
+
+/**
+ * Generate the NFA of one direction and set up its DFA cache
+ */
+static int dfa_init(Dfa *dfa, Regex *regex, const RegexNode *nodes, int root, bool reverse,
+                    bool anchored_start, bool anchored_end) {
+    Builder builder = {0};
+    Fragment frag;
+
+    memset(dfa, 0, sizeof(Dfa));
+    dfa->regex = regex;
+    dfa->anchored_start = anchored_start;
+    dfa->anchored_end = anchored_end;
+
+    if (emit(&builder, nodes, root, reverse, &frag) != LITE_OK) {
+        free(builder.nodes);
+        return LITE_ERROR;
+    }
+
+    int accept = emit_node(&builder, NFA_ACCEPT, -1, -1, -1);
+    if (accept < 0) {
+        free(builder.nodes);
+        return LITE_ERROR;
+    }
+    builder.nodes[frag.end].out = accept;
+
+    dfa->nodes = builder.nodes;
+    dfa->node_count = builder.count;
+    dfa->start = frag.start;
+    dfa->stride = regex->class_count;
+
+    /* Half the budget for transitions, half for the state sets */
+    size_t row = (size_t)dfa->stride * (sizeof(int) + 1) + sizeof(DfaState);
+    dfa->max_states = (int)(REGEX_CACHE_BYTES / 2 / row);
+    if (dfa->max_states < 16) dfa->max_states = 16;
+    dfa->max_pool = REGEX_CACHE_BYTES / 2 / (int)sizeof(int);
+    if (dfa->max_pool < dfa->node_count * 2) dfa->max_pool = dfa->node_count * 2;
+    dfa->pool_capacity = dfa->node_count * 2 < dfa->max_pool ? dfa->node_count * 2 : dfa->max_pool;
+
+    int table_size = 1;
+    while (table_size < dfa->max_states * 2) table_size *= 2;
+    dfa->table_mask = table_size - 1;
+
+    dfa->states = (DfaState*)malloc(dfa->max_states * sizeof(DfaState));
+    dfa->flags = (uint8_t*)malloc((size_t)dfa->max_states * dfa->stride);
+    dfa->next = (int*)malloc((size_t)dfa->max_states * dfa->stride * sizeof(int));
+    dfa->pool = (int*)malloc(dfa->pool_capacity * sizeof(int));
+    dfa->table = (int*)malloc(table_size * sizeof(int));
+    dfa->scratch = (int*)malloc(dfa->node_count * sizeof(int));
+    dfa->stack = (int*)malloc((dfa->node_count * 2 + 1) * sizeof(int));
+    dfa->marks = (unsigned int*)calloc(dfa->node_count, sizeof(unsigned int));
+
+    if (!dfa->states || !dfa->flags || !dfa->next || !dfa->pool || !dfa->table ||
+        !dfa->scratch || !dfa->stack || !dfa->marks) {
+        return LITE_ERROR;
+    }
+
+    memset(dfa->next, -1, (size_t)dfa->max_states * dfa->stride * sizeof(int));
+    memset(dfa->table, -1, table_size * sizeof(int));
+    dfa->line_start = NO_STATE;
+    dfa->mid_line = NO_STATE;
+    dfa->skip_row = -1;
+
+    return LITE_OK;
+}
+
+/**
+ * Free the tables of a DFA
+ */
+static void dfa_free(Dfa *dfa) {
+    free(dfa->nodes);
+    free(dfa->states);
+    free(dfa->flags);
+    free(dfa->next);
+    free(dfa->pool);
+    free(dfa->table);
+    free(dfa->scratch);
+    free(dfa->stack);
+    free(dfa->marks);
+}
+
+/**
+ * Compile a pattern
+ *
+ * Returns NULL and describes the problem in error if the pattern is
+ * invalid.
+ */
+Regex* regex_compile(const char *pattern, size_t length, bool ignore_case,
+                     char *error, size_t error_size) {
+    if (error && error_size > 0) error[0] = '\0';
+    if (!pattern || length == 0) {
+        if (error) snprintf(error, error_size, "empty pattern");
+        return NULL;
+    }
+
+    Regex *regex = (Regex*)calloc(1, sizeof(Regex));
+    char *text = (char*)malloc(length + 1);
+    if (!regex || !text) {
+        free(regex);
+        free(text);
+        if (error) snprintf(error, error_size, "out of memory");
+        return NULL;
+    }
+
+    memcpy(text, pattern, length);
+    text[length] = '\0';
+
+    /* Anchors are only special at the very ends of the pattern */
+    bool anchored_start = text[0] == '^';
+    bool anchored_end = false;
+    size_t backslashes = 0;
+    while (backslashes + 1 < length && text[length - 2 - backslashes] == '\\') backslashes++;
+    if (length > (anchored_start ? 1u : 0u) && text[length - 1] == '$' && backslashes % 2 == 0) {
+        anchored_end = true;
+        text[length - 1] = '\0';
+    }
+
+    Parser ps = {0};
+    ps.regex = regex;
+    ps.p = text + (anchored_start ? 1 : 0);
+    ps.ignore_case = ignore_case;
+    ps.error = error;
+    ps.error_size = error_size;
+
+    int root;
+    int result = parse_alternation(&ps, &root);
+    if (result == LITE_OK && *ps.p != '\0') {
+        result = fail(&ps, "unmatched )");
+    }
+
+    if (result == LITE_OK) {
+        build_classes(regex);
+
+        if (dfa_init(&regex->forward, regex, ps.nodes, root, false, anchored_start, anchored_end) != LITE_OK ||
+            dfa_init(&regex->reverse, regex, ps.nodes, root, true, anchored_end, anchored_start) != LITE_OK) {
+            result = fail(&ps, "pattern too large");
+        }
+    }
+
+    free(ps.nodes);
+    free(text);
+
+    if (result != LITE_OK) {
+        regex_free(regex);
+        return NULL;
+    }
+
+    return regex;
+}
+
+/**
+ * Free a compiled pattern
+ */
+void regex_free(Regex *regex) {
+    if (!regex) return;
+
+    dfa_free(&regex->forward);
+    dfa_free(&regex->reverse);
+    free(regex->sets);
+    free(regex);
+}
+
+/**
+ * Check whether an offset is at the start of a line
+ */
+static bool at_line_start(const PieceTable *table, size_t offset) {
+    char ch = '\0';
+    return offset == 0 || (piece_table_copy(table, offset - 1, &ch, 1) == 1 && ch == '\n');
+}
+
+/**
+ * Find where the earliest match starting at or after an offset ends
+ *
+ * The scan ends at stop, which must be the end of a line or the text.
+ */
+static size_t scan_forward(Regex *regex, const PieceTable *table, size_t offset, size_t stop) {
+    Dfa *dfa = &regex->forward;
+    size_t chunk_length;
+    const char *chunk;
+
+    dfa_find_skip(dfa);
+
+    /* Rows are state indices times the stride, saving a multiply per byte */
+    int stride = dfa->stride;
+    int row = (at_line_start(table, offset) ? dfa_line_start(dfa) : dfa_mid_line(dfa)) * stride;
+    int skip_row = dfa->skip_row;
+
+    /* The tables never move, keep them out of memory the compiler must reload */
+    const int *next = dfa->next;
+    const uint8_t *flag_table = dfa->flags;
+    const uint8_t *classes = regex->classes;
+
+    while (offset < stop && (chunk = piece_table_chunk(table, offset, &chunk_length)) != NULL) {
+        if (chunk_length > stop - offset) {
+            chunk_length = stop - offset;
+        }
+
+        const unsigned char *p = (const unsigned char*)chunk;
+        const unsigned char *end = p + chunk_length;
+
+        while (p < end) {
+            uint8_t flags = flag_table[row];
+            if (flags) {
+                if ((flags & STATE_ACCEPT) && (!dfa->anchored_end || *p == '\n')) {
+                    return offset + (size_t)(p - (const unsigned char*)chunk);
+                }
+
+                /* Nothing can match before the next line */
+                if (flags & STATE_DEAD) {
+                    p = (const unsigned char*)memchr(p, '\n', (size_t)(end - p));
+                    if (!p) break;
+                }
+            } else if (row == skip_row) {
+                p = (const unsigned char*)memchr(p, dfa->skip_byte, (size_t)(end - p));
+                if (!p) break;
+            }
+
+            int target = next[row + classes[*p]];
+            if (target < 0) {
+                target = dfa_step(dfa, row / stride, *p) * stride;
+                skip_row = dfa->skip_row;
+            }
+            row = target;
+            p++;
+        }
+
+        offset += chunk_length;
+    }
+
+    return (flag_table[row] & STATE_ACCEPT) ? offset : PIECE_NPOS;
+}
+
+/**
+ * Scan backwards from a line end down to low for match starts below limit
+ *
+ * With first set the first start found, the rightmost one, is returned.
+ * Otherwise the scan goes on to low and returns the leftmost start.
+ */
+static size_t scan_reverse(Regex *regex, const PieceTable *table, size_t from, size_t low,
+                           size_t limit, bool first) {
+    Dfa *dfa = &regex->reverse;
+    size_t best = PIECE_NPOS;
+    size_t offset = from;
+
+    dfa_find_skip(dfa);
+
+    int stride = dfa->stride;
+    int row = dfa_line_start(dfa) * stride;
+    int skip_row = dfa->skip_row;
+
+    const int *next = dfa->next;
+    const uint8_t *flag_table = dfa->flags;
+    const uint8_t *classes = regex->classes;
+
+    while (offset > low) {
+        size_t chunk_length;
+        const char *chunk = piece_table_chunk_before(table, offset, &chunk_length);
+        if (!chunk) break;
+
+        if (chunk_length > offset - low) {
+            chunk += chunk_length - (offset - low);
+            chunk_length = offset - low;
+        }
+
+        const unsigned char *start = (const unsigned char*)chunk;
+        const unsigned char *p = start + chunk_length;
+
+        while (p > start) {
+            uint8_t flags = flag_table[row];
+            if (flags) {
+                size_t position = offset - (size_t)(start + chunk_length - p);
+                if ((flags & STATE_ACCEPT) && position < limit && (!dfa->anchored_end || p[-1] == '\n')) {
+                    best = position;
+                    if (first) return best;
+                }
+
+                if (flags & STATE_DEAD) {
+                    while (p > start && p[-1] != '\n') p--;
+                    if (p == start) break;
+                }
+            } else if (row == skip_row) {
+                unsigned char skip = (unsigned char)dfa->skip_byte;
+                while (p > start && p[-1] != skip) p--;
+                if (p == start) break;
+            }
+
+            p--;
+            int target = next[row + classes[*p]];
+            if (target < 0) {
+                target = dfa_step(dfa, row / stride, *p) * stride;
+                skip_row = dfa->skip_row;
+            }
+            row = target;
+        }
+
+        offset -= chunk_length;
+    }
+
+    if (offset == low && (flag_table[row] & STATE_ACCEPT) && low < limit &&
+        (!dfa->anchored_end || at_line_start(table, low))) {
+        best = low;
+    }
+
+    return best;
+}
+
+/**
+ * Find the leftmost match starting at or after an offset
+ */
+size_t regex_search_forward(Regex *regex, const PieceTable *table, size_t offset) {
+    if (!table) return PIECE_NPOS;
+
+    /* An empty match may start at the very end */
+    return regex_search_range(regex, table, offset, piece_table_length(table) + 1);
+}
+
+/**
+ * Find the leftmost match starting in the range [from, to)
+ *
+ * The forward scan stops at the end of the earliest match, and only the
+ * line holding it is scanned backwards for its leftmost start. No match
+ * spans lines, so the scan need not go past the line holding to.
+ */
+size_t regex_search_range(Regex *regex, const PieceTable *table, size_t from, size_t to) {
+    if (!regex || !table) return PIECE_NPOS;
+
+    size_t length = piece_table_length(table);
+    if (from > length || from >= to) return PIECE_NPOS;
+
+    size_t stop = to < length ? piece_table_find(table, to, '\n') : length;
+    if (stop == PIECE_NPOS) stop = length;
+
+    size_t end = scan_forward(regex, table, from, stop);
+    if (end == PIECE_NPOS) return PIECE_NPOS;
+
+    size_t line_end = piece_table_find(table, end, '\n');
+    if (line_end == PIECE_NPOS) line_end = length;
+
+    size_t line_start = piece_table_find_reverse(table, end, '\n');
+    line_start = line_start == PIECE_NPOS ? 0 : line_start + 1;
+
+    size_t start = scan_reverse(regex, table, line_end, line_start > from ? line_start : from,
+                                line_end + 1, false);
+    return start < to ? start : PIECE_NPOS;
+}
+
+/**
+ * Find the last match starting before an offset
+ */
+size_t regex_search_backward(Regex *regex, const PieceTable *table, size_t offset) {
+    if (!regex || !table || offset == 0) return PIECE_NPOS;
+
+    size_t length = piece_table_length(table);
+    if (offset > length) offset = length;
+
+    /* A match starting before the offset may run on to the end of its line */
+    size_t line_end = piece_table_find(table, offset, '\n');
+    if (line_end == PIECE_NPOS) line_end = length;
+
+    return scan_reverse(regex, table, line_end, 0, offset, true);
+}
@@ -0,0 +1,360 @@
+/**
+ * search.c - Buffer text search for LITE editor
+ *
+ * Candidates are found by comparing the first and the last byte of the
+ * pattern against a whole vector of positions at once, and only positions
+ * where both match are compared in full. The kernel is chosen once at run
+ * time: AVX2 when the CPU has it, SSE2 on other x86 machines and a memchr
+ * based loop everywhere else.
+ *
+ * Case is ignored for ASCII letters only. Their lower case forms differ
+ * from the upper case ones in bit 0x20, so setting that bit in the text
+ * folds both to the pattern byte.
+ */
+
+#include "lite.h"
+#include "core/search.h"
+#include "core/piece.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define SEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+/* Substring kernel, returns the first match in a block of text */
+typedef const char* (*SearchKernel)(const SearchPattern *pattern, const char *text, size_t length);
+
+/* Kernel selected for this CPU */
+static SearchKernel kernel = NULL;
+static const char *kernel_name = "none";
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Fold an ASCII letter to lower case
+ */
+static uint8_t fold(uint8_t ch) {
+    return ch >= 'A' && ch <= 'Z' ? (uint8_t)(ch | 0x20) : ch;
+}
+
+/**
+ * Compare the inner bytes of a candidate, the filter checked the ends
+ */
+static bool verify(const SearchPattern *pattern, const char *text) {
+    if (pattern->length <= 2) return true;
+
+    if (!pattern->ignore_case) {
+        return memcmp(text + 1, pattern->text + 1, pattern->length - 2) == 0;
+    }
+
+    for (size_t i = 1; i < pattern->length - 1; i++) {
+        if (fold((uint8_t)text[i]) != (uint8_t)pattern->text[i]) return false;
+    }
+
+    return true;
+}
+
+/**
+ * Portable kernel
+ */
+static const char* search_scalar(const SearchPattern *pattern, const char *text, size_t length) {
+    if (length < pattern->length) return NULL;
+
+    size_t last = pattern->length - 1;
+    const char *end = text + length - last;
+
+    if (pattern->first_fold == 0) {
+        const char *p = text;
+        while (p < end && (p = (const char*)memchr(p, pattern->first, end - p)) != NULL) {
+            if (((uint8_t)p[last] | pattern->last_fold) == pattern->last && verify(pattern, p)) {
+                return p;
+            }
+            p++;
+        }
+        return NULL;
+    }
+
+    for (const char *p = text; p < end; p++) {
+        if (((uint8_t)p[0] | pattern->first_fold) == pattern->first &&
+            ((uint8_t)p[last] | pattern->last_fold) == pattern->last && verify(pattern, p)) {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+#ifdef SEARCH_X86
+/**
+ * Verify the candidates of a filter mask, bit n standing for text + n
+ */
+static const char* verify_mask(const SearchPattern *pattern, const char *text, uint64_t mask) {
+    while (mask) {
+        const char *candidate = text + __builtin_ctzll(mask);
+        if (verify(pattern, candidate)) return candidate;
+        mask &= mask - 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * SSE2 kernel, 16 candidates per step
+ */
+static const char* search_sse2(const SearchPattern *pattern, const char *text, size_t length) {
+    if (length < pattern->length) return NULL;
+
+    size_t last = pattern->length - 1;
+    size_t count = length - last;
+    const __m128i first = _mm_set1_epi8((char)pattern->first);
+    const __m128i final = _mm_set1_epi8((char)pattern->last);
+    const __m128i first_fold = _mm_set1_epi8((char)pattern->first_fold);
+    const __m128i last_fold = _mm_set1_epi8((char)pattern->last_fold);
+    size_t i = 0;
+
+    while (i + 16 <= count) {
+        unsigned int mask = 0;
+
+        /* The filter loop makes no calls, so the vectors stay in registers */
+        for (; i + 16 <= count; i += 16) {
+            __m128i head = _mm_or_si128(_mm_loadu_si128((const __m128i*)(text + i)), first_fold);
+            __m128i tail = _mm_or_si128(_mm_loadu_si128((const __m128i*)(text + i + last)), last_fold);
+            mask = (unsigned int)_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, final)));
+            if (mask) break;
+        }
+        if (!mask) break;
+
+        const char *found = verify_mask(pattern, text + i, mask);
+        if (found) return found;
+        i += 16;
+    }
+
+    return search_scalar(pattern, text + i, length - i);
+}
+
+/**
+ * AVX2 kernel, 64 candidates per step
+ */
+__attribute__((target("avx2")))
+static const char* search_avx2(const SearchPattern *pattern, const char *text, size_t length) {
+    if (length < pattern->length) return NULL;
+
+    size_t last = pattern->length - 1;
+    size_t count = length - last;
+    const __m256i first = _mm256_set1_epi8((char)pattern->first);
+    const __m256i final = _mm256_set1_epi8((char)pattern->last);
+    const __m256i first_fold = _mm256_set1_epi8((char)pattern->first_fold);
+    const __m256i last_fold = _mm256_set1_epi8((char)pattern->last_fold);
+    size_t i = 0;
+
+    while (i + 64 <= count) {
+        uint64_t mask = 0;
+
+        /* Two vectors per step, so each step waits on fewer loads */
+        for (; i + 64 <= count; i += 64) {
+            __m256i head = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(text + i)), first_fold);
+            __m256i tail = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(text + i + last)), last_fold);
+            __m256i head2 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(text + i + 32)), first_fold);
+            __m256i tail2 = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(text + i + 32 + last)), last_fold);
+            __m256i match = _mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, final));
+            __m256i match2 = _mm256_and_si256(_mm256_cmpeq_epi8(head2, first), _mm256_cmpeq_epi8(tail2, final));
+            if (!_mm256_testz_si256(_mm256_or_si256(match, match2), _mm256_or_si256(match, match2))) {
+                mask = (uint32_t)_mm256_movemask_epi8(match) |
+                       (uint64_t)(uint32_t)_mm256_movemask_epi8(match2) << 32;
+                break;
+            }
+        }
+        if (!mask) break;
+
+        const char *found = verify_mask(pattern, text + i, mask);
+        if (found) return found;
+        i += 64;
+    }
+
+    return search_sse2(pattern, text + i, length - i);
+}
+#endif
+
+/**
+ * Pick the widest kernel the CPU supports
+ */
+static void select_kernel(void) {
+    kernel = search_scalar;
+    kernel_name = "scalar";
+
+#ifdef SEARCH_X86
+    kernel = search_sse2;
+    kernel_name = "sse2";
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = search_avx2;
+        kernel_name = "avx2";
+    }
+#endif
+}
+
+/**
+ * Compile a literal pattern
+ */
+int search_compile(SearchPattern *pattern, const char *text, size_t length, bool ignore_case) {
+    if (!pattern || !text || length == 0 || length > SEARCH_MAX_PATTERN) return LITE_ERROR;
+
+    for (size_t i = 0; i < length; i++) {
+        pattern->text[i] = ignore_case ? (char)fold((uint8_t)text[i]) : text[i];
+    }
+
+    pattern->length = length;
+    pattern->ignore_case = ignore_case;
+    pattern->first = (uint8_t)pattern->text[0];
+    pattern->last = (uint8_t)pattern->text[length - 1];
+    pattern->first_fold = ignore_case && pattern->first >= 'a' && pattern->first <= 'z' ? 0x20 : 0;
+    pattern->last_fold = ignore_case && pattern->last >= 'a' && pattern->last <= 'z' ? 0x20 : 0;
+    pattern->regex = NULL;
+
+    return LITE_OK;
+}
+
+/**
+ * Compile a regular expression pattern
+ *
+ * The text is kept as typed, for showing the pattern to the user.
+ */
+int search_compile_regex(SearchPattern *pattern, const char *text, size_t length, bool ignore_case,
+                         char *error, size_t error_size) {
+    if (!pattern || !text || length > SEARCH_MAX_PATTERN) return LITE_ERROR;
+
+    Regex *regex = regex_compile(text, length, ignore_case, error, error_size);
+    if (!regex) return LITE_ERROR;
+
+    memcpy(pattern->text, text, length);
+    pattern->length = length;
+    pattern->ignore_case = ignore_case;
+    pattern->first = pattern->last = 0;
+    pattern->first_fold = pattern->last_fold = 0;
+    pattern->regex = regex;
+
+    return LITE_OK;
+}
+
+/**
+ * Free the compiled regex of a pattern
+ */
+void search_free(SearchPattern *pattern) {
+    if (!pattern) return;
+
+    regex_free(pattern->regex);
+    pattern->regex = NULL;
+    pattern->length = 0;
+}
+
+/**
+ * Find the first match in a block of text
+ */
+const char* search_block(const SearchPattern *pattern, const char *text, size_t length) {
+    pthread_once(&kernel_once, select_kernel);
+
+    return kernel(pattern, text, length);
+}
+
+/**
+ * Find the first match starting in the range [from, to)
+ *
+ * Each chunk of the piece table is searched where it lies. Matches that
+ * start near the end of a chunk and run into the next are found in a
+ * small copy of the text around the seam.
+ */
+size_t search_range(const PieceTable *table, size_t from, size_t to, const SearchPattern *pattern) {
+    if (!table || !pattern || pattern->length == 0) return PIECE_NPOS;
+
+    if (pattern->regex) {
+        return regex_search_range(pattern->regex, table, from, to);
+    }
+
+    size_t overlap = pattern->length - 1;
+    size_t offset = from;
+    size_t chunk_length;
+    const char *chunk;
+
+    while (offset < to && (chunk = piece_table_chunk(table, offset, &chunk_length)) != NULL) {
+        size_t starts = to - offset < chunk_length ? to - offset : chunk_length;
+        size_t scan = starts + overlap < chunk_length ? starts + overlap : chunk_length;
+
+        const char *found = search_block(pattern, chunk, scan);
+        if (found) return offset + (size_t)(found - chunk);
+
+        /* Starts this close to the end were not covered by the chunk */
+        size_t seam = chunk_length > overlap ? chunk_length - overlap : 0;
+        if (scan == chunk_length && seam < starts) {
+            char text[2 * SEARCH_MAX_PATTERN];
+            size_t seam_starts = starts - seam;
+            size_t copied = piece_table_copy(table, offset + seam, text, seam_starts + overlap);
+
+            found = search_block(pattern, text, copied);
+            if (found && (size_t)(found - text) < seam_starts) {
+                return offset + seam + (size_t)(found - text);
+            }
+        }
+
+        offset += chunk_length;
+    }
+
+    return PIECE_NPOS;
+}
+
+/**
+ * Find the first match at or after an offset
+ */
+size_t search_forward(const PieceTable *table, size_t offset, const SearchPattern *pattern) {
+    if (!table || !pattern || pattern->length == 0) return PIECE_NPOS;
+
+    if (pattern->regex) {
+        return regex_search_forward(pattern->regex, table, offset);
+    }
+
+    return search_range(table, offset, piece_table_length(table), pattern);
+}
+
+/**
+ * Find the last match starting before an offset
+ *
+ * Chunks are searched from the offset backwards, each one forwards.
+ */
+size_t search_backward(const PieceTable *table, size_t offset, const SearchPattern *pattern) {
+    if (!table || !pattern || pattern->length == 0) return PIECE_NPOS;
+
+    if (pattern->regex) {
+        return regex_search_backward(pattern->regex, table, offset);
+    }
+
+    size_t end = offset;
+    size_t chunk_length;
+
+    while (piece_table_chunk_before(table, end, &chunk_length) != NULL) {
+        size_t start = end - chunk_length;
+        size_t found = PIECE_NPOS;
+        size_t match = search_range(table, start, end, pattern);
+
+        while (match != PIECE_NPOS) {
+            found = match;
+            match = search_range(table, match + 1, end, pattern);
+        }
+
+        if (found != PIECE_NPOS) return found;
+        end = start;
+    }
+
+    return PIECE_NPOS;
+}
+
+/**
+ * Get the name of the selected kernel
+ */
+const char* search_kernel_name(void) {
+    pthread_once(&kernel_once, select_kernel);
+
+    return kernel_name;
+}
@@ -0,0 +1,346 @@
+/**
+ * undo.c - Undo and redo journal for LITE editor
+ *
+ * Records and their text are kept in two arrays that only grow at the
+ * end, apart from the redo tail that a new edit cuts off. A record costs
+ * a few words plus the bytes it changed, so typing a line adds one record
+ * that grows a byte per keystroke rather than a copy of the line each
+ * time. When the journal goes over its limit, the oldest records are
+ * dropped in a batch and the rest moved down.
+ */
+
+#include "lite.h"
+#include "core/undo.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Memory a journal may use before its oldest records are dropped */
+static size_t undo_limit = (size_t)LITE_UNDO_MEMORY << 20;
+
+/**
+ * Initialize an empty journal
+ */
+void undo_init(UndoJournal *journal) {
+    if (!journal) return;
+
+    memset(journal, 0, sizeof(UndoJournal));
+    journal->sealed = true;
+}
+
+/**
+ * Free the memory of a journal
+ */
+void undo_free(UndoJournal *journal) {
+    if (!journal) return;
+
+    free(journal->records);
+    free(journal->log);
+    undo_init(journal);
+}
+
+/**
+ * Forget all edits, the current text becomes the saved text
+ */
+void undo_clear(UndoJournal *journal) {
+    undo_free(journal);
+}
+
+/**
+ * Set the memory limit of every journal
+ */
+void undo_set_limit(size_t bytes) {
+    undo_limit = bytes;
+}
+
+/**
+ * Get the memory a journal uses
+ */
+size_t undo_memory(const UndoJournal *journal) {
+    if (!journal) return 0;
+    return journal->capacity * sizeof(UndoRecord) + journal->log_capacity;
+}
+
+/**
+ * Drop the oldest records until the journal uses at most three quarters
+ * of the limit
+ *
+ * The newest record is always kept, so that the last edit can be undone
+ * however large it was.
+ */
+static void drop_oldest(UndoJournal *journal) {
+    size_t target = undo_limit / 4 * 3;
+    size_t drop = 0;
+    size_t text = 0;
+    size_t used = journal->count * sizeof(UndoRecord) + journal->log_length;
+
+    while (drop + 1 < journal->count && used > target) {
+        used -= sizeof(UndoRecord) + journal->records[drop].length;
+        text += journal->records[drop].length;
+        drop++;
+    }
+
+    if (drop == 0) return;
+
+    memmove(journal->log, journal->log + text, journal->log_length - text);
+    journal->log_length -= text;
+
+    memmove(journal->records, journal->records + drop, (journal->count - drop) * sizeof(UndoRecord));
+    journal->count -= drop;
+    journal->current -= drop;
+    journal->dropped += drop;
+
+    for (size_t i = 0; i < journal->count; i++) {
+        journal->records[i].text -= text;
+    }
+
+    /* What is left of a partly dropped step is undone on its own */
+    journal->records[0].joined = false;
+
+    if (journal->saved != UNDO_UNSAVED && journal->saved < journal->dropped) {
+        journal->saved = UNDO_UNSAVED;
+    }
+
+    /* Give back the memory once the journal has shrunk well below it */
+    if (journal->log_capacity > journal->log_length * 2 && journal->log_capacity > 4096) {
+        size_t capacity = journal->log_length > 4096 ? journal->log_length : 4096;
+        char *log = (char*)realloc(journal->log, capacity);
+        if (log) {
+            journal->log = log;
+            journal->log_capacity = capacity;
+        }
+    }
+}
+
+/**
+ * Make room for more text at the end of the log
+ */
+static bool reserve_log(UndoJournal *journal, size_t length) {
+    if (journal->log_length + length <= journal->log_capacity) return true;
+
+    size_t capacity = journal->log_capacity > 0 ? journal->log_capacity * 2 : 4096;
+    while (capacity < journal->log_length + length) {
+        capacity *= 2;
+    }
+
+    char *log = (char*)realloc(journal->log, capacity);
+    if (!log) return false;
+
+    journal->log = log;
+    journal->log_capacity = capacity;
+    return true;
+}
+
+/**
+ * Append text to the log, reversed for deletions
+ */
+static void append_text(UndoJournal *journal, UndoKind kind, const char *text, size_t length) {
+    char *out = journal->log + journal->log_length;
+
+    if (kind == UNDO_DELETE) {
+        for (size_t i = 0; i < length; i++) {
+            out[i] = text[length - 1 - i];
+        }
+    } else {
+        memcpy(out, text, length);
+    }
+
+    journal->log_length += length;
+}
+
+/**
+ * Record an edit that was just made
+ *
+ * text is the inserted text, or the deleted text as it was before the
+ * deletion. Edits that were undone can no longer be redone afterwards.
+ */
+int undo_record(UndoJournal *journal, UndoKind kind, size_t offset, const char *text, size_t length) {
+    if (!journal || (!text && length > 0)) return LITE_ERROR;
+    if (length == 0) return LITE_OK;
+
+    /* A new edit replaces the undone ones */
+    if (journal->current < journal->count) {
+        journal->count = journal->current;
+        journal->log_length = journal->count > 0 ? journal->records[journal->count - 1].text +
+                                                   journal->records[journal->count - 1].length : 0;
+        if (journal->saved != UNDO_UNSAVED && journal->saved > journal->dropped + journal->count) {
+            journal->saved = UNDO_UNSAVED;
+        }
+        if (journal->changed > journal->dropped + journal->count) {
+            journal->changed = journal->dropped + journal->count;
+        }
+        journal->sealed = true;
+    }
+
+    if (!reserve_log(journal, length)) return LITE_ERROR;
+
+    /* Typing grows the last record at its end and backspacing at its start */
+    UndoRecord *last = journal->count > 0 ? &journal->records[journal->count - 1] : NULL;
+    if (!journal->sealed && last && last->kind == kind &&
+        ((kind == UNDO_INSERT && offset == last->offset + last->length) ||
+         (kind == UNDO_DELETE && offset + length == last->offset))) {
+        append_text(journal, kind, text, length);
+        last->length += length;
+        if (kind == UNDO_DELETE) {
+            last->offset = offset;
+        }
+
+        /* The saved text had the record at its old size */
+        if (journal->saved == journal->dropped + journal->count) {
+            journal->saved = UNDO_UNSAVED;
+        }
+        if (journal->changed > journal->dropped + journal->count - 1) {
+            journal->changed = journal->dropped + journal->count - 1;
+        }
+    } else {
+        if (journal->count == journal->capacity) {
+            size_t capacity = journal->capacity > 0 ? journal->capacity * 2 : 64;
+            UndoRecord *records = (UndoRecord*)realloc(journal->records, capacity * sizeof(UndoRecord));
+            if (!records) return LITE_ERROR;
+
+            journal->records = records;
+            journal->capacity = capacity;
+        }
+
+        UndoRecord *record = &journal->records[journal->count];
+        record->offset = offset;
+        record->length = length;
+        record->text = journal->log_length;
+        record->kind = (unsigned char)kind;
+        record->joined = !journal->sealed && journal->count > 0;
+        append_text(journal, kind, text, length);
+
+        journal->count++;
+        journal->current = journal->count;
+        journal->sealed = false;
+    }
+
+    if (journal->count * sizeof(UndoRecord) + journal->log_length > undo_limit) {
+        drop_oldest(journal);
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * End the current undo step, the next edit starts a new one
+ */
+void undo_seal(UndoJournal *journal) {
+    if (!journal) return;
+    journal->sealed = true;
+}
+
+/**
+ * Take the last applied record for undoing
+ *
+ * Returns NULL if there is nothing left to undo. The caller reverts the
+ * record and keeps going while it is joined to the one before.
+ */
+const UndoRecord* undo_back(UndoJournal *journal) {
+    if (!journal || journal->current == 0) return NULL;
+
+    journal->sealed = true;
+    journal->current--;
+    return &journal->records[journal->current];
+}
+
+/**
+ * Take the next undone record for redoing
+ *
+ * Returns NULL if there is nothing left to redo. The caller applies the
+ * record and keeps going while the next one is joined to it.
+ */
+const UndoRecord* undo_forward(UndoJournal *journal) {
+    if (!journal || journal->current == journal->count) return NULL;
+
+    journal->sealed = true;
+    journal->current++;
+    return &journal->records[journal->current - 1];
+}
+
+/**
+ * Get the text of a record as stored, reversed for deletions
+ */
+const char* undo_text(const UndoJournal *journal, const UndoRecord *record) {
+    if (!journal || !record) return NULL;
+    return journal->log + record->text;
+}
+
+/**
+ * Remember that the text was saved as it is now
+ */
+void undo_mark_saved(UndoJournal *journal) {
+    if (!journal) return;
+
+    journal->saved = journal->dropped + journal->current;
+    journal->sealed = true;
+}
+
+/**
+ * Forget where the saved text is, when no position of the journal holds it
+ */
+void undo_forget_saved(UndoJournal *journal) {
+    if (!journal) return;
+    journal->saved = UNDO_UNSAVED;
+}
+
+/**
+ * Check whether the text is back to what was last saved
+ */
+bool undo_is_saved(const UndoJournal *journal) {
+    if (!journal) return false;
+    return journal->saved == journal->dropped + journal->current;
+}
+
+/**
+ * Remember that every record was written out as it is now
+ */
+void undo_mark_written(UndoJournal *journal) {
+    if (!journal) return;
+    journal->changed = journal->dropped + journal->count;
+}
+
+/**
+ * Replace the contents of a journal with records read back from disk
+ *
+ * The log holds the text of the records one after another, as stored.
+ * dropped, current and saved count records the same way as the journal
+ * fields do, current and saved must lie within the records.
+ */
+int undo_restore(UndoJournal *journal, const UndoRecord *records, size_t count,
+                 const char *log, size_t log_length, size_t dropped, size_t current, size_t saved) {
+    if (!journal || (count > 0 && (!records || !log))) return LITE_ERROR;
+    if (current < dropped || current > dropped + count) return LITE_ERROR;
+    if (saved != UNDO_UNSAVED && (saved < dropped || saved > dropped + count)) return LITE_ERROR;
+
+    size_t text = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (records[i].text != text || records[i].length > log_length - text) return LITE_ERROR;
+        text += records[i].length;
+    }
+
+    undo_free(journal);
+    if (count == 0) {
+        journal->dropped = journal->changed = dropped;
+        journal->saved = saved;
+        return LITE_OK;
+    }
+
+    journal->records = (UndoRecord*)malloc(count * sizeof(UndoRecord));
+    journal->log = (char*)malloc(text > 0 ? text : 1);
+    if (!journal->records || !journal->log) {
+        undo_free(journal);
+        return LITE_ERROR;
+    }
+
+    memcpy(journal->records, records, count * sizeof(UndoRecord));
+    memcpy(journal->log, log, text);
+    journal->records[0].joined = false;
+    journal->count = journal->capacity = count;
+    journal->log_length = journal->log_capacity = text;
+    journal->dropped = dropped;
+    journal->current = current - dropped;
+    journal->saved = saved;
+    journal->changed = dropped + count;
+
+    return LITE_OK;
+}
\ No newline at end of file
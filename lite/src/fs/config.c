@@ -0,0 +1,183 @@
+/**
+ * config.c - Configuration file parsing for LITE editor
+ *
+ * The configuration file holds one "key = value" setting per line.
+ * Blank lines and everything after a '#' are ignored.
+ */
+
+#include "lite.h"
+#include "fs/config.h"
+#include "utils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+
+/**
+ * Strip leading and trailing whitespace in place
+ */
+static char* trim(char *text) {
+    while (isspace((unsigned char)*text)) text++;
+    
+    char *end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    
+    return text;
+}
+
+/**
+ * Parse a boolean setting
+ */
+static int parse_bool(const char *value, bool *result) {
+    if (strcmp(value, "true") == 0 || strcmp(value, "yes") == 0 ||
+        strcmp(value, "on") == 0 || strcmp(value, "1") == 0) {
+        *result = true;
+        return LITE_OK;
+    }
+    
+    if (strcmp(value, "false") == 0 || strcmp(value, "no") == 0 ||
+        strcmp(value, "off") == 0 || strcmp(value, "0") == 0) {
+        *result = false;
+        return LITE_OK;
+    }
+    
+    return LITE_ERROR;
+}
+
+/**
+ * Parse a non-negative integer setting
+ */
+static int parse_int(const char *value, int *result) {
+    char *end;
+    long number = strtol(value, &end, 10);
+    
+    if (end == value || *end != '\0' || number < 0 || number > INT_MAX) {
+        return LITE_ERROR;
+    }
+    
+    *result = (int)number;
+    return LITE_OK;
+}
+
+/**
+ * Parse how hard saves sync the file
+ */
+static int parse_sync(const char *value, FileSync *result) {
+    if (strcmp(value, "full") == 0) {
+        *result = FILE_SYNC_FULL;
+    } else if (strcmp(value, "data") == 0) {
+        *result = FILE_SYNC_DATA;
+    } else if (strcmp(value, "none") == 0 || strcmp(value, "off") == 0) {
+        *result = FILE_SYNC_NONE;
+    } else {
+        return LITE_ERROR;
+    }
+    
+    return LITE_OK;
+}
+
+/**
+ * Apply a single setting
+ */
+static int apply_setting(EditorConfig *config, const char *key, const char *value) {
+    if (strcmp(key, "tab_width") == 0) {
+        int width;
+        if (parse_int(value, &width) != LITE_OK || width == 0) return LITE_ERROR;
+        config->tab_width = width;
+        return LITE_OK;
+    }
+    
+    if (strcmp(key, "syntax_highlight") == 0) {
+        return parse_bool(value, &config->syntax_highlight);
+    }
+    
+    if (strcmp(key, "line_numbers") == 0) {
+        return parse_bool(value, &config->line_numbers);
+    }
+    
+    if (strcmp(key, "dark_mode") == 0) {
+        return parse_bool(value, &config->dark_mode);
+    }
+    
+    if (strcmp(key, "theme") == 0) {
+        char *theme = strdup(value);
+        if (!theme) return LITE_ERROR;
+        free(config->theme_name);
+        config->theme_name = theme;
+        return LITE_OK;
+    }
+    
+    if (strcmp(key, "autosave") == 0) {
+        return parse_int(value, &config->autosave_delay);
+    }
+    
+    if (strcmp(key, "undo_memory") == 0) {
+        return parse_int(value, &config->undo_memory);
+    }
+    
+    if (strcmp(key, "undo_file") == 0) {
+        return parse_bool(value, &config->undo_file);
+    }
+    
+    if (strcmp(key, "swap_file") == 0) {
+        return parse_bool(value, &config->swap_file);
+    }
+    
+    if (strcmp(key, "fsync") == 0) {
+        return parse_sync(value, &config->save_sync);
+    }
+    
+    if (strcmp(key, "large_file_memory") == 0) {
+        return parse_int(value, &config->large_file_memory);
+    }
+    
+    return LITE_ERROR;
+}
+
+/**
+ * Load settings from a configuration file
+ *
+ * Settings that are missing from the file keep their current values.
+ * Unknown keys and malformed values are logged and skipped.
+ */
+int config_load(EditorConfig *config, const char *path) {
+    if (!config || !path) return LITE_ERROR;
+    
+    FILE *fp = fopen(path, "r");
+    if (!fp) return LITE_ERROR_FILE_NOT_FOUND;
+    
+    char line[LITE_MAX_LINE_LENGTH];
+    int line_num = 0;
+    
+    while (fgets(line, sizeof(line), fp)) {
+        line_num++;
+        
+        /* Drop comments */
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        
+        char *text = trim(line);
+        if (*text == '\0') continue;
+        
+        char *equals = strchr(text, '=');
+        if (!equals) {
+            LOG_WARNING("%s:%d: expected key = value", path, line_num);
+            continue;
+        }
+        
+        *equals = '\0';
+        char *key = trim(text);
+        char *value = trim(equals + 1);
+        
+        if (apply_setting(config, key, value) != LITE_OK) {
+            LOG_WARNING("%s:%d: invalid setting %s = %s", path, line_num, key, value);
+        }
+    }
+    
+    fclose(fp);
+    
+    LOG_INFO("Loaded configuration from %s", path);
+    return LITE_OK;
+}
@@ -0,0 +1,319 @@
+/**
+ * fault.c - Mapped files cut short for LITE editor
+ *
+ * The text of a buffer is a mapping of its file, and when another program
+ * truncates the file, reading what was past its new end raises SIGBUS.
+ * The handler only does what is safe in a signal handler. It takes a slot,
+ * hands the address to a thread of its own through a pipe, and polls
+ * until that thread has mapped a page of zeros there. Then it returns and
+ * the read is retried.
+ *
+ * The UI thread is woken through an eventfd and looks at the buffers the
+ * pages belong to. An unmodified buffer loads its file again. A modified
+ * one keeps what is left of the file and its edits, and remembers where
+ * the lost text starts, so that it is not saved as zeros unawares.
+ * Followed buffers find out for themselves.
+ */
+
+#include "lite.h"
+#include "fs/fault.h"
+#include "fs/follow.h"
+#include "fs/save.h"
+#include "core/editor.h"
+#include "utils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Steps of a faulting read through its slot */
+enum {
+    SLOT_FREE,
+    SLOT_CLAIMED,
+    SLOT_WAITING,
+    SLOT_MAPPED,
+    SLOT_FAILED
+};
+
+/* Thread that maps pages over what was cut off, started with the handler */
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    atomic_int slots[FAULT_SLOTS];
+    atomic_uintptr_t addresses[FAULT_SLOTS];
+    uintptr_t *pages;           /* Mapped over, not yet looked at by the UI thread */
+    size_t page_count;
+    size_t page_capacity;
+    size_t page_size;
+    bool started;
+    int request_fd[2];
+    int notify_fd;
+} fault = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .request_fd = { -1, -1 },
+    .notify_fd = -1,
+};
+
+/**
+ * Wake the UI thread
+ */
+static void notify(void) {
+    uint64_t one = 1;
+    ssize_t written = write(fault.notify_fd, &one, sizeof(one));
+    (void)written;
+}
+
+/**
+ * Take a free slot, waiting for one if they are all taken
+ */
+static int claim_slot(void) {
+    for (;;) {
+        for (int i = 0; i < FAULT_SLOTS; i++) {
+            int expected = SLOT_FREE;
+            if (atomic_compare_exchange_strong(&fault.slots[i], &expected, SLOT_CLAIMED)) {
+                return i;
+            }
+        }
+        poll(NULL, 0, 1);
+    }
+}
+
+/**
+ * Handle a read of a mapped file past its end
+ *
+ * Returns once a page of zeros is in place and the read can be retried.
+ * Any other bus error, or a page that could not be mapped, is left to
+ * kill the process as usual.
+ */
+static void handle_bus_error(int sig, siginfo_t *info, void *context) {
+    (void)context;
+    int saved_errno = errno;
+    int result = SLOT_FAILED;
+
+    if (info->si_code == BUS_ADRERR) {
+        int slot = claim_slot();
+        atomic_store(&fault.addresses[slot], (uintptr_t)info->si_addr);
+        atomic_store(&fault.slots[slot], SLOT_WAITING);
+
+        char wake = 0;
+        if (write(fault.request_fd[1], &wake, 1) == 1) {
+            while ((result = atomic_load(&fault.slots[slot])) == SLOT_WAITING) {
+                poll(NULL, 0, 1);
+            }
+        }
+        atomic_store(&fault.slots[slot], SLOT_FREE);
+    }
+
+    if (result != SLOT_MAPPED) {
+        signal(sig, SIG_DFL);
+    }
+    errno = saved_errno;
+}
+
+/**
+ * Note a page that was mapped over for the UI thread
+ */
+static void add_page(uintptr_t page) {
+    pthread_mutex_lock(&fault.lock);
+
+    if (fault.page_count == fault.page_capacity) {
+        size_t capacity = fault.page_capacity ? fault.page_capacity * 2 : FAULT_SLOTS;
+        uintptr_t *pages = (uintptr_t*)realloc(fault.pages, capacity * sizeof(uintptr_t));
+        if (pages) {
+            fault.pages = pages;
+            fault.page_capacity = capacity;
+        }
+    }
+    if (fault.page_count < fault.page_capacity) {
+        fault.pages[fault.page_count++] = page;
+    }
+
+    pthread_mutex_unlock(&fault.lock);
+    notify();
+}
+
+/**
+ * Map pages of zeros where reads faulted, until the pipe is closed
+ *
+ * This thread never reads a mapped file, so it cannot fault itself.
+ */
+static void* fixer_main(void *arg) {
+    (void)arg;
+    char wake[FAULT_SLOTS];
+
+    for (;;) {
+        ssize_t count = read(fault.request_fd[0], wake, sizeof(wake));
+        if (count == -1 && errno == EINTR) continue;
+        if (count <= 0) break;
+
+        for (int i = 0; i < FAULT_SLOTS; i++) {
+            if (atomic_load(&fault.slots[i]) != SLOT_WAITING) continue;
+
+            uintptr_t page = atomic_load(&fault.addresses[i]) & ~(uintptr_t)(fault.page_size - 1);
+            bool mapped = mmap((void*)page, fault.page_size, PROT_READ,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED;
+            if (mapped) {
+                add_page(page);
+            }
+
+            int expected = SLOT_WAITING;
+            atomic_compare_exchange_strong(&fault.slots[i], &expected, mapped ? SLOT_MAPPED : SLOT_FAILED);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Keep a buffer whose file was cut short under its text
+ *
+ * lost is where the first page that faulted starts in the text, or where
+ * the file ends now if that is before it.
+ */
+static void cut_short(EditorState *state, Buffer *buffer, size_t lost) {
+    struct stat st;
+    if (stat(buffer->filename, &st) == 0 && st.st_dev == buffer->file_device &&
+        st.st_ino == buffer->file_inode && (size_t)st.st_size < lost) {
+        lost = (size_t)st.st_size;
+    }
+
+    /* There is nothing to lose in showing the file as it is now */
+    if (!buffer_is_modified(buffer) && !save_running(buffer)) {
+        char *filename = strdup(buffer->filename);
+        int result = filename ? buffer_load_file(buffer, filename) : LITE_ERROR;
+        free(filename);
+
+        if (result == LITE_OK) {
+            editor_set_status_message(state, "%s was cut short while open, reloaded it", buffer->filename);
+            return;
+        }
+    }
+
+    if (buffer_detach_file(buffer, lost) != LITE_OK) {
+        LOG_ERROR("Failed to detach %s from its file", buffer->filename);
+    }
+    editor_set_status_message(state, "%s was cut short while open, text past byte %zu is lost",
+                              buffer->filename, lost);
+}
+
+/**
+ * Start mapping over what is cut off from mapped files
+ *
+ * Returns the eventfd that wakes the UI thread, or -1 if reading such a
+ * file kills the editor.
+ */
+int fault_init(void) {
+    if (fault.started) return fault.notify_fd;
+
+    fault.page_size = (size_t)sysconf(_SC_PAGESIZE);
+    fault.notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fault.notify_fd == -1 || pipe(fault.request_fd) != 0) {
+        LOG_WARNING("Files cut short while open will crash the editor: %s", strerror(errno));
+        fault_free();
+        return -1;
+    }
+
+    fcntl(fault.request_fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fault.request_fd[1], F_SETFD, FD_CLOEXEC);
+
+    if (pthread_create(&fault.thread, NULL, fixer_main, NULL) != 0) {
+        LOG_WARNING("Files cut short while open will crash the editor");
+        fault_free();
+        return -1;
+    }
+    fault.started = true;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = handle_bus_error;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGBUS, &action, NULL) != 0) {
+        LOG_WARNING("Files cut short while open will crash the editor: %s", strerror(errno));
+        fault_free();
+        return -1;
+    }
+
+    return fault.notify_fd;
+}
+
+/**
+ * Stop mapping over what is cut off from mapped files
+ */
+void fault_free(void) {
+    signal(SIGBUS, SIG_DFL);
+
+    /* Closing the pipe stops the thread */
+    if (fault.request_fd[1] != -1) {
+        close(fault.request_fd[1]);
+        fault.request_fd[1] = -1;
+    }
+    if (fault.started) {
+        pthread_join(fault.thread, NULL);
+        fault.started = false;
+    }
+    if (fault.request_fd[0] != -1) {
+        close(fault.request_fd[0]);
+        fault.request_fd[0] = -1;
+    }
+
+    if (fault.notify_fd != -1) {
+        close(fault.notify_fd);
+        fault.notify_fd = -1;
+    }
+
+    free(fault.pages);
+    fault.pages = NULL;
+    fault.page_count = 0;
+    fault.page_capacity = 0;
+}
+
+/**
+ * Deal with the buffers whose files were found cut short
+ */
+void fault_collect(EditorState *state) {
+    uint64_t count;
+    while (read(fault.notify_fd, &count, sizeof(count)) > 0) {
+    }
+
+    pthread_mutex_lock(&fault.lock);
+    uintptr_t *pages = fault.pages;
+    size_t page_count = fault.page_count;
+    fault.pages = NULL;
+    fault.page_count = 0;
+    fault.page_capacity = 0;
+    pthread_mutex_unlock(&fault.lock);
+
+    for (int i = 0; i < state->buffer_count; i++) {
+        Buffer *buffer = state->buffers[i];
+        if (!buffer || !buffer->filename || !buffer->text.original_reserved) continue;
+        if (follow_running(buffer)) continue;
+
+        /* Everything from the first page lost on is gone from the file */
+        uintptr_t start = (uintptr_t)buffer->text.original;
+        size_t lost = PIECE_NPOS;
+        for (size_t j = 0; j < page_count; j++) {
+            if (pages[j] >= start && pages[j] - start < buffer->text.original_reserved &&
+                pages[j] - start < lost) {
+                lost = pages[j] - start;
+            }
+        }
+
+        if (lost != PIECE_NPOS) {
+            cut_short(state, buffer, lost);
+        }
+    }
+
+    free(pages);
+}
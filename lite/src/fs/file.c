@@ -4,7 +4,11 @@
 
 #include "lite.h"
 #include "fs/file.h"
+#include "fs/load.h"
+#include "fs/pager.h"
 #include "core/buffer.h"
+#include "core/grep.h"
+#include "syntax/highlight.h"
 #include "utils/log.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,113 +17,400 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+/* Size of the blocks read when streaming a file */
+#define FILE_READ_BLOCK PIECE_ADD_BLOCK_MAX
+
+/* Pieces handed to the kernel in one write when saving */
+#define FILE_SAVE_PIECES 1024
+
+/* How hard saves make sure the file reached the disk */
+static FileSync save_sync = LITE_SAVE_SYNC;
+
+/**
+ * Stream a file into a piece table
+ *
+ * Data is read straight into the append buffer in large blocks and its
+ * line breaks are counted with memchr as it arrives, so lines of any
+ * length load in a single pass without a line buffer that has to grow.
+ * This also works for pipes and other files whose size is not known up
+ * front.
+ */
+static int stream_file(FILE *fp, PieceTable *text, bool *crlf) {
+    piece_table_free(text);
+    *crlf = false;
+    
+    for (;;) {
+        size_t available;
+        char *space = piece_table_append_space(text, FILE_READ_BLOCK, &available);
+        if (!space) return LITE_ERROR;
+        
+        size_t count = fread(space, 1, available, fp);
+        if (count > 0) {
+            if (piece_table_append_commit(text, count) != LITE_OK) {
+                return LITE_ERROR;
+            }
+        }
+        
+        if (count < available) {
+            if (ferror(fp)) return LITE_ERROR;
+            break;
+        }
+    }
+    
+    /* The final line break is implied, drop it from the text */
+    char tail[2];
+    size_t length = piece_table_length(text);
+    size_t drop = 0;
+    
+    if (length >= 2) {
+        piece_table_copy(text, length - 2, tail, 2);
+        if (tail[1] == '\n') drop = tail[0] == '\r' ? 2 : 1;
+        *crlf = drop == 2;
+    } else if (length == 1) {
+        piece_table_copy(text, 0, tail + 1, 1);
+        if (tail[1] == '\n') drop = 1;
+    }
+    
+    if (drop > 0) {
+        return piece_table_delete(text, length - drop, drop);
+    }
+    
+    return LITE_OK;
+}
+
+/**
+ * Get the length of text without the implied final line break
+ *
+ * Sets crlf if the line break is "\r\n".
+ */
+static size_t text_length(const char *data, size_t length, bool *crlf) {
+    *crlf = false;
+    if (length > 0 && data[length - 1] == '\n') {
+        length--;
+        if (length > 0 && data[length - 1] == '\r') {
+            length--;
+            *crlf = true;
+        }
+    }
+    
+    return length;
+}
+
+/**
+ * Check that no line of a text is longer than BUFFER_MAX_LINE_LENGTH
+ *
+ * Only text longer than that can hold such a line, so other text is not
+ * looked at.
+ */
+static bool lines_fit(const PieceTable *text) {
+    size_t length = piece_table_length(text);
+    size_t start = 0;
+    
+    while (length - start > BUFFER_MAX_LINE_LENGTH) {
+        size_t newline = piece_table_find(text, start, '\n');
+        if (newline == PIECE_NPOS || newline - start > BUFFER_MAX_LINE_LENGTH) {
+            return false;
+        }
+        start = newline + 1;
+    }
+    
+    return true;
+}
+
+/**
+ * Map a regular file read-only as the original text of a piece table
+ *
+ * Room is left for the mapping to grow in place, in case the file is
+ * followed, and the buffer remembers which file it maps. Returns
+ * LITE_ERROR if the file cannot be mapped, e.g. because it is not a
+ * regular file.
+ */
+static int map_file(FILE *fp, Buffer *buffer) {
+#ifndef _WIN32
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return LITE_ERROR;
+    }
+    
+    if (piece_table_map(&buffer->text, fileno(fp), (size_t)st.st_size, PIECE_MAP_RESERVE) != LITE_OK) {
+        return LITE_ERROR;
+    }
+    
+    buffer->file_device = st.st_dev;
+    buffer->file_inode = st.st_ino;
+    return LITE_OK;
+#else
+    (void)fp;
+    (void)buffer;
+    return LITE_ERROR;
+#endif
+}
 
 /**
  * Load file into buffer
+ *
+ * Regular files are memory-mapped read-only and become the original text
+ * of the buffer's piece table, so nothing is copied until it is edited.
+ * Other files are streamed into the append buffer.
  */
 int file_load(Buffer *buffer, const char *filename) {
     if (!buffer || !filename) return LITE_ERROR;
     
-    FILE *fp = fopen(filename, "r");
+    FILE *fp = fopen(filename, "rb");
     if (!fp) {
         return LITE_ERROR_FILE_NOT_FOUND;
     }
     
-    /* Clear buffer first */
-    Line *line = buffer->first_line;
-    while (line->next) {
-        Line *next = line->next;
-        free(line->data);
-        free(line);
-        line = next;
+    /* Highlighting starts over for the new text, and the highlighter,
+     * searches and loader must be done reading the old one before it is
+     * freed */
+    highlight_free(buffer->highlight);
+    grep_forget(buffer);
+    load_forget(buffer);
+    pager_forget(buffer);
+    buffer->highlight = NULL;
+    buffer->version++;
+    
+    int result;
+    
+    buffer->file_device = 0;
+    buffer->file_inode = 0;
+    buffer->lost_from = PIECE_NPOS;
+    
+    if (map_file(fp, buffer) == LITE_OK) {
+        fclose(fp);
+        
+        /* Large files show up while their lines are still being counted */
+        size_t length = text_length(buffer->text.original, buffer->text.original_mapped, &buffer->final_crlf);
+        if (length < LOAD_ASYNC_MIN || load_start(buffer, length) != LITE_OK) {
+            result = piece_table_load_mapped(&buffer->text, length);
+        } else {
+            result = LITE_OK;
+        }
+    } else {
+        result = stream_file(fp, &buffer->text, &buffer->final_crlf);
+        fclose(fp);
+    }
+    
+    /* Line numbers are ints, a file with more lines is not opened */
+    if (result == LITE_OK && piece_table_newlines(&buffer->text) >= BUFFER_MAX_LINES) {
+        piece_table_free(&buffer->text);
+        result = LITE_ERROR_TOO_MANY_LINES;
+    }
+    
+    /* Columns are ints too, a file with a longer line is not opened either */
+    if (result == LITE_OK && !load_running(buffer) && !lines_fit(&buffer->text)) {
+        piece_table_free(&buffer->text);
+        result = LITE_ERROR_LINE_TOO_LONG;
+    }
+    
+    if (result != LITE_OK) {
+        buffer->line_count = 1;
+        buffer_set_cursor(buffer, 0, 0);
+        return result;
     }
     
-    /* Free last line */
-    free(line->data);
+    buffer->line_count = (int)piece_table_newlines(&buffer->text) + 1;
     
     /* Reset buffer state */
-    buffer->first_line = NULL;
-    buffer->current_line = NULL;
-    buffer->line_count = 0;
-    buffer->cursor_x = 0;
-    buffer->cursor_y = 0;
-    
-    /* Read file line by line */
-    char line_buf[LITE_MAX_LINE_LENGTH];
-    Line *prev_line = NULL;
-    
-    while (fgets(line_buf, sizeof(line_buf), fp)) {
-        /* Remove newline character */
-        size_t len = strlen(line_buf);
-        if (len > 0 && (line_buf[len - 1] == '\n' || line_buf[len - 1] == '\r')) {
-            line_buf[len - 1] = '\0';
-            len--;
-        }
-        if (len > 0 && line_buf[len - 1] == '\r') {
-            line_buf[len - 1] = '\0';
-            len--;
-        }
-        
-        /* Create new line */
-        Line *new_line = (Line*)malloc(sizeof(Line));
-        if (!new_line) {
-            fclose(fp);
+    buffer->scroll_x = 0;
+    buffer->scroll_y = 0;
+    buffer_set_cursor(buffer, 0, 0);
+    buffer_mark_dirty(buffer, 0, BUFFER_LAST_LINE);
+    
+    /* Reset modified flag */
+    buffer->modified = false;
+    
+    return LITE_OK;
+}
+
+/**
+ * Set how hard saves make sure the file reached the disk
+ */
+void file_set_sync(FileSync sync) {
+    save_sync = sync;
+}
+
+/**
+ * Write a whole vector of pieces, however much each write takes
+ */
+static int write_pieces(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
             return LITE_ERROR;
         }
         
-        /* Allocate and copy line data */
-        new_line->data = strdup(line_buf);
-        if (!new_line->data) {
-            free(new_line);
-            fclose(fp);
-            return LITE_ERROR;
+        /* Skip what was written, the rest of a piece goes again */
+        size_t done = (size_t)written;
+        while (count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
         }
-        
-        new_line->length = len;
-        new_line->next = NULL;
-        new_line->prev = prev_line;
-        
-        /* Link into list */
-        if (prev_line) {
-            prev_line->next = new_line;
-        } else {
-            buffer->first_line = new_line;
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + done;
+            iov->iov_len -= done;
         }
-        
-        prev_line = new_line;
-        buffer->line_count++;
     }
     
-    /* If file was empty, create an empty line */
-    if (buffer->line_count == 0) {
-        Line *new_line = (Line*)malloc(sizeof(Line));
-        if (!new_line) {
-            fclose(fp);
-            return LITE_ERROR;
-        }
+    return LITE_OK;
+}
+
+/**
+ * Write the text of a piece table and a final line break
+ *
+ * The pieces are handed over in batches straight from where they are
+ * stored, so nothing is copied on the way to the kernel. The line break
+ * is "\r\n" if crlf is set, the one the file was loaded with.
+ */
+static int write_text(int fd, const PieceTable *text, bool crlf) {
+    struct iovec iov[FILE_SAVE_PIECES];
+    int count = 0;
+    size_t offset = 0;
+    size_t chunk_length;
+    const char *chunk;
+    
+    while ((chunk = piece_table_chunk(text, offset, &chunk_length)) != NULL) {
+        iov[count].iov_base = (void*)chunk;
+        iov[count].iov_len = chunk_length;
+        offset += chunk_length;
         
-        new_line->data = strdup("");
-        if (!new_line->data) {
-            free(new_line);
-            fclose(fp);
-            return LITE_ERROR;
+        if (++count == FILE_SAVE_PIECES) {
+            if (write_pieces(fd, iov, count) != LITE_OK) return LITE_ERROR;
+            count = 0;
         }
-        
-        new_line->length = 0;
-        new_line->next = NULL;
-        new_line->prev = NULL;
-        
-        buffer->first_line = new_line;
-        buffer->line_count = 1;
     }
     
-    fclose(fp);
+    /* Terminate the last line */
+    iov[count].iov_base = (void*)(crlf ? "\r\n" : "\n");
+    iov[count].iov_len = crlf ? 2 : 1;
+    count++;
     
-    /* Set current line to first line */
-    buffer->current_line = buffer->first_line;
+    return write_pieces(fd, iov, count);
+}
+
+/**
+ * Create the temporary file a save is written to
+ *
+ * It lives next to the file it replaces, so that renaming it over that
+ * file cannot cross file systems, and gets the same permissions and, as
+ * far as allowed, the same owner.
+ */
+static int create_save_file(const char *target, char **temp_path) {
+    size_t length = strlen(target) + sizeof(".XXXXXX");
+    char *path = (char*)malloc(length);
+    if (!path) return -1;
     
-    /* Reset modified flag */
-    buffer->modified = false;
+    snprintf(path, length, "%s.XXXXXX", target);
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        free(path);
+        return -1;
+    }
+    
+    struct stat st;
+    if (stat(target, &st) == 0) {
+        fchmod(fd, st.st_mode & 07777);
+        if (fchown(fd, st.st_uid, st.st_gid) != 0) {
+            /* Only root can give files away, the new file stays ours */
+        }
+    } else {
+        /* A new file gets the usual permissions rather than mkstemp's */
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(fd, 0666 & ~mask);
+    }
+    
+    *temp_path = path;
+    return fd;
+}
+
+/**
+ * Sync the directory holding a file, so that a rename in it is durable
+ */
+static void sync_directory(const char *path) {
+    char *copy = strdup(path);
+    if (!copy) return;
+    
+    int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+    free(copy);
+}
+
+/**
+ * Write a text to a file
+ *
+ * The text goes to a temporary file next to the original, which is
+ * synced according to the fsync setting and then renamed over it, so the
+ * file holds either the old text or the new one whenever the editor or
+ * the system stops. This also keeps a mapped original intact until the
+ * buffer lets go of it. Symbolic links are followed and the file they
+ * point to is replaced.
+ *
+ * The last line ends in "\r\n" if crlf is set, otherwise in "\n". Safe
+ * to call on any thread with a view of a buffer's text. On failure errno
+ * tells why.
+ */
+int file_write(const char *filename, const PieceTable *text, bool crlf) {
+    if (!filename || !text) return LITE_ERROR;
+    
+    char resolved[PATH_MAX];
+    const char *target = filename;
+    struct stat st;
+    if (lstat(target, &st) == 0 && S_ISLNK(st.st_mode) && realpath(target, resolved)) {
+        target = resolved;
+    }
+    
+    char *temp_path = NULL;
+    int fd = create_save_file(target, &temp_path);
+    if (fd == -1) {
+        int error = errno;
+        LOG_ERROR("Failed to create a file next to %s: %s", target, strerror(error));
+        errno = error;
+        return LITE_ERROR;
+    }
+    
+    int result = write_text(fd, text, crlf);
+    
+    if (result == LITE_OK && save_sync == FILE_SYNC_DATA) {
+        result = fdatasync(fd) == 0 ? LITE_OK : LITE_ERROR;
+    } else if (result == LITE_OK && save_sync == FILE_SYNC_FULL) {
+        result = fsync(fd) == 0 ? LITE_OK : LITE_ERROR;
+    }
+    
+    int error = errno;
+    if (close(fd) != 0 && result == LITE_OK) {
+        error = errno;
+        result = LITE_ERROR;
+    }
+    
+    /* Put the new file in place of the old one */
+    if (result == LITE_OK && rename(temp_path, target) != 0) {
+        error = errno;
+        result = LITE_ERROR;
+    }
+    
+    if (result != LITE_OK) {
+        LOG_ERROR("Failed to save %s: %s", target, strerror(error));
+        unlink(temp_path);
+        free(temp_path);
+        errno = error;
+        return LITE_ERROR;
+    }
+    free(temp_path);
+    
+    if (save_sync == FILE_SYNC_FULL) {
+        sync_directory(target);
+    }
     
     return LITE_OK;
 }
@@ -130,21 +421,10 @@ int file_load(Buffer *buffer, const char *filename) {
 int file_save(Buffer *buffer) {
     if (!buffer || !buffer->filename) return LITE_ERROR;
     
-    FILE *fp = fopen(buffer->filename, "w");
-    if (!fp) {
+    if (file_write(buffer->filename, &buffer->text, buffer->final_crlf) != LITE_OK) {
         return LITE_ERROR;
     }
     
-    /* Write lines to file */
-    Line *line = buffer->first_line;
-    while (line) {
-        fputs(line->data, fp);
-        fputc('\n', fp);
-        line = line->next;
-    }
-    
-    fclose(fp);
-    
     /* Reset modified flag */
     buffer->modified = false;
     
@@ -172,6 +452,7 @@ char* file_get_absolute_path(const char *filename) {
     if (filename[0] == '/') {
         /* Already absolute path */
         strncpy(path_buf, filename, PATH_MAX - 1);
+        path_buf[PATH_MAX - 1] = '\0';
     } else {
         /* Relative path, make absolute */
         char cwd[PATH_MAX];
@@ -199,4 +480,66 @@ char* file_get_extension(const char *filename) {
     
     /* Return extension including dot */
     return strdup(dot);
+}
+
+/**
+ * Create a directory and any parents it is missing
+ */
+void file_make_directories(const char *path) {
+    if (!path) return;
+    
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    
+    for (char *p = dir + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(dir, 0700);
+            *p = '/';
+        }
+    }
+    mkdir(dir, 0700);
+}
+
+/**
+ * Get the path of a file the editor keeps about another file
+ *
+ * Such files live in $XDG_CACHE_HOME/lite/<kind>, or ~/.cache/lite/<kind>,
+ * and are named after a hash of the absolute path of the file they are
+ * about. The directory is not created here.
+ */
+char* file_cache_path(const char *kind, const char *filename, const char *extension) {
+    if (!kind || !filename || !extension) return NULL;
+    
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char dir[PATH_MAX];
+    int written;
+    
+    if (cache && cache[0] == '/') {
+        written = snprintf(dir, sizeof(dir), "%s/lite/%s", cache, kind);
+    } else if (home && home[0]) {
+        written = snprintf(dir, sizeof(dir), "%s/.cache/lite/%s", home, kind);
+    } else {
+        return NULL;
+    }
+    
+    if (written <= 0 || (size_t)written >= sizeof(dir)) return NULL;
+    
+    char *absolute = file_get_absolute_path(filename);
+    if (!absolute) return NULL;
+    
+    /* FNV-1a */
+    unsigned long long key = 14695981039346656037ULL;
+    for (const char *p = absolute; *p; p++) {
+        key = (key ^ (unsigned char)*p) * 1099511628211ULL;
+    }
+    free(absolute);
+    
+    size_t length = strlen(dir) + strlen(extension) + 19;
+    char *path = (char*)malloc(length);
+    if (!path) return NULL;
+    
+    snprintf(path, length, "%s/%016llx%s", dir, key, extension);
+    return path;
 }
\ No newline at end of file
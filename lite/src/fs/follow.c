@@ -0,0 +1,420 @@
+/**
+ * follow.c - Following growing files for LITE editor
+ *
+ * Every followed buffer keeps its file open, and its text is a mapping of
+ * that very file. All buffers share one inotify descriptor. Its events
+ * only mark a buffer as changed, and what was written is taken in at most
+ * every FOLLOW_DELAY milliseconds, however often the file is written to.
+ * The mapping grows over the new bytes in the address space set aside for
+ * it, and they are added to the text the way a background load adds
+ * them. Nothing is copied, so the pager keeps a followed file within its
+ * budget like any other.
+ *
+ * As when loading, the line break at the end of the file is not part of
+ * the text. It is added once something follows it.
+ */
+
+#include "lite.h"
+#include "fs/follow.h"
+#include "fs/load.h"
+#include "fs/save.h"
+#include "core/editor.h"
+#include "utils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+/* Events that mean a followed file was replaced */
+#define FOLLOW_GONE (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)
+
+/* Followed file */
+typedef struct FollowWatch {
+    struct FollowWatch *next;
+    Buffer *buffer;
+    int fd;
+    int wd;
+    off_t offset;               /* Bytes of the file taken in, with the line break left out */
+    bool changed;
+    bool gone;
+} FollowWatch;
+
+/* Followed files and the descriptor that watches them */
+static struct {
+    int notify_fd;
+    FollowWatch *watches;
+} follower = {
+    .notify_fd = -1,
+};
+
+/**
+ * Find the watch of a buffer
+ */
+static FollowWatch* find_watch(const Buffer *buffer) {
+    for (FollowWatch *watch = follower.watches; watch; watch = watch->next) {
+        if (watch->buffer == buffer) return watch;
+    }
+
+    return NULL;
+}
+
+/**
+ * Check whether the text of an unmodified buffer is a mapping of a file
+ *
+ * All of its text must come from the mapping, in order, for the file's
+ * new bytes to go on at the end of it. A buffer that was saved maps the
+ * file its save replaced.
+ */
+static bool maps_file(const Buffer *buffer, const struct stat *st) {
+    return buffer->text.original_reserved && buffer->file_device == st->st_dev &&
+           buffer->file_inode == st->st_ino &&
+           piece_table_length(&buffer->text) == buffer->text.original_length;
+}
+
+/**
+ * Load the file of a buffer again
+ */
+static int reload(Buffer *buffer) {
+    char *filename = strdup(buffer->filename);
+    int result = filename ? buffer_load_file(buffer, filename) : LITE_ERROR;
+    free(filename);
+
+    return result;
+}
+
+/**
+ * Add the part of a followed file's mapping up to an offset to its text
+ *
+ * Returns LITE_ERROR_TOO_MANY_LINES if it holds more lines than fit, or
+ * LITE_ERROR_LINE_TOO_LONG if it makes a line longer than fits.
+ */
+static int extend_text(Buffer *buffer, size_t to) {
+    const char *data = buffer->text.original;
+    size_t from = buffer->text.original_length;
+
+    /* The last line grows with what is added */
+    size_t line = piece_table_length(&buffer->text) - buffer_line_offset(buffer, buffer->line_count - 1);
+
+    while (from < to) {
+        size_t length = to - from < PIECE_MAX_LENGTH ? to - from : PIECE_MAX_LENGTH;
+
+        size_t newlines = 0;
+        const char *p = data + from;
+        const char *end = p + length;
+        const char *newline;
+        while ((newline = memchr(p, '\n', end - p)) != NULL) {
+            if (line + (size_t)(newline - p) > BUFFER_MAX_LINE_LENGTH) return LITE_ERROR_LINE_TOO_LONG;
+            line = 0;
+            newlines++;
+            p = newline + 1;
+        }
+        line += (size_t)(end - p);
+
+        if (!buffer_lines_fit(buffer, newlines)) return LITE_ERROR_TOO_MANY_LINES;
+        if (line > BUFFER_MAX_LINE_LENGTH) return LITE_ERROR_LINE_TOO_LONG;
+        if (buffer_append_loaded(buffer, length, newlines) != LITE_OK) return LITE_ERROR;
+        from += length;
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Take in what was written to a followed file since the last time
+ *
+ * Sets more if the file has more to take in than is taken at once, or
+ * has to be loaded again first.
+ */
+static int read_file(EditorState *state, FollowWatch *watch, bool *more) {
+    Buffer *buffer = watch->buffer;
+
+    struct stat st;
+    if (fstat(watch->fd, &st) != 0) {
+        editor_set_status_message(state, "Failed to read %s, stopped following", buffer->filename);
+        return LITE_ERROR;
+    }
+
+    /* The file is only deleted once it is closed, which is up to us */
+    if (st.st_nlink == 0) {
+        watch->gone = true;
+    }
+
+    /* A file cut short was rotated in place, and what the buffer holds
+     * is gone from it */
+    if (st.st_size < watch->offset) {
+        /* Edits cannot be loaded again, the text keeps what is left of
+         * the file and no longer maps it */
+        if (buffer_is_modified(buffer)) {
+            if (buffer_detach_file(buffer, (size_t)st.st_size) != LITE_OK) {
+                LOG_ERROR("Failed to detach %s from its file", buffer->filename);
+            }
+
+            editor_set_status_message(state, "%s was truncated, text past byte %lld is lost, stopped following",
+                                      buffer->filename, (long long)st.st_size);
+            return LITE_ERROR;
+        }
+
+        /* A save still reads the old text */
+        if (save_running(buffer)) {
+            *more = true;
+            return LITE_OK;
+        }
+
+        if (reload(buffer) != LITE_OK || !maps_file(buffer, &st)) {
+            editor_set_status_message(state, "Failed to reload %s, stopped following", buffer->filename);
+            return LITE_ERROR;
+        }
+
+        editor_set_status_message(state, "%s was truncated, reloaded it", buffer->filename);
+        watch->offset = (off_t)buffer->text.original_mapped;
+
+        /* A large file is taken in on where it was loaded up to */
+        if (load_running(buffer)) {
+            *more = true;
+            return LITE_OK;
+        }
+
+        buffer_set_cursor(buffer, 0, buffer->line_count - 1);
+    }
+
+    *more = false;
+    if (st.st_size <= watch->offset) return LITE_OK;
+
+    if (piece_table_remap(&buffer->text, watch->fd, (size_t)st.st_size) != LITE_OK) {
+        editor_set_status_message(state, "%s grew too large to follow, stopped following",
+                                  buffer->filename);
+        return LITE_ERROR;
+    }
+
+    const char *data = buffer->text.original;
+    size_t from = buffer->text.original_length;
+    size_t to = (size_t)st.st_size;
+
+    if (to - from > FOLLOW_READ_LIMIT) {
+        to = from + FOLLOW_READ_LIMIT;
+        *more = true;
+    } else if (data[to - 1] == '\n') {
+        /* The line break at the end waits for what follows it */
+        to--;
+        buffer->final_crlf = to > from && data[to - 1] == '\r';
+        if (buffer->final_crlf) to--;
+    }
+
+    /* The view only keeps up with the file when it was at the end */
+    bool at_end = buffer->cursor_y == buffer->line_count - 1;
+
+    int result = extend_text(buffer, to);
+    if (result == LITE_ERROR_TOO_MANY_LINES) {
+        editor_set_status_message(state, "%s has more than %d lines, stopped following",
+                                  buffer->filename, BUFFER_MAX_LINES);
+        return LITE_ERROR;
+    } else if (result == LITE_ERROR_LINE_TOO_LONG) {
+        editor_set_status_message(state, "%s has a line longer than %d bytes, stopped following",
+                                  buffer->filename, BUFFER_MAX_LINE_LENGTH);
+        return LITE_ERROR;
+    } else if (result != LITE_OK) {
+        editor_set_status_message(state, "Failed to read %s, stopped following", buffer->filename);
+        return LITE_ERROR;
+    }
+
+    watch->offset = *more ? (off_t)to : st.st_size;
+
+    if (at_end) {
+        buffer_set_cursor(buffer, 0, buffer->line_count - 1);
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Set up following files
+ *
+ * Returns the inotify descriptor, or -1 if files cannot be followed.
+ */
+int follow_init(void) {
+    if (follower.notify_fd == -1) {
+        follower.notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (follower.notify_fd == -1) {
+            LOG_WARNING("Files cannot be followed: %s", strerror(errno));
+        }
+    }
+
+    return follower.notify_fd;
+}
+
+/**
+ * Stop following every file
+ */
+void follow_free(void) {
+    while (follower.watches) {
+        follow_stop(follower.watches->buffer);
+    }
+
+    if (follower.notify_fd != -1) {
+        close(follower.notify_fd);
+        follower.notify_fd = -1;
+    }
+}
+
+/**
+ * Start following the file of a buffer
+ *
+ * The file must be a regular file that is completely loaded, and the
+ * buffer must hold what is in it. A buffer whose text is not a mapping of
+ * the file, such as one that was saved since, loads it again first.
+ * Whatever was written to the file since it was loaded is taken in at the
+ * next update.
+ */
+int follow_start(Buffer *buffer) {
+    if (!buffer || !buffer->filename || follower.notify_fd == -1) return LITE_ERROR;
+    if (find_watch(buffer)) return LITE_OK;
+    if (load_running(buffer) || save_running(buffer) || buffer_is_modified(buffer)) return LITE_ERROR;
+
+    FollowWatch *watch = (FollowWatch*)calloc(1, sizeof(FollowWatch));
+    if (!watch) return LITE_ERROR;
+
+    watch->buffer = buffer;
+    watch->fd = open(buffer->filename, O_RDONLY | O_CLOEXEC);
+    if (watch->fd == -1) {
+        free(watch);
+        return LITE_ERROR;
+    }
+
+    struct stat st;
+    if (fstat(watch->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(watch->fd);
+        free(watch);
+        return LITE_ERROR;
+    }
+
+    if (!maps_file(buffer, &st) && (reload(buffer) != LITE_OK || !maps_file(buffer, &st))) {
+        close(watch->fd);
+        free(watch);
+        return LITE_ERROR;
+    }
+
+    watch->wd = inotify_add_watch(follower.notify_fd, buffer->filename, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+    if (watch->wd == -1) {
+        LOG_ERROR("Failed to watch %s: %s", buffer->filename, strerror(errno));
+        close(watch->fd);
+        free(watch);
+        return LITE_ERROR;
+    }
+
+    watch->offset = (off_t)buffer->text.original_mapped;
+    watch->changed = true;
+
+    watch->next = follower.watches;
+    follower.watches = watch;
+
+    return LITE_OK;
+}
+
+/**
+ * Stop following the file of a buffer
+ */
+void follow_stop(Buffer *buffer) {
+    FollowWatch **link = &follower.watches;
+    while (*link && (*link)->buffer != buffer) {
+        link = &(*link)->next;
+    }
+
+    FollowWatch *watch = *link;
+    if (!watch) return;
+    *link = watch->next;
+
+    /* Buffers following the same file share its watch */
+    bool shared = false;
+    for (FollowWatch *other = follower.watches; other; other = other->next) {
+        shared = shared || other->wd == watch->wd;
+    }
+    if (!shared) {
+        inotify_rm_watch(follower.notify_fd, watch->wd);
+    }
+
+    close(watch->fd);
+    free(watch);
+}
+
+/**
+ * Check whether the file of a buffer is followed
+ */
+bool follow_running(const Buffer *buffer) {
+    return find_watch(buffer) != NULL;
+}
+
+/**
+ * Take the events of followed files
+ *
+ * Returns true if any of them changed and needs an update.
+ */
+bool follow_collect(void) {
+    union {
+        struct inotify_event event;
+        char data[4096];
+    } events;
+    bool changed = false;
+    ssize_t count;
+
+    while ((count = read(follower.notify_fd, events.data, sizeof(events.data))) > 0) {
+        for (char *p = events.data; p < events.data + count; ) {
+            struct inotify_event *event = (struct inotify_event*)p;
+
+            for (FollowWatch *watch = follower.watches; watch; watch = watch->next) {
+                if (watch->wd != event->wd) continue;
+
+                watch->changed = true;
+                watch->gone = watch->gone || (event->mask & FOLLOW_GONE) != 0;
+                changed = true;
+            }
+
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return changed;
+}
+
+/**
+ * Append what was written to changed files to their buffers
+ *
+ * Returns true if there is more to read, from a file that had too much
+ * for one read or from one that has not finished loading.
+ */
+bool follow_update(EditorState *state) {
+    bool again = false;
+
+    FollowWatch *watch = follower.watches;
+    while (watch) {
+        FollowWatch *next = watch->next;
+        Buffer *buffer = watch->buffer;
+
+        if (watch->changed && load_running(buffer)) {
+            again = true;
+        } else if (watch->changed) {
+            bool more = false;
+            watch->changed = false;
+
+            if (read_file(state, watch, &more) != LITE_OK) {
+                LOG_WARNING("Stopped following %s", buffer->filename);
+                follow_stop(buffer);
+            } else if (more) {
+                watch->changed = true;
+                again = true;
+            } else if (watch->gone) {
+                /* What was written before it went has been read */
+                editor_set_status_message(state, "%s was moved or deleted, stopped following",
+                                          buffer->filename);
+                follow_stop(buffer);
+            }
+        }
+
+        watch = next;
+    }
+
+    return again;
+}
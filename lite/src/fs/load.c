@@ -0,0 +1,447 @@
+/**
+ * load.c - Background loading for LITE editor
+ *
+ * Loads wait in a queue and are counted one after another by a thread
+ * that starts with the first of them. The thread hands over batches of
+ * counted lines and wakes the UI thread through an eventfd, which adds
+ * them to the buffer's text. Only the UI thread touches the buffer.
+ *
+ * The mapping being counted belongs to the buffer's text, so a buffer
+ * cannot be freed while its load runs. Freeing it stops the load first.
+ */
+
+#include "lite.h"
+#include "fs/load.h"
+#include "fs/undofile.h"
+#include "core/editor.h"
+#include "utils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+/* Run of whole lines counted by the loading thread */
+typedef struct LoadBatch {
+    size_t length;
+    size_t newlines;
+} LoadBatch;
+
+/* Load of a mapped file into a buffer */
+typedef struct LoadJob {
+    struct LoadJob *next;
+    Buffer *buffer;
+    const char *data;
+    size_t length;              /* Length of the text, without the final line break */
+    size_t added;               /* Bytes added to the buffer, UI thread only */
+    LoadBatch *batches;         /* Counted but not added yet */
+    UndoHash hash;              /* Hash of the text, for restoring its history */
+    size_t batch_count;
+    size_t batch_capacity;
+    bool counting;
+    bool counted;               /* The thread is done with the file */
+    bool too_long;              /* Counting stopped at a line too long to load */
+    bool cancelled;
+} LoadJob;
+
+/* Loading thread, started on first use */
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t finished;
+    LoadJob *jobs;
+    LoadJob *running;
+    bool started;
+    bool stopping;
+    int notify_fd;
+} loader = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .finished = PTHREAD_COND_INITIALIZER,
+    .notify_fd = -1,
+};
+
+/**
+ * Wake the UI thread
+ */
+static void notify(void) {
+    uint64_t one = 1;
+    ssize_t written = write(loader.notify_fd, &one, sizeof(one));
+    (void)written;
+}
+
+/**
+ * Find the load of a buffer
+ */
+static LoadJob* find_job(const Buffer *buffer) {
+    for (LoadJob *job = loader.jobs; job; job = job->next) {
+        if (job->buffer == buffer) return job;
+    }
+
+    return NULL;
+}
+
+/**
+ * Unlink a load and free it
+ */
+static void remove_job(LoadJob *job) {
+    LoadJob **link = &loader.jobs;
+    while (*link != job) {
+        link = &(*link)->next;
+    }
+    *link = job->next;
+
+    free(job->batches);
+    free(job);
+}
+
+/**
+ * Hand a batch of counted lines over to the UI thread
+ *
+ * Called with the lock held.
+ */
+static int add_batch(LoadJob *job, size_t length, size_t newlines) {
+    if (job->batch_count == job->batch_capacity) {
+        size_t capacity = job->batch_capacity ? job->batch_capacity * 2 : 64;
+        LoadBatch *batches = (LoadBatch*)realloc(job->batches, capacity * sizeof(LoadBatch));
+        if (!batches) return LITE_ERROR;
+
+        job->batches = batches;
+        job->batch_capacity = capacity;
+    }
+
+    job->batches[job->batch_count].length = length;
+    job->batches[job->batch_count].newlines = newlines;
+
+    /* The UI thread is only woken for the first batch it has not taken */
+    if (job->batch_count++ == 0) {
+        notify();
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Count the lines of a file in batches of at most a piece
+ *
+ * Each batch ends after the last line break in it, unless a line is too
+ * long for that. Counting stops at a line longer than a buffer holds.
+ * Pages that have been counted are dropped again, since only the ones on
+ * screen need to stay in memory. The text is hashed on the way, while
+ * its pages are still in.
+ */
+static void count_lines(LoadJob *job) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t released = 0;
+    size_t offset = 0;
+    size_t line = 0;            /* Length of the line counted so far */
+
+    madvise((void*)job->data, job->length, MADV_SEQUENTIAL);
+    undofile_hash_init(&job->hash);
+
+    while (offset < job->length) {
+        const char *start = job->data + offset;
+        size_t length = job->length - offset;
+        if (length > PIECE_MAX_LENGTH) length = PIECE_MAX_LENGTH;
+
+        size_t newlines = 0;
+        bool too_long = false;
+        const char *last = NULL;
+        const char *p = start;
+        while ((p = memchr(p, '\n', start + length - p)) != NULL) {
+            too_long |= line + (size_t)(p - (last ? last + 1 : start)) > BUFFER_MAX_LINE_LENGTH;
+            line = 0;
+            newlines++;
+            last = p++;
+        }
+
+        if (last && offset + length < job->length) {
+            length = (size_t)(last - start) + 1;
+        } else {
+            line += (size_t)(start + length - (last ? last + 1 : start));
+            too_long |= line > BUFFER_MAX_LINE_LENGTH;
+        }
+
+        if (too_long) {
+            pthread_mutex_lock(&loader.lock);
+            job->too_long = true;
+            pthread_mutex_unlock(&loader.lock);
+            break;
+        }
+
+        undofile_hash_add(&job->hash, start, length);
+        offset += length;
+
+        size_t release = offset & ~(page - 1);
+        if (release > released) {
+            madvise((void*)(job->data + released), release - released, MADV_DONTNEED);
+            released = release;
+        }
+
+        pthread_mutex_lock(&loader.lock);
+        int result = job->cancelled ? LITE_ERROR : add_batch(job, length, newlines);
+        pthread_mutex_unlock(&loader.lock);
+
+        if (result != LITE_OK) break;
+    }
+
+    madvise((void*)job->data, job->length, MADV_NORMAL);
+}
+
+/**
+ * Loading thread, counts queued loads in order until stopped
+ */
+static void* loader_main(void *data) {
+    (void)data;
+
+    pthread_mutex_lock(&loader.lock);
+
+    for (;;) {
+        LoadJob *job = NULL;
+        while (!loader.stopping) {
+            for (job = loader.jobs; job; job = job->next) {
+                if (!job->counting && !job->cancelled) break;
+            }
+            if (job) break;
+
+            pthread_cond_wait(&loader.wake, &loader.lock);
+        }
+        if (!job) break;
+
+        job->counting = true;
+        loader.running = job;
+        pthread_mutex_unlock(&loader.lock);
+
+        count_lines(job);
+
+        pthread_mutex_lock(&loader.lock);
+        job->counted = true;
+        loader.running = NULL;
+        pthread_cond_broadcast(&loader.finished);
+        notify();
+    }
+
+    pthread_mutex_unlock(&loader.lock);
+    return NULL;
+}
+
+/**
+ * Set up background loading
+ *
+ * Returns a descriptor that becomes readable when lines were counted, or
+ * -1 if files have to be loaded on the UI thread.
+ */
+int load_init(void) {
+    if (loader.notify_fd == -1) {
+        loader.notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loader.notify_fd == -1) {
+            LOG_WARNING("Loading on the UI thread: %s", strerror(errno));
+        }
+    }
+
+    return loader.notify_fd;
+}
+
+/**
+ * Stop the loading thread
+ *
+ * Every buffer must have been freed first.
+ */
+void load_free(void) {
+    if (loader.started) {
+        pthread_mutex_lock(&loader.lock);
+        loader.stopping = true;
+        pthread_cond_signal(&loader.wake);
+        pthread_mutex_unlock(&loader.lock);
+
+        pthread_join(loader.thread, NULL);
+        loader.started = false;
+        loader.stopping = false;
+    }
+
+    while (loader.jobs) {
+        remove_job(loader.jobs);
+    }
+
+    if (loader.notify_fd != -1) {
+        close(loader.notify_fd);
+        loader.notify_fd = -1;
+    }
+}
+
+/**
+ * Start loading the mapped file of a buffer in the background
+ *
+ * The buffer's text must be a mapping that holds no text yet. It stays
+ * empty until the first lines are counted. Returns LITE_ERROR if the load
+ * could not be started, and the text is left to the caller.
+ */
+int load_start(Buffer *buffer, size_t length) {
+    if (!buffer || !buffer->text.original_reserved || loader.notify_fd == -1) return LITE_ERROR;
+
+    LoadJob *job = (LoadJob*)calloc(1, sizeof(LoadJob));
+    if (!job) return LITE_ERROR;
+
+    job->buffer = buffer;
+    job->data = buffer->text.original;
+    job->length = length;
+
+    if (!loader.started) {
+        if (pthread_create(&loader.thread, NULL, loader_main, NULL) != 0) {
+            LOG_ERROR("Failed to start loading thread");
+            free(job);
+            return LITE_ERROR;
+        }
+        loader.started = true;
+    }
+
+    pthread_mutex_lock(&loader.lock);
+    LoadJob **link = &loader.jobs;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = job;
+    pthread_cond_signal(&loader.wake);
+    pthread_mutex_unlock(&loader.lock);
+
+    return LITE_OK;
+}
+
+/**
+ * Check whether a buffer is still being loaded
+ */
+bool load_running(const Buffer *buffer) {
+    pthread_mutex_lock(&loader.lock);
+    bool running = find_job(buffer) != NULL;
+    pthread_mutex_unlock(&loader.lock);
+
+    return running;
+}
+
+/**
+ * Get how much of a buffer has been loaded, in percent
+ *
+ * Returns -1 if the buffer is not being loaded.
+ */
+int load_progress(const Buffer *buffer) {
+    pthread_mutex_lock(&loader.lock);
+    LoadJob *job = find_job(buffer);
+    int percent = job ? (int)((double)job->added * 100 / (double)job->length) : -1;
+    pthread_mutex_unlock(&loader.lock);
+
+    return percent;
+}
+
+/**
+ * Add the lines counted since the last call to their buffers
+ */
+void load_collect(EditorState *state) {
+    uint64_t count;
+    while (read(loader.notify_fd, &count, sizeof(count)) > 0) {
+    }
+
+    /* Only the UI thread adds or removes loads, so the list can be walked */
+    LoadJob *job = loader.jobs;
+    while (job) {
+        LoadJob *next = job->next;
+
+        /* A load that failed stays until its buffer goes, so that the
+         * part of the file that was loaded cannot be saved over it */
+        if (job->cancelled) {
+            job = next;
+            continue;
+        }
+
+        pthread_mutex_lock(&loader.lock);
+        LoadBatch *batches = job->batches;
+        size_t batch_count = job->batch_count;
+        bool done = job->counted;
+        bool too_long = job->too_long;
+        job->batches = NULL;
+        job->batch_count = 0;
+        job->batch_capacity = 0;
+        pthread_mutex_unlock(&loader.lock);
+
+        Buffer *buffer = job->buffer;
+        for (size_t i = 0; i < batch_count; i++) {
+            /* Line numbers are ints, the rest of the file is left out */
+            if (!buffer_lines_fit(buffer, batches[i].newlines)) {
+                LOG_ERROR("Stopped loading %s at line %d", buffer->filename, buffer->line_count);
+                editor_set_status_message(state, "%s has more than %d lines, only part of it was loaded",
+                                          buffer->filename, BUFFER_MAX_LINES);
+
+                pthread_mutex_lock(&loader.lock);
+                job->cancelled = true;
+                pthread_mutex_unlock(&loader.lock);
+                break;
+            }
+
+            if (buffer_append_loaded(buffer, batches[i].length, batches[i].newlines) != LITE_OK) {
+                LOG_ERROR("Failed to load %s past byte %zu", buffer->filename, job->added);
+                editor_set_status_message(state, "Out of memory, only part of %s was loaded",
+                                          buffer->filename);
+
+                pthread_mutex_lock(&loader.lock);
+                job->cancelled = true;
+                pthread_mutex_unlock(&loader.lock);
+                break;
+            }
+            job->added += batches[i].length;
+        }
+        free(batches);
+
+        /* Columns are ints too, the rest of the file is left out */
+        if (too_long && !job->cancelled) {
+            LOG_ERROR("Stopped loading %s at line %d", buffer->filename, buffer->line_count);
+            editor_set_status_message(state, "%s has a line longer than %d bytes, only part of it was loaded",
+                                      buffer->filename, BUFFER_MAX_LINE_LENGTH);
+
+            pthread_mutex_lock(&loader.lock);
+            job->cancelled = true;
+            pthread_mutex_unlock(&loader.lock);
+        }
+
+        if (done && !job->cancelled) {
+            /* History can only be restored onto the whole file, and not
+             * after it was edited while loading */
+            if (buffer->undo.count == 0) {
+                uint64_t hash = undofile_hash_end(&job->hash);
+                undofile_open(buffer, &hash);
+            }
+
+            pthread_mutex_lock(&loader.lock);
+            remove_job(job);
+            pthread_mutex_unlock(&loader.lock);
+        }
+
+        job = next;
+    }
+}
+
+/**
+ * Stop loading a buffer that is about to be freed or reloaded
+ *
+ * The rest of the file is not added. A buffer that was not completely
+ * loaded must not be saved.
+ */
+void load_forget(Buffer *buffer) {
+    if (!buffer || !loader.started) return;
+
+    pthread_mutex_lock(&loader.lock);
+
+    LoadJob *job = find_job(buffer);
+    if (job) {
+        job->cancelled = true;
+        while (loader.running == job) {
+            pthread_cond_wait(&loader.finished, &loader.lock);
+        }
+        remove_job(job);
+    }
+
+    pthread_mutex_unlock(&loader.lock);
+}
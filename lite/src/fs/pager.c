@@ -0,0 +1,202 @@
+/**
+ * pager.c - Memory budget for mapped files in LITE editor
+ *
+ * The windows that were shown are kept in a table shared by all buffers,
+ * as many as fit in the budget. Showing a window that is not in the table
+ * pushes out the one shown longest ago, and its pages are dropped right
+ * away. Pages touched by anything else, such as a search running through
+ * the whole file or a save, are dropped by trimming a while later.
+ *
+ * Dropping the pages of a read-only file mapping cannot lose anything,
+ * they are read from the file again when the text is next looked at. So
+ * it is also safe while other threads read the text.
+ */
+
+#include "lite.h"
+#include "fs/pager.h"
+#include "utils/log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Window of a mapping that was shown */
+typedef struct PagerWindow {
+    Buffer *buffer;
+    size_t index;
+    unsigned long used;
+} PagerWindow;
+
+/* Windows kept in memory */
+static struct {
+    PagerWindow *windows;
+    size_t count;
+    size_t capacity;
+    unsigned long clock;
+    size_t budget;
+} pager = {
+    .budget = (size_t)LITE_LARGE_FILE_MEMORY << 20,
+};
+
+/**
+ * Drop the pages of part of a buffer's mapping
+ */
+static void release(Buffer *buffer, size_t from, size_t to) {
+    if (to > buffer->text.original_mapped) to = buffer->text.original_mapped;
+    if (from >= to) return;
+
+    madvise(buffer->text.original + from, to - from, MADV_DONTNEED);
+}
+
+/**
+ * Note that a window was shown, pushing out the oldest one if needed
+ */
+static void keep_window(Buffer *buffer, size_t index) {
+    PagerWindow *oldest = NULL;
+
+    for (size_t i = 0; i < pager.count; i++) {
+        PagerWindow *window = &pager.windows[i];
+        if (window->buffer == buffer && window->index == index) {
+            window->used = ++pager.clock;
+            return;
+        }
+        if (!oldest || window->used < oldest->used) {
+            oldest = window;
+        }
+    }
+
+    if (pager.count == pager.capacity) {
+        if (!oldest) return;
+
+        release(oldest->buffer, oldest->index * PAGER_WINDOW, (oldest->index + 1) * PAGER_WINDOW);
+    } else {
+        oldest = &pager.windows[pager.count++];
+    }
+
+    oldest->buffer = buffer;
+    oldest->index = index;
+    oldest->used = ++pager.clock;
+}
+
+/**
+ * Order windows by buffer and by where they are in the mapping
+ */
+static int compare_windows(const void *a, const void *b) {
+    const PagerWindow *x = (const PagerWindow*)a;
+    const PagerWindow *y = (const PagerWindow*)b;
+
+    if (x->buffer != y->buffer) return x->buffer < y->buffer ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/**
+ * Set how much of the mapped files is kept in memory
+ *
+ * Files up to this size are left alone.
+ */
+void pager_set_budget(size_t bytes) {
+    if (bytes < PAGER_WINDOW) bytes = PAGER_WINDOW;
+
+    size_t capacity = bytes / PAGER_WINDOW;
+    if (capacity != pager.capacity) {
+        PagerWindow *windows = (PagerWindow*)realloc(pager.windows, capacity * sizeof(PagerWindow));
+        if (!windows) {
+            LOG_ERROR("Failed to allocate the window table");
+            return;
+        }
+
+        /* Windows that no longer fit are dropped at the next trim */
+        pager.windows = windows;
+        pager.capacity = capacity;
+        if (pager.count > capacity) pager.count = capacity;
+    }
+
+    pager.budget = bytes;
+}
+
+/**
+ * Free the window table
+ */
+void pager_free(void) {
+    free(pager.windows);
+    pager.windows = NULL;
+    pager.count = 0;
+    pager.capacity = 0;
+}
+
+/**
+ * Check whether a buffer's text is a mapping larger than the budget
+ */
+bool pager_enabled(const Buffer *buffer) {
+    return buffer && buffer->text.original_mapped > pager.budget;
+}
+
+/**
+ * Note that a range of a buffer's text is shown
+ *
+ * Only the parts of the range that come from the mapping count, text
+ * typed in is not in it.
+ */
+void pager_touch(Buffer *buffer, size_t offset, size_t length) {
+    if (!pager_enabled(buffer)) return;
+
+    if (!pager.windows) {
+        pager_set_budget(pager.budget);
+        if (!pager.windows) return;
+    }
+
+    const char *start = buffer->text.original;
+    const char *end = start + buffer->text.original_mapped;
+
+    while (length > 0) {
+        size_t chunk;
+        const char *data = piece_table_chunk(&buffer->text, offset, &chunk);
+        if (!data || chunk == 0) break;
+        if (chunk > length) chunk = length;
+
+        if (data >= start && data < end) {
+            size_t first = (size_t)(data - start) / PAGER_WINDOW;
+            size_t last = (size_t)(data - start + chunk - 1) / PAGER_WINDOW;
+            for (size_t index = first; index <= last; index++) {
+                keep_window(buffer, index);
+            }
+        }
+
+        offset += chunk;
+        length -= chunk;
+    }
+}
+
+/**
+ * Drop the pages of a buffer's mapping outside the windows kept
+ */
+void pager_trim(Buffer *buffer) {
+    if (!pager_enabled(buffer)) return;
+
+    /* Which window was shown when is in the stamps, not the order */
+    qsort(pager.windows, pager.count, sizeof(PagerWindow), compare_windows);
+
+    size_t from = 0;
+    for (size_t i = 0; i < pager.count; i++) {
+        PagerWindow *window = &pager.windows[i];
+        if (window->buffer != buffer) continue;
+
+        release(buffer, from, window->index * PAGER_WINDOW);
+        from = (window->index + 1) * PAGER_WINDOW;
+    }
+    release(buffer, from, buffer->text.original_mapped);
+}
+
+/**
+ * Forget the windows of a buffer whose mapping is about to go
+ */
+void pager_forget(Buffer *buffer) {
+    size_t kept = 0;
+
+    for (size_t i = 0; i < pager.count; i++) {
+        if (pager.windows[i].buffer != buffer) {
+            pager.windows[kept++] = pager.windows[i];
+        }
+    }
+
+    pager.count = kept;
+}
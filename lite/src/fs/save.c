@@ -0,0 +1,304 @@
+/**
+ * save.c - Background saving for LITE editor
+ *
+ * Saves wait in a queue and are written one after another by a thread
+ * that starts with the first of them. A finished save moves to a list of
+ * results, and the UI thread is woken through an eventfd to collect them
+ * in the order they finished.
+ *
+ * The view a save writes from shares the text of its buffer, so a buffer
+ * cannot be freed while one of its saves is queued or running. Freeing
+ * it waits for the running one and drops the others.
+ */
+
+#include "lite.h"
+#include "fs/save.h"
+#include "fs/file.h"
+#include "fs/swap.h"
+#include "fs/load.h"
+#include "fs/undofile.h"
+#include "core/editor.h"
+#include "utils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/* Save of a buffer's text as it was when the save started */
+typedef struct SaveJob {
+    struct SaveJob *next;
+    Buffer *buffer;
+    PieceTable view;
+    bool crlf;                  /* The last line ends in "\r\n" */
+    unsigned long version;
+    bool hashed;                /* The text is hashed for its undo history */
+    uint64_t hash;
+    int error;                  /* errno of a failed save, 0 once saved */
+    char filename[];
+} SaveJob;
+
+/* Saving thread, started on first use */
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t finished;
+    SaveJob *queue;
+    SaveJob *running;
+    SaveJob *done;
+    bool started;
+    bool stopping;
+    int notify_fd;
+} saver = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .finished = PTHREAD_COND_INITIALIZER,
+    .notify_fd = -1,
+};
+
+/**
+ * Free a save and its view
+ */
+static void free_job(SaveJob *job) {
+    piece_table_free(&job->view);
+    free(job);
+}
+
+/**
+ * Append a save to the end of a list
+ */
+static void append_job(SaveJob **list, SaveJob *job) {
+    job->next = NULL;
+    while (*list) {
+        list = &(*list)->next;
+    }
+    *list = job;
+}
+
+/**
+ * Saving thread, writes queued saves in order until stopped
+ */
+static void* saver_main(void *data) {
+    (void)data;
+
+    pthread_mutex_lock(&saver.lock);
+
+    for (;;) {
+        while (!saver.queue && !saver.stopping) {
+            pthread_cond_wait(&saver.wake, &saver.lock);
+        }
+
+        /* Everything queued is saved before stopping */
+        SaveJob *job = saver.queue;
+        if (!job) break;
+
+        saver.queue = job->next;
+        saver.running = job;
+        pthread_mutex_unlock(&saver.lock);
+
+        job->error = file_write(job->filename, &job->view, job->crlf) == LITE_OK ? 0 : (errno ? errno : EIO);
+
+        /* Hashing reads the whole text again, which is no job for the UI thread */
+        if (job->error == 0 && job->hashed) {
+            job->hash = undofile_hash_text(&job->view);
+        }
+
+        pthread_mutex_lock(&saver.lock);
+        saver.running = NULL;
+        append_job(&saver.done, job);
+        pthread_cond_broadcast(&saver.finished);
+
+        uint64_t one = 1;
+        ssize_t written = write(saver.notify_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    pthread_mutex_unlock(&saver.lock);
+    return NULL;
+}
+
+/**
+ * Set up background saving
+ *
+ * Returns a descriptor that becomes readable when saves are done, or -1
+ * if saves have to be made on the UI thread.
+ */
+int save_init(void) {
+    if (saver.notify_fd == -1) {
+        saver.notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (saver.notify_fd == -1) {
+            LOG_WARNING("Saving on the UI thread: %s", strerror(errno));
+        }
+    }
+
+    return saver.notify_fd;
+}
+
+/**
+ * Finish the saves that are queued and stop the saving thread
+ *
+ * Every buffer must have been freed first.
+ */
+void save_free(void) {
+    if (saver.started) {
+        pthread_mutex_lock(&saver.lock);
+        saver.stopping = true;
+        pthread_cond_signal(&saver.wake);
+        pthread_mutex_unlock(&saver.lock);
+
+        pthread_join(saver.thread, NULL);
+        saver.started = false;
+        saver.stopping = false;
+    }
+
+    while (saver.done) {
+        SaveJob *job = saver.done;
+        saver.done = job->next;
+        free_job(job);
+    }
+
+    if (saver.notify_fd != -1) {
+        close(saver.notify_fd);
+        saver.notify_fd = -1;
+    }
+}
+
+/**
+ * Start saving a buffer in the background
+ *
+ * The text is saved as it is now. Returns LITE_ERROR if the save could
+ * not be started, and the caller should save the buffer itself.
+ */
+int save_start(Buffer *buffer) {
+    if (!buffer || !buffer->filename || saver.notify_fd == -1) return LITE_ERROR;
+    if (load_running(buffer)) return LITE_ERROR;
+
+    size_t length = strlen(buffer->filename) + 1;
+    SaveJob *job = (SaveJob*)malloc(sizeof(SaveJob) + length);
+    if (!job) return LITE_ERROR;
+
+    if (piece_table_view(&buffer->text, &job->view) != LITE_OK) {
+        free(job);
+        return LITE_ERROR;
+    }
+
+    job->buffer = buffer;
+    job->crlf = buffer->final_crlf;
+    job->version = buffer->version;
+    job->hashed = undofile_enabled();
+    job->hash = 0;
+    job->error = 0;
+    memcpy(job->filename, buffer->filename, length);
+
+    if (!saver.started) {
+        if (pthread_create(&saver.thread, NULL, saver_main, NULL) != 0) {
+            LOG_ERROR("Failed to start saving thread");
+            free_job(job);
+            return LITE_ERROR;
+        }
+        saver.started = true;
+    }
+
+    swap_save_started(buffer);
+
+    pthread_mutex_lock(&saver.lock);
+    append_job(&saver.queue, job);
+    pthread_cond_signal(&saver.wake);
+    pthread_mutex_unlock(&saver.lock);
+
+    return LITE_OK;
+}
+
+/**
+ * Check whether a save of a buffer is queued or running
+ */
+bool save_running(const Buffer *buffer) {
+    bool running = false;
+
+    pthread_mutex_lock(&saver.lock);
+    running = saver.running && saver.running->buffer == buffer;
+    for (SaveJob *job = saver.queue; job && !running; job = job->next) {
+        running = job->buffer == buffer;
+    }
+    pthread_mutex_unlock(&saver.lock);
+
+    return running;
+}
+
+/**
+ * Take the results of finished saves and report them
+ */
+void save_collect(EditorState *state) {
+    uint64_t count;
+    while (read(saver.notify_fd, &count, sizeof(count)) > 0) {
+    }
+
+    pthread_mutex_lock(&saver.lock);
+    SaveJob *done = saver.done;
+    saver.done = NULL;
+    pthread_mutex_unlock(&saver.lock);
+
+    while (done) {
+        SaveJob *job = done;
+        done = job->next;
+
+        Buffer *buffer = job->buffer;
+        if (job->error == 0) {
+            /* Edits made since the save started are still unsaved */
+            bool current = buffer->version == job->version;
+            buffer_mark_saved(buffer, current, job->hash);
+            editor_set_status_message(state, current ? "Saved %s" : "Saved %s, edited since",
+                                      job->filename);
+        } else {
+            swap_save_failed(buffer);
+            editor_set_status_message(state, "Failed to save %s: %s", job->filename,
+                                      strerror(job->error));
+        }
+
+        free_job(job);
+    }
+}
+
+/**
+ * Stop saving a buffer that is about to be freed
+ *
+ * A running save is waited for, since it reads the buffer's text, and
+ * the others are dropped along with the results.
+ */
+void save_forget(Buffer *buffer) {
+    if (!buffer || !saver.started) return;
+
+    pthread_mutex_lock(&saver.lock);
+
+    SaveJob **link = &saver.queue;
+    while (*link) {
+        SaveJob *job = *link;
+        if (job->buffer == buffer) {
+            *link = job->next;
+            free_job(job);
+        } else {
+            link = &job->next;
+        }
+    }
+
+    while (saver.running && saver.running->buffer == buffer) {
+        pthread_cond_wait(&saver.finished, &saver.lock);
+    }
+
+    link = &saver.done;
+    while (*link) {
+        SaveJob *job = *link;
+        if (job->buffer == buffer) {
+            *link = job->next;
+            free_job(job);
+        } else {
+            link = &job->next;
+        }
+    }
+
+    pthread_mutex_unlock(&saver.lock);
+}
@@ -0,0 +1,699 @@
+/**
+ * swap.c - Crash recovery files for LITE editor
+ *
+ * A swap file starts with a header naming the edited file, the process
+ * editing it and the size and modification time the file had when the
+ * edits started. Batches of edits follow, each an insert with its text
+ * or a delete with its length, under a checksum so that a batch torn by
+ * a crash is recognized and the edits end there.
+ *
+ * Edits are appended to the pending batch of their buffer in memory,
+ * which is all the input path pays. A timer, or the batch reaching
+ * SWAP_BATCH_LIMIT, hands the batch to a thread that appends it to the
+ * file and syncs it. Saving the buffer removes the file, as does
+ * closing it, so a swap file that is found on open was left behind.
+ */
+
+#include "lite.h"
+#include "fs/swap.h"
+#include "fs/file.h"
+#include "utils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* Identifies swap files and their format */
+#define SWAP_MAGIC "LITESWAP"
+#define SWAP_VERSION 1
+
+/* Size of the header, without the path */
+#define SWAP_HEADER (8 + 2 * sizeof(uint32_t) + 3 * sizeof(uint64_t) + sizeof(uint32_t))
+
+/* Size of a batch header: payload length and checksum */
+#define BATCH_HEADER 8
+
+/* Size of an edit, without its text */
+#define EDIT_SIZE (1 + 2 * sizeof(uint64_t))
+
+/* What the writer does with a batch */
+typedef enum {
+    SWAP_APPEND,
+    SWAP_CREATE,                /* Start the file over, the batch has its header */
+    SWAP_REMOVE
+} SwapOp;
+
+/* Batch of edits, built up in memory and then written */
+typedef struct SwapWrite {
+    struct SwapWrite *next;
+    char *path;
+    SwapOp op;
+    size_t batch;               /* Where the batch starts after the header */
+    size_t length;
+    size_t capacity;
+    char *data;
+} SwapWrite;
+
+/* Swap state of a buffer */
+typedef struct SwapFile {
+    char *path;
+    char *source;               /* Absolute path of the edited file */
+    uint64_t base_size;
+    int64_t base_sec;
+    int64_t base_nsec;
+    bool created;               /* The file was started with a header */
+    bool found;                 /* Holds edits of an earlier session */
+    SwapWrite *pending;
+    SwapWrite *since_save;      /* Edits made while a save is running */
+} SwapFile;
+
+/* Writer thread, started on first use */
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    SwapWrite *queue;
+    SwapWrite *tail;
+    bool started;
+    bool stopping;
+    bool enabled;
+} writer = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .enabled = true,
+};
+
+/**
+ * Checksum a batch (FNV-1a)
+ */
+static uint32_t checksum(const char *data, size_t length) {
+    uint32_t sum = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        sum ^= (unsigned char)data[i];
+        sum *= 16777619u;
+    }
+    return sum;
+}
+
+/**
+ * Free a batch
+ */
+static void free_write(SwapWrite *item) {
+    if (!item) return;
+
+    free(item->path);
+    free(item->data);
+    free(item);
+}
+
+/**
+ * Write a whole block to a file descriptor
+ */
+static bool write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+
+    return true;
+}
+
+/**
+ * Create a swap file, along with its directory
+ *
+ * The directory is synced too, so that the file is found after a crash.
+ */
+static int create_file(const char *path) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash) *slash = '\0';
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1 && errno == ENOENT) {
+        file_make_directories(dir);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    }
+    if (fd == -1) return -1;
+
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd != -1) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    return fd;
+}
+
+/**
+ * Carry out a batch on the writer thread
+ */
+static void write_batch(SwapWrite *item) {
+    if (item->op == SWAP_REMOVE) {
+        if (unlink(item->path) != 0 && errno != ENOENT) {
+            LOG_WARNING("Failed to remove swap file %s: %s", item->path, strerror(errno));
+        }
+        return;
+    }
+
+    /* The checksum is left to this thread, it covers the whole batch */
+    char *batch = item->data + item->batch;
+    uint32_t header[2];
+    header[0] = (uint32_t)(item->length - item->batch - BATCH_HEADER);
+    header[1] = checksum(batch + BATCH_HEADER, header[0]);
+    memcpy(batch, header, sizeof(header));
+
+    /* A file that went away is not recreated without its header */
+    int fd = item->op == SWAP_CREATE ? create_file(item->path)
+                                     : open(item->path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd == -1) {
+        LOG_WARNING("Failed to open swap file %s: %s", item->path, strerror(errno));
+        return;
+    }
+
+    if (!write_all(fd, item->data, item->length) || fdatasync(fd) != 0) {
+        LOG_WARNING("Failed to write swap file %s: %s", item->path, strerror(errno));
+    }
+    close(fd);
+}
+
+/**
+ * Writer thread, carries out queued batches in order until stopped
+ */
+static void* writer_main(void *data) {
+    (void)data;
+
+    pthread_mutex_lock(&writer.lock);
+
+    for (;;) {
+        while (!writer.queue && !writer.stopping) {
+            pthread_cond_wait(&writer.wake, &writer.lock);
+        }
+
+        /* Everything queued is written before stopping */
+        SwapWrite *item = writer.queue;
+        if (!item) break;
+
+        writer.queue = item->next;
+        if (!writer.queue) {
+            writer.tail = NULL;
+        }
+        pthread_mutex_unlock(&writer.lock);
+
+        write_batch(item);
+        free_write(item);
+
+        pthread_mutex_lock(&writer.lock);
+    }
+
+    pthread_mutex_unlock(&writer.lock);
+    return NULL;
+}
+
+/**
+ * Hand a batch to the writer thread
+ *
+ * Without a thread the batch is written right away.
+ */
+static void queue_write(SwapWrite *item) {
+    if (!writer.started) {
+        if (pthread_create(&writer.thread, NULL, writer_main, NULL) == 0) {
+            writer.started = true;
+        } else {
+            LOG_ERROR("Failed to start swap file thread");
+            write_batch(item);
+            free_write(item);
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&writer.lock);
+    item->next = NULL;
+    if (writer.tail) {
+        writer.tail->next = item;
+    } else {
+        writer.queue = item;
+    }
+    writer.tail = item;
+    pthread_cond_signal(&writer.wake);
+    pthread_mutex_unlock(&writer.lock);
+}
+
+/**
+ * Turn swap files on or off
+ */
+void swap_set_enabled(bool enabled) {
+    writer.enabled = enabled;
+}
+
+/**
+ * Write out what is queued and stop the writer thread
+ *
+ * Every buffer must have been closed first.
+ */
+void swap_free(void) {
+    if (!writer.started) return;
+
+    pthread_mutex_lock(&writer.lock);
+    writer.stopping = true;
+    pthread_cond_signal(&writer.wake);
+    pthread_mutex_unlock(&writer.lock);
+
+    pthread_join(writer.thread, NULL);
+    writer.started = false;
+    writer.stopping = false;
+}
+
+/**
+ * Make room at the end of a batch
+ */
+static bool reserve(SwapWrite *item, size_t length) {
+    if (item->length + length <= item->capacity) return true;
+
+    size_t capacity = item->capacity > 0 ? item->capacity * 2 : 4096;
+    while (capacity < item->length + length) {
+        capacity *= 2;
+    }
+
+    char *data = (char*)realloc(item->data, capacity);
+    if (!data) return false;
+
+    item->data = data;
+    item->capacity = capacity;
+    return true;
+}
+
+/**
+ * Append a field to a batch that has room for it
+ */
+static void put(SwapWrite *item, const void *data, size_t length) {
+    memcpy(item->data + item->length, data, length);
+    item->length += length;
+}
+
+/**
+ * Queue a request to remove the swap file of a buffer
+ */
+static void remove_file(SwapFile *swap) {
+    SwapWrite *item = (SwapWrite*)calloc(1, sizeof(SwapWrite));
+    if (!item || !(item->path = strdup(swap->path))) {
+        free(item);
+        return;
+    }
+
+    item->op = SWAP_REMOVE;
+    queue_write(item);
+}
+
+/**
+ * Start the pending batch of a buffer
+ *
+ * The first batch after the file was removed starts it over, headed by
+ * what identifies the edited file as it was before the edits.
+ */
+static SwapWrite* start_batch(SwapFile *swap) {
+    SwapWrite *item = (SwapWrite*)calloc(1, sizeof(SwapWrite));
+    if (!item || !(item->path = strdup(swap->path))) {
+        free(item);
+        return NULL;
+    }
+
+    uint32_t source_length = (uint32_t)strlen(swap->source);
+    if (!reserve(item, SWAP_HEADER + source_length + BATCH_HEADER)) {
+        free_write(item);
+        return NULL;
+    }
+
+    if (!swap->created) {
+        uint32_t fields[2] = { SWAP_VERSION, (uint32_t)getpid() };
+        put(item, SWAP_MAGIC, 8);
+        put(item, fields, sizeof(fields));
+        put(item, &swap->base_size, sizeof(uint64_t));
+        put(item, &swap->base_sec, sizeof(int64_t));
+        put(item, &swap->base_nsec, sizeof(int64_t));
+        put(item, &source_length, sizeof(uint32_t));
+        put(item, swap->source, source_length);
+        item->op = SWAP_CREATE;
+    }
+
+    item->batch = item->length;
+    item->length += BATCH_HEADER;
+    return item;
+}
+
+/**
+ * Remember the size and modification time of the edited file
+ */
+static void stat_base(SwapFile *swap, const char *filename) {
+    struct stat st;
+    if (stat(filename, &st) == 0) {
+        swap->base_size = (uint64_t)st.st_size;
+        swap->base_sec = (int64_t)st.st_mtim.tv_sec;
+        swap->base_nsec = (int64_t)st.st_mtim.tv_nsec;
+    } else {
+        swap->base_size = 0;
+        swap->base_sec = 0;
+        swap->base_nsec = 0;
+    }
+}
+
+/**
+ * Check whether a process is still running
+ */
+static bool process_alive(pid_t pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+/**
+ * Read a whole swap file and check that it belongs to a file
+ *
+ * Returns the data with the offset of the first batch, or NULL.
+ */
+static char* read_file(const char *path, const char *source, size_t *length, size_t *first) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+
+    struct stat st;
+    char *data = NULL;
+    if (fstat(fileno(fp), &st) == 0 && (size_t)st.st_size >= SWAP_HEADER) {
+        *length = (size_t)st.st_size;
+        data = (char*)malloc(*length);
+        if (data && fread(data, 1, *length, fp) != *length) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(fp);
+    if (!data) return NULL;
+
+    uint32_t fields[2];
+    uint32_t source_length;
+    memcpy(fields, data + 8, sizeof(fields));
+    memcpy(&source_length, data + SWAP_HEADER - sizeof(uint32_t), sizeof(uint32_t));
+
+    /* Two paths may hash to the same file name */
+    if (memcmp(data, SWAP_MAGIC, 8) != 0 || fields[0] != SWAP_VERSION ||
+        source_length != strlen(source) || source_length > *length - SWAP_HEADER ||
+        memcmp(data + SWAP_HEADER, source, source_length) != 0) {
+        free(data);
+        return NULL;
+    }
+
+    *first = SWAP_HEADER + source_length;
+    return data;
+}
+
+/**
+ * Start logging the edits of a buffer that was just opened
+ *
+ * Returns SWAP_FOUND if a swap file of an earlier session holds edits
+ * that can be recovered. If another editor that is still running keeps
+ * the swap file, the buffer gets none and its process id is stored in
+ * owner.
+ */
+SwapStatus swap_open(Buffer *buffer, int *owner) {
+    if (!buffer || !buffer->filename || !writer.enabled) return SWAP_NONE;
+
+    swap_close(buffer);
+
+    SwapFile *swap = (SwapFile*)calloc(1, sizeof(SwapFile));
+    if (!swap) return SWAP_NONE;
+
+    swap->path = file_cache_path("swap", buffer->filename, ".swp");
+    swap->source = file_get_absolute_path(buffer->filename);
+    if (!swap->path || !swap->source) {
+        free(swap->path);
+        free(swap->source);
+        free(swap);
+        return SWAP_NONE;
+    }
+    stat_base(swap, buffer->filename);
+
+    size_t length, first;
+    char *data = read_file(swap->path, swap->source, &length, &first);
+    if (!data) {
+        buffer->swap = swap;
+        return SWAP_NONE;
+    }
+
+    uint32_t fields[2];
+    memcpy(fields, data + 8, sizeof(fields));
+    bool edits = length > first + BATCH_HEADER;
+    free(data);
+
+    pid_t pid = (pid_t)fields[1];
+    if (pid != getpid() && process_alive(pid)) {
+        if (owner) *owner = (int)pid;
+        free(swap->path);
+        free(swap->source);
+        free(swap);
+        return SWAP_IN_USE;
+    }
+
+    buffer->swap = swap;
+    swap->found = edits;
+    return edits ? SWAP_FOUND : SWAP_NONE;
+}
+
+/**
+ * Append an edit to a batch
+ */
+static void add_edit(SwapWrite *item, bool insert, size_t offset, const char *text, size_t length) {
+    if (!reserve(item, EDIT_SIZE + (insert ? length : 0))) return;
+
+    unsigned char kind = insert ? 1 : 0;
+    uint64_t fields[2] = { offset, length };
+    put(item, &kind, 1);
+    put(item, fields, sizeof(fields));
+    if (insert) {
+        put(item, text, length);
+    }
+}
+
+/**
+ * Log an edit that was just made to a buffer
+ *
+ * text is the inserted text; deletions only log their length. Nothing is
+ * written here, the edit waits in memory for the next flush.
+ */
+void swap_record(Buffer *buffer, bool insert, size_t offset, const char *text, size_t length) {
+    SwapFile *swap = buffer ? buffer->swap : NULL;
+    if (!swap || length == 0) return;
+
+    /* Edits made without recovering start a new file over the old one */
+    swap->found = false;
+
+    if (!swap->pending) {
+        swap->pending = start_batch(swap);
+        if (!swap->pending) return;
+        swap->created = true;
+    }
+
+    add_edit(swap->pending, insert, offset, text, length);
+
+    /* They also go on top of the text being saved, in case it makes it */
+    if (swap->since_save) {
+        add_edit(swap->since_save, insert, offset, text, length);
+    }
+
+    if (swap->pending->length - swap->pending->batch >= SWAP_BATCH_LIMIT) {
+        swap_flush(buffer);
+    }
+}
+
+/**
+ * Hand the pending edits of a buffer to the writer
+ */
+void swap_flush(Buffer *buffer) {
+    SwapFile *swap = buffer ? buffer->swap : NULL;
+    if (!swap || !swap->pending) return;
+
+    queue_write(swap->pending);
+    swap->pending = NULL;
+}
+
+/**
+ * Note that a save of a buffer started from its text as it is now
+ *
+ * Edits made until the save is done are kept apart as well, so that
+ * they can start the swap file of the saved text.
+ */
+void swap_save_started(Buffer *buffer) {
+    SwapFile *swap = buffer ? buffer->swap : NULL;
+    if (!swap) return;
+
+    free_write(swap->since_save);
+    swap->since_save = (SwapWrite*)calloc(1, sizeof(SwapWrite));
+}
+
+/**
+ * Note that a save of a buffer failed, the swap file goes on as before
+ */
+void swap_save_failed(Buffer *buffer) {
+    SwapFile *swap = buffer ? buffer->swap : NULL;
+    if (!swap) return;
+
+    free_write(swap->since_save);
+    swap->since_save = NULL;
+}
+
+/**
+ * Note that a buffer was saved, its edits are no longer needed
+ *
+ * Edits made while a background save ran are what the swap file of the
+ * saved text starts with.
+ */
+void swap_saved(Buffer *buffer) {
+    SwapFile *swap = buffer ? buffer->swap : NULL;
+    if (!swap) return;
+
+    /* Edits left by an earlier session no longer fit the file either */
+    free_write(swap->pending);
+    swap->pending = NULL;
+    if (swap->created || swap->found) {
+        remove_file(swap);
+    }
+    swap->created = false;
+    swap->found = false;
+
+    /* Saving under another name moves the swap file along */
+    char *source = file_get_absolute_path(buffer->filename);
+    if (source && strcmp(source, swap->source) != 0) {
+        char *path = file_cache_path("swap", buffer->filename, ".swp");
+        if (path) {
+            free(swap->path);
+            free(swap->source);
+            swap->path = path;
+            swap->source = source;
+            source = NULL;
+        }
+    }
+    free(source);
+
+    stat_base(swap, buffer->filename);
+
+    SwapWrite *since_save = swap->since_save;
+    swap->since_save = NULL;
+    if (since_save && since_save->length > 0) {
+        swap->pending = start_batch(swap);
+        if (swap->pending && reserve(swap->pending, since_save->length)) {
+            put(swap->pending, since_save->data, since_save->length);
+            swap->created = true;
+        }
+    }
+    free_write(since_save);
+}
+
+/**
+ * Apply the edits left in the swap file to a buffer
+ *
+ * The buffer must not have been edited since it was opened. The edits
+ * are made as one undo step and logged to a new swap file. The number of
+ * edits applied is stored in edits.
+ */
+int swap_recover(Buffer *buffer, size_t *edits) {
+    SwapFile *swap = buffer ? buffer->swap : NULL;
+    if (!swap || !swap->found) return LITE_ERROR_FILE_NOT_FOUND;
+
+    size_t length, first;
+    char *data = read_file(swap->path, swap->source, &length, &first);
+    if (!data) return LITE_ERROR_FILE_NOT_FOUND;
+
+    /* The edits only make sense on the file they were made to */
+    uint64_t base[3];
+    memcpy(base, data + 8 + 2 * sizeof(uint32_t), sizeof(base));
+    if (base[0] != swap->base_size || (int64_t)base[1] != swap->base_sec ||
+        (int64_t)base[2] != swap->base_nsec) {
+        free(data);
+        return LITE_ERROR_FILE_CHANGED;
+    }
+
+    undo_seal(&buffer->undo);
+
+    size_t applied = 0;
+    const char *in = data + first;
+    const char *end = data + length;
+    while ((size_t)(end - in) >= BATCH_HEADER) {
+        uint32_t header[2];
+        memcpy(header, in, sizeof(header));
+        in += BATCH_HEADER;
+
+        /* A batch cut short by a crash ends the edits */
+        if (header[0] > (size_t)(end - in) || checksum(in, header[0]) != header[1]) break;
+
+        const char *batch_end = in + header[0];
+        while ((size_t)(batch_end - in) >= EDIT_SIZE) {
+            uint64_t fields[2];
+            bool insert = *in++ != 0;
+            memcpy(fields, in, sizeof(fields));
+            in += sizeof(fields);
+
+            const char *text = NULL;
+            if (insert) {
+                if (fields[1] > (size_t)(batch_end - in)) break;
+                text = in;
+                in += fields[1];
+            }
+
+            if (buffer_edit(buffer, insert, (size_t)fields[0], text, (size_t)fields[1]) != LITE_OK) break;
+            applied++;
+        }
+        in = batch_end;
+    }
+
+    undo_seal(&buffer->undo);
+    free(data);
+
+    if (edits) *edits = applied;
+    return LITE_OK;
+}
+
+/**
+ * Write out the pending edits of a buffer and leave its swap file behind
+ *
+ * Used when the editor is made to exit, so that the edits can be
+ * recovered the next time.
+ */
+void swap_detach(Buffer *buffer) {
+    SwapFile *swap = buffer ? buffer->swap : NULL;
+    if (!swap) return;
+
+    swap_flush(buffer);
+
+    free_write(swap->since_save);
+    free(swap->path);
+    free(swap->source);
+    free(swap);
+    buffer->swap = NULL;
+}
+
+/**
+ * Stop logging the edits of a buffer and remove its swap file
+ */
+void swap_close(Buffer *buffer) {
+    SwapFile *swap = buffer ? buffer->swap : NULL;
+    if (!swap) return;
+
+    free_write(swap->pending);
+    free_write(swap->since_save);
+    if (swap->created) {
+        remove_file(swap);
+    }
+
+    free(swap->path);
+    free(swap->source);
+    free(swap);
+    buffer->swap = NULL;
+}
@@ -0,0 +1,709 @@
+/**
+ * undofile.c - Persistent undo history for LITE editor
+ *
+ * A history file starts with a header naming the edited file, followed by
+ * batches. Each batch holds the records that changed since the batch
+ * before, from the first changed one to the newest, plus the journal
+ * positions and the hash of the text as last saved. Reading the batches
+ * back in order rebuilds the journal; a batch cut short by a crash fails
+ * its checksum and ends the history there.
+ *
+ * Batches are put together on the UI thread, which only copies the new
+ * records, and written by a thread of their own, so the disk is never
+ * waited on while typing. Once a file has grown well beyond the history
+ * it holds, the next batch carries the whole journal and replaces it.
+ */
+
+#include "lite.h"
+#include "fs/undofile.h"
+#include "fs/file.h"
+#include "core/undo.h"
+#include "utils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* Identifies history files and their format */
+#define UNDOFILE_MAGIC "LITEUNDO"
+#define UNDOFILE_VERSION 1
+
+/* Size of a batch header: payload length and checksum */
+#define BATCH_HEADER 8
+
+/* Size of the journal positions at the start of a batch */
+#define BATCH_FIELDS (6 * sizeof(uint64_t))
+
+/* Size of a record in a batch, without its text */
+#define RECORD_SIZE (2 * sizeof(uint64_t) + 2)
+
+/* History state of a buffer */
+typedef struct UndoFile {
+    char *path;                 /* History file */
+    char *source;               /* Absolute path of the edited file */
+    uint64_t saved_hash;
+    bool hash_known;
+    bool rewrite;               /* The next batch replaces the file */
+    size_t file_bytes;
+    size_t written_current;
+    size_t written_saved;
+    size_t written_dropped;
+    uint64_t written_hash;
+} UndoFile;
+
+/* Batch waiting to be written */
+typedef struct UndoWrite {
+    struct UndoWrite *next;
+    char *path;
+    bool replace;
+    size_t batch;               /* Where the batch starts after the file header */
+    size_t length;
+    char data[];
+} UndoWrite;
+
+/* Writer thread, started on first use */
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    UndoWrite *queue;
+    UndoWrite *tail;
+    bool started;
+    bool stopping;
+    bool enabled;
+} writer = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .enabled = true,
+};
+
+/**
+ * Mix a word into a hash
+ */
+static uint64_t mix(uint64_t hash, uint64_t word) {
+    hash ^= word;
+    hash *= 0x9e3779b97f4a7c15ULL;
+    return hash ^ (hash >> 29);
+}
+
+/**
+ * Start hashing a text
+ */
+void undofile_hash_init(UndoHash *h) {
+    h->hash = 0x243f6a8885a308d3ULL;
+    h->word = 0;
+    h->fill = 0;
+    h->length = 0;
+}
+
+/**
+ * Hash the next bytes of a text
+ *
+ * The text is taken eight bytes at a time, whatever chunks it comes in.
+ */
+void undofile_hash_add(UndoHash *h, const char *text, size_t length) {
+    const unsigned char *data = (const unsigned char*)text;
+    h->length += length;
+
+    while (length > 0 && h->fill > 0) {
+        h->word |= (uint64_t)*data++ << (8 * h->fill);
+        length--;
+        if (++h->fill == 8) {
+            h->hash = mix(h->hash, h->word);
+            h->word = 0;
+            h->fill = 0;
+        }
+    }
+
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        h->hash = mix(h->hash, word);
+        data += 8;
+        length -= 8;
+    }
+
+    while (length > 0) {
+        h->word |= (uint64_t)*data++ << (8 * h->fill);
+        h->fill++;
+        length--;
+    }
+}
+
+/**
+ * Get the hash of the text taken so far
+ */
+uint64_t undofile_hash_end(const UndoHash *h) {
+    return mix(mix(h->hash, h->word), h->length);
+}
+
+/**
+ * Hash the text of a piece table
+ *
+ * This reads the whole text, so it is done where the text is read anyway
+ * or on another thread, not while typing.
+ */
+uint64_t undofile_hash_text(const PieceTable *text) {
+    UndoHash h;
+    size_t offset = 0;
+    size_t length;
+    const char *chunk;
+
+    undofile_hash_init(&h);
+    while ((chunk = piece_table_chunk(text, offset, &length)) != NULL) {
+        undofile_hash_add(&h, chunk, length);
+        offset += length;
+    }
+
+    return undofile_hash_end(&h);
+}
+
+/**
+ * Checksum a batch (FNV-1a)
+ */
+static uint32_t checksum(const char *data, size_t length) {
+    uint32_t sum = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        sum ^= (unsigned char)data[i];
+        sum *= 16777619u;
+    }
+    return sum;
+}
+
+/**
+ * Write a whole block to a file descriptor
+ */
+static bool write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+
+    return true;
+}
+
+/**
+ * Write a batch to its history file on the writer thread
+ */
+static void write_batch(UndoWrite *item) {
+    /* The checksum is left to this thread, it covers the whole batch */
+    char *batch = item->data + item->batch;
+    uint32_t header[2];
+    header[0] = (uint32_t)(item->length - item->batch - BATCH_HEADER);
+    header[1] = checksum(batch + BATCH_HEADER, header[0]);
+    memcpy(batch, header, sizeof(header));
+
+    if (!item->replace) {
+        /* A file that went away is not recreated without its header */
+        int fd = open(item->path, O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (fd == -1) return;
+
+        if (!write_all(fd, item->data, item->length)) {
+            LOG_WARNING("Failed to write undo history %s: %s", item->path, strerror(errno));
+        }
+        close(fd);
+        return;
+    }
+
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s.tmp", item->path);
+
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1 && errno == ENOENT) {
+        char *slash = strrchr(temp, '/');
+        *slash = '\0';
+        file_make_directories(temp);
+        *slash = '/';
+        fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    }
+    if (fd == -1) {
+        LOG_WARNING("Failed to create undo history %s: %s", temp, strerror(errno));
+        return;
+    }
+
+    bool ok = write_all(fd, item->data, item->length);
+    if (close(fd) != 0 || !ok || rename(temp, item->path) != 0) {
+        LOG_WARNING("Failed to write undo history %s: %s", item->path, strerror(errno));
+        unlink(temp);
+    }
+}
+
+/**
+ * Writer thread, writes queued batches in order until stopped
+ */
+static void* writer_main(void *data) {
+    (void)data;
+
+    pthread_mutex_lock(&writer.lock);
+
+    for (;;) {
+        while (!writer.queue && !writer.stopping) {
+            pthread_cond_wait(&writer.wake, &writer.lock);
+        }
+
+        /* Everything queued is written before stopping */
+        UndoWrite *item = writer.queue;
+        if (!item) break;
+
+        writer.queue = item->next;
+        if (!writer.queue) {
+            writer.tail = NULL;
+        }
+        pthread_mutex_unlock(&writer.lock);
+
+        write_batch(item);
+        free(item->path);
+        free(item);
+
+        pthread_mutex_lock(&writer.lock);
+    }
+
+    pthread_mutex_unlock(&writer.lock);
+    return NULL;
+}
+
+/**
+ * Hand a batch to the writer thread
+ *
+ * Without a thread the batch is written right away.
+ */
+static void queue_write(UndoWrite *item) {
+    if (!writer.started) {
+        if (pthread_create(&writer.thread, NULL, writer_main, NULL) == 0) {
+            writer.started = true;
+        } else {
+            LOG_ERROR("Failed to start undo history thread");
+            write_batch(item);
+            free(item->path);
+            free(item);
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&writer.lock);
+    item->next = NULL;
+    if (writer.tail) {
+        writer.tail->next = item;
+    } else {
+        writer.queue = item;
+    }
+    writer.tail = item;
+    pthread_cond_signal(&writer.wake);
+    pthread_mutex_unlock(&writer.lock);
+}
+
+/**
+ * Turn keeping undo history on disk on or off
+ */
+void undofile_set_enabled(bool enabled) {
+    writer.enabled = enabled;
+}
+
+/**
+ * Check whether undo history is kept on disk
+ */
+bool undofile_enabled(void) {
+    return writer.enabled;
+}
+
+/**
+ * Write out what is queued and stop the writer thread
+ *
+ * Every buffer must have been closed first.
+ */
+void undofile_free(void) {
+    if (!writer.started) return;
+
+    pthread_mutex_lock(&writer.lock);
+    writer.stopping = true;
+    pthread_cond_signal(&writer.wake);
+    pthread_mutex_unlock(&writer.lock);
+
+    pthread_join(writer.thread, NULL);
+    writer.started = false;
+    writer.stopping = false;
+}
+
+/**
+ * Append a 64-bit field to a batch
+ */
+static char* put_u64(char *out, uint64_t value) {
+    memcpy(out, &value, sizeof(value));
+    return out + sizeof(value);
+}
+
+/**
+ * Read a 64-bit field of a batch
+ */
+static const char* get_u64(const char *in, uint64_t *value) {
+    memcpy(value, in, sizeof(*value));
+    return in + sizeof(*value);
+}
+
+/**
+ * Write the changes of a buffer's journal since the last batch
+ */
+void undofile_flush(Buffer *buffer) {
+    UndoFile *file = buffer ? buffer->undo_file : NULL;
+    if (!file) return;
+
+    UndoJournal *journal = &buffer->undo;
+    size_t end = journal->dropped + journal->count;
+    uint64_t saved = journal->saved != UNDO_UNSAVED && file->hash_known ? journal->saved : UINT64_MAX;
+
+    if (!file->rewrite && journal->changed >= end &&
+        journal->dropped + journal->current == file->written_current &&
+        saved == file->written_saved && journal->dropped == file->written_dropped &&
+        file->saved_hash == file->written_hash) {
+        return;
+    }
+
+    /* A file mostly made of history that was replaced since is rewritten */
+    size_t history = journal->count * RECORD_SIZE + journal->log_length;
+    if (file->file_bytes > history * 2 + UNDOFILE_SLACK) {
+        file->rewrite = true;
+    }
+
+    size_t from = file->rewrite ? 0 : journal->changed;
+    size_t first = (from > journal->dropped ? from : journal->dropped) - journal->dropped;
+    if (first > journal->count) {
+        first = journal->count;
+    }
+
+    size_t header = 0;
+    size_t source_length = strlen(file->source);
+    if (file->rewrite) {
+        header = strlen(UNDOFILE_MAGIC) + 2 * sizeof(uint32_t) + source_length;
+    }
+
+    size_t length = header + BATCH_HEADER + BATCH_FIELDS;
+    for (size_t i = first; i < journal->count; i++) {
+        length += RECORD_SIZE + journal->records[i].length;
+    }
+    if (length - header - BATCH_HEADER > UINT32_MAX) return;
+
+    UndoWrite *item = (UndoWrite*)malloc(sizeof(UndoWrite) + length);
+    char *path = item ? strdup(file->path) : NULL;
+    if (!path) {
+        free(item);
+        return;
+    }
+
+    item->path = path;
+    item->replace = file->rewrite;
+    item->batch = header;
+    item->length = length;
+
+    char *out = item->data;
+    if (file->rewrite) {
+        uint32_t fields[2] = { UNDOFILE_VERSION, (uint32_t)source_length };
+        memcpy(out, UNDOFILE_MAGIC, strlen(UNDOFILE_MAGIC));
+        out += strlen(UNDOFILE_MAGIC);
+        memcpy(out, fields, sizeof(fields));
+        out += sizeof(fields);
+        memcpy(out, file->source, source_length);
+        out += source_length;
+    }
+
+    out += BATCH_HEADER;
+    out = put_u64(out, journal->dropped + first);
+    out = put_u64(out, journal->dropped);
+    out = put_u64(out, journal->dropped + journal->current);
+    out = put_u64(out, saved);
+    out = put_u64(out, file->saved_hash);
+    out = put_u64(out, journal->count - first);
+
+    for (size_t i = first; i < journal->count; i++) {
+        const UndoRecord *record = &journal->records[i];
+        out = put_u64(out, record->offset);
+        out = put_u64(out, record->length);
+        *out++ = (char)record->kind;
+        *out++ = (char)record->joined;
+        memcpy(out, undo_text(journal, record), record->length);
+        out += record->length;
+    }
+
+    file->file_bytes = file->rewrite ? length : file->file_bytes + length;
+    file->rewrite = false;
+    file->written_current = journal->dropped + journal->current;
+    file->written_saved = saved;
+    file->written_dropped = journal->dropped;
+    file->written_hash = file->saved_hash;
+    undo_mark_written(journal);
+
+    queue_write(item);
+}
+
+/* Journal rebuilt from a history file */
+typedef struct UndoReplay {
+    UndoRecord *records;
+    size_t count;
+    size_t capacity;
+    size_t origin;              /* Number of the first record */
+    const char **texts;
+    uint64_t dropped;
+    uint64_t current;
+    uint64_t saved;
+    uint64_t hash;
+} UndoReplay;
+
+/**
+ * Apply a batch to a journal being rebuilt
+ *
+ * Text of the records stays in the file data. Returns false if the batch
+ * does not fit onto the batches before it.
+ */
+static bool replay_batch(UndoReplay *replay, const char *in, size_t length, bool first_batch) {
+    if (length < BATCH_FIELDS) return false;
+
+    const char *end = in + length;
+    uint64_t from, dropped, current, saved, hash, count;
+    in = get_u64(in, &from);
+    in = get_u64(in, &dropped);
+    in = get_u64(in, &current);
+    in = get_u64(in, &saved);
+    in = get_u64(in, &hash);
+    in = get_u64(in, &count);
+
+    uint64_t start = from > dropped ? from : dropped;
+    if (first_batch) {
+        replay->origin = (size_t)start;
+    }
+    if (start < replay->origin || start > replay->origin + replay->count) return false;
+    if (count > (size_t)(end - in) / RECORD_SIZE) return false;
+
+    size_t kept = (size_t)(start - replay->origin);
+    if (kept + count > replay->capacity) {
+        size_t capacity = kept + count + 64;
+        UndoRecord *records = (UndoRecord*)realloc(replay->records, capacity * sizeof(UndoRecord));
+        if (!records) return false;
+        replay->records = records;
+
+        const char **texts = (const char**)realloc(replay->texts, capacity * sizeof(char*));
+        if (!texts) return false;
+        replay->texts = texts;
+
+        replay->capacity = capacity;
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        if ((size_t)(end - in) < RECORD_SIZE) return false;
+
+        UndoRecord *record = &replay->records[kept + i];
+        uint64_t offset, text_length;
+        in = get_u64(in, &offset);
+        in = get_u64(in, &text_length);
+        record->kind = (unsigned char)*in++;
+        record->joined = *in++ != 0;
+        if (text_length > (size_t)(end - in) || record->kind > UNDO_DELETE) return false;
+
+        record->offset = (size_t)offset;
+        record->length = (size_t)text_length;
+        replay->texts[kept + i] = in;
+        in += text_length;
+    }
+
+    if (dropped < replay->origin || dropped > start + count || current < dropped ||
+        current > start + count) {
+        return false;
+    }
+
+    replay->count = kept + (size_t)count;
+    replay->dropped = dropped;
+    replay->current = current;
+    replay->saved = saved;
+    replay->hash = hash;
+    return true;
+}
+
+/**
+ * Rebuild a journal from the contents of a history file
+ *
+ * Returns LITE_OK if the history belongs to the text of the buffer and
+ * was restored.
+ */
+static int restore_history(Buffer *buffer, UndoFile *file, const char *data, size_t length) {
+    size_t magic = strlen(UNDOFILE_MAGIC);
+    uint32_t fields[2];
+    if (length < magic + sizeof(fields) || memcmp(data, UNDOFILE_MAGIC, magic) != 0) return LITE_ERROR;
+
+    memcpy(fields, data + magic, sizeof(fields));
+    const char *in = data + magic + sizeof(fields);
+    const char *end = data + length;
+    if (fields[0] != UNDOFILE_VERSION || fields[1] > (size_t)(end - in)) return LITE_ERROR;
+
+    /* Two paths may hash to the same file name */
+    if (fields[1] != strlen(file->source) || memcmp(in, file->source, fields[1]) != 0) return LITE_ERROR;
+    in += fields[1];
+
+    UndoReplay replay;
+    memset(&replay, 0, sizeof(replay));
+    bool any = false;
+
+    while ((size_t)(end - in) >= BATCH_HEADER) {
+        uint32_t header[2];
+        memcpy(header, in, sizeof(header));
+        in += BATCH_HEADER;
+
+        /* A batch cut short by a crash ends the history */
+        if (header[0] > (size_t)(end - in) || checksum(in, header[0]) != header[1]) break;
+        if (!replay_batch(&replay, in, header[0], !any)) break;
+
+        any = true;
+        in += header[0];
+    }
+
+    int result = LITE_ERROR;
+    if (any && replay.saved != UINT64_MAX && replay.hash == file->saved_hash &&
+        replay.saved >= replay.dropped && replay.saved <= replay.origin + replay.count) {
+        /* Gather the text of the records that were not dropped */
+        size_t skip = (size_t)(replay.dropped - replay.origin);
+        size_t count = replay.count - skip;
+        size_t text = 0;
+        for (size_t i = skip; i < replay.count; i++) {
+            text += replay.records[i].length;
+        }
+
+        char *log = (char*)malloc(text > 0 ? text : 1);
+        if (log) {
+            size_t position = 0;
+            for (size_t i = skip; i < replay.count; i++) {
+                replay.records[i].text = position;
+                memcpy(log + position, replay.texts[i], replay.records[i].length);
+                position += replay.records[i].length;
+            }
+
+            /* The file holds the saved text, so that is where the history resumes */
+            result = undo_restore(&buffer->undo, replay.records + skip, count, log, text,
+                                  (size_t)replay.dropped, (size_t)replay.saved, (size_t)replay.saved);
+            free(log);
+        }
+    }
+
+    if (result == LITE_OK) {
+        file->written_current = (size_t)replay.current;
+        file->written_saved = (size_t)replay.saved;
+        file->written_dropped = (size_t)replay.dropped;
+        file->written_hash = replay.hash;
+        file->file_bytes = length;
+    }
+
+    free(replay.records);
+    free(replay.texts);
+    return result;
+}
+
+/**
+ * Read a whole history file
+ */
+static char* read_history(const char *path, size_t *length) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+
+    struct stat st;
+    char *data = NULL;
+    if (fstat(fileno(fp), &st) == 0 && st.st_size > 0) {
+        data = (char*)malloc((size_t)st.st_size);
+        if (data && fread(data, 1, (size_t)st.st_size, fp) != (size_t)st.st_size) {
+            free(data);
+            data = NULL;
+        }
+        *length = (size_t)st.st_size;
+    }
+
+    fclose(fp);
+    return data;
+}
+
+/**
+ * Start keeping the history of a buffer that was just loaded from a file
+ *
+ * History kept from earlier sessions is restored if the file still holds
+ * the text it was last saved with. hash is the hash of the text when it
+ * was taken while loading, otherwise the text is hashed here if there is
+ * history to restore.
+ */
+void undofile_open(Buffer *buffer, const uint64_t *hash) {
+    if (!buffer || !buffer->filename || !writer.enabled) return;
+
+    undofile_close(buffer);
+
+    char *source = file_get_absolute_path(buffer->filename);
+    char *path = file_cache_path("undo", buffer->filename, ".undo");
+    UndoFile *file = (UndoFile*)calloc(1, sizeof(UndoFile));
+    if (!source || !path || !file) {
+        free(source);
+        free(path);
+        free(file);
+        return;
+    }
+
+    file->path = path;
+    file->source = source;
+    file->rewrite = true;
+    buffer->undo_file = file;
+
+    size_t length = 0;
+    char *data = read_history(path, &length);
+    if (!data) return;
+
+    /* Only a file with history needs hashing now, the others wait for a save */
+    file->saved_hash = hash ? *hash : undofile_hash_text(&buffer->text);
+    file->hash_known = true;
+
+    if (restore_history(buffer, file, data, length) == LITE_OK) {
+        file->rewrite = false;
+        LOG_INFO("Restored undo history of %s", buffer->filename);
+    }
+
+    free(data);
+}
+
+/**
+ * Note that a buffer was saved, and write out its history
+ *
+ * hash is the hash of the text that was saved, taken by whoever saved it.
+ */
+void undofile_saved(Buffer *buffer, uint64_t hash) {
+    if (!buffer || !buffer->filename) return;
+
+    /* Saving under another name starts the history of that file */
+    UndoFile *file = buffer->undo_file;
+    char *source = file_get_absolute_path(buffer->filename);
+    if (!file || !source || strcmp(source, file->source) != 0) {
+        undofile_open(buffer, &hash);
+        file = buffer->undo_file;
+    }
+    free(source);
+
+    if (!file) return;
+
+    file->saved_hash = hash;
+    file->hash_known = true;
+    undofile_flush(buffer);
+}
+
+/**
+ * Write out the history of a buffer and stop keeping it
+ */
+void undofile_close(Buffer *buffer) {
+    if (!buffer || !buffer->undo_file) return;
+
+    undofile_flush(buffer);
+
+    free(buffer->undo_file->path);
+    free(buffer->undo_file->source);
+    free(buffer->undo_file);
+    buffer->undo_file = NULL;
+}
@@ -11,23 +11,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <locale.h>
-#include <signal.h>
-
-/* Global editor state for signal handlers */
-static EditorState *global_state = NULL;
-
-/* Signal handler for cleanup */
-static void handle_signal(int sig) {
-    if (global_state) {
-        editor_free(global_state);
-    }
-    
-    /* Reset terminal */
-    endwin();
-    
-    fprintf(stderr, "Received signal %d, exiting\n", sig);
-    exit(1);
-}
 
 /* Print usage information */
 static void print_usage(const char *program_name) {
@@ -68,10 +51,6 @@ int main(int argc, char *argv[]) {
     log_init("lite.log");
     LOG_INFO("LITE Editor starting");
     
-    /* Set up signal handlers */
-    signal(SIGINT, handle_signal);
-    signal(SIGTERM, handle_signal);
-    
     /* Initialize editor */
     EditorState *state = editor_init();
     if (!state) {
@@ -79,8 +58,8 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
-    /* Store global reference for signal handlers */
-    global_state = state;
+    /* Load configuration */
+    editor_load_config(state, state->config.config_path);
     
     /* Open files from command line */
     for (i = 1; i < argc; i++) {
@@ -103,17 +82,14 @@ int main(int argc, char *argv[]) {
         /* Render editor state */
         editor_render(state);
         
-        /* Get and process user input */
-        int key = ui_get_key(state);
-        editor_process_key(state, key);
-        
-        /* Update editor state */
-        editor_update(state);
+        /* Sleep until input, a timer or a signal needs handling */
+        if (event_loop_run_once(&state->events) != LITE_OK) {
+            break;
+        }
     }
     
     /* Clean up */
     editor_free(state);
-    global_state = NULL;
     
     LOG_INFO("LITE Editor exiting");
     log_close();
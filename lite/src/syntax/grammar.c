@@ -0,0 +1,477 @@
+/**
+ * grammar.c - Data-defined language grammars for LITE editor
+ *
+ * Grammars are loaded once at startup from GRAMMAR_DIR next to the
+ * configuration file. Each one is compiled into an image that is written
+ * to GRAMMAR_CACHE_DIR, and a cached image whose source has not changed
+ * since is mapped instead of compiling the source again. The loaded
+ * grammars are never modified, so the highlighting worker reads them
+ * without locking.
+ */
+
+#include "lite.h"
+#include "syntax/grammar.h"
+#include "syntax/highlight.h"
+#include "syntax/keyword_hash.h"
+#include "utils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+/* Loaded grammars, searched in load order */
+static Grammar grammars[GRAMMAR_MAX_LOADED];
+static int grammar_count = 0;
+
+/**
+ * Check that an array lies within an image
+ */
+static bool in_image(size_t size, uint32_t offset, size_t count, size_t element) {
+    if (offset % 4 != 0 || offset > size) return false;
+    return count <= (size - offset) / element;
+}
+
+/**
+ * Check an image and set up the table pointers of a grammar
+ *
+ * A cached image is checked in full before use, so that a damaged or
+ * foreign cache file cannot send the lexer outside the tables. With st
+ * given, the image must also have been compiled from that source.
+ */
+static bool open_image(Grammar *grammar, const unsigned char *image, size_t size, const struct stat *st) {
+    const GrammarHeader *h = (const GrammarHeader*)image;
+
+    if (size < sizeof(GrammarHeader) || h->magic != GRAMMAR_MAGIC ||
+        h->version != GRAMMAR_VERSION || h->size != size) {
+        return false;
+    }
+
+    if (st && (h->source_size != (uint64_t)st->st_size ||
+               h->source_mtime != (int64_t)st->st_mtim.tv_sec ||
+               h->source_mtime_nsec != (int64_t)st->st_mtim.tv_nsec)) {
+        return false;
+    }
+
+    if (h->context_count == 0 || h->context_count > GRAMMAR_MAX_CONTEXTS ||
+        h->state_count == 0 || h->state_count > GRAMMAR_MAX_STATES ||
+        h->class_count == 0 || h->class_count > 256 ||
+        h->rule_count > GRAMMAR_MAX_RULES || ((h->keyword_mask + 1) & h->keyword_mask) != 0) {
+        return false;
+    }
+
+    size_t slots = (size_t)h->keyword_mask + 1;
+    if (!in_image(size, h->files, h->file_count, sizeof(uint32_t)) ||
+        !in_image(size, h->contexts, h->context_count, sizeof(GrammarContext)) ||
+        !in_image(size, h->rules, h->rule_count, sizeof(GrammarRule)) ||
+        !in_image(size, h->classes, 256, 1) ||
+        !in_image(size, h->transitions, (size_t)h->state_count * h->class_count, sizeof(uint16_t)) ||
+        !in_image(size, h->accepts, h->state_count, sizeof(uint16_t)) ||
+        !in_image(size, h->keywords, slots, sizeof(GrammarKeyword)) ||
+        !in_image(size, h->strings, h->strings_size, 1) ||
+        h->strings_size == 0 || image[h->strings + h->strings_size - 1] != '\0' ||
+        h->name >= h->strings_size) {
+        return false;
+    }
+
+    grammar->image = image;
+    grammar->size = size;
+    grammar->header = h;
+    grammar->files = (const uint32_t*)(image + h->files);
+    grammar->contexts = (const GrammarContext*)(image + h->contexts);
+    grammar->rules = (const GrammarRule*)(image + h->rules);
+    grammar->classes = image + h->classes;
+    grammar->transitions = (const uint16_t*)(image + h->transitions);
+    grammar->accepts = (const uint16_t*)(image + h->accepts);
+    grammar->keywords = (const GrammarKeyword*)(image + h->keywords);
+    grammar->strings = (const char*)(image + h->strings);
+
+    for (uint32_t i = 0; i < h->file_count; i++) {
+        if (grammar->files[i] >= h->strings_size) return false;
+    }
+
+    for (uint32_t i = 0; i < h->context_count; i++) {
+        const GrammarContext *context = &grammar->contexts[i];
+        if (context->start >= h->state_count || context->line_start >= h->state_count ||
+            context->eol >= h->context_count || context->token >= TOK_COUNT) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < h->rule_count; i++) {
+        const GrammarRule *rule = &grammar->rules[i];
+        if (rule->token >= TOK_COUNT ||
+            (rule->next != GRAMMAR_STAY && rule->next >= h->context_count)) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < 256; i++) {
+        if (grammar->classes[i] >= h->class_count) return false;
+    }
+
+    for (size_t i = 0; i < (size_t)h->state_count * h->class_count; i++) {
+        if (grammar->transitions[i] >= h->state_count) return false;
+    }
+
+    for (uint32_t i = 0; i < h->state_count; i++) {
+        if (grammar->accepts[i] > h->rule_count) return false;
+    }
+
+    for (size_t i = 0; i < slots; i++) {
+        const GrammarKeyword *keyword = &grammar->keywords[i];
+        if (keyword->length > 0 && (keyword->token >= TOK_COUNT ||
+            keyword->word >= h->strings_size || keyword->length > h->strings_size - keyword->word - 1)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Map a cached image
+ *
+ * Returns NULL if there is no usable cache for the source.
+ */
+static const unsigned char* map_cache(Grammar *grammar, const char *path, const struct stat *source) {
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(GrammarHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    if (!open_image(grammar, (const unsigned char*)map, (size_t)st.st_size, source)) {
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+
+    grammar->mapped = true;
+    return (const unsigned char*)map;
+#else
+    (void)grammar;
+    (void)path;
+    (void)source;
+    return NULL;
+#endif
+}
+
+/**
+ * Write a compiled image to the cache
+ *
+ * The image goes to a temporary file that is renamed into place, so a
+ * concurrent start never maps a half-written cache.
+ */
+static int write_cache(const char *cache_dir, const char *path, const unsigned char *image, size_t size) {
+    if (mkdir(cache_dir, 0755) != 0 && errno != EEXIST) return LITE_ERROR;
+
+    size_t length = strlen(path) + 8;
+    char *temp_path = (char*)malloc(length);
+    if (!temp_path) return LITE_ERROR;
+    snprintf(temp_path, length, "%s.XXXXXX", path);
+
+    int fd = mkstemp(temp_path);
+    if (fd == -1) {
+        free(temp_path);
+        return LITE_ERROR;
+    }
+    fchmod(fd, 0644);
+
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = write(fd, image + written, size - written);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            break;
+        }
+        written += (size_t)n;
+    }
+
+    int result = written == size && close(fd) == 0 ? LITE_OK : LITE_ERROR;
+    if (written != size) close(fd);
+
+    if (result == LITE_OK && rename(temp_path, path) != 0) {
+        result = LITE_ERROR;
+    }
+    if (result != LITE_OK) {
+        unlink(temp_path);
+    }
+
+    free(temp_path);
+    return result;
+}
+
+/**
+ * Join a directory and a file name
+ */
+static char* join_path(const char *dir, const char *name) {
+    size_t length = strlen(dir) + strlen(name) + 2;
+    char *path = (char*)malloc(length);
+    if (path) {
+        snprintf(path, length, "%s/%s", dir, name);
+    }
+    return path;
+}
+
+/**
+ * Load one grammar, from the cache if it is up to date
+ */
+static int load_grammar(const char *dir, const char *file) {
+    char *source = join_path(dir, file);
+    char *cache_dir = join_path(dir, GRAMMAR_CACHE_DIR);
+    char *cache_name = (char*)malloc(strlen(file) + 5);
+    char *cache = NULL;
+    int result = LITE_ERROR;
+
+    if (cache_name) {
+        sprintf(cache_name, "%s.bin", file);
+        cache = cache_dir ? join_path(cache_dir, cache_name) : NULL;
+    }
+
+    struct stat st;
+    if (!source || !cache || stat(source, &st) != 0) goto done;
+
+    Grammar *grammar = &grammars[grammar_count];
+    memset(grammar, 0, sizeof(Grammar));
+
+    if (!map_cache(grammar, cache, &st)) {
+        unsigned char *image;
+        size_t size;
+        char error[256];
+
+        if (grammar_compile(source, &image, &size, error, sizeof(error)) != LITE_OK) {
+            LOG_WARNING("Grammar not loaded: %s", error);
+            goto done;
+        }
+
+        /* Use the cache just written so that the image is shared and
+         * paged like on later starts, or keep the compiled copy */
+        if (write_cache(cache_dir, cache, image, size) != LITE_OK) {
+            LOG_WARNING("Cannot write grammar cache %s: %s", cache, strerror(errno));
+        }
+
+        if (map_cache(grammar, cache, &st)) {
+            free(image);
+        } else if (open_image(grammar, image, size, NULL)) {
+            grammar->mapped = false;
+        } else {
+            LOG_ERROR("Compiled grammar %s is invalid", source);
+            free(image);
+            goto done;
+        }
+    }
+
+    grammar->path = source;
+    source = NULL;
+    grammar_count++;
+    result = LITE_OK;
+
+    LOG_INFO("Loaded grammar %s from %s", grammar_name(grammar), grammar->path);
+
+done:
+    free(source);
+    free(cache_dir);
+    free(cache_name);
+    free(cache);
+    return result;
+}
+
+/**
+ * Compare file names for sorting
+ */
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * Load every grammar in a directory
+ *
+ * Files ending in ".grammar" are loaded in name order, and an earlier
+ * grammar wins when two claim the same files. Loading happens once,
+ * before any buffer is highlighted. Returns the number of grammars
+ * loaded.
+ */
+int grammar_load_dir(const char *dir) {
+    if (!dir || grammar_count > 0) return grammar_count;
+
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+
+    char *names[GRAMMAR_MAX_LOADED];
+    int count = 0;
+    struct dirent *entry;
+
+    while ((entry = readdir(d)) != NULL && count < GRAMMAR_MAX_LOADED) {
+        size_t length = strlen(entry->d_name);
+        if (entry->d_name[0] == '.' || length <= 8 ||
+            strcmp(entry->d_name + length - 8, ".grammar") != 0) {
+            continue;
+        }
+
+        names[count] = strdup(entry->d_name);
+        if (names[count]) count++;
+    }
+    closedir(d);
+
+    qsort(names, count, sizeof(char*), compare_names);
+
+    for (int i = 0; i < count; i++) {
+        load_grammar(dir, names[i]);
+        free(names[i]);
+    }
+
+    return grammar_count;
+}
+
+/**
+ * Unload all grammars
+ *
+ * No buffer may be highlighted with one afterwards.
+ */
+void grammar_unload_all(void) {
+    for (int i = 0; i < grammar_count; i++) {
+        Grammar *grammar = &grammars[i];
+
+#ifndef _WIN32
+        if (grammar->mapped) {
+            munmap((void*)grammar->image, grammar->size);
+        } else
+#endif
+        {
+            free((void*)grammar->image);
+        }
+
+        free(grammar->path);
+        memset(grammar, 0, sizeof(Grammar));
+    }
+
+    grammar_count = 0;
+}
+
+/**
+ * Find the grammar for a file
+ *
+ * Patterns starting with '.' match the extension, others the whole
+ * file name. Returns the grammar index, or -1.
+ */
+int grammar_find(const char *filename) {
+    if (!filename) return -1;
+
+    const char *base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+    const char *ext = strrchr(base, '.');
+
+    for (int i = 0; i < grammar_count; i++) {
+        const Grammar *grammar = &grammars[i];
+
+        for (uint32_t f = 0; f < grammar->header->file_count; f++) {
+            const char *pattern = grammar->strings + grammar->files[f];
+
+            if (pattern[0] == '.' ? ext && strcmp(ext, pattern) == 0 : strcmp(base, pattern) == 0) {
+                return i;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Get a loaded grammar
+ */
+const Grammar* grammar_get(int index) {
+    if (index < 0 || index >= grammar_count) return NULL;
+
+    return &grammars[index];
+}
+
+/**
+ * Get the language name of a grammar
+ */
+const char* grammar_name(const Grammar *grammar) {
+    return grammar ? grammar->strings + grammar->header->name : NULL;
+}
+
+/**
+ * Look up a keyword
+ */
+static int keyword_token(const Grammar *grammar, const char *word, int length, int token) {
+    const GrammarHeader *h = grammar->header;
+    if (length <= 0 || (uint32_t)length > h->keyword_max_length) return token;
+
+    const GrammarKeyword *keyword = &grammar->keywords[keyword_hash(h->keyword_seed, word, length) & h->keyword_mask];
+    if (keyword->length == length && memcmp(grammar->strings + keyword->word, word, length) == 0) {
+        return keyword->token;
+    }
+
+    return token;
+}
+
+/**
+ * Lex one line with a grammar
+ *
+ * state is the context the line starts in. Fills in the token type of
+ * every byte and returns the context the next line starts in.
+ */
+int grammar_lex_line(const Grammar *grammar, const char *text, int length, int state,
+                     unsigned char *tokens) {
+    if (!grammar) return 0;
+
+    const GrammarHeader *h = grammar->header;
+    uint32_t classes = h->class_count;
+    int context = state >= 0 && (uint32_t)state < h->context_count ? state : 0;
+    bool keep = false;
+    int i = 0;
+
+    while (i < length) {
+        const GrammarContext *ctx = &grammar->contexts[context];
+        uint32_t dfa = i == 0 ? ctx->line_start : ctx->start;
+        int rule = -1;
+        int end = i;
+
+        /* Longest match, the DFA already picks the earliest rule on ties */
+        for (int j = i; j < length && dfa != GRAMMAR_DEAD_STATE; j++) {
+            dfa = grammar->transitions[dfa * classes + grammar->classes[(unsigned char)text[j]]];
+            if (grammar->accepts[dfa]) {
+                rule = grammar->accepts[dfa] - 1;
+                end = j + 1;
+            }
+        }
+
+        if (rule < 0) {
+            tokens[i++] = ctx->token;
+            keep = false;
+            continue;
+        }
+
+        const GrammarRule *r = &grammar->rules[rule];
+        int token = r->token;
+        if (r->flags & GRAMMAR_RULE_WORD) {
+            token = keyword_token(grammar, text + i, end - i, token);
+        }
+
+        memset(tokens + i, token, end - i);
+        i = end;
+
+        if (r->next != GRAMMAR_STAY) {
+            context = r->next;
+        }
+        keep = (r->flags & GRAMMAR_RULE_KEEP) != 0;
+    }
+
+    return keep ? context : grammar->contexts[context].eol;
+}
@@ -0,0 +1,1228 @@
+/**
+ * grammar_compile.c - Grammar compiler for LITE editor
+ *
+ * Turns a grammar source file into the image described in grammar.h.
+ * Rule patterns are parsed into a Thompson NFA, the rules of every
+ * context are turned into one DFA by subset construction over byte
+ * classes, and the keywords are placed in a perfect hash table.
+ *
+ * The source holds one directive per line. Lines starting with '#' are
+ * comments.
+ *
+ *   name <language>
+ *   files <.ext|filename>...
+ *   keywords <token> <word>...
+ *   context <name> <token> [eol <context>]
+ *   rule <pattern> <token> [word] [keep] [goto <context>]
+ *
+ * Rules belong to the context above them, and the first context is the
+ * one a file starts in. At every position the longest match wins, and
+ * the earlier rule wins between matches of equal length. Patterns know
+ * literals, '.', [classes], \s \d \w and their negations, \t, \xHH,
+ * grouping, '|', '*', '+', '?' and a leading '^' that anchors the rule
+ * to the start of a line. They cannot contain spaces, use \s or \x20.
+ */
+
+#include "lite.h"
+#include "syntax/grammar.h"
+#include "syntax/highlight.h"
+#include "syntax/keyword_hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#define MAX_NAME 64
+#define MAX_KEYWORDS 1024
+#define MAX_KEYWORD_LENGTH 255
+#define MAX_KEYWORD_SEEDS (1u << 20)
+
+/* NFA node types */
+enum {
+    NFA_EPSILON,
+    NFA_SET,
+    NFA_ACCEPT
+};
+
+/* NFA node, epsilon nodes have up to two successors */
+typedef struct NfaNode {
+    int type;
+    int out;
+    int out2;
+    int value;                  /* Set index or accepted rule */
+} NfaNode;
+
+/* Partly built automaton, end is an epsilon node waiting for its successor */
+typedef struct Fragment {
+    int start;
+    int end;
+} Fragment;
+
+/* Rule while compiling */
+typedef struct CompileRule {
+    int context;
+    int start;
+    bool anchored;
+    uint8_t token;
+    uint8_t flags;
+    char next[MAX_NAME];
+    int line;
+} CompileRule;
+
+/* Context while compiling */
+typedef struct CompileContext {
+    char name[MAX_NAME];
+    uint8_t token;
+    char eol[MAX_NAME];
+    int line;
+} CompileContext;
+
+/* Keyword while compiling */
+typedef struct CompileKeyword {
+    char word[MAX_KEYWORD_LENGTH + 1];
+    uint8_t token;
+} CompileKeyword;
+
+/* Growable byte buffer */
+typedef struct ByteBuffer {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+} ByteBuffer;
+
+/* DFA state while compiling, members index the shared set pool */
+typedef struct DfaState {
+    int members;
+    int count;
+    unsigned int hash;
+} DfaState;
+
+/* Compiler state */
+typedef struct Compiler {
+    const char *path;
+    int line;
+    char *error;
+    size_t error_size;
+
+    char name[MAX_NAME];
+    char files[32][MAX_NAME];
+    int file_count;
+
+    CompileContext contexts[GRAMMAR_MAX_CONTEXTS];
+    int context_count;
+    CompileRule rules[GRAMMAR_MAX_RULES];
+    int rule_count;
+    CompileKeyword *keywords;
+    int keyword_count;
+
+    NfaNode *nodes;
+    int node_count;
+    int node_capacity;
+    uint8_t (*sets)[32];
+    int set_count;
+    int set_capacity;
+
+    uint8_t classes[256];
+    int class_count;
+
+    DfaState *states;
+    int state_count;
+    int state_capacity;
+    int *pool;
+    int pool_size;
+    int pool_capacity;
+    int *table;
+    int table_size;
+    uint16_t *transitions;
+    uint16_t *accepts;
+    uint16_t starts[GRAMMAR_MAX_CONTEXTS][2];
+
+    uint32_t keyword_seed;
+    uint32_t keyword_mask;
+    int *keyword_slots;
+} Compiler;
+
+/* Token type names used in grammar files */
+static const char *token_names[TOK_COUNT] = {
+    "default", "keyword", "type", "string", "comment",
+    "number", "identifier", "preprocessor", "operator"
+};
+
+/**
+ * Record an error at the current line
+ */
+static int fail(Compiler *c, const char *format, ...) {
+    int used = snprintf(c->error, c->error_size, "%s:%d: ", c->path, c->line);
+    if (used < 0 || (size_t)used >= c->error_size) return LITE_ERROR;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(c->error + used, c->error_size - used, format, args);
+    va_end(args);
+
+    return LITE_ERROR;
+}
+
+/**
+ * Look up a token type by name
+ */
+static int parse_token(const char *name) {
+    for (int i = 0; i < TOK_COUNT; i++) {
+        if (strcmp(token_names[i], name) == 0) return i;
+    }
+
+    return -1;
+}
+
+/**
+ * Add an NFA node
+ */
+static int add_node(Compiler *c, int type, int out, int out2, int value) {
+    if (c->node_count == c->node_capacity) {
+        int capacity = c->node_capacity > 0 ? c->node_capacity * 2 : 256;
+        NfaNode *nodes = (NfaNode*)realloc(c->nodes, capacity * sizeof(NfaNode));
+        if (!nodes) return -1;
+
+        c->nodes = nodes;
+        c->node_capacity = capacity;
+    }
+
+    NfaNode *node = &c->nodes[c->node_count];
+    node->type = type;
+    node->out = out;
+    node->out2 = out2;
+    node->value = value;
+
+    return c->node_count++;
+}
+
+/**
+ * Add a byte set
+ */
+static int add_set(Compiler *c, const uint8_t set[32]) {
+    if (c->set_count == c->set_capacity) {
+        int capacity = c->set_capacity > 0 ? c->set_capacity * 2 : 64;
+        uint8_t (*sets)[32] = (uint8_t(*)[32])realloc(c->sets, capacity * sizeof(*sets));
+        if (!sets) return -1;
+
+        c->sets = sets;
+        c->set_capacity = capacity;
+    }
+
+    memcpy(c->sets[c->set_count], set, 32);
+    return c->set_count++;
+}
+
+/**
+ * Add a byte to a set
+ */
+static void set_add(uint8_t set[32], int byte) {
+    set[byte >> 3] |= (uint8_t)(1u << (byte & 7));
+}
+
+/**
+ * Check whether a set holds a byte
+ */
+static bool set_has(const uint8_t set[32], int byte) {
+    return (set[byte >> 3] >> (byte & 7)) & 1;
+}
+
+/**
+ * Add a range of bytes to a set
+ */
+static void set_add_range(uint8_t set[32], int from, int to) {
+    for (int b = from; b <= to; b++) {
+        set_add(set, b);
+    }
+}
+
+/**
+ * Invert a set
+ */
+static void set_invert(uint8_t set[32]) {
+    for (int i = 0; i < 32; i++) {
+        set[i] = (uint8_t)~set[i];
+    }
+}
+
+/**
+ * Create an empty fragment
+ */
+static int empty_fragment(Compiler *c, Fragment *frag) {
+    int node = add_node(c, NFA_EPSILON, -1, -1, 0);
+    if (node < 0) return fail(c, "out of memory");
+
+    frag->start = node;
+    frag->end = node;
+    return LITE_OK;
+}
+
+/**
+ * Create a fragment matching one byte of a set
+ */
+static int set_fragment(Compiler *c, const uint8_t set[32], Fragment *frag) {
+    int index = add_set(c, set);
+    int end = add_node(c, NFA_EPSILON, -1, -1, 0);
+    int start = end < 0 ? -1 : add_node(c, NFA_SET, end, -1, index);
+    if (index < 0 || start < 0) return fail(c, "out of memory");
+
+    frag->start = start;
+    frag->end = end;
+    return LITE_OK;
+}
+
+/**
+ * Parse a hex digit
+ */
+static int hex_value(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Parse an escape after a backslash into a set
+ */
+static int parse_escape(Compiler *c, const char **p, uint8_t set[32]) {
+    char ch = *(*p)++;
+
+    switch (ch) {
+        case '\0':
+            return fail(c, "pattern ends in a backslash");
+        case 's':
+        case 'S':
+            set_add(set, ' ');
+            set_add(set, '\t');
+            break;
+        case 'd':
+        case 'D':
+            set_add_range(set, '0', '9');
+            break;
+        case 'w':
+        case 'W':
+            set_add_range(set, 'a', 'z');
+            set_add_range(set, 'A', 'Z');
+            set_add_range(set, '0', '9');
+            set_add(set, '_');
+            break;
+        case 't':
+            set_add(set, '\t');
+            break;
+        case 'x': {
+            int high = hex_value((*p)[0]);
+            int low = high < 0 ? -1 : hex_value((*p)[1]);
+            if (low < 0) return fail(c, "\\x needs two hex digits");
+
+            set_add(set, high * 16 + low);
+            *p += 2;
+            break;
+        }
+        default:
+            set_add(set, (unsigned char)ch);
+            break;
+    }
+
+    if (ch == 'S' || ch == 'D' || ch == 'W') {
+        set_invert(set);
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Parse a bracketed class after the opening '['
+ */
+static int parse_class(Compiler *c, const char **p, uint8_t set[32]) {
+    bool negate = false;
+    bool first = true;
+
+    if (**p == '^') {
+        negate = true;
+        (*p)++;
+    }
+
+    while (**p != ']' || first) {
+        if (**p == '\0') return fail(c, "unterminated [");
+        first = false;
+
+        if (**p == '\\') {
+            (*p)++;
+
+            /* A single escaped byte may still start a range */
+            uint8_t escaped[32] = {0};
+            if (parse_escape(c, p, escaped) != LITE_OK) return LITE_ERROR;
+            for (int i = 0; i < 32; i++) {
+                set[i] |= escaped[i];
+            }
+            continue;
+        }
+
+        int from = (unsigned char)*(*p)++;
+        if (**p == '-' && (*p)[1] != ']' && (*p)[1] != '\0') {
+            int to = (unsigned char)(*p)[1];
+            if (to < from) return fail(c, "invalid range in class");
+
+            set_add_range(set, from, to);
+            *p += 2;
+        } else {
+            set_add(set, from);
+        }
+    }
+
+    (*p)++;
+
+    if (negate) {
+        set_invert(set);
+    }
+
+    return LITE_OK;
+}
+
+static int parse_alternation(Compiler *c, const char **p, Fragment *frag);
+
+/**
+ * Parse a single item of a pattern
+ */
+static int parse_atom(Compiler *c, const char **p, Fragment *frag) {
+    uint8_t set[32] = {0};
+    char ch = **p;
+
+    switch (ch) {
+        case '(':
+            (*p)++;
+            if (parse_alternation(c, p, frag) != LITE_OK) return LITE_ERROR;
+            if (**p != ')') return fail(c, "missing )");
+            (*p)++;
+            return LITE_OK;
+        case ')':
+        case '|':
+        case '*':
+        case '+':
+        case '?':
+            return fail(c, "unexpected '%c' in pattern", ch);
+        case '[':
+            (*p)++;
+            if (parse_class(c, p, set) != LITE_OK) return LITE_ERROR;
+            break;
+        case '.':
+            (*p)++;
+            set_invert(set);
+            break;
+        case '\\':
+            (*p)++;
+            if (parse_escape(c, p, set) != LITE_OK) return LITE_ERROR;
+            break;
+        default:
+            (*p)++;
+            set_add(set, (unsigned char)ch);
+            break;
+    }
+
+    return set_fragment(c, set, frag);
+}
+
+/**
+ * Parse an item followed by any number of repetition operators
+ */
+static int parse_repeat(Compiler *c, const char **p, Fragment *frag) {
+    if (parse_atom(c, p, frag) != LITE_OK) return LITE_ERROR;
+
+    while (**p == '*' || **p == '+' || **p == '?') {
+        char op = *(*p)++;
+        int end = add_node(c, NFA_EPSILON, -1, -1, 0);
+        int split = end < 0 ? -1 : add_node(c, NFA_EPSILON, frag->start, end, 0);
+        if (split < 0) return fail(c, "out of memory");
+
+        if (op == '*') {
+            /* Loop back through the split, which may also skip ahead */
+            c->nodes[frag->end].out = split;
+            frag->start = split;
+        } else if (op == '+') {
+            /* At least once, then loop back through the split */
+            c->nodes[frag->end].out = split;
+        } else {
+            c->nodes[frag->end].out = end;
+            frag->start = split;
+        }
+        frag->end = end;
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Parse a sequence of items
+ */
+static int parse_sequence(Compiler *c, const char **p, Fragment *frag) {
+    if (empty_fragment(c, frag) != LITE_OK) return LITE_ERROR;
+
+    while (**p != '\0' && **p != '|' && **p != ')') {
+        Fragment item;
+        if (parse_repeat(c, p, &item) != LITE_OK) return LITE_ERROR;
+
+        c->nodes[frag->end].out = item.start;
+        frag->end = item.end;
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Parse alternatives separated by '|'
+ */
+static int parse_alternation(Compiler *c, const char **p, Fragment *frag) {
+    if (parse_sequence(c, p, frag) != LITE_OK) return LITE_ERROR;
+
+    while (**p == '|') {
+        (*p)++;
+
+        Fragment other;
+        if (parse_sequence(c, p, &other) != LITE_OK) return LITE_ERROR;
+
+        int end = add_node(c, NFA_EPSILON, -1, -1, 0);
+        int split = end < 0 ? -1 : add_node(c, NFA_EPSILON, frag->start, other.start, 0);
+        if (split < 0) return fail(c, "out of memory");
+
+        c->nodes[frag->end].out = end;
+        c->nodes[other.end].out = end;
+        frag->start = split;
+        frag->end = end;
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Compile the pattern of a rule into the NFA
+ */
+static int compile_pattern(Compiler *c, CompileRule *rule, const char *pattern, int index) {
+    const char *p = pattern;
+
+    rule->anchored = *p == '^';
+    if (rule->anchored) p++;
+
+    Fragment frag;
+    if (parse_alternation(c, &p, &frag) != LITE_OK) return LITE_ERROR;
+    if (*p != '\0') return fail(c, "unbalanced ) in pattern");
+
+    int accept = add_node(c, NFA_ACCEPT, -1, -1, index);
+    if (accept < 0) return fail(c, "out of memory");
+
+    c->nodes[frag.end].out = accept;
+    rule->start = frag.start;
+    return LITE_OK;
+}
+
+/**
+ * Copy a name, failing if it does not fit
+ */
+static int copy_name(Compiler *c, char *dest, const char *name) {
+    if (strlen(name) >= MAX_NAME) return fail(c, "name too long: %s", name);
+
+    strcpy(dest, name);
+    return LITE_OK;
+}
+
+/**
+ * Parse a "rule" directive
+ */
+static int parse_rule(Compiler *c, char **args, int argc) {
+    if (c->context_count == 0) return fail(c, "rule before the first context");
+    if (argc < 3) return fail(c, "expected rule <pattern> <token> [word] [keep] [goto <context>]");
+    if (c->rule_count >= GRAMMAR_MAX_RULES) return fail(c, "too many rules");
+
+    int index = c->rule_count;
+    CompileRule *rule = &c->rules[index];
+    memset(rule, 0, sizeof(CompileRule));
+    rule->context = c->context_count - 1;
+    rule->line = c->line;
+
+    int token = parse_token(args[2]);
+    if (token < 0) return fail(c, "unknown token type: %s", args[2]);
+    rule->token = (uint8_t)token;
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(args[i], "word") == 0) {
+            rule->flags |= GRAMMAR_RULE_WORD;
+        } else if (strcmp(args[i], "keep") == 0) {
+            rule->flags |= GRAMMAR_RULE_KEEP;
+        } else if (strcmp(args[i], "goto") == 0 && i + 1 < argc) {
+            if (copy_name(c, rule->next, args[++i]) != LITE_OK) return LITE_ERROR;
+        } else {
+            return fail(c, "unexpected '%s' in rule", args[i]);
+        }
+    }
+
+    if (compile_pattern(c, rule, args[1], index) != LITE_OK) return LITE_ERROR;
+
+    c->rule_count++;
+    return LITE_OK;
+}
+
+/**
+ * Parse a "context" directive
+ */
+static int parse_context(Compiler *c, char **args, int argc) {
+    if (argc != 3 && !(argc == 5 && strcmp(args[3], "eol") == 0)) {
+        return fail(c, "expected context <name> <token> [eol <context>]");
+    }
+    if (c->context_count >= GRAMMAR_MAX_CONTEXTS) return fail(c, "too many contexts");
+
+    CompileContext *context = &c->contexts[c->context_count];
+    memset(context, 0, sizeof(CompileContext));
+    context->line = c->line;
+
+    if (copy_name(c, context->name, args[1]) != LITE_OK) return LITE_ERROR;
+    if (argc == 5 && copy_name(c, context->eol, args[4]) != LITE_OK) return LITE_ERROR;
+
+    int token = parse_token(args[2]);
+    if (token < 0) return fail(c, "unknown token type: %s", args[2]);
+    context->token = (uint8_t)token;
+
+    for (int i = 0; i < c->context_count; i++) {
+        if (strcmp(c->contexts[i].name, context->name) == 0) {
+            return fail(c, "duplicate context: %s", context->name);
+        }
+    }
+
+    c->context_count++;
+    return LITE_OK;
+}
+
+/**
+ * Parse a "keywords" directive
+ */
+static int parse_keywords(Compiler *c, char **args, int argc) {
+    if (argc < 3) return fail(c, "expected keywords <token> <word>...");
+
+    int token = parse_token(args[1]);
+    if (token < 0) return fail(c, "unknown token type: %s", args[1]);
+
+    for (int i = 2; i < argc; i++) {
+        if (strlen(args[i]) > MAX_KEYWORD_LENGTH) return fail(c, "keyword too long");
+        if (c->keyword_count >= MAX_KEYWORDS) return fail(c, "too many keywords");
+
+        for (int k = 0; k < c->keyword_count; k++) {
+            if (strcmp(c->keywords[k].word, args[i]) == 0) {
+                return fail(c, "duplicate keyword: %s", args[i]);
+            }
+        }
+
+        CompileKeyword *keyword = &c->keywords[c->keyword_count++];
+        strcpy(keyword->word, args[i]);
+        keyword->token = (uint8_t)token;
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Parse one line of the source
+ */
+static int parse_line(Compiler *c, char *line) {
+    char *args[64];
+    int argc = 0;
+
+    char *word = strtok(line, " \t\r\n");
+    while (word) {
+        if (argc == 64) return fail(c, "too many words on one line");
+        args[argc++] = word;
+        word = strtok(NULL, " \t\r\n");
+    }
+
+    if (argc == 0 || args[0][0] == '#') return LITE_OK;
+
+    if (strcmp(args[0], "name") == 0) {
+        if (argc != 2) return fail(c, "expected name <language>");
+        return copy_name(c, c->name, args[1]);
+    }
+
+    if (strcmp(args[0], "files") == 0) {
+        for (int i = 1; i < argc; i++) {
+            if (c->file_count >= 32) return fail(c, "too many file patterns");
+            if (copy_name(c, c->files[c->file_count++], args[i]) != LITE_OK) return LITE_ERROR;
+        }
+        return LITE_OK;
+    }
+
+    if (strcmp(args[0], "keywords") == 0) return parse_keywords(c, args, argc);
+    if (strcmp(args[0], "context") == 0) return parse_context(c, args, argc);
+    if (strcmp(args[0], "rule") == 0) return parse_rule(c, args, argc);
+
+    return fail(c, "unknown directive: %s", args[0]);
+}
+
+/**
+ * Find a context by name
+ */
+static int find_context(Compiler *c, const char *name) {
+    for (int i = 0; i < c->context_count; i++) {
+        if (strcmp(c->contexts[i].name, name) == 0) return i;
+    }
+
+    return -1;
+}
+
+/**
+ * Split the byte values into classes no pattern tells apart
+ */
+static void build_classes(Compiler *c) {
+    memset(c->classes, 0, sizeof(c->classes));
+    c->class_count = 1;
+
+    for (int s = 0; s < c->set_count; s++) {
+        int inside[256];
+        int outside[256];
+        int count = 0;
+
+        for (int i = 0; i < 256; i++) {
+            inside[i] = -1;
+            outside[i] = -1;
+        }
+
+        for (int b = 0; b < 256; b++) {
+            int *slot = set_has(c->sets[s], b) ? &inside[c->classes[b]] : &outside[c->classes[b]];
+            if (*slot < 0) *slot = count++;
+            c->classes[b] = (uint8_t)*slot;
+        }
+
+        c->class_count = count;
+    }
+}
+
+/**
+ * Add the epsilon closure of a node to a set being built
+ */
+static int add_closure(Compiler *c, int node, int *set, int *count, unsigned int *marks,
+                       unsigned int mark, int *stack) {
+    int depth = 0;
+    stack[depth++] = node;
+
+    while (depth > 0) {
+        int n = stack[--depth];
+        if (n < 0 || marks[n] == mark) continue;
+
+        marks[n] = mark;
+        set[(*count)++] = n;
+
+        if (c->nodes[n].type == NFA_EPSILON) {
+            stack[depth++] = c->nodes[n].out;
+            stack[depth++] = c->nodes[n].out2;
+        }
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Compare two NFA node indexes for sorting
+ */
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Hash a sorted set of NFA nodes
+ */
+static unsigned int hash_set(const int *set, int count) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < count; i++) {
+        hash = (hash ^ (unsigned int)set[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Grow the DFA state lookup table
+ */
+static int grow_table(Compiler *c) {
+    int size = c->table_size > 0 ? c->table_size * 2 : 1024;
+    int *table = (int*)malloc(size * sizeof(int));
+    if (!table) return LITE_ERROR;
+
+    for (int i = 0; i < size; i++) {
+        table[i] = -1;
+    }
+
+    for (int s = 0; s < c->state_count; s++) {
+        int slot = c->states[s].hash & (size - 1);
+        while (table[slot] != -1) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = s;
+    }
+
+    free(c->table);
+    c->table = table;
+    c->table_size = size;
+    return LITE_OK;
+}
+
+/**
+ * Find the DFA state for a set of NFA nodes, adding it if it is new
+ */
+static int intern_state(Compiler *c, int *set, int count) {
+    qsort(set, count, sizeof(int), compare_ints);
+    unsigned int hash = hash_set(set, count);
+
+    int slot = hash & (c->table_size - 1);
+    while (c->table[slot] != -1) {
+        DfaState *state = &c->states[c->table[slot]];
+        if (state->hash == hash && state->count == count &&
+            memcmp(c->pool + state->members, set, count * sizeof(int)) == 0) {
+            return c->table[slot];
+        }
+        slot = (slot + 1) & (c->table_size - 1);
+    }
+
+    if (c->state_count >= GRAMMAR_MAX_STATES) {
+        return fail(c, "grammar needs more than %d DFA states", GRAMMAR_MAX_STATES);
+    }
+
+    if (c->state_count == c->state_capacity) {
+        int capacity = c->state_capacity > 0 ? c->state_capacity * 2 : 256;
+        DfaState *states = (DfaState*)realloc(c->states, capacity * sizeof(DfaState));
+        if (!states) return fail(c, "out of memory");
+        c->states = states;
+        c->state_capacity = capacity;
+    }
+
+    if (c->pool_size + count > c->pool_capacity) {
+        int capacity = c->pool_capacity > 0 ? c->pool_capacity : 1024;
+        while (capacity < c->pool_size + count) {
+            capacity *= 2;
+        }
+        int *pool = (int*)realloc(c->pool, capacity * sizeof(int));
+        if (!pool) return fail(c, "out of memory");
+        c->pool = pool;
+        c->pool_capacity = capacity;
+    }
+
+    int index = c->state_count++;
+    DfaState *state = &c->states[index];
+    state->members = c->pool_size;
+    state->count = count;
+    state->hash = hash;
+    if (count > 0) {
+        memcpy(c->pool + c->pool_size, set, count * sizeof(int));
+    }
+    c->pool_size += count;
+    c->table[slot] = index;
+
+    /* Keep the table at most half full */
+    if (c->state_count * 2 > c->table_size && grow_table(c) != LITE_OK) {
+        return fail(c, "out of memory");
+    }
+
+    return index;
+}
+
+/**
+ * Build the DFA of every context by subset construction
+ */
+static int build_dfa(Compiler *c) {
+    int *set = (int*)malloc(c->node_count * sizeof(int));
+    int *stack = (int*)malloc(c->node_count * 2 * sizeof(int) + sizeof(int));
+    unsigned int *marks = (unsigned int*)calloc(c->node_count, sizeof(unsigned int));
+    unsigned int mark = 0;
+    int result = LITE_ERROR;
+
+    if (!set || !stack || !marks || grow_table(c) != LITE_OK) {
+        fail(c, "out of memory");
+        goto done;
+    }
+
+    /* State 0 is the dead state */
+    if (intern_state(c, set, 0) != GRAMMAR_DEAD_STATE) goto done;
+
+    for (int ctx = 0; ctx < c->context_count; ctx++) {
+        for (int anchored = 0; anchored < 2; anchored++) {
+            int count = 0;
+            mark++;
+
+            for (int r = 0; r < c->rule_count; r++) {
+                CompileRule *rule = &c->rules[r];
+                if (rule->context == ctx && (anchored || !rule->anchored)) {
+                    add_closure(c, rule->start, set, &count, marks, mark, stack);
+                }
+            }
+
+            int state = intern_state(c, set, count);
+            if (state < 0) goto done;
+            c->starts[ctx][anchored] = (uint16_t)state;
+        }
+    }
+
+    /* One representative byte per class */
+    int representative[256];
+    for (int b = 255; b >= 0; b--) {
+        representative[c->classes[b]] = b;
+    }
+
+    size_t transition_capacity = 0;
+
+    for (int s = 0; s < c->state_count; s++) {
+        if ((size_t)c->state_count * c->class_count > transition_capacity) {
+            size_t capacity = transition_capacity > 0 ? transition_capacity * 2 : 4096;
+            while (capacity < (size_t)c->state_count * c->class_count) {
+                capacity *= 2;
+            }
+            uint16_t *transitions = (uint16_t*)realloc(c->transitions, capacity * sizeof(uint16_t));
+            if (!transitions) {
+                fail(c, "out of memory");
+                goto done;
+            }
+            c->transitions = transitions;
+            transition_capacity = capacity;
+        }
+
+        for (int k = 0; k < c->class_count; k++) {
+            int byte = representative[k];
+            int count = 0;
+            mark++;
+
+            /* The pool may move while states are added, index it each time */
+            for (int m = 0; m < c->states[s].count; m++) {
+                NfaNode *node = &c->nodes[c->pool[c->states[s].members + m]];
+                if (node->type == NFA_SET && set_has(c->sets[node->value], byte)) {
+                    add_closure(c, node->out, set, &count, marks, mark, stack);
+                }
+            }
+
+            int target = intern_state(c, set, count);
+            if (target < 0) goto done;
+            c->transitions[(size_t)s * c->class_count + k] = (uint16_t)target;
+        }
+    }
+
+    c->accepts = (uint16_t*)calloc(c->state_count, sizeof(uint16_t));
+    if (!c->accepts) {
+        fail(c, "out of memory");
+        goto done;
+    }
+
+    /* A state accepts the earliest rule any of its nodes accepts */
+    for (int s = 0; s < c->state_count; s++) {
+        int best = -1;
+        for (int m = 0; m < c->states[s].count; m++) {
+            NfaNode *node = &c->nodes[c->pool[c->states[s].members + m]];
+            if (node->type == NFA_ACCEPT && (best < 0 || node->value < best)) {
+                best = node->value;
+            }
+        }
+        c->accepts[s] = (uint16_t)(best + 1);
+    }
+
+    result = LITE_OK;
+
+done:
+    free(set);
+    free(stack);
+    free(marks);
+    return result;
+}
+
+/**
+ * Find a perfect hash for the keywords
+ */
+static int build_keywords(Compiler *c) {
+    uint32_t size = 1;
+    while (size < (uint32_t)c->keyword_count * 2) {
+        size *= 2;
+    }
+
+    for (; size <= 65536; size *= 2) {
+        int *slots = (int*)malloc(size * sizeof(int));
+        if (!slots) return fail(c, "out of memory");
+
+        for (uint32_t seed = 1; seed < MAX_KEYWORD_SEEDS; seed++) {
+            bool placed = true;
+            for (uint32_t i = 0; i < size; i++) {
+                slots[i] = -1;
+            }
+
+            for (int k = 0; k < c->keyword_count && placed; k++) {
+                const char *word = c->keywords[k].word;
+                uint32_t slot = keyword_hash(seed, word, (int)strlen(word)) & (size - 1);
+                placed = slots[slot] == -1;
+                slots[slot] = k;
+            }
+
+            if (placed) {
+                c->keyword_seed = seed;
+                c->keyword_mask = size - 1;
+                c->keyword_slots = slots;
+                return LITE_OK;
+            }
+        }
+
+        free(slots);
+    }
+
+    return fail(c, "no perfect hash found for the keywords");
+}
+
+/**
+ * Reserve space at the end of a byte buffer, aligned to 8 bytes
+ *
+ * Returns the offset of the space.
+ */
+static uint32_t buffer_reserve(ByteBuffer *buffer, size_t size) {
+    size_t offset = (buffer->size + 7) & ~(size_t)7;
+
+    if (offset + size > buffer->capacity) {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+        while (capacity < offset + size) {
+            capacity *= 2;
+        }
+
+        unsigned char *data = (unsigned char*)realloc(buffer->data, capacity);
+        if (!data) {
+            buffer->failed = true;
+            return 0;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+
+    memset(buffer->data + buffer->size, 0, offset + size - buffer->size);
+    buffer->size = offset + size;
+    return (uint32_t)offset;
+}
+
+/**
+ * Append data to a byte buffer, aligned to 8 bytes
+ */
+static uint32_t buffer_append(ByteBuffer *buffer, const void *data, size_t size) {
+    uint32_t offset = buffer_reserve(buffer, size);
+    if (!buffer->failed && size > 0) {
+        memcpy(buffer->data + offset, data, size);
+    }
+    return offset;
+}
+
+/**
+ * Add a string to the string pool
+ */
+static uint32_t add_string(ByteBuffer *strings, const char *text) {
+    size_t length = strlen(text) + 1;
+    uint32_t offset = (uint32_t)strings->size;
+
+    if (strings->size + length > strings->capacity) {
+        size_t capacity = strings->capacity > 0 ? strings->capacity : 1024;
+        while (capacity < strings->size + length) {
+            capacity *= 2;
+        }
+
+        unsigned char *data = (unsigned char*)realloc(strings->data, capacity);
+        if (!data) {
+            strings->failed = true;
+            return 0;
+        }
+        strings->data = data;
+        strings->capacity = capacity;
+    }
+
+    memcpy(strings->data + strings->size, text, length);
+    strings->size += length;
+    return offset;
+}
+
+/**
+ * Lay out the compiled grammar as an image
+ */
+static int write_image(Compiler *c, const struct stat *st, unsigned char **image, size_t *size) {
+    ByteBuffer out = {0};
+    ByteBuffer strings = {0};
+    GrammarHeader header;
+    memset(&header, 0, sizeof(header));
+
+    header.magic = GRAMMAR_MAGIC;
+    header.version = GRAMMAR_VERSION;
+    header.source_size = (uint64_t)st->st_size;
+    header.source_mtime = (int64_t)st->st_mtim.tv_sec;
+    header.source_mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+
+    /* The header is filled in last */
+    buffer_reserve(&out, sizeof(GrammarHeader));
+
+    header.name = add_string(&strings, c->name);
+
+    uint32_t files[32];
+    for (int i = 0; i < c->file_count; i++) {
+        files[i] = add_string(&strings, c->files[i]);
+    }
+    header.file_count = (uint32_t)c->file_count;
+    header.files = buffer_append(&out, files, c->file_count * sizeof(uint32_t));
+
+    GrammarContext contexts[GRAMMAR_MAX_CONTEXTS];
+    for (int i = 0; i < c->context_count; i++) {
+        memset(&contexts[i], 0, sizeof(GrammarContext));
+        contexts[i].start = c->starts[i][0];
+        contexts[i].line_start = c->starts[i][1];
+        contexts[i].token = c->contexts[i].token;
+        contexts[i].eol = (uint8_t)(c->contexts[i].eol[0] ? find_context(c, c->contexts[i].eol) : i);
+    }
+    header.context_count = (uint32_t)c->context_count;
+    header.contexts = buffer_append(&out, contexts, c->context_count * sizeof(GrammarContext));
+
+    GrammarRule *rules = (GrammarRule*)calloc(c->rule_count > 0 ? c->rule_count : 1, sizeof(GrammarRule));
+    if (!rules) return fail(c, "out of memory");
+
+    for (int i = 0; i < c->rule_count; i++) {
+        rules[i].token = c->rules[i].token;
+        rules[i].flags = c->rules[i].flags;
+        rules[i].next = (uint8_t)(c->rules[i].next[0] ? find_context(c, c->rules[i].next) : GRAMMAR_STAY);
+    }
+    header.rule_count = (uint32_t)c->rule_count;
+    header.rules = buffer_append(&out, rules, c->rule_count * sizeof(GrammarRule));
+    free(rules);
+
+    header.state_count = (uint32_t)c->state_count;
+    header.class_count = (uint32_t)c->class_count;
+    header.classes = buffer_append(&out, c->classes, sizeof(c->classes));
+    header.transitions = buffer_append(&out, c->transitions,
+                                       (size_t)c->state_count * c->class_count * sizeof(uint16_t));
+    header.accepts = buffer_append(&out, c->accepts, c->state_count * sizeof(uint16_t));
+
+    size_t slots = (size_t)c->keyword_mask + 1;
+    GrammarKeyword *keywords = (GrammarKeyword*)calloc(slots, sizeof(GrammarKeyword));
+    if (!keywords) {
+        free(out.data);
+        free(strings.data);
+        return fail(c, "out of memory");
+    }
+
+    uint32_t max_length = 0;
+    for (size_t i = 0; i < slots; i++) {
+        int k = c->keyword_slots[i];
+        if (k < 0) continue;
+
+        keywords[i].word = add_string(&strings, c->keywords[k].word);
+        keywords[i].length = (uint8_t)strlen(c->keywords[k].word);
+        keywords[i].token = c->keywords[k].token;
+        if (keywords[i].length > max_length) max_length = keywords[i].length;
+    }
+    header.keyword_seed = c->keyword_seed;
+    header.keyword_mask = c->keyword_mask;
+    header.keyword_max_length = max_length;
+    header.keywords = buffer_append(&out, keywords, slots * sizeof(GrammarKeyword));
+    free(keywords);
+
+    header.strings_size = (uint32_t)strings.size;
+    header.strings = buffer_append(&out, strings.data, strings.size);
+
+    if (out.failed || strings.failed || out.size > UINT32_MAX) {
+        free(out.data);
+        free(strings.data);
+        return fail(c, "out of memory");
+    }
+    free(strings.data);
+
+    header.size = (uint32_t)out.size;
+    memcpy(out.data, &header, sizeof(header));
+
+    *image = out.data;
+    *size = out.size;
+    return LITE_OK;
+}
+
+/**
+ * Check that every context a rule or context refers to exists
+ */
+static int resolve_contexts(Compiler *c) {
+    if (c->name[0] == '\0') return fail(c, "missing name");
+    if (c->context_count == 0) return fail(c, "no contexts defined");
+
+    for (int i = 0; i < c->context_count; i++) {
+        c->line = c->contexts[i].line;
+        if (c->contexts[i].eol[0] && find_context(c, c->contexts[i].eol) < 0) {
+            return fail(c, "unknown context: %s", c->contexts[i].eol);
+        }
+    }
+
+    for (int i = 0; i < c->rule_count; i++) {
+        c->line = c->rules[i].line;
+        if (c->rules[i].next[0] && find_context(c, c->rules[i].next) < 0) {
+            return fail(c, "unknown context: %s", c->rules[i].next);
+        }
+    }
+
+    return LITE_OK;
+}
+
+/**
+ * Compile a grammar source file into an image
+ *
+ * On success *image is a malloc'd block of *size bytes. On failure a
+ * message naming the file and line is left in error.
+ */
+int grammar_compile(const char *path, unsigned char **image, size_t *size,
+                    char *error, size_t error_size) {
+    if (!path || !image || !size || !error || error_size == 0) return LITE_ERROR;
+
+    *image = NULL;
+    *size = 0;
+    error[0] = '\0';
+
+    Compiler *c = (Compiler*)calloc(1, sizeof(Compiler));
+    if (!c) {
+        snprintf(error, error_size, "%s: out of memory", path);
+        return LITE_ERROR;
+    }
+
+    c->path = path;
+    c->error = error;
+    c->error_size = error_size;
+
+    int result = LITE_ERROR;
+    struct stat st;
+    FILE *fp = fopen(path, "r");
+
+    if (!fp || fstat(fileno(fp), &st) != 0) {
+        snprintf(error, error_size, "%s: cannot open", path);
+        goto done;
+    }
+
+    c->keywords = (CompileKeyword*)malloc(MAX_KEYWORDS * sizeof(CompileKeyword));
+    if (!c->keywords) {
+        fail(c, "out of memory");
+        goto done;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        c->line++;
+        if (parse_line(c, line) != LITE_OK) goto done;
+    }
+
+    if (resolve_contexts(c) != LITE_OK) goto done;
+
+    c->line = 0;
+    build_classes(c);
+
+    if (build_dfa(c) != LITE_OK || build_keywords(c) != LITE_OK) goto done;
+
+    result = write_image(c, &st, image, size);
+
+done:
+    if (fp) fclose(fp);
+    free(c->keywords);
+    free(c->nodes);
+    free(c->sets);
+    free(c->states);
+    free(c->pool);
+    free(c->table);
+    free(c->transitions);
+    free(c->accepts);
+    free(c->keyword_slots);
+    free(c);
+
+    return result;
+}
@@ -1,63 +1,99 @@
 /**
  * highlight.c - Syntax highlighting for LITE editor
+ *
+ * Lines are lexed one at a time and the lexer state at the end of every
+ * line is kept, so any line can be highlighted from the state its
+ * predecessor left behind. After an edit, lexing resumes at the first
+ * changed line and stops as soon as a line ends in the same state as
+ * before, because everything below it is then unaffected.
+ *
+ * The UI thread lexes at most HIGHLIGHT_SYNC_BYTES per update. When that
+ * is not enough, the rest is lexed by a worker thread from a snapshot of
+ * the piece table. The worker publishes end states for the UI thread to
+ * take over, and lines whose start state is not known yet are drawn
+ * without highlighting in the meantime. Every edit cancels the job, so
+ * results are only ever applied to the text version they were made for.
  */
 
 #include "lite.h"
 #include "syntax/highlight.h"
+#include "syntax/keyword_hash.h"
+#include "syntax/keyword_tables.h" /* Generated from keywords.def */
+#include "syntax/grammar.h"
+#include "core/buffer.h"
 #include "utils/log.h"
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
-/* Color pairs for token types */
-static int token_colors[TOK_COUNT];
-
-/* Keywords for supported languages */
-static const char *c_keywords[] = {
-    "auto", "break", "case", "char", "const", "continue", "default", "do",
-    "double", "else", "enum", "extern", "float", "for", "goto", "if",
-    "int", "long", "register", "return", "short", "signed", "sizeof", "static",
-    "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while",
-    NULL
-};
+/* Lines the worker lexes between checks for cancellation */
+#define CANCEL_CHECK_LINES 1024
 
-static const char *c_types[] = {
-    "int", "char", "float", "double", "void", "unsigned", "signed",
-    "short", "long", "struct", "union", "enum", "typedef", "static",
-    NULL
-};
+/* Sequential reader over the lines of a buffer or a snapshot */
+typedef struct LineReader {
+    const PieceTable *table;
+    const PieceSnapshot *snapshot;
+    size_t span;
+    size_t offset;
+    const char *chunk;
+    size_t chunk_length;
+} LineReader;
 
-static const char *js_keywords[] = {
-    "break", "case", "catch", "class", "const", "continue", "debugger",
-    "default", "delete", "do", "else", "export", "extends", "finally",
-    "for", "function", "if", "import", "in", "instanceof", "new", "return",
-    "super", "switch", "this", "throw", "try", "typeof", "var", "void",
-    "while", "with", "yield", "let", "await", "async",
-    NULL
-};
+/* Lexing work handed to the worker
+ *
+ * The worker lexes `count` lines of the snapshot, the first of which is
+ * line `first` and starts in state `start`, and stores the end state of
+ * each in states. `old` holds the states left over from before the last
+ * edit, so the worker can stop where the new states meet them again.
+ * published, done and cancelled are guarded by the worker lock, merged
+ * belongs to the UI thread.
+ */
+typedef struct HighlightJob {
+    struct HighlightJob *next;
+    LanguageId language;
+    PieceSnapshot text;
+    unsigned long version;
+    int first;
+    int count;
+    LexState start;
+    unsigned char *old;
+    int old_count;
+    int dirty_end;
+    unsigned char *states;
+    int merged;
+    int published;
+    bool done;
+    bool cancelled;
+} HighlightJob;
 
-static const char *java_keywords[] = {
-    "abstract", "assert", "boolean", "break", "byte", "case", "catch",
-    "char", "class", "const", "continue", "default", "do", "double",
-    "else", "enum", "extends", "final", "finally", "float", "for",
-    "goto", "if", "implements", "import", "instanceof", "int", "interface",
-    "long", "native", "new", "package", "private", "protected", "public",
-    "return", "short", "static", "strictfp", "super", "switch", "synchronized",
-    "this", "throw", "throws", "transient", "try", "void", "volatile", "while",
-    NULL
+/* Highlighting worker thread, started on first use */
+typedef struct HighlightWorker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    HighlightJob *queue;
+    HighlightJob *current;
+    HighlightScratch scratch;
+    bool started;
+    bool stopping;
+    int notify_fd;
+} HighlightWorker;
+
+static HighlightWorker worker = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+    .notify_fd = -1,
 };
 
-/**
- * Check if a string is in a keyword list
- */
-static bool is_keyword(const char *word, const char **keywords) {
-    for (int i = 0; keywords[i] != NULL; i++) {
-        if (strcmp(word, keywords[i]) == 0) {
-            return true;
-        }
-    }
-    return false;
-}
+/* Color pairs for token types */
+static int token_colors[TOK_COUNT] = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
 
 /**
  * Initialize syntax highlighting
@@ -75,6 +111,15 @@ void highlight_init(void) {
     token_colors[TOK_OPERATOR] = 9;     /* Green on black */
 }
 
+/**
+ * Get the color pair used for a token type
+ */
+int highlight_get_color(TokenType type) {
+    if (type < 0 || type >= TOK_COUNT) return token_colors[TOK_DEFAULT];
+    
+    return token_colors[type];
+}
+
 /**
  * Set color for a token type
  */
@@ -93,6 +138,12 @@ void highlight_set_color(TokenType type, short fg, short bg) {
 LanguageId highlight_detect_language(const char *filename) {
     if (!filename) return LANG_UNKNOWN;
     
+    /* Grammars loaded at startup take precedence over built-in lexers */
+    int grammar = grammar_find(filename);
+    if (grammar >= 0) {
+        return (LanguageId)(LANG_COUNT + grammar);
+    }
+    
     /* Find extension */
     const char *ext = strrchr(filename, '.');
     if (!ext) return LANG_UNKNOWN;
@@ -110,13 +161,927 @@ LanguageId highlight_detect_language(const char *filename) {
 }
 
 /**
- * Highlight a line of text
+ * Mark a run of bytes with a token type
+ */
+static void set_tokens(unsigned char *tokens, int from, int to, TokenType type) {
+    memset(tokens + from, type, to - from);
+}
+
+/**
+ * Classify an identifier
+ */
+static TokenType classify_word(const char *word, int length, LanguageId lang) {
+    const KeywordTable *table;
+    
+    switch (lang) {
+        case LANG_C: table = &keywords_c; break;
+        case LANG_JS: table = &keywords_js; break;
+        case LANG_JAVA: table = &keywords_java; break;
+        default: return TOK_IDENTIFIER;
+    }
+    
+    const KeywordEntry *entry = keyword_lookup(table, word, length);
+    return entry ? (TokenType)entry->type : TOK_IDENTIFIER;
+}
+
+/**
+ * Scan the rest of a block comment
+ *
+ * Returns the index just past the closing marker, or the line length if
+ * the comment continues on the next line.
+ */
+static int scan_comment(const char *text, int length, int i, unsigned char *tokens, bool *open) {
+    int start = i;
+    
+    while (i < length) {
+        if (text[i] == '*' && i + 1 < length && text[i + 1] == '/') {
+            set_tokens(tokens, start, i + 2, TOK_COMMENT);
+            *open = false;
+            return i + 2;
+        }
+        i++;
+    }
+    
+    set_tokens(tokens, start, length, TOK_COMMENT);
+    *open = true;
+    return length;
+}
+
+/**
+ * Scan the rest of a quoted string
+ *
+ * Template strings always continue onto the next line. Other strings
+ * only do when the line ends in a backslash.
+ */
+static int scan_string(const char *text, int length, int i, char quote, unsigned char *tokens, bool *open) {
+    int start = i;
+    
+    while (i < length) {
+        if (text[i] == '\\') {
+            i += 2;
+            continue;
+        }
+        if (text[i] == quote) {
+            set_tokens(tokens, start, i + 1, TOK_STRING);
+            *open = false;
+            return i + 1;
+        }
+        i++;
+    }
+    
+    set_tokens(tokens, start, length, TOK_STRING);
+    *open = quote == '`' || i > length;
+    return length;
+}
+
+/**
+ * Scan the rest of a preprocessor directive
+ *
+ * Comments inside the directive are left to the caller.
+ */
+static int scan_directive(const char *text, int length, int i, unsigned char *tokens, bool *open) {
+    int start = i;
+    
+    while (i < length) {
+        if (text[i] == '/' && i + 1 < length && (text[i + 1] == '/' || text[i + 1] == '*')) {
+            break;
+        }
+        i++;
+    }
+    
+    set_tokens(tokens, start, i, TOK_PREPROCESSOR);
+    *open = i == length && length > 0 && text[length - 1] == '\\';
+    return i;
+}
+
+/**
+ * Lex one line
+ *
+ * Fills in a token type for every byte of the line and returns the state
+ * the line ends in.
+ */
+static LexState lex_line(LanguageId lang, const char *text, int length, LexState state, unsigned char *tokens) {
+    int i = 0;
+    bool open = false;
+    
+    /* Languages past the built-in ones come from grammar files */
+    if (lang >= LANG_COUNT) {
+        return (LexState)grammar_lex_line(grammar_get(lang - LANG_COUNT), text, length, state, tokens);
+    }
+    
+    /* Finish whatever the previous line left open */
+    switch (state) {
+        case LEX_COMMENT:
+            i = scan_comment(text, length, 0, tokens, &open);
+            if (open) return LEX_COMMENT;
+            break;
+        case LEX_STRING:
+            i = scan_string(text, length, 0, '"', tokens, &open);
+            if (open) return LEX_STRING;
+            break;
+        case LEX_TEMPLATE:
+            i = scan_string(text, length, 0, '`', tokens, &open);
+            if (open) return LEX_TEMPLATE;
+            break;
+        case LEX_PREPROCESSOR:
+            i = scan_directive(text, length, 0, tokens, &open);
+            if (open) return LEX_PREPROCESSOR;
+            break;
+        default:
+            break;
+    }
+    
+    bool line_start = i == 0;
+    LexState end_state = LEX_NORMAL;
+    
+    while (i < length) {
+        char c = text[i];
+        char next = i + 1 < length ? text[i + 1] : '\0';
+        
+        if (isspace((unsigned char)c)) {
+            tokens[i++] = TOK_DEFAULT;
+            continue;
+        }
+        
+        if (c == '/' && next == '/') {
+            set_tokens(tokens, i, length, TOK_COMMENT);
+            i = length;
+        } else if (c == '/' && next == '*') {
+            set_tokens(tokens, i, i + 2, TOK_COMMENT);
+            i = scan_comment(text, length, i + 2, tokens, &open);
+            if (open) end_state = LEX_COMMENT;
+        } else if (c == '"' || c == '\'' || (c == '`' && lang == LANG_JS)) {
+            tokens[i] = TOK_STRING;
+            i = scan_string(text, length, i + 1, c, tokens, &open);
+            if (open) end_state = c == '`' ? LEX_TEMPLATE : LEX_STRING;
+        } else if (c == '#' && line_start && lang == LANG_C) {
+            i = scan_directive(text, length, i, tokens, &open);
+            if (open) end_state = LEX_PREPROCESSOR;
+        } else if (isdigit((unsigned char)c) || (c == '.' && isdigit((unsigned char)next))) {
+            int start = i;
+            while (i < length && (isalnum((unsigned char)text[i]) || text[i] == '.' || text[i] == '_')) {
+                i++;
+            }
+            set_tokens(tokens, start, i, TOK_NUMBER);
+        } else if (isalpha((unsigned char)c) || c == '_' || (c == '$' && lang == LANG_JS)) {
+            int start = i;
+            while (i < length && (isalnum((unsigned char)text[i]) || text[i] == '_' ||
+                                  (text[i] == '$' && lang == LANG_JS))) {
+                i++;
+            }
+            set_tokens(tokens, start, i, classify_word(text + start, i - start, lang));
+        } else if (ispunct((unsigned char)c)) {
+            tokens[i++] = TOK_OPERATOR;
+        } else {
+            tokens[i++] = TOK_DEFAULT;
+        }
+        
+        line_start = false;
+    }
+    
+    return end_state;
+}
+
+/**
+ * Make room for the states of a number of lines
+ */
+static int reserve_states(HighlightState *state, int lines) {
+    if (lines <= state->capacity) return LITE_OK;
+    
+    int capacity = state->capacity > 0 ? state->capacity : 1024;
+    while (capacity < lines) {
+        capacity *= 2;
+    }
+    
+    unsigned char *states = (unsigned char*)realloc(state->states, capacity);
+    if (!states) return LITE_ERROR;
+    
+    state->states = states;
+    state->capacity = capacity;
+    return LITE_OK;
+}
+
+/**
+ * Make sure the scratch buffers hold a line of some length
+ */
+static int reserve_scratch(HighlightScratch *scratch, size_t length) {
+    if (length + 1 <= scratch->size) return LITE_OK;
+    
+    size_t size = scratch->size > 0 ? scratch->size : 256;
+    while (size < length + 1) {
+        size *= 2;
+    }
+    
+    char *text = (char*)realloc(scratch->text, size);
+    if (!text) return LITE_ERROR;
+    scratch->text = text;
+    
+    unsigned char *tokens = (unsigned char*)realloc(scratch->tokens, size);
+    if (!tokens) return LITE_ERROR;
+    scratch->tokens = tokens;
+    
+    scratch->size = size;
+    return LITE_OK;
+}
+
+/**
+ * Free the scratch buffers
+ */
+static void free_scratch(HighlightScratch *scratch) {
+    free(scratch->text);
+    free(scratch->tokens);
+    scratch->text = NULL;
+    scratch->tokens = NULL;
+    scratch->size = 0;
+}
+
+/**
+ * Start reading lines of a piece table at an offset
+ */
+static void reader_init(LineReader *reader, const PieceTable *table, size_t offset) {
+    reader->table = table;
+    reader->snapshot = NULL;
+    reader->span = 0;
+    reader->offset = offset;
+    reader->chunk = NULL;
+    reader->chunk_length = 0;
+}
+
+/**
+ * Start reading lines at the beginning of a snapshot
+ */
+static void reader_init_snapshot(LineReader *reader, const PieceSnapshot *snapshot) {
+    reader_init(reader, NULL, 0);
+    reader->snapshot = snapshot;
+}
+
+/**
+ * Get the next run of text for a reader
+ */
+static const char* next_chunk(LineReader *reader, size_t *length) {
+    if (reader->snapshot) {
+        if (reader->span >= reader->snapshot->count) return NULL;
+        
+        const PieceSpan *span = &reader->snapshot->spans[reader->span++];
+        *length = span->length;
+        return span->data;
+    }
+    
+    return piece_table_chunk(reader->table, reader->offset, length);
+}
+
+/**
+ * Read the next line
+ *
+ * Lines that lie within one piece are returned in place. Only a line
+ * that spans pieces is copied into the scratch buffer. The line break,
+ * including a carriage return before it, is not part of the line.
+ */
+static int read_line(HighlightScratch *scratch, LineReader *reader, const char **text, int *length) {
+    const char *line = NULL;
+    size_t used = 0;
+    bool terminated = false;
+    
+    for (;;) {
+        if (reader->chunk_length == 0) {
+            reader->chunk = next_chunk(reader, &reader->chunk_length);
+            if (!reader->chunk) {
+                /* Last line of the text */
+                reader->chunk_length = 0;
+                break;
+            }
+        }
+        
+        const char *newline = (const char*)memchr(reader->chunk, '\n', reader->chunk_length);
+        size_t part = newline ? (size_t)(newline - reader->chunk) : reader->chunk_length;
+        size_t consumed = newline ? part + 1 : part;
+        
+        if (newline && used == 0 && !line) {
+            /* The whole line is inside this piece */
+            line = reader->chunk;
+        } else {
+            if (reserve_scratch(scratch, used + part) != LITE_OK) return LITE_ERROR;
+            memcpy(scratch->text + used, reader->chunk, part);
+        }
+        used += part;
+        
+        reader->chunk += consumed;
+        reader->chunk_length -= consumed;
+        reader->offset += consumed;
+        
+        if (newline) {
+            terminated = true;
+            break;
+        }
+    }
+    
+    /* Tokens are needed for the whole line */
+    if (reserve_scratch(scratch, used) != LITE_OK) return LITE_ERROR;
+    
+    *text = line ? line : scratch->text;
+    *length = (int)used;
+    
+    if (terminated && used > 0 && (*text)[used - 1] == '\r') {
+        (*length)--;
+    }
+    
+    return LITE_OK;
+}
+
+/**
+ * Free a job
+ */
+static void free_job(HighlightJob *job) {
+    piece_snapshot_free(&job->text);
+    free(job->old);
+    free(job->states);
+    free(job);
+}
+
+/**
+ * Make results visible to the UI thread and wake it up
+ *
+ * Returns false if the job was cancelled.
+ */
+static bool publish_results(HighlightJob *job, int lines, bool done) {
+    pthread_mutex_lock(&worker.lock);
+    job->published = lines;
+    job->done = done;
+    bool cancelled = job->cancelled;
+    pthread_mutex_unlock(&worker.lock);
+    
+    if (!cancelled) {
+        /* Can only fail when the counter is about to overflow, and then
+         * the UI thread has a wakeup pending anyway */
+        uint64_t one = 1;
+        ssize_t written = write(worker.notify_fd, &one, sizeof(one));
+        (void)written;
+    }
+    
+    return !cancelled;
+}
+
+/**
+ * Lex the lines of a job on the worker thread
+ */
+static void run_job(HighlightJob *job) {
+    LineReader reader;
+    reader_init_snapshot(&reader, &job->text);
+    
+    LexState start = job->start;
+    int line = 0;
+    
+    while (line < job->count) {
+        if (line % CANCEL_CHECK_LINES == 0) {
+            pthread_mutex_lock(&worker.lock);
+            bool cancelled = job->cancelled;
+            pthread_mutex_unlock(&worker.lock);
+            if (cancelled) return;
+        }
+        
+        const char *text;
+        int length;
+        if (read_line(&worker.scratch, &reader, &text, &length) != LITE_OK) {
+            /* Publish what there is, the UI thread takes over from there */
+            break;
+        }
+        
+        LexState end = lex_line(job->language, text, length, start, worker.scratch.tokens);
+        job->states[line] = (unsigned char)end;
+        line++;
+        
+        /* The old states are correct again from here on */
+        if (line <= job->old_count && end == job->old[line - 1] &&
+            job->first + line >= job->dirty_end) {
+            break;
+        }
+        
+        if (line % HIGHLIGHT_PUBLISH_LINES == 0 && !publish_results(job, line, false)) {
+            return;
+        }
+        
+        start = end;
+    }
+    
+    publish_results(job, line, true);
+}
+
+/**
+ * Worker thread, runs queued jobs until stopped
+ */
+static void* worker_main(void *data) {
+    (void)data;
+    
+    pthread_mutex_lock(&worker.lock);
+    
+    for (;;) {
+        while (!worker.queue && !worker.stopping) {
+            pthread_cond_wait(&worker.wake, &worker.lock);
+        }
+        if (worker.stopping) break;
+        
+        HighlightJob *job = worker.queue;
+        worker.queue = job->next;
+        worker.current = job;
+        pthread_mutex_unlock(&worker.lock);
+        
+        run_job(job);
+        
+        pthread_mutex_lock(&worker.lock);
+        worker.current = NULL;
+        
+        /* Nobody refers to a job that was cancelled while running */
+        if (job->cancelled) {
+            free_job(job);
+        }
+        pthread_cond_broadcast(&worker.idle);
+    }
+    
+    pthread_mutex_unlock(&worker.lock);
+    return NULL;
+}
+
+/**
+ * Start the worker thread if it is not running yet
+ */
+static int start_worker(void) {
+    if (worker.started) return LITE_OK;
+    
+    /* Without a way to wake the UI thread, results would go unnoticed */
+    if (worker.notify_fd == -1) return LITE_ERROR;
+    
+    if (pthread_create(&worker.thread, NULL, worker_main, NULL) != 0) {
+        LOG_ERROR("Failed to start highlighting thread");
+        return LITE_ERROR;
+    }
+    
+    worker.started = true;
+    return LITE_OK;
+}
+
+/**
+ * Drop the job of a buffer
+ *
+ * A job the worker is running is freed by the worker once it notices.
+ * With wait set, this returns only after the worker has let go of the
+ * job, so that the text it is reading may be freed.
+ */
+static void cancel_job(HighlightState *state, bool wait) {
+    HighlightJob *job = state->job;
+    if (!job) return;
+    
+    state->job = NULL;
+    
+    pthread_mutex_lock(&worker.lock);
+    
+    if (worker.current == job) {
+        job->cancelled = true;
+        while (wait && worker.current == job) {
+            pthread_cond_wait(&worker.idle, &worker.lock);
+        }
+        pthread_mutex_unlock(&worker.lock);
+        return;
+    }
+    
+    /* Take it off the queue if the worker has not started on it */
+    HighlightJob **link = &worker.queue;
+    while (*link && *link != job) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = job->next;
+    }
+    
+    pthread_mutex_unlock(&worker.lock);
+    free_job(job);
+}
+
+/**
+ * Record the end state of line `dirty`, the next one to bring up to date
+ *
+ * Room for the line must already be reserved. Returns true once the
+ * states of all remaining lines are known to be correct.
+ */
+static bool store_state(Buffer *buffer, HighlightState *state, LexState end) {
+    int line = state->dirty;
+    
+    if (line < state->computed) {
+        LexState old = (LexState)state->states[line];
+        state->states[line] = (unsigned char)end;
+        
+        if (end != old) {
+            /* The next line starts in a different state */
+            buffer_mark_dirty(buffer, line + 1, line + 1);
+        } else if (line + 1 >= state->dirty_end) {
+            /* Unchanged lines follow in the same state as before */
+            state->dirty = state->computed;
+            return true;
+        }
+    } else {
+        state->states[line] = (unsigned char)end;
+        state->computed = line + 1;
+    }
+    
+    state->dirty = line + 1;
+    return false;
+}
+
+/**
+ * Redraw lines that were drawn plain and can be highlighted now
+ */
+static void reveal_lines(Buffer *buffer, HighlightState *state) {
+    if (state->plain_from <= state->dirty) {
+        buffer_mark_dirty(buffer, state->plain_from, state->dirty);
+        state->plain_from = state->dirty + 1;
+    }
+}
+
+/**
+ * Take over the results the worker has published for a buffer
+ *
+ * Only lines before `limit` are taken. The job is released once all of
+ * its results are in or the remaining states turn out to be correct.
+ */
+static void collect_results(Buffer *buffer, HighlightState *state, int limit) {
+    HighlightJob *job = state->job;
+    if (!job) return;
+    
+    pthread_mutex_lock(&worker.lock);
+    int published = job->published;
+    bool done = job->done;
+    pthread_mutex_unlock(&worker.lock);
+    
+    /* Results for another version of the text are of no use */
+    if (job->version != buffer->version || state->dirty != job->first + job->merged ||
+        reserve_states(state, job->first + job->count) != LITE_OK) {
+        cancel_job(state, false);
+        return;
+    }
+    
+    bool converged = false;
+    int merged = job->merged;
+    
+    while (job->merged < published && job->first + job->merged < limit && !converged) {
+        converged = store_state(buffer, state, (LexState)job->states[job->merged]);
+        job->merged++;
+    }
+    
+    if (job->merged > merged) {
+        state->dirty_offset = PIECE_NPOS;
+        reveal_lines(buffer, state);
+    }
+    
+    if (converged || (done && job->merged == published)) {
+        cancel_job(state, false);
+    }
+}
+
+/**
+ * Hand the lines from `dirty` to the end of the buffer to the worker
+ */
+static int post_job(Buffer *buffer, HighlightState *state) {
+    if (start_worker() != LITE_OK) return LITE_ERROR;
+    
+    int first = state->dirty;
+    int count = buffer->line_count - first;
+    if (count <= 0) return LITE_ERROR;
+    
+    size_t offset = state->dirty_offset;
+    if (offset == PIECE_NPOS) {
+        offset = buffer_line_offset(buffer, first);
+    }
+    state->dirty_offset = offset;
+    
+    HighlightJob *job = (HighlightJob*)calloc(1, sizeof(HighlightJob));
+    if (!job) return LITE_ERROR;
+    
+    job->language = state->language;
+    job->version = buffer->version;
+    job->first = first;
+    job->count = count;
+    job->start = first == 0 ? LEX_NORMAL : (LexState)state->states[first - 1];
+    job->dirty_end = state->dirty_end;
+    job->old_count = state->computed - first;
+    if (job->old_count > count) {
+        job->old_count = count;
+    }
+    
+    job->states = (unsigned char*)malloc(count);
+    if (job->old_count > 0) {
+        job->old = (unsigned char*)malloc(job->old_count);
+    }
+    
+    if (!job->states || (job->old_count > 0 && !job->old) ||
+        piece_table_snapshot(&buffer->text, offset, &job->text) != LITE_OK) {
+        free_job(job);
+        return LITE_ERROR;
+    }
+    
+    if (job->old_count > 0) {
+        memcpy(job->old, state->states + first, job->old_count);
+    }
+    
+    pthread_mutex_lock(&worker.lock);
+    HighlightJob **link = &worker.queue;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = job;
+    pthread_cond_signal(&worker.wake);
+    pthread_mutex_unlock(&worker.lock);
+    
+    state->job = job;
+    return LITE_OK;
+}
+
+/**
+ * Lex lines on the UI thread
+ *
+ * Stops at end_line, where the old states turn out correct, or once
+ * `budget` bytes have been lexed. Returns false if it ran out of budget.
+ */
+static bool lex_lines(Buffer *buffer, HighlightState *state, int end_line, size_t budget) {
+    /* Continue where the last update stopped without looking the line up */
+    size_t offset = state->dirty_offset;
+    if (offset == PIECE_NPOS) {
+        offset = buffer_line_offset(buffer, state->dirty);
+    }
+    state->dirty_offset = PIECE_NPOS;
+    
+    LineReader reader;
+    reader_init(&reader, &buffer->text, offset);
+    size_t lexed = 0;
+    
+    while (state->dirty < end_line) {
+        if (lexed >= budget) {
+            state->dirty_offset = reader.offset;
+            return false;
+        }
+        
+        int line = state->dirty;
+        const char *text;
+        int length;
+        
+        if (read_line(&state->scratch, &reader, &text, &length) != LITE_OK ||
+            reserve_states(state, line + 1) != LITE_OK) {
+            LOG_ERROR("Out of memory while highlighting");
+            return true;
+        }
+        
+        LexState start = line == 0 ? LEX_NORMAL : (LexState)state->states[line - 1];
+        LexState end = lex_line(state->language, text, length, start, state->scratch.tokens);
+        state->lexed_lines++;
+        lexed += (size_t)length + 1;
+        
+        if (store_state(buffer, state, end)) {
+            return true;
+        }
+    }
+    
+    state->dirty_offset = reader.offset;
+    return true;
+}
+
+/**
+ * Get the highlighting state of a buffer
+ *
+ * Created on first use and started over when the buffer's language
+ * changes. Returns NULL if the language is not highlighted.
+ */
+static HighlightState* get_state(Buffer *buffer) {
+    LanguageId language = highlight_detect_language(buffer->filename);
+    HighlightState *state = buffer->highlight;
+    
+    if (!state) {
+        if (language == LANG_UNKNOWN) return NULL;
+        
+        state = (HighlightState*)calloc(1, sizeof(HighlightState));
+        if (!state) return NULL;
+        
+        state->language = language;
+        state->dirty_offset = PIECE_NPOS;
+        state->plain_from = INT_MAX;
+        buffer->highlight = state;
+    } else if (state->language != language) {
+        cancel_job(state, false);
+        state->language = language;
+        state->computed = 0;
+        state->dirty = 0;
+        state->dirty_end = 0;
+        state->dirty_offset = PIECE_NPOS;
+        state->plain_from = INT_MAX;
+    }
+    
+    return language == LANG_UNKNOWN ? NULL : state;
+}
+
+/**
+ * Set up the highlighting worker
+ *
+ * The worker itself starts with the first job. Returns a descriptor
+ * that becomes readable when results are ready, or -1 if highlighting
+ * has to stay on the UI thread.
+ */
+int highlight_worker_init(void) {
+    if (worker.notify_fd == -1) {
+        worker.notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (worker.notify_fd == -1) {
+            LOG_WARNING("Highlighting on the UI thread: %s", strerror(errno));
+        }
+    }
+    
+    return worker.notify_fd;
+}
+
+/**
+ * Stop the highlighting worker
+ *
+ * Every buffer must have been freed first.
  */
-void highlight_line(WINDOW *win, const char *line, int line_num, LanguageId lang) {
-    if (!win || !line) return;
+void highlight_worker_free(void) {
+    if (worker.started) {
+        pthread_mutex_lock(&worker.lock);
+        worker.stopping = true;
+        pthread_cond_signal(&worker.wake);
+        pthread_mutex_unlock(&worker.lock);
+        
+        pthread_join(worker.thread, NULL);
+        worker.started = false;
+        worker.stopping = false;
+    }
     
-    /* For now, just display the line */
-    mvwaddstr(win, line_num, 0, line);
+    if (worker.notify_fd != -1) {
+        close(worker.notify_fd);
+        worker.notify_fd = -1;
+    }
+    
+    free_scratch(&worker.scratch);
+}
+
+/**
+ * Acknowledge a wakeup from the worker
+ *
+ * The results themselves are taken over by the next highlight_update.
+ */
+void highlight_worker_drain(void) {
+    uint64_t count;
+    
+    while (read(worker.notify_fd, &count, sizeof(count)) > 0) {
+    }
+}
+
+/**
+ * Free the highlighting state of a buffer
+ *
+ * Waits for the worker to stop reading the buffer's text.
+ */
+void highlight_free(HighlightState *state) {
+    if (!state) return;
+    
+    cancel_job(state, true);
+    free(state->states);
+    free_scratch(&state->scratch);
+    free(state);
+}
+
+/**
+ * Account for an edit to the buffer
+ *
+ * old_count lines starting at first were replaced with new_count lines.
+ * States below the edit are kept, moved to their new line numbers, so
+ * that relexing can stop once it reaches them in the same state. Called
+ * before the buffer version changes.
+ */
+void highlight_lines_changed(Buffer *buffer, int first, int old_count, int new_count) {
+    HighlightState *state = buffer ? buffer->highlight : NULL;
+    if (!state || first < 0) return;
+    
+    /* Results for the lines above the edit still hold */
+    if (state->job) {
+        collect_results(buffer, state, first);
+        cancel_job(state, false);
+    }
     
-    /* TODO: Implement proper syntax highlighting */
-}
\ No newline at end of file
+    int delta = new_count - old_count;
+    
+    /* Offsets move with the edit */
+    state->dirty_offset = PIECE_NPOS;
+    
+    /* Lines drawn plain move with the edit too */
+    if (state->plain_from != INT_MAX && state->plain_from > first) {
+        state->plain_from = state->plain_from + delta > first ? state->plain_from + delta : first;
+    }
+    
+    /* Relexing may not stop before the line where it last left off, that
+     * line was lexed from a start state that has changed since */
+    if (state->dirty >= state->computed) {
+        state->dirty_end = 0;
+    } else if (state->dirty_end <= state->dirty) {
+        state->dirty_end = state->dirty + 1;
+    }
+    
+    if (first < state->computed) {
+        int tail = first + old_count;
+        
+        if (tail <= state->computed && new_count > 0) {
+            /* The last replaced line still ends where the old one did */
+            unsigned char last = state->states[tail - 1];
+            
+            if (reserve_states(state, state->computed + delta) != LITE_OK) {
+                state->computed = first;
+            } else {
+                memmove(state->states + first + new_count, state->states + tail,
+                        state->computed - tail);
+                state->computed += delta;
+                
+                int kept = old_count < new_count ? old_count : new_count;
+                for (int i = first + kept - 1; i < first + new_count - 1; i++) {
+                    if (i >= first) state->states[i] = LEX_UNKNOWN;
+                }
+                state->states[first + new_count - 1] = last;
+            }
+        } else {
+            state->computed = first;
+        }
+    }
+    
+    if (state->dirty_end > first + old_count) {
+        state->dirty_end += delta;
+    }
+    if (state->dirty_end < first + new_count) {
+        state->dirty_end = first + new_count;
+    }
+    if (state->dirty > first) {
+        state->dirty = first;
+    }
+    if (state->dirty > state->computed) {
+        state->dirty = state->computed;
+    }
+}
+
+/**
+ * Bring the lexer states up to date for all lines before end_line
+ *
+ * Lines whose starting state turns out different from before are marked
+ * for redrawing. Nothing is done for lines already known to be correct.
+ * Whatever does not fit in the UI thread's budget is left to the worker,
+ * whose results are taken over by later calls.
+ */
+void highlight_update(Buffer *buffer, int end_line) {
+    if (!buffer) return;
+    
+    HighlightState *state = get_state(buffer);
+    if (!state) return;
+    
+    collect_results(buffer, state, INT_MAX);
+    
+    if (end_line > buffer->line_count) {
+        end_line = buffer->line_count;
+    }
+    if (state->dirty >= end_line) return;
+    
+    /* The worker is already on it */
+    if (state->job) return;
+    
+    if (!lex_lines(buffer, state, end_line, HIGHLIGHT_SYNC_BYTES) &&
+        post_job(buffer, state) != LITE_OK) {
+        /* Without the worker everything is lexed here */
+        lex_lines(buffer, state, end_line, SIZE_MAX);
+    }
+    
+    reveal_lines(buffer, state);
+}
+
+/**
+ * Highlight a line
+ *
+ * Returns the token type of every byte of the line, valid until the next
+ * call, or NULL if the buffer is not highlighted or the state the line
+ * starts in is not known yet.
+ */
+const unsigned char* highlight_line(Buffer *buffer, int line, size_t offset, int *length) {
+    if (!buffer || !length || offset == PIECE_NPOS) return NULL;
+    
+    HighlightState *state = get_state(buffer);
+    if (!state) return NULL;
+    
+    /* The line starts in the state its predecessor ends in */
+    if (state->dirty < line) {
+        if (line < state->plain_from) {
+            state->plain_from = line;
+        }
+        return NULL;
+    }
+    
+    LineReader reader;
+    const char *text;
+    reader_init(&reader, &buffer->text, offset);
+    if (read_line(&state->scratch, &reader, &text, length) != LITE_OK) {
+        return NULL;
+    }
+    
+    LexState start = line == 0 ? LEX_NORMAL : (LexState)state->states[line - 1];
+    lex_line(state->language, text, *length, start, state->scratch.tokens);
+    
+    return state->scratch.tokens;
+}
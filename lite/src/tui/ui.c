@@ -6,10 +6,26 @@
 #include "tui/ui.h"
 #include "core/editor.h"
 #include "core/buffer.h"
+#include "fs/load.h"
+#include "fs/pager.h"
+#include "fs/follow.h"
 #include "syntax/highlight.h"
 #include "utils/log.h"
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+/* Size of the reads that collect pasted text */
+#define PASTE_READ_BLOCK 65536
+
+/* Give up on a paste whose end marker has not arrived by then */
+#define PASTE_TIMEOUT_MS 1000
+
+/* Longest key sequence looked up in input read past a paste */
+#define INPUT_KEY_MAX 16
 
 /**
  * Initialize the UI
@@ -22,7 +38,12 @@ int ui_init(EditorState *state) {
     raw();
     keypad(stdscr, TRUE);
     noecho();
-    timeout(100); /* Non-blocking input with 100ms timeout */
+    nodelay(stdscr, TRUE); /* Keys are read once the event loop reports input */
+    
+    /* Have the terminal mark pasted text */
+    define_key(UI_PASTE_BEGIN, UI_KEY_PASTE_BEGIN);
+    define_key(UI_PASTE_END, UI_KEY_PASTE_END);
+    putp("\033[?2004h");
     
     /* Enable colors if available */
     if (has_colors()) {
@@ -42,6 +63,10 @@ int ui_init(EditorState *state) {
         init_pair(10, COLOR_BLACK, COLOR_WHITE);  /* Status line */
     }
     
+    /* Flush stdscr once so getch() has nothing left to repaint over the
+     * windows, which are no longer redrawn on every frame */
+    refresh();
+    
     /* Get terminal size */
     getmaxyx(stdscr, state->ui.term_height, state->ui.term_width);
     
@@ -58,6 +83,16 @@ int ui_init(EditorState *state) {
     /* Set editor height */
     state->ui.editor_height = state->ui.term_height - 2;
     
+    /* Nothing is on screen yet */
+    state->ui.drawn_buffer_id = -1;
+    state->ui.drawn_scroll_x = 0;
+    state->ui.drawn_scroll_y = 0;
+    ui_invalidate(state);
+    
+    state->ui.input = NULL;
+    state->ui.input_length = 0;
+    state->ui.input_offset = 0;
+    
     return LITE_OK;
 }
 
@@ -72,6 +107,12 @@ void ui_free(EditorState *state) {
     if (state->ui.status_win) delwin(state->ui.status_win);
     if (state->ui.command_win) delwin(state->ui.command_win);
     
+    free(state->ui.input);
+    state->ui.input = NULL;
+    
+    /* Turn bracketed paste back off */
+    putp("\033[?2004l");
+    
     /* End ncurses */
     endwin();
 }
@@ -101,21 +142,130 @@ void ui_resize(EditorState *state) {
     redrawwin(state->ui.main_win);
     redrawwin(state->ui.status_win);
     redrawwin(state->ui.command_win);
+    ui_invalidate(state);
+}
+
+/**
+ * Adopt a new terminal size after SIGWINCH
+ *
+ * The signal is delivered through the event loop, so curses has not seen
+ * it and the size has to be queried here.
+ */
+void ui_terminal_resized(EditorState *state) {
+    if (!state) return;
+    
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == -1 || size.ws_row == 0 || size.ws_col == 0) {
+        return;
+    }
+    
+    resizeterm(size.ws_row, size.ws_col);
+    ui_resize(state);
+}
+
+/**
+ * Scroll the view so the cursor stays visible
+ */
+static void scroll_to_cursor(EditorState *state, Buffer *buffer) {
+    int height = state->ui.editor_height;
+    int width = state->ui.term_width - (state->config.line_numbers ? 4 : 0);
+    
+    if (buffer->cursor_y < buffer->scroll_y) {
+        buffer->scroll_y = buffer->cursor_y;
+    } else if (height > 0 && buffer->cursor_y >= buffer->scroll_y + height) {
+        buffer->scroll_y = buffer->cursor_y - height + 1;
+    }
+    
+    if (buffer->cursor_x < buffer->scroll_x) {
+        buffer->scroll_x = buffer->cursor_x;
+    } else if (width > 0 && buffer->cursor_x >= buffer->scroll_x + width) {
+        buffer->scroll_x = buffer->cursor_x - width + 1;
+    }
+}
+
+/**
+ * Draw a single buffer line on a screen row
+ */
+static void draw_line(EditorState *state, Buffer *buffer, int y, int line_num, size_t offset) {
+    WINDOW *win = state->ui.main_win;
+    
+    int x_offset = state->config.line_numbers ? 4 : 0;
+    int text_width = state->ui.term_width - x_offset + 1;
+    char text[LITE_MAX_LINE_LENGTH];
+    
+    if (text_width > (int)sizeof(text)) {
+        text_width = sizeof(text);
+    }
+    
+    wmove(win, y, 0);
+    wclrtoeol(win);
+    
+    if (offset == PIECE_NPOS) return;
+    
+    /* Display line number if enabled */
+    if (state->config.line_numbers) {
+        wattron(win, A_DIM);
+        mvwprintw(win, y, 0, "%3d ", line_num + 1);
+        wattroff(win, A_DIM);
+    }
+    
+    /* Display line content */
+    int length = buffer_copy_line(buffer, offset, buffer->scroll_x, text, text_width);
+    
+    const unsigned char *tokens = NULL;
+    int token_count = 0;
+    if (state->config.syntax_highlight) {
+        tokens = highlight_line(buffer, line_num, offset, &token_count);
+    }
+    
+    if (!tokens) {
+        mvwprintw(win, y, x_offset, "%s", text);
+        return;
+    }
+    
+    /* Draw runs of bytes with the same token type */
+    wmove(win, y, x_offset);
+    int start = 0;
+    while (start < length) {
+        int col = buffer->scroll_x + start;
+        TokenType type = col < token_count ? (TokenType)tokens[col] : TOK_DEFAULT;
+        
+        int end = start + 1;
+        while (end < length && buffer->scroll_x + end < token_count &&
+               tokens[buffer->scroll_x + end] == type) {
+            end++;
+        }
+        
+        if (type == TOK_DEFAULT) {
+            waddnstr(win, text + start, end - start);
+        } else {
+            int pair = highlight_get_color(type);
+            wattron(win, COLOR_PAIR(pair));
+            waddnstr(win, text + start, end - start);
+            wattroff(win, COLOR_PAIR(pair));
+        }
+        
+        start = end;
+    }
 }
 
 /**
  * Render buffer content
+ *
+ * Only lines the buffer reports as changed are redrawn, unless the view
+ * itself moved or another buffer is shown.
  */
 void ui_render_buffer(EditorState *state) {
     if (!state) return;
     
     WINDOW *win = state->ui.main_win;
     
-    /* Clear window */
-    werase(win);
-    
     /* If no buffer, show welcome message */
     if (state->buffer_count == 0) {
+        if (!state->ui.full_redraw && state->ui.drawn_buffer_id == 0) return;
+        
+        werase(win);
+        
         char welcome[80];
         int welcome_len = snprintf(welcome, sizeof(welcome),
                                   "LITE Editor v%s", LITE_VERSION);
@@ -126,6 +276,8 @@ void ui_render_buffer(EditorState *state) {
         mvwprintw(win, welcome_y, welcome_x, "%s", welcome);
         mvwprintw(win, welcome_y + 2, welcome_x - 10, "Type :help for help, :q to quit");
         
+        state->ui.drawn_buffer_id = 0;
+        state->ui.full_redraw = false;
         return;
     }
     
@@ -133,42 +285,56 @@ void ui_render_buffer(EditorState *state) {
     Buffer *buffer = state->buffers[state->current_buffer];
     if (!buffer) return;
     
-    /* Determine display range */
-    int start_y = buffer->scroll_y;
-    int end_y = start_y + state->ui.editor_height;
+    scroll_to_cursor(state, buffer);
     
-    /* Display buffer content */
-    Line *line = buffer->first_line;
-    int line_num = 0;
+    /* Relex edited lines first, this can damage lines further down */
+    if (state->config.syntax_highlight) {
+        highlight_update(buffer, buffer->scroll_y + state->ui.editor_height);
+    }
     
-    /* Skip lines before scroll position */
-    while (line && line_num < start_y) {
-        line = line->next;
-        line_num++;
+    /* A different buffer or a moved view invalidates every row */
+    bool full = state->ui.full_redraw ||
+                state->ui.drawn_buffer_id != buffer->id ||
+                state->ui.drawn_scroll_x != buffer->scroll_x ||
+                state->ui.drawn_scroll_y != buffer->scroll_y;
+    
+    /* Keep the part of a large file on screen in memory */
+    if (full && pager_enabled(buffer)) {
+        int last_y = buffer->scroll_y + state->ui.editor_height;
+        size_t from = buffer_line_offset(buffer, buffer->scroll_y);
+        size_t to = last_y < buffer->line_count ? buffer_line_offset(buffer, last_y)
+                                                : piece_table_length(&buffer->text);
+        pager_touch(buffer, from, to - from < PAGER_WINDOW ? to - from : PAGER_WINDOW);
     }
     
-    /* Display visible lines */
-    int y = 0;
-    while (line && line_num < end_y) {
-        /* Display line number if enabled */
-        if (state->config.line_numbers) {
-            wattron(win, A_DIM);
-            mvwprintw(win, y, 0, "%3d ", line_num + 1);
-            wattroff(win, A_DIM);
-        }
+    if (full || buffer_is_dirty(buffer)) {
+        int start_y = buffer->scroll_y;
+        int last_line = -1;
+        size_t offset = PIECE_NPOS;
         
-        /* Display line content */
-        int x_offset = state->config.line_numbers ? 4 : 0;
-        if (state->config.syntax_highlight) {
-            /* TODO: Implement proper syntax highlighting */
-            mvwprintw(win, y, x_offset, "%s", line->data);
-        } else {
-            mvwprintw(win, y, x_offset, "%s", line->data);
+        for (int y = 0; y < state->ui.editor_height; y++) {
+            int line_num = start_y + y;
+            
+            if (!full && !buffer_is_line_dirty(buffer, line_num)) continue;
+            
+            /* Continue from the previous line or look the line up */
+            if (line_num >= buffer->line_count) {
+                offset = PIECE_NPOS;
+            } else if (last_line >= 0 && line_num == last_line + 1 && offset != PIECE_NPOS) {
+                offset = buffer_next_line(buffer, offset);
+            } else {
+                offset = buffer_line_offset(buffer, line_num);
+            }
+            last_line = line_num;
+            
+            draw_line(state, buffer, y, line_num, offset);
         }
         
-        line = line->next;
-        line_num++;
-        y++;
+        buffer_clear_dirty(buffer);
+        state->ui.drawn_buffer_id = buffer->id;
+        state->ui.drawn_scroll_x = buffer->scroll_x;
+        state->ui.drawn_scroll_y = buffer->scroll_y;
+        state->ui.full_redraw = false;
     }
     
     /* Position cursor */
@@ -184,11 +350,57 @@ void ui_render_buffer(EditorState *state) {
 
 /**
  * Render status line
+ *
+ * The line is only redrawn when its text differs from what is on screen.
  */
 void ui_render_status_line(EditorState *state) {
     if (!state) return;
     
     WINDOW *win = state->ui.status_win;
+    Buffer *buffer = NULL;
+    
+    if (state->buffer_count > 0) {
+        buffer = state->buffers[state->current_buffer];
+    }
+    
+    /* Left side: filename and modified indicator */
+    char left_status[256] = " LITE Editor";
+    
+    /* Right side: position information */
+    char right_status[64] = "No File     ";
+    
+    if (buffer) {
+        char *filename = buffer->filename ? buffer->filename : "[No Name]";
+        snprintf(left_status, sizeof(left_status), " %s%s%s",
+                 filename, buffer->modified ? " [+]" : "", follow_running(buffer) ? " [follow]" : "");
+        
+        /* Lines of a file still being loaded are counted as they come in */
+        int loaded = load_progress(buffer);
+        if (loaded >= 0) {
+            snprintf(right_status, sizeof(right_status), "%d:%d | %d lines, loading %d%% ",
+                     buffer->cursor_y + 1, buffer->cursor_x + 1, buffer->line_count, loaded);
+        } else {
+            snprintf(right_status, sizeof(right_status), "%d:%d | %d lines ",
+                     buffer->cursor_y + 1, buffer->cursor_x + 1, buffer->line_count);
+        }
+    }
+    
+    /* Mode indicator in middle */
+    char mode_str[16] = "";
+    if (buffer) {
+        switch (state->mode) {
+            case MODE_NORMAL: strcpy(mode_str, "NORMAL"); break;
+            case MODE_INSERT: strcpy(mode_str, "INSERT"); break;
+            case MODE_COMMAND: strcpy(mode_str, "COMMAND"); break;
+            case MODE_VISUAL: strcpy(mode_str, "VISUAL"); break;
+        }
+    }
+    
+    /* Skip drawing if nothing changed */
+    char status_text[LITE_MAX_LINE_LENGTH];
+    snprintf(status_text, sizeof(status_text), "%s\t%s\t%s", left_status, mode_str, right_status);
+    if (strcmp(status_text, state->ui.status_text) == 0) return;
+    strcpy(state->ui.status_text, status_text);
     
     /* Clear window */
     werase(win);
@@ -201,45 +413,10 @@ void ui_render_status_line(EditorState *state) {
         mvwprintw(win, 0, i, " ");
     }
     
-    /* If no buffer, show basic status */
-    if (state->buffer_count == 0) {
-        mvwprintw(win, 0, 0, " LITE Editor");
-        mvwprintw(win, 0, state->ui.term_width - 12, "No File");
-        wattroff(win, COLOR_PAIR(10));
-        return;
-    }
-    
-    /* Get current buffer */
-    Buffer *buffer = state->buffers[state->current_buffer];
-    if (!buffer) {
-        wattroff(win, COLOR_PAIR(10));
-        return;
-    }
-    
-    /* Left side: filename and modified indicator */
-    char left_status[256];
-    char *filename = buffer->filename ? buffer->filename : "[No Name]";
-    snprintf(left_status, sizeof(left_status), " %s%s",
-             filename, buffer->modified ? " [+]" : "");
-    
-    /* Right side: position information */
-    char right_status[64];
-    snprintf(right_status, sizeof(right_status), "%d:%d | %d lines ",
-             buffer->cursor_y + 1, buffer->cursor_x + 1, buffer->line_count);
-    
     /* Display status */
     mvwprintw(win, 0, 0, "%s", left_status);
     mvwprintw(win, 0, state->ui.term_width - strlen(right_status), "%s", right_status);
     
-    /* Display mode indicator in middle */
-    char mode_str[16] = "";
-    switch (state->mode) {
-        case MODE_NORMAL: strcpy(mode_str, "NORMAL"); break;
-        case MODE_INSERT: strcpy(mode_str, "INSERT"); break;
-        case MODE_COMMAND: strcpy(mode_str, "COMMAND"); break;
-        case MODE_VISUAL: strcpy(mode_str, "VISUAL"); break;
-    }
-    
     int mode_x = (state->ui.term_width - strlen(mode_str)) / 2;
     mvwprintw(win, 0, mode_x, "%s", mode_str);
     
@@ -249,22 +426,32 @@ void ui_render_status_line(EditorState *state) {
 
 /**
  * Render command line
+ *
+ * The line is only redrawn when its text differs from what is on screen.
  */
 void ui_render_command_line(EditorState *state) {
     if (!state) return;
     
     WINDOW *win = state->ui.command_win;
     
-    /* Clear window */
-    werase(win);
+    /* Command input or status message */
+    char command_text[LITE_MAX_LINE_LENGTH + 1];
+    if (state->mode == MODE_COMMAND) {
+        snprintf(command_text, sizeof(command_text), "%c%s", state->command_prompt, state->command_buffer);
+    } else {
+        snprintf(command_text, sizeof(command_text), "%s", state->status_message);
+    }
+    
+    if (strcmp(command_text, state->ui.command_text) != 0) {
+        snprintf(state->ui.command_text, sizeof(state->ui.command_text), "%s", command_text);
+        
+        /* Clear window */
+        werase(win);
+        mvwprintw(win, 0, 0, "%s", command_text);
+    }
     
-    /* If in command mode, show command input */
     if (state->mode == MODE_COMMAND) {
-        mvwprintw(win, 0, 0, ":%s", state->command_buffer);
-        wmove(win, 0, state->command_pos + 1); /* +1 for the colon */
-    } else if (strlen(state->status_message) > 0) {
-        /* Show status message */
-        mvwprintw(win, 0, 0, "%s", state->status_message);
+        wmove(win, 0, state->command_pos + 1); /* +1 for the prompt */
     }
 }
 
@@ -282,14 +469,38 @@ void ui_render_message(EditorState *state) {
 
 /**
  * Refresh display
+ *
+ * Changes are collected with wnoutrefresh and sent in a single update.
+ * The window holding the cursor goes last so the terminal cursor ends up
+ * there.
  */
 void ui_refresh(EditorState *state) {
     if (!state) return;
     
-    /* Refresh all windows */
-    wrefresh(state->ui.main_win);
-    wrefresh(state->ui.status_win);
-    wrefresh(state->ui.command_win);
+    wnoutrefresh(state->ui.status_win);
+    
+    if (state->mode == MODE_COMMAND) {
+        wnoutrefresh(state->ui.main_win);
+        wnoutrefresh(state->ui.command_win);
+    } else {
+        wnoutrefresh(state->ui.command_win);
+        wnoutrefresh(state->ui.main_win);
+    }
+    
+    doupdate();
+}
+
+/**
+ * Force the next render to redraw everything
+ */
+void ui_invalidate(EditorState *state) {
+    if (!state) return;
+    
+    state->ui.full_redraw = true;
+    
+    /* No rendered text matches these, so both lines are drawn again */
+    strcpy(state->ui.status_text, "\n");
+    strcpy(state->ui.command_text, "\n");
 }
 
 /**
@@ -304,12 +515,64 @@ void ui_clear(EditorState *state) {
     werase(state->ui.command_win);
 }
 
+/**
+ * Drop the input read past a paste
+ */
+static void drop_input(UIState *ui) {
+    free(ui->input);
+    ui->input = NULL;
+    ui->input_length = 0;
+    ui->input_offset = 0;
+}
+
+/**
+ * Take the next key from the input read past a paste
+ *
+ * Escape sequences are looked up among the keys curses knows, so they
+ * come out as the same key codes getch() returns for them.
+ */
+static int next_input_key(UIState *ui) {
+    const char *p = ui->input + ui->input_offset;
+    size_t left = ui->input_length - ui->input_offset;
+    
+    if (p[0] == '\033') {
+        char sequence[INPUT_KEY_MAX + 1];
+        
+        for (size_t n = 2; n <= left && n <= INPUT_KEY_MAX; n++) {
+            memcpy(sequence, p, n);
+            sequence[n] = '\0';
+            
+            /* Negative while it is the start of a longer sequence */
+            int code = key_defined(sequence);
+            if (code > 0) {
+                ui->input_offset += n;
+                return code;
+            }
+            if (code == 0) break;
+        }
+    }
+    
+    ui->input_offset++;
+    return (unsigned char)p[0];
+}
+
 /**
  * Get keyboard input
+ *
+ * Whatever came in after a paste is handed out before the keys still
+ * waiting on the terminal.
  */
 int ui_get_key(EditorState *state) {
     if (!state) return ERR;
     
+    if (state->ui.input) {
+        int key = next_input_key(&state->ui);
+        if (state->ui.input_offset == state->ui.input_length) {
+            drop_input(&state->ui);
+        }
+        return key;
+    }
+    
     /* Check for terminal resize */
     int ch = getch();
     if (ch == KEY_RESIZE) {
@@ -318,4 +581,101 @@ int ui_get_key(EditorState *state) {
     }
     
     return ch;
-}
\ No newline at end of file
+}
+
+/**
+ * Find the end of paste marker
+ */
+static char* find_paste_end(char *text, size_t length) {
+    size_t marker_length = strlen(UI_PASTE_END);
+    char *p = text;
+    char *end = text + length;
+    
+    while ((p = memchr(p, UI_PASTE_END[0], end - p)) != NULL) {
+        if ((size_t)(end - p) >= marker_length && memcmp(p, UI_PASTE_END, marker_length) == 0) {
+            return p;
+        }
+        p++;
+    }
+    
+    return NULL;
+}
+
+/**
+ * Read the text of a bracketed paste
+ *
+ * Called once the paste start marker came in as UI_KEY_PASTE_BEGIN. The
+ * text is read straight from the terminal in large blocks up to the end
+ * marker, instead of one key at a time through curses. Anything typed
+ * after the end marker is kept and handed out by ui_get_key() before the
+ * terminal is read again. Returns the pasted text, which the caller
+ * frees, or NULL if nothing could be read.
+ */
+char* ui_read_paste(EditorState *state, size_t *length) {
+    if (!state || !length) return NULL;
+    
+    /* Input kept from an earlier paste holds the start of this one */
+    size_t kept = state->ui.input ? state->ui.input_length - state->ui.input_offset : 0;
+    size_t capacity = PASTE_READ_BLOCK + kept;
+    size_t used = 0;
+    char *text = (char*)malloc(capacity);
+    if (!text) return NULL;
+    
+    if (kept > 0) {
+        memcpy(text, state->ui.input + state->ui.input_offset, kept);
+        used = kept;
+    }
+    drop_input(&state->ui);
+    
+    size_t marker_length = strlen(UI_PASTE_END);
+    size_t searched = 0;
+    
+    for (;;) {
+        char *marker = find_paste_end(text + searched, used - searched);
+        if (marker) {
+            /* Keep what follows the paste for the keys that come next */
+            char *rest = marker + marker_length;
+            size_t rest_length = (size_t)(text + used - rest);
+            if (rest_length > 0) {
+                state->ui.input = (char*)malloc(rest_length);
+                if (state->ui.input) {
+                    memcpy(state->ui.input, rest, rest_length);
+                    state->ui.input_length = rest_length;
+                } else {
+                    LOG_ERROR("Dropped %zu bytes typed after a paste", rest_length);
+                }
+            }
+            
+            used = marker - text;
+            break;
+        }
+        
+        /* The marker may straddle the next read */
+        searched = used >= marker_length ? used - marker_length + 1 : 0;
+        
+        /* Keep room for a full block */
+        if (capacity - used < PASTE_READ_BLOCK) {
+            char *grown = (char*)realloc(text, capacity * 2);
+            if (!grown) break;
+            text = grown;
+            capacity *= 2;
+        }
+        
+        struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+        int ready = poll(&pfd, 1, PASTE_TIMEOUT_MS);
+        if (ready == -1 && errno == EINTR) continue;
+        if (ready <= 0) {
+            LOG_WARNING("Paste ended without an end marker");
+            break;
+        }
+        
+        ssize_t n = read(STDIN_FILENO, text + used, capacity - used);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+        
+        used += n;
+    }
+    
+    *length = used;
+    return text;
+}
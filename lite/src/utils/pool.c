@@ -0,0 +1,318 @@
+/**
+ * pool.c - Work-stealing thread pool for LITE editor
+ *
+ * Each deque has a lock of its own, so the owner and a thief only meet
+ * when they go for the same deque. The pool lock guards the counts of
+ * queued and unfinished tasks that idle workers and pool_wait sleep on.
+ * Tasks are expected to be coarse, megabytes of text rather than single
+ * lines, which keeps the locks off the profile.
+ */
+
+#include "lite.h"
+#include "utils/pool.h"
+#include "utils/log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* Initial number of tasks a deque holds */
+#define DEQUE_INITIAL_CAPACITY 64
+
+/* Queued task */
+typedef struct PoolItem {
+    PoolTask task;
+    void *data;
+} PoolItem;
+
+/* Task deque of one worker, a ring buffer indexed from head to tail */
+typedef struct PoolDeque {
+    pthread_mutex_t lock;
+    PoolItem *items;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+} PoolDeque;
+
+/* Worker thread */
+typedef struct PoolWorker {
+    struct ThreadPool *pool;
+    pthread_t thread;
+    int index;
+    PoolDeque deque;
+} PoolWorker;
+
+/* Thread pool */
+struct ThreadPool {
+    PoolWorker *workers;
+    int worker_count;
+    int thread_count;           /* Workers that started */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    size_t queued;              /* Tasks waiting in the deques */
+    size_t pending;             /* Tasks queued or running */
+    unsigned int next_deque;
+    bool stopping;
+};
+
+/* Index of the calling thread in its pool, -1 outside of pools */
+static __thread int worker_index = -1;
+static __thread ThreadPool *worker_pool = NULL;
+
+/**
+ * Add a task at the tail of a deque
+ */
+static int deque_push(PoolDeque *deque, PoolTask task, void *data) {
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->tail - deque->head == deque->capacity) {
+        size_t capacity = deque->capacity > 0 ? deque->capacity * 2 : DEQUE_INITIAL_CAPACITY;
+        PoolItem *items = (PoolItem*)malloc(capacity * sizeof(PoolItem));
+        if (!items) {
+            pthread_mutex_unlock(&deque->lock);
+            return LITE_ERROR;
+        }
+
+        for (size_t i = deque->head; i < deque->tail; i++) {
+            items[i - deque->head] = deque->items[i % deque->capacity];
+        }
+        free(deque->items);
+
+        deque->tail -= deque->head;
+        deque->head = 0;
+        deque->items = items;
+        deque->capacity = capacity;
+    }
+
+    PoolItem *item = &deque->items[deque->tail % deque->capacity];
+    item->task = task;
+    item->data = data;
+    deque->tail++;
+
+    pthread_mutex_unlock(&deque->lock);
+    return LITE_OK;
+}
+
+/**
+ * Take a task from a deque, the newest from the owner's end or the oldest
+ * when stealing
+ */
+static bool deque_take(PoolDeque *deque, bool steal, PoolItem *item) {
+    pthread_mutex_lock(&deque->lock);
+
+    bool found = deque->tail > deque->head;
+    if (found) {
+        if (steal) {
+            *item = deque->items[deque->head % deque->capacity];
+            deque->head++;
+        } else {
+            deque->tail--;
+            *item = deque->items[deque->tail % deque->capacity];
+        }
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/**
+ * Find a task for a worker, stealing from the others when its own deque
+ * is empty
+ */
+static bool find_task(ThreadPool *pool, int index, PoolItem *item) {
+    bool found = deque_take(&pool->workers[index].deque, false, item);
+
+    for (int i = 1; i < pool->worker_count && !found; i++) {
+        found = deque_take(&pool->workers[(index + i) % pool->worker_count].deque, true, item);
+    }
+
+    if (found) {
+        pthread_mutex_lock(&pool->lock);
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return found;
+}
+
+/**
+ * Worker thread, runs tasks until the pool is freed
+ */
+static void* worker_main(void *data) {
+    PoolWorker *worker = (PoolWorker*)data;
+    ThreadPool *pool = worker->pool;
+
+    worker_index = worker->index;
+    worker_pool = pool;
+
+    for (;;) {
+        PoolItem item;
+
+        if (find_task(pool, worker->index, &item)) {
+            item.task(item.data);
+
+            pthread_mutex_lock(&pool->lock);
+            if (--pool->pending == 0) {
+                pthread_cond_broadcast(&pool->done);
+            }
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        /* Sleep until something is queued, a task may have been stolen
+         * between the count going up and this worker looking */
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        bool stop = pool->stopping && pool->queued == 0;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (stop) break;
+    }
+
+    return NULL;
+}
+
+/**
+ * Create a pool and start its workers
+ *
+ * With threads 0 or less, one worker is started per online CPU.
+ */
+ThreadPool* pool_create(int threads) {
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > POOL_MAX_THREADS) {
+        threads = POOL_MAX_THREADS;
+    }
+
+    ThreadPool *pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    if (!pool) return NULL;
+
+    pool->workers = (PoolWorker*)calloc(threads, sizeof(PoolWorker));
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    /* Workers look at every deque, even those of workers that failed to start */
+    pool->worker_count = threads;
+    for (int i = 0; i < threads; i++) {
+        PoolWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+    }
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0) {
+            LOG_ERROR("Failed to start pool worker %d", i);
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    if (pool->thread_count == 0) {
+        pool_free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+/**
+ * Stop the workers and free a pool
+ *
+ * Tasks still queued are run first.
+ */
+void pool_free(ThreadPool *pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+        free(pool->workers[i].deque.items);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool);
+}
+
+/**
+ * Queue a task
+ *
+ * A worker queues on its own deque, other threads spread their tasks
+ * over all deques in turn.
+ */
+int pool_submit(ThreadPool *pool, PoolTask task, void *data) {
+    if (!pool || !task) return LITE_ERROR;
+
+    /* The task is pushed and counted under the pool's lock, so a worker
+     * that steals it cannot take it off the count before it is on it.
+     * Workers never hold a deque's lock while taking the pool's. */
+    pthread_mutex_lock(&pool->lock);
+    int index = worker_pool == pool ? worker_index
+                                    : (int)(pool->next_deque++ % (unsigned int)pool->thread_count);
+
+    if (deque_push(&pool->workers[index].deque, task, data) != LITE_OK) {
+        pthread_mutex_unlock(&pool->lock);
+        return LITE_ERROR;
+    }
+
+    pool->pending++;
+    pool->queued++;
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    return LITE_OK;
+}
+
+/**
+ * Wait until every queued task has finished
+ *
+ * Must not be called from a task of the same pool.
+ */
+void pool_wait(ThreadPool *pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Get the number of workers of a pool
+ */
+int pool_threads(const ThreadPool *pool) {
+    return pool ? pool->thread_count : 0;
+}
+
+/**
+ * Get the index of the calling worker in its pool
+ *
+ * Returns -1 when called from a thread that is not a pool worker. Tasks
+ * can use the index to keep per-thread state without locking.
+ */
+int pool_worker_index(void) {
+    return worker_index;
+}
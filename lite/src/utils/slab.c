@@ -0,0 +1,109 @@
+/**
+ * slab.c - Fixed-size object slab allocator for LITE editor
+ *
+ * Objects are carved out of large slabs and recycled through a free
+ * list. Everything allocated from a slab allocator is released at once
+ * by slab_release, without visiting individual objects.
+ */
+
+#include "lite.h"
+#include "utils/slab.h"
+#include <stdlib.h>
+
+/* Header at the start of every slab */
+typedef struct SlabHeader {
+    struct SlabHeader *next;
+    max_align_t align;
+} SlabHeader;
+
+/**
+ * Initialize a slab allocator
+ */
+void slab_init(SlabAllocator *slab, size_t object_size, size_t objects_per_slab) {
+    if (!slab) return;
+    
+    /* Free objects hold the free list link, keep them pointer aligned */
+    if (object_size < sizeof(void*)) {
+        object_size = sizeof(void*);
+    }
+    object_size = (object_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    
+    slab->object_size = object_size;
+    slab->objects_per_slab = objects_per_slab > 0 ? objects_per_slab : 1;
+    slab->slabs = NULL;
+    slab->free_list = NULL;
+    slab->slab_count = 0;
+    slab->in_use = 0;
+}
+
+/**
+ * Allocate an object
+ */
+void* slab_alloc(SlabAllocator *slab) {
+    if (!slab) return NULL;
+    
+    /* Carve a new slab into free objects when the free list is empty */
+    if (!slab->free_list) {
+        SlabHeader *header = (SlabHeader*)malloc(sizeof(SlabHeader) + slab->object_size * slab->objects_per_slab);
+        if (!header) return NULL;
+        
+        header->next = (SlabHeader*)slab->slabs;
+        slab->slabs = header;
+        slab->slab_count++;
+        
+        char *objects = (char*)(header + 1);
+        for (size_t i = slab->objects_per_slab; i > 0; i--) {
+            void **object = (void**)(objects + (i - 1) * slab->object_size);
+            *object = slab->free_list;
+            slab->free_list = object;
+        }
+    }
+    
+    void **object = (void**)slab->free_list;
+    slab->free_list = *object;
+    slab->in_use++;
+    
+    return object;
+}
+
+/**
+ * Return an object to its allocator
+ */
+void slab_free(SlabAllocator *slab, void *object) {
+    if (!slab || !object) return;
+    
+    *(void**)object = slab->free_list;
+    slab->free_list = object;
+    slab->in_use--;
+}
+
+/**
+ * Release every object and slab at once
+ */
+void slab_release(SlabAllocator *slab) {
+    if (!slab) return;
+    
+    SlabHeader *header = (SlabHeader*)slab->slabs;
+    while (header) {
+        SlabHeader *next = header->next;
+        free(header);
+        header = next;
+    }
+    
+    slab->slabs = NULL;
+    slab->free_list = NULL;
+    slab->slab_count = 0;
+    slab->in_use = 0;
+}
+
+/**
+ * Get allocator statistics
+ */
+void slab_get_stats(const SlabAllocator *slab, SlabStats *stats) {
+    if (!slab || !stats) return;
+    
+    stats->slabs = slab->slab_count;
+    stats->objects = slab->slab_count * slab->objects_per_slab;
+    stats->in_use = slab->in_use;
+    stats->bytes = slab->slab_count * (sizeof(SlabHeader) + slab->object_size * slab->objects_per_slab);
+}
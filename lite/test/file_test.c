@@ -0,0 +1,74 @@
+/**
+ * file_test.c - Loading and saving tests for LITE editor
+ *
+ * Files are loaded into a buffer and saved again unchanged, which must
+ * give back the very bytes that were loaded.
+ *
+ * Usage: file_test
+ */
+
+#include "lite.h"
+#include "core/buffer.h"
+#include "fs/file.h"
+#include "fs/undofile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* File the tests write to */
+static char path[] = "/tmp/lite_file_test.XXXXXX";
+
+/**
+ * Write a file, load and save it, and check its bytes are unchanged
+ */
+static int round_trip(const char *name, const char *data) {
+    size_t length = strlen(data);
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp || fwrite(data, 1, length, fp) != length || fclose(fp) != 0) {
+        fprintf(stderr, "%s: failed to write %s\n", name, path);
+        return 1;
+    }
+
+    Buffer *buffer = buffer_create();
+    if (!buffer || buffer_load_file(buffer, path) != LITE_OK || buffer_save_file(buffer) != LITE_OK) {
+        fprintf(stderr, "%s: failed to load and save %s\n", name, path);
+        buffer_free(buffer);
+        return 1;
+    }
+    buffer_free(buffer);
+
+    char saved[256];
+    fp = fopen(path, "rb");
+    size_t count = fp ? fread(saved, 1, sizeof(saved), fp) : 0;
+    if (fp) fclose(fp);
+
+    if (count != length || memcmp(saved, data, length) != 0) {
+        fprintf(stderr, "%s: saved %zu bytes that differ from the %zu loaded\n", name, count, length);
+        return 1;
+    }
+
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+int main(void) {
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    undofile_set_enabled(false);
+
+    int failed = 0;
+    failed += round_trip("crlf", "a\r\nb\r\n");
+    failed += round_trip("lf", "a\nb\n");
+    failed += round_trip("mixed", "a\nb\r\n");
+    failed += round_trip("blank crlf", "\r\n");
+
+    unlink(path);
+    return failed ? 1 : 0;
+}
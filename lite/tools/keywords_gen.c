@@ -0,0 +1,241 @@
+/**
+ * keywords_gen.c - Keyword table generator for LITE editor
+ *
+ * Reads src/syntax/keywords.def and writes a header with one perfect
+ * hash table per language. For every table it searches for the smallest
+ * size and a seed under which no two keywords share a slot.
+ *
+ * Usage: keywords_gen <keywords.def> <output.h>
+ */
+
+#include "syntax/keyword_hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_TABLES 16
+#define MAX_WORDS 256
+#define MAX_NAME 32
+#define MAX_SEEDS 4000000u
+
+/* Keyword read from the definition file */
+typedef struct Keyword {
+    char word[MAX_NAME];
+    char type[MAX_NAME];
+} Keyword;
+
+/* Table being generated */
+typedef struct Table {
+    char name[MAX_NAME];
+    Keyword words[MAX_WORDS];
+    int count;
+    int max_length;
+    uint32_t seed;
+    uint32_t size;
+    int *slots;
+} Table;
+
+static Table tables[MAX_TABLES];
+static int table_count = 0;
+
+/**
+ * Find a table by name, creating it if needed
+ */
+static Table* get_table(const char *name) {
+    for (int i = 0; i < table_count; i++) {
+        if (strcmp(tables[i].name, name) == 0) return &tables[i];
+    }
+    
+    if (table_count >= MAX_TABLES) return NULL;
+    
+    Table *table = &tables[table_count++];
+    snprintf(table->name, sizeof(table->name), "%s", name);
+    return table;
+}
+
+/**
+ * Add a keyword to a table
+ */
+static int add_word(Table *table, const char *word, const char *type, int line_num) {
+    if (strlen(word) >= MAX_NAME || strlen(word) > 255) {
+        fprintf(stderr, "line %d: keyword too long: %s\n", line_num, word);
+        return -1;
+    }
+    
+    for (int i = 0; i < table->count; i++) {
+        if (strcmp(table->words[i].word, word) == 0) {
+            fprintf(stderr, "line %d: duplicate keyword in %s: %s\n", line_num, table->name, word);
+            return -1;
+        }
+    }
+    
+    if (table->count >= MAX_WORDS) {
+        fprintf(stderr, "line %d: too many keywords in %s\n", line_num, table->name);
+        return -1;
+    }
+    
+    Keyword *keyword = &table->words[table->count++];
+    snprintf(keyword->word, sizeof(keyword->word), "%s", word);
+    snprintf(keyword->type, sizeof(keyword->type), "%s", type);
+    
+    int length = (int)strlen(word);
+    if (length > table->max_length) table->max_length = length;
+    
+    return 0;
+}
+
+/**
+ * Read the definition file
+ */
+static int read_definitions(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    
+    char line[1024];
+    int line_num = 0;
+    
+    while (fgets(line, sizeof(line), fp)) {
+        line_num++;
+        
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        
+        char *name = strtok(line, " \t\r\n");
+        if (!name) continue;
+        
+        char *type = strtok(NULL, " \t\r\n");
+        if (!type || strlen(name) >= MAX_NAME || strlen(type) >= MAX_NAME) {
+            fprintf(stderr, "%s:%d: expected <table> <type> <word>...\n", path, line_num);
+            fclose(fp);
+            return -1;
+        }
+        
+        Table *table = get_table(name);
+        if (!table) {
+            fprintf(stderr, "%s:%d: too many tables\n", path, line_num);
+            fclose(fp);
+            return -1;
+        }
+        
+        char *word;
+        while ((word = strtok(NULL, " \t\r\n")) != NULL) {
+            if (add_word(table, word, type, line_num) != 0) {
+                fclose(fp);
+                return -1;
+            }
+        }
+    }
+    
+    fclose(fp);
+    return 0;
+}
+
+/**
+ * Try to place every keyword of a table with one seed
+ */
+static int try_seed(Table *table, uint32_t seed, uint32_t size, int *slots) {
+    for (uint32_t i = 0; i < size; i++) {
+        slots[i] = -1;
+    }
+    
+    for (int i = 0; i < table->count; i++) {
+        const char *word = table->words[i].word;
+        uint32_t slot = keyword_hash(seed, word, (int)strlen(word)) & (size - 1);
+        if (slots[slot] != -1) return 0;
+        slots[slot] = i;
+    }
+    
+    return 1;
+}
+
+/**
+ * Find the smallest collision free table size and its seed
+ */
+static int build_table(Table *table) {
+    uint32_t size = 1;
+    while (size < (uint32_t)table->count * 2) {
+        size *= 2;
+    }
+    
+    for (; size <= 4096; size *= 2) {
+        int *slots = (int*)malloc(size * sizeof(int));
+        if (!slots) return -1;
+        
+        for (uint32_t seed = 1; seed < MAX_SEEDS; seed++) {
+            if (try_seed(table, seed, size, slots)) {
+                table->seed = seed;
+                table->size = size;
+                table->slots = slots;
+                return 0;
+            }
+        }
+        
+        free(slots);
+    }
+    
+    fprintf(stderr, "no perfect hash found for %s\n", table->name);
+    return -1;
+}
+
+/**
+ * Write the generated header
+ */
+static int write_header(const char *path, const char *source) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    
+    fprintf(fp, "/* Generated by tools/keywords_gen from %s, do not edit */\n\n", source);
+    
+    for (int t = 0; t < table_count; t++) {
+        Table *table = &tables[t];
+        
+        fprintf(fp, "static const KeywordEntry keywords_%s_entries[%u] = {\n", table->name, table->size);
+        for (uint32_t i = 0; i < table->size; i++) {
+            if (table->slots[i] == -1) continue;
+            
+            Keyword *keyword = &table->words[table->slots[i]];
+            fprintf(fp, "    [%u] = { \"%s\", %d, %s },\n",
+                    i, keyword->word, (int)strlen(keyword->word), keyword->type);
+        }
+        fprintf(fp, "};\n\n");
+        
+        fprintf(fp, "static const KeywordTable keywords_%s = {\n", table->name);
+        fprintf(fp, "    %uu, %uu, %d, keywords_%s_entries\n", table->seed, table->size - 1,
+                table->max_length, table->name);
+        fprintf(fp, "};\n\n");
+    }
+    
+    if (fclose(fp) != 0) {
+        perror(path);
+        return -1;
+    }
+    
+    return 0;
+}
+
+/* Main function */
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <keywords.def> <output.h>\n", argv[0]);
+        return 1;
+    }
+    
+    if (read_definitions(argv[1]) != 0) return 1;
+    
+    for (int i = 0; i < table_count; i++) {
+        if (build_table(&tables[i]) != 0) return 1;
+    }
+    
+    if (write_header(argv[2], argv[1]) != 0) {
+        remove(argv[2]);
+        return 1;
+    }
+    
+    return 0;
+}